@@ -0,0 +1,79 @@
+#include "assetLoader.hpp"
+#include "threadPool.hpp"
+#include "timer.hpp"
+#include "uploadRing.hpp"
+
+#include <cstdio>
+#include <thread>
+
+namespace
+{
+	// Enough for every asset of a scene to finish decoding before the render thread catches up
+	const size_t UPLOAD_QUEUE_SIZE = 256;
+}
+
+AssetLoader::AssetLoader()
+	: m_uploads(UPLOAD_QUEUE_SIZE)
+	, m_pending(0)
+	, m_decoding(0)
+	, m_failed(0)
+	, m_loaded(0)
+{
+}
+
+AssetLoader::~AssetLoader()
+{
+	waitForDecodes();
+
+	Upload* upload;
+	while (m_uploads.pop(upload)) {
+		delete upload;
+	}
+}
+
+void AssetLoader::load(const std::string& name, std::function<bool()> decode, std::function<void()> upload)
+{
+	m_pending++;
+	m_decoding++;
+
+	Upload* job = new Upload();
+	job->name = name;
+	job->run = std::move(upload);
+	ThreadPool::instance().enqueue([this, job, decode]() {
+		if (!decode()) {
+			printf("Failed to load %s\n", job->name.c_str());
+			m_failed++;
+		}
+
+		// The render thread drains the queue every frame, so a full queue only needs a moment
+		while (!m_uploads.push(job)) {
+			std::this_thread::yield();
+		}
+		m_decoding--;
+	});
+}
+
+void AssetLoader::waitForDecodes()
+{
+	while (m_decoding.load() > 0) {
+		std::this_thread::yield();
+	}
+}
+
+unsigned int AssetLoader::processUploads(double budgetMs)
+{
+	Timer timer;
+	unsigned int count = 0;
+	Upload* upload;
+	while ((count == 0 || timer.elapsedMs() < budgetMs) && m_uploads.pop(upload)) {
+		upload->run();
+		delete upload;
+		count++;
+		m_loaded++;
+		m_pending--;
+	}
+
+	// Fence this frame's uploads from the ring and take back the space of earlier ones
+	UploadRing::instance().endFrame();
+	return count;
+}
@@ -0,0 +1,51 @@
+#pragma once
+#include <atomic>
+#include <functional>
+#include <string>
+
+#include "mpmcQueue.hpp"
+
+// Loads assets in two halves: decode runs on the thread pool and must not touch GL, upload runs on the
+// render thread from processUploads once its decode has finished, so the render loop starts straight away
+class AssetLoader
+{
+public:
+	AssetLoader();
+	~AssetLoader();
+
+	// Queue one asset. A decode that returns false is reported, but its upload still runs so the object
+	// ends up in the same state the synchronous loaders leave it in after a failure
+	void load(const std::string& name, std::function<bool()> decode, std::function<void()> upload);
+
+	// Run finished uploads until budgetMs has been spent, at least one per call so loading always
+	// progresses, then end the upload ring's frame. Returns the number of uploads run
+	unsigned int processUploads(double budgetMs);
+
+	// Block until no decode is running, call before the objects being loaded into are destroyed.
+	// Uploads still queued are dropped by the destructor
+	void waitForDecodes();
+
+	// True once every queued asset has been decoded and uploaded
+	bool isFinished() const { return m_pending.load() == 0; }
+
+	unsigned int getPendingCount() const { return m_pending.load(); }
+	unsigned int getLoadedCount() const { return m_loaded; }
+	unsigned int getFailedCount() const { return m_failed.load(); }
+
+private:
+	AssetLoader(const AssetLoader&);
+	AssetLoader& operator=(const AssetLoader&);
+
+	struct Upload
+	{
+		std::string name;
+		std::function<void()> run;
+	};
+
+private:
+	MpmcQueue<Upload*> m_uploads;
+	std::atomic<unsigned int> m_pending;
+	std::atomic<unsigned int> m_decoding;
+	std::atomic<unsigned int> m_failed;
+	unsigned int m_loaded;
+};
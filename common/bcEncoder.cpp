@@ -0,0 +1,628 @@
+#include "bcEncoder.hpp"
+#include "threadPool.hpp"
+
+#include <algorithm>
+#include <cfloat>
+#include <climits>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+namespace
+{
+	// Interpolation weights out of 64 for BC7's 4 bit indices
+	const int BC7_WEIGHTS[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+	// Position between the two endpoints of each BC1 index, in the order the palette stores them
+	const float BC1_WEIGHTS[4] = { 0.0f, 1.0f, 1.0f / 3.0f, 2.0f / 3.0f };
+
+	// Endpoint fit and index search passes per block, later passes refit the endpoints to the indices
+	const int REFINE_PASSES = 3;
+
+	typedef int Block[16][4];
+
+	struct BitWriter
+	{
+		unsigned char* out;
+		unsigned int pos;
+
+		void write(unsigned int value, unsigned int bits)
+		{
+			for (unsigned int i = 0; i < bits; i++, pos++) {
+				if ((value >> i) & 1) {
+					out[pos >> 3] |= (unsigned char)(1 << (pos & 7));
+				}
+			}
+		}
+	};
+
+	struct BitReader
+	{
+		const unsigned char* in;
+		unsigned int pos;
+
+		unsigned int read(unsigned int bits)
+		{
+			unsigned int value = 0;
+			for (unsigned int i = 0; i < bits; i++, pos++) {
+				value |= ((in[pos >> 3] >> (pos & 7)) & 1u) << i;
+			}
+			return value;
+		}
+	};
+
+	void loadBlock(const unsigned char* rgba, int width, int height, int bx, int by, Block block)
+	{
+		for (int y = 0; y < 4; y++) {
+			int sy = std::min(by * 4 + y, height - 1);
+			for (int x = 0; x < 4; x++) {
+				int sx = std::min(bx * 4 + x, width - 1);
+				const unsigned char* p = rgba + ((size_t)sy * width + sx) * 4;
+				for (int c = 0; c < 4; c++) {
+					block[y * 4 + x][c] = p[c];
+				}
+			}
+		}
+	}
+
+	void storeBlock(const Block block, int width, int height, int bx, int by, unsigned char* rgba)
+	{
+		for (int y = 0; y < 4 && by * 4 + y < height; y++) {
+			for (int x = 0; x < 4 && bx * 4 + x < width; x++) {
+				unsigned char* p = rgba + ((size_t)(by * 4 + y) * width + bx * 4 + x) * 4;
+				for (int c = 0; c < 4; c++) {
+					p[c] = (unsigned char)block[y * 4 + x][c];
+				}
+			}
+		}
+	}
+
+	inline float clampChannel(float v)
+	{
+		return std::min(std::max(v, 0.0f), 255.0f);
+	}
+
+	// Mean and principal axis of the block over its first channels, by power iteration on the covariance
+	void principalAxis(const Block block, int channels, float mean[4], float axis[4])
+	{
+		for (int c = 0; c < 4; c++) {
+			mean[c] = 0.0f;
+			axis[c] = 0.0f;
+		}
+		for (int i = 0; i < 16; i++) {
+			for (int c = 0; c < channels; c++) {
+				mean[c] += block[i][c] / 16.0f;
+			}
+		}
+
+		float covariance[4][4] = {};
+		for (int i = 0; i < 16; i++) {
+			float d[4];
+			for (int c = 0; c < channels; c++) {
+				d[c] = block[i][c] - mean[c];
+			}
+			for (int r = 0; r < channels; r++) {
+				for (int c = 0; c < channels; c++) {
+					covariance[r][c] += d[r] * d[c];
+				}
+			}
+		}
+
+		// Start from the channel with the most spread
+		int widest = 0;
+		for (int c = 1; c < channels; c++) {
+			if (covariance[c][c] > covariance[widest][widest]) {
+				widest = c;
+			}
+		}
+		if (covariance[widest][widest] <= 0.0f) {
+			return;
+		}
+		for (int c = 0; c < channels; c++) {
+			axis[c] = covariance[widest][c];
+		}
+
+		for (int iteration = 0; iteration < 8; iteration++) {
+			float next[4] = {};
+			float largest = 0.0f;
+			for (int r = 0; r < channels; r++) {
+				for (int c = 0; c < channels; c++) {
+					next[r] += covariance[r][c] * axis[c];
+				}
+				largest = std::max(largest, fabsf(next[r]));
+			}
+			if (largest <= 0.0f) {
+				break;
+			}
+			for (int c = 0; c < channels; c++) {
+				axis[c] = next[c] / largest;
+			}
+		}
+
+		float length = 0.0f;
+		for (int c = 0; c < channels; c++) {
+			length += axis[c] * axis[c];
+		}
+		length = sqrtf(length);
+		for (int c = 0; c < channels; c++) {
+			axis[c] = length > 0.0f ? axis[c] / length : 0.0f;
+		}
+	}
+
+	// Endpoints at the extremes of the block's projection onto its principal axis, high end first
+	void axisEndpoints(const Block block, int channels, float high[4], float low[4])
+	{
+		float mean[4], axis[4];
+		principalAxis(block, channels, mean, axis);
+
+		float minT = FLT_MAX, maxT = -FLT_MAX;
+		for (int i = 0; i < 16; i++) {
+			float t = 0.0f;
+			for (int c = 0; c < channels; c++) {
+				t += (block[i][c] - mean[c]) * axis[c];
+			}
+			minT = std::min(minT, t);
+			maxT = std::max(maxT, t);
+		}
+		for (int c = 0; c < 4; c++) {
+			high[c] = clampChannel(mean[c] + axis[c] * maxT);
+			low[c] = clampChannel(mean[c] + axis[c] * minT);
+		}
+	}
+
+	// Least squares endpoints for pixels at fixed positions t between them, false when every t is the same
+	bool fitEndpoints(const Block block, int channels, const float t[16], float e0[4], float e1[4])
+	{
+		float aa = 0.0f, ab = 0.0f, bb = 0.0f;
+		float ax[4] = {}, bx[4] = {};
+		for (int i = 0; i < 16; i++) {
+			float a = 1.0f - t[i], b = t[i];
+			aa += a * a;
+			ab += a * b;
+			bb += b * b;
+			for (int c = 0; c < channels; c++) {
+				ax[c] += a * block[i][c];
+				bx[c] += b * block[i][c];
+			}
+		}
+
+		float det = aa * bb - ab * ab;
+		if (fabsf(det) < 1e-6f) {
+			return false;
+		}
+		for (int c = 0; c < channels; c++) {
+			e0[c] = clampChannel((ax[c] * bb - bx[c] * ab) / det);
+			e1[c] = clampChannel((bx[c] * aa - ax[c] * ab) / det);
+		}
+		return true;
+	}
+
+	// BC1
+
+	inline int expand5(int v) { return (v << 3) | (v >> 2); }
+	inline int expand6(int v) { return (v << 2) | (v >> 4); }
+
+	uint16_t packRgb565(const float color[4])
+	{
+		int r = std::min((int)(color[0] * 31.0f / 255.0f + 0.5f), 31);
+		int g = std::min((int)(color[1] * 63.0f / 255.0f + 0.5f), 63);
+		int b = std::min((int)(color[2] * 31.0f / 255.0f + 0.5f), 31);
+		return (uint16_t)((r << 11) | (g << 5) | b);
+	}
+
+	void bc1Palette(uint16_t c0, uint16_t c1, bool fourColours, int palette[4][3])
+	{
+		int e[2][3] = {
+			{ expand5(c0 >> 11), expand6((c0 >> 5) & 63), expand5(c0 & 31) },
+			{ expand5(c1 >> 11), expand6((c1 >> 5) & 63), expand5(c1 & 31) }
+		};
+		for (int c = 0; c < 3; c++) {
+			palette[0][c] = e[0][c];
+			palette[1][c] = e[1][c];
+			if (fourColours) {
+				palette[2][c] = (2 * e[0][c] + e[1][c]) / 3;
+				palette[3][c] = (e[0][c] + 2 * e[1][c]) / 3;
+			}
+			else {
+				palette[2][c] = (e[0][c] + e[1][c]) / 2;
+				palette[3][c] = 0;
+			}
+		}
+	}
+
+	void encodeBc1(const Block block, unsigned char* out)
+	{
+		float e0[4], e1[4];
+		axisEndpoints(block, 3, e0, e1);
+
+		uint16_t bestC0 = 0, bestC1 = 0;
+		uint32_t bestIndices = 0;
+		int bestError = INT_MAX;
+		for (int pass = 0; pass < REFINE_PASSES; pass++) {
+			// Four colour mode needs c0 > c1, equal endpoints decode to one colour in either mode
+			uint16_t c0 = packRgb565(e0), c1 = packRgb565(e1);
+			if (c0 < c1) {
+				std::swap(c0, c1);
+			}
+			int palette[4][3];
+			bc1Palette(c0, c1, true, palette);
+
+			uint32_t indices = 0;
+			int error = 0;
+			float t[16];
+			for (int i = 0; i < 16; i++) {
+				int best = 0, bestDistance = INT_MAX;
+				for (int k = 0; k < 4; k++) {
+					int dr = block[i][0] - palette[k][0], dg = block[i][1] - palette[k][1], db = block[i][2] - palette[k][2];
+					int distance = dr * dr + dg * dg + db * db;
+					if (distance < bestDistance) {
+						bestDistance = distance;
+						best = k;
+					}
+				}
+				indices |= (uint32_t)best << (i * 2);
+				error += bestDistance;
+				t[i] = BC1_WEIGHTS[best];
+			}
+
+			if (error < bestError) {
+				bestError = error;
+				bestC0 = c0;
+				bestC1 = c1;
+				bestIndices = indices;
+			}
+			if (error == 0 || c0 == c1 || !fitEndpoints(block, 3, t, e0, e1)) {
+				break;
+			}
+		}
+
+		out[0] = (unsigned char)(bestC0 & 0xff);
+		out[1] = (unsigned char)(bestC0 >> 8);
+		out[2] = (unsigned char)(bestC1 & 0xff);
+		out[3] = (unsigned char)(bestC1 >> 8);
+		for (int i = 0; i < 4; i++) {
+			out[4 + i] = (unsigned char)(bestIndices >> (i * 8));
+		}
+	}
+
+	void decodeBc1(const unsigned char* in, bool alwaysFourColours, Block block)
+	{
+		uint16_t c0 = (uint16_t)(in[0] | (in[1] << 8));
+		uint16_t c1 = (uint16_t)(in[2] | (in[3] << 8));
+		uint32_t indices = (uint32_t)in[4] | ((uint32_t)in[5] << 8) | ((uint32_t)in[6] << 16) | ((uint32_t)in[7] << 24);
+
+		int palette[4][3];
+		bool fourColours = alwaysFourColours || c0 > c1;
+		bc1Palette(c0, c1, fourColours, palette);
+		for (int i = 0; i < 16; i++) {
+			int index = (indices >> (i * 2)) & 3;
+			for (int c = 0; c < 3; c++) {
+				block[i][c] = palette[index][c];
+			}
+			block[i][3] = (!fourColours && index == 3) ? 0 : 255;
+		}
+	}
+
+	// BC4, one channel between two 8 bit endpoints with 3 bit indices
+
+	void bc4Palette(int a0, int a1, int palette[8])
+	{
+		palette[0] = a0;
+		palette[1] = a1;
+		if (a0 > a1) {
+			for (int i = 2; i < 8; i++) {
+				palette[i] = ((8 - i) * a0 + (i - 1) * a1 + 3) / 7;
+			}
+		}
+		else {
+			for (int i = 2; i < 6; i++) {
+				palette[i] = ((6 - i) * a0 + (i - 1) * a1 + 2) / 5;
+			}
+			palette[6] = 0;
+			palette[7] = 255;
+		}
+	}
+
+	void encodeBc4(const Block block, int channel, unsigned char* out)
+	{
+		int low = 255, high = 0;
+		for (int i = 0; i < 16; i++) {
+			low = std::min(low, block[i][channel]);
+			high = std::max(high, block[i][channel]);
+		}
+
+		int palette[8];
+		bc4Palette(high, low, palette);
+		uint64_t indices = 0;
+		for (int i = 0; i < 16; i++) {
+			int best = 0, bestDistance = INT_MAX;
+			for (int k = 0; k < 8 && high > low; k++) {
+				int distance = abs(block[i][channel] - palette[k]);
+				if (distance < bestDistance) {
+					bestDistance = distance;
+					best = k;
+				}
+			}
+			indices |= (uint64_t)best << (i * 3);
+		}
+
+		out[0] = (unsigned char)high;
+		out[1] = (unsigned char)low;
+		for (int i = 0; i < 6; i++) {
+			out[2 + i] = (unsigned char)(indices >> (i * 8));
+		}
+	}
+
+	void decodeBc4(const unsigned char* in, int channel, Block block)
+	{
+		int palette[8];
+		bc4Palette(in[0], in[1], palette);
+		uint64_t indices = 0;
+		for (int i = 0; i < 6; i++) {
+			indices |= (uint64_t)in[2 + i] << (i * 8);
+		}
+		for (int i = 0; i < 16; i++) {
+			block[i][channel] = palette[(indices >> (i * 3)) & 7];
+		}
+	}
+
+	// BC7 mode 6: one subset, 7 bit RGBA endpoints with a p-bit each and 4 bit indices
+
+	// Closest 7 bit value and p-bit to each endpoint, the p-bit is shared by the endpoint's four channels
+	void quantizeBc7(const float endpoint[4], bool opaque, int quantized[4], int& pBit)
+	{
+		int bestError = INT_MAX;
+		for (int p = opaque ? 1 : 0; p < 2; p++) {
+			int values[4];
+			int error = 0;
+			for (int c = 0; c < 4; c++) {
+				values[c] = std::min(std::max((int)floorf((endpoint[c] - p) * 0.5f + 0.5f), 0), 127);
+				int d = ((values[c] << 1) | p) - (int)(endpoint[c] + 0.5f);
+				error += d * d;
+			}
+			if (error < bestError) {
+				bestError = error;
+				pBit = p;
+				memcpy(quantized, values, sizeof(values));
+			}
+		}
+	}
+
+	void bc7Palette(const int quantized[2][4], const int pBits[2], int palette[16][4])
+	{
+		for (int c = 0; c < 4; c++) {
+			int a = (quantized[0][c] << 1) | pBits[0];
+			int b = (quantized[1][c] << 1) | pBits[1];
+			for (int i = 0; i < 16; i++) {
+				palette[i][c] = ((64 - BC7_WEIGHTS[i]) * a + BC7_WEIGHTS[i] * b + 32) >> 6;
+			}
+		}
+	}
+
+	void encodeBc7(const Block block, unsigned char* out)
+	{
+		// Opaque blocks keep both p-bits set so alpha stays exactly 255
+		bool opaque = true;
+		for (int i = 0; i < 16; i++) {
+			opaque = opaque && block[i][3] == 255;
+		}
+
+		float e[2][4];
+		axisEndpoints(block, 4, e[0], e[1]);
+
+		int bestQuantized[2][4] = {}, bestPBits[2] = {};
+		int bestIndices[16] = {};
+		int bestError = INT_MAX;
+		for (int pass = 0; pass < REFINE_PASSES; pass++) {
+			int quantized[2][4], pBits[2];
+			quantizeBc7(e[0], opaque, quantized[0], pBits[0]);
+			quantizeBc7(e[1], opaque, quantized[1], pBits[1]);
+			int palette[16][4];
+			bc7Palette(quantized, pBits, palette);
+
+			int indices[16];
+			int error = 0;
+			float t[16];
+			for (int i = 0; i < 16; i++) {
+				int best = 0, bestDistance = INT_MAX;
+				for (int k = 0; k < 16; k++) {
+					int distance = 0;
+					for (int c = 0; c < 4; c++) {
+						int d = block[i][c] - palette[k][c];
+						distance += d * d;
+					}
+					if (distance < bestDistance) {
+						bestDistance = distance;
+						best = k;
+					}
+				}
+				indices[i] = best;
+				error += bestDistance;
+				t[i] = BC7_WEIGHTS[best] / 64.0f;
+			}
+
+			if (error < bestError) {
+				bestError = error;
+				memcpy(bestQuantized, quantized, sizeof(quantized));
+				memcpy(bestPBits, pBits, sizeof(pBits));
+				memcpy(bestIndices, indices, sizeof(indices));
+			}
+			if (error == 0 || !fitEndpoints(block, 4, t, e[0], e[1])) {
+				break;
+			}
+		}
+
+		// The first index is stored without its top bit, so it has to be below 8
+		if (bestIndices[0] >= 8) {
+			for (int c = 0; c < 4; c++) {
+				std::swap(bestQuantized[0][c], bestQuantized[1][c]);
+			}
+			std::swap(bestPBits[0], bestPBits[1]);
+			for (int i = 0; i < 16; i++) {
+				bestIndices[i] = 15 - bestIndices[i];
+			}
+		}
+
+		memset(out, 0, 16);
+		BitWriter writer = { out, 0 };
+		writer.write(1 << 6, 7);
+		for (int c = 0; c < 4; c++) {
+			writer.write(bestQuantized[0][c], 7);
+			writer.write(bestQuantized[1][c], 7);
+		}
+		writer.write(bestPBits[0], 1);
+		writer.write(bestPBits[1], 1);
+		for (int i = 0; i < 16; i++) {
+			writer.write(bestIndices[i], i == 0 ? 3 : 4);
+		}
+	}
+
+	void decodeBc7(const unsigned char* in, Block block)
+	{
+		BitReader reader = { in, 0 };
+		if (reader.read(7) != (1 << 6)) {
+			memset(block, 0, sizeof(Block));
+			return;
+		}
+
+		int quantized[2][4], pBits[2];
+		for (int c = 0; c < 4; c++) {
+			quantized[0][c] = reader.read(7);
+			quantized[1][c] = reader.read(7);
+		}
+		pBits[0] = reader.read(1);
+		pBits[1] = reader.read(1);
+		int palette[16][4];
+		bc7Palette(quantized, pBits, palette);
+		for (int i = 0; i < 16; i++) {
+			int index = reader.read(i == 0 ? 3 : 4);
+			memcpy(block[i], palette[index], sizeof(palette[index]));
+		}
+	}
+
+	void encodeBlock(BcFormat format, const Block block, unsigned char* out)
+	{
+		switch (format) {
+		case BC1:
+			encodeBc1(block, out);
+			break;
+		case BC3:
+			encodeBc4(block, 3, out);
+			encodeBc1(block, out + 8);
+			break;
+		case BC4:
+			encodeBc4(block, 0, out);
+			break;
+		case BC5:
+			encodeBc4(block, 0, out);
+			encodeBc4(block, 1, out + 8);
+			break;
+		case BC7:
+			encodeBc7(block, out);
+			break;
+		default:
+			break;
+		}
+	}
+
+	void decodeBlock(BcFormat format, const unsigned char* in, Block block)
+	{
+		for (int i = 0; i < 16; i++) {
+			block[i][0] = block[i][1] = block[i][2] = 0;
+			block[i][3] = 255;
+		}
+
+		switch (format) {
+		case BC1:
+			decodeBc1(in, false, block);
+			break;
+		case BC3:
+			decodeBc1(in + 8, true, block);
+			decodeBc4(in, 3, block);
+			break;
+		case BC4:
+			decodeBc4(in, 0, block);
+			break;
+		case BC5:
+			decodeBc4(in, 0, block);
+			decodeBc4(in + 8, 1, block);
+			break;
+		case BC7:
+			decodeBc7(in, block);
+			break;
+		default:
+			break;
+		}
+	}
+}
+
+namespace bc
+{
+	const char* getName(BcFormat format)
+	{
+		switch (format) {
+		case BC1: return "BC1";
+		case BC3: return "BC3";
+		case BC4: return "BC4";
+		case BC5: return "BC5";
+		case BC7: return "BC7";
+		default: return "uncompressed";
+		}
+	}
+
+	unsigned int getBlockBytes(BcFormat format)
+	{
+		return (format == BC1 || format == BC4) ? 8 : 16;
+	}
+
+	size_t getImageSize(BcFormat format, int width, int height)
+	{
+		return (size_t)((width + 3) / 4) * ((height + 3) / 4) * getBlockBytes(format);
+	}
+
+	void encode(BcFormat format, const unsigned char* rgba, int width, int height, unsigned char* blocks)
+	{
+		const int blocksX = (width + 3) / 4;
+		const int blocksY = (height + 3) / 4;
+		const unsigned int blockBytes = getBlockBytes(format);
+		ThreadPool::instance().parallelFor(blocksY, [&](unsigned int by) {
+			Block block;
+			for (int bx = 0; bx < blocksX; bx++) {
+				loadBlock(rgba, width, height, bx, by, block);
+				encodeBlock(format, block, blocks + ((size_t)by * blocksX + bx) * blockBytes);
+			}
+		});
+	}
+
+	void decode(BcFormat format, const unsigned char* blocks, int width, int height, unsigned char* rgba)
+	{
+		const int blocksX = (width + 3) / 4;
+		const int blocksY = (height + 3) / 4;
+		const unsigned int blockBytes = getBlockBytes(format);
+		for (int by = 0; by < blocksY; by++) {
+			for (int bx = 0; bx < blocksX; bx++) {
+				Block block;
+				decodeBlock(format, blocks + ((size_t)by * blocksX + bx) * blockBytes, block);
+				storeBlock(block, width, height, bx, by, rgba);
+			}
+		}
+	}
+
+	double computePsnr(const unsigned char* original, const unsigned char* decoded, int width, int height, int channels)
+	{
+		double sum = 0.0;
+		const size_t pixelCount = (size_t)width * height;
+		for (size_t i = 0; i < pixelCount; i++) {
+			for (int c = 0; c < channels; c++) {
+				double d = (double)original[i * 4 + c] - decoded[i * 4 + c];
+				sum += d * d;
+			}
+		}
+
+		double mse = sum / ((double)pixelCount * channels);
+		if (mse <= 0.0) {
+			return 100.0;
+		}
+		return 10.0 * log10(255.0 * 255.0 / mse);
+	}
+}
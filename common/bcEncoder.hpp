@@ -0,0 +1,34 @@
+#pragma once
+#include <cstddef>
+
+// Block compressed formats, every 4x4 block of pixels becomes 8 or 16 bytes
+enum BcFormat
+{
+	BC_NONE = 0,
+	BC1,		// RGB, 4 bits per pixel
+	BC3,		// RGBA, BC1 colour plus a BC4 alpha block
+	BC4,		// one channel, 4 bits per pixel
+	BC5,		// two channels, two BC4 blocks, used for normal maps
+	BC7,		// RGBA, 8 bits per pixel, mode 6 only
+	BC_FORMAT_COUNT
+};
+
+namespace bc
+{
+	const char* getName(BcFormat format);
+
+	// 8 or 16
+	unsigned int getBlockBytes(BcFormat format);
+
+	size_t getImageSize(BcFormat format, int width, int height);
+
+	// Compress tightly packed RGBA8 pixels, the partial blocks at the right and bottom edges repeat the
+	// last row and column. Block rows are spread over the thread pool
+	void encode(BcFormat format, const unsigned char* rgba, int width, int height, unsigned char* blocks);
+
+	// Expand blocks written by encode back to RGBA8, channels the format drops come back as 0 (alpha as 255)
+	void decode(BcFormat format, const unsigned char* blocks, int width, int height, unsigned char* rgba);
+
+	// Peak signal to noise ratio in dB over the first channels of two RGBA8 images, 100 for an exact match
+	double computePsnr(const unsigned char* original, const unsigned char* decoded, int width, int height, int channels);
+}
@@ -3,23 +3,24 @@
 #include "maths.hpp"
 
 Camera::Camera(int width, int height)
-	: m_target(0.0f, 0.0f, -1.0f)
-	, m_up(0.0f, 1.0f, 0.0f)
-	, m_mouseX(0)
-	, m_mouseY(0)
-	, m_mousePress(false)
-	, m_firstMouse(true)
-	, position(0.0f, 25, 20)
+	: position(0.0f, 25, 20)
+	, projTransform(nullptr)
 	, fov(45.0f)
+	, aspect((float)width / __max(height, 0.1))
+	, viewportRect(0.0f, 0.0f, width, height)
 	, near(0.1)
 	, far(1000)
-	, viewportRect(0.0f, 0.0f, width, height)
-	, aspect((float)width / __max(height, 0.1))
 	, useConstraints(false)
-	, projTransform(nullptr)
+	, terrain(nullptr)
 	, m_yaw(-90.0f)
 	, m_pitch(0.0f)
 	, m_roll(0.0f)
+	, m_mouseX(0)
+	, m_mouseY(0)
+	, m_mousePress(false)
+	, m_target(0.0f, 0.0f, -1.0f)
+	, m_up(0.0f, 1.0f, 0.0f)
+	, m_firstMouse(true)
 	, m_mouseSensitivity(5)
 	, m_keySensitivity(10)
 	, m_curFrame(0)
@@ -40,7 +41,8 @@ void Camera::update(double curFrame, double deltaFrame)
 	m_curFrame = curFrame;
 	m_deltaFrame = deltaFrame;
 
-	if (useConstraints)
+	// The terrain is only set once it has finished loading
+	if (useConstraints && terrain)
 	{
 		float height = terrain->getHeightAt(position);
 		if (height > 0)
@@ -133,3 +135,20 @@ glm::mat4 Camera::getViewTransform()
 
 	return viewTransform;
 }
+
+float Camera::getProjectionScale()
+{
+	return projTransform[5] * viewportRect.w * 0.5f;
+}
+
+void Camera::getRay(double x, double y, glm::vec3& origin, glm::vec3& direction)
+{
+	// Normalized device coordinates of the point, undone by the projection's scale onto the plane a unit ahead
+	float ndcX = (float)((x - viewportRect.x) / viewportRect.z * 2.0 - 1.0);
+	float ndcY = (float)(1.0 - (y - viewportRect.y) / viewportRect.w * 2.0);
+
+	glm::vec3 right = glm::normalize(maths::cross(m_target, m_up));
+	glm::vec3 up = maths::cross(right, m_target);
+	origin = position;
+	direction = glm::normalize(m_target + right * (ndcX / projTransform[0]) + up * (ndcY / projTransform[5]));
+}
@@ -19,6 +19,12 @@ public:
 
 	glm::mat4 getViewTransform();
 
+	// Pixels covered by one world unit at a distance of one unit, for screen space error
+	float getProjectionScale();
+
+	// World space ray through a point of the window, in pixels from its top left as GLFW gives the cursor
+	void getRay(double x, double y, glm::vec3& origin, glm::vec3& direction);
+
 	glm::vec3 position;
 	glm::mat4 viewTransform;
 	float* projTransform;
@@ -0,0 +1,115 @@
+#include "contentHash.hpp"
+#include "mappedFile.hpp"
+
+#include <cstring>
+
+namespace
+{
+	const unsigned long long PRIME1 = 11400714785074694791ULL;
+	const unsigned long long PRIME2 = 14029467366897019727ULL;
+	const unsigned long long PRIME3 = 1609587929392839161ULL;
+	const unsigned long long PRIME4 = 9650029242287828579ULL;
+	const unsigned long long PRIME5 = 2870177450012600261ULL;
+
+	inline unsigned long long rotateLeft(unsigned long long x, int bits)
+	{
+		return (x << bits) | (x >> (64 - bits));
+	}
+
+	inline unsigned long long read64(const unsigned char* p)
+	{
+		unsigned long long value;
+		memcpy(&value, p, sizeof(value));
+		return value;
+	}
+
+	inline unsigned int read32(const unsigned char* p)
+	{
+		unsigned int value;
+		memcpy(&value, p, sizeof(value));
+		return value;
+	}
+
+	inline unsigned long long round(unsigned long long acc, unsigned long long input)
+	{
+		acc += input * PRIME2;
+		acc = rotateLeft(acc, 31);
+		return acc * PRIME1;
+	}
+
+	inline unsigned long long mergeRound(unsigned long long acc, unsigned long long value)
+	{
+		acc ^= round(0, value);
+		return acc * PRIME1 + PRIME4;
+	}
+}
+
+unsigned long long contentHash(const void* data, size_t size, unsigned long long seed)
+{
+	const unsigned char* p = (const unsigned char*)data;
+	const unsigned char* end = p + size;
+	unsigned long long h;
+
+	if (size >= 32) {
+		// Four independent lanes over 32 byte stripes
+		unsigned long long v1 = seed + PRIME1 + PRIME2;
+		unsigned long long v2 = seed + PRIME2;
+		unsigned long long v3 = seed;
+		unsigned long long v4 = seed - PRIME1;
+
+		const unsigned char* limit = end - 32;
+		do {
+			v1 = round(v1, read64(p));
+			v2 = round(v2, read64(p + 8));
+			v3 = round(v3, read64(p + 16));
+			v4 = round(v4, read64(p + 24));
+			p += 32;
+		} while (p <= limit);
+
+		h = rotateLeft(v1, 1) + rotateLeft(v2, 7) + rotateLeft(v3, 12) + rotateLeft(v4, 18);
+		h = mergeRound(h, v1);
+		h = mergeRound(h, v2);
+		h = mergeRound(h, v3);
+		h = mergeRound(h, v4);
+	}
+	else {
+		h = seed + PRIME5;
+	}
+
+	h += (unsigned long long)size;
+
+	// Remaining tail bytes
+	for (; p + 8 <= end; p += 8) {
+		h ^= round(0, read64(p));
+		h = rotateLeft(h, 27) * PRIME1 + PRIME4;
+	}
+	if (p + 4 <= end) {
+		h ^= (unsigned long long)read32(p) * PRIME1;
+		h = rotateLeft(h, 23) * PRIME2 + PRIME3;
+		p += 4;
+	}
+	for (; p < end; p++) {
+		h ^= (*p) * PRIME5;
+		h = rotateLeft(h, 11) * PRIME1;
+	}
+
+	h ^= h >> 33;
+	h *= PRIME2;
+	h ^= h >> 29;
+	h *= PRIME3;
+	h ^= h >> 32;
+
+	return h;
+}
+
+bool hashFile(const char* path, unsigned long long& size, unsigned long long& hash)
+{
+	MappedFile file;
+	if (!file.open(path)) {
+		return false;
+	}
+
+	size = file.size();
+	hash = contentHash(file.data(), file.size());
+	return true;
+}
@@ -0,0 +1,8 @@
+#pragma once
+#include <cstddef>
+
+// 64-bit hash of a block of memory (xxHash64 algorithm), used to tell when a cached asset is stale
+unsigned long long contentHash(const void* data, size_t size, unsigned long long seed = 0);
+
+// Size and content hash of a file, returns false if the file cannot be read
+bool hashFile(const char* path, unsigned long long& size, unsigned long long& hash);
@@ -0,0 +1,45 @@
+#include "frameTimeStats.hpp"
+
+#include <algorithm>
+#include <cstdio>
+
+double FrameTimeStats::getAverageMs() const
+{
+	if (m_frames.empty()) {
+		return 0.0;
+	}
+	double sum = 0.0;
+	for (size_t i = 0; i < m_frames.size(); i++) {
+		sum += m_frames[i];
+	}
+	return sum / m_frames.size();
+}
+
+double FrameTimeStats::getWorstMs() const
+{
+	return m_frames.empty() ? 0.0 : *std::max_element(m_frames.begin(), m_frames.end());
+}
+
+double FrameTimeStats::getPercentileMs(double fraction) const
+{
+	if (m_frames.empty()) {
+		return 0.0;
+	}
+	std::vector<double> sorted(m_frames);
+	size_t index = std::min((size_t)(fraction * sorted.size()), sorted.size() - 1);
+	std::nth_element(sorted.begin(), sorted.begin() + index, sorted.end());
+	return sorted[index];
+}
+
+unsigned int FrameTimeStats::countSlowerThan(double ms) const
+{
+	return (unsigned int)std::count_if(m_frames.begin(), m_frames.end(), [ms](double frame) { return frame > ms; });
+}
+
+void FrameTimeStats::print(const char* label) const
+{
+	const double median = getPercentileMs(0.5);
+	printf("%s: %u frames, average %.1f ms, median %.1f ms, 99th percentile %.1f ms, worst %.1f ms, %u spikes over %.1f ms\n",
+		label, getFrameCount(), getAverageMs(), median, getPercentileMs(0.99), getWorstMs(),
+		countSlowerThan(2.0 * median), 2.0 * median);
+}
@@ -0,0 +1,26 @@
+#pragma once
+#include <vector>
+
+// Frame times collected over a stretch of frames, e.g. while assets load, to see the hitches they cause
+class FrameTimeStats
+{
+public:
+	void reset() { m_frames.clear(); }
+	void addFrame(double ms) { m_frames.push_back(ms); }
+
+	unsigned int getFrameCount() const { return (unsigned int)m_frames.size(); }
+	double getAverageMs() const;
+	double getWorstMs() const;
+
+	// Frame time that fraction of the frames stay within, 0.5 is the median
+	double getPercentileMs(double fraction) const;
+
+	// Frames taking longer than ms
+	unsigned int countSlowerThan(double ms) const;
+
+	// One line with the average, median, 99th percentile, worst frame and the frames over twice the median
+	void print(const char* label) const;
+
+private:
+	std::vector<double> m_frames;
+};
@@ -0,0 +1,664 @@
+#include "heightPyramid.hpp"
+#include "threadPool.hpp"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+#if defined(__AVX2__)
+#define HEIGHT_PYRAMID_AVX2
+#include <immintrin.h>
+#endif
+
+namespace
+{
+	// Quads along the side of a cell of the finest level
+	const unsigned int CELL_SHIFT = 2;
+	const unsigned int CELL_QUADS = 1 << CELL_SHIFT;
+
+	// Level of a ray stepping through the quads of a tile rather than through cells
+	const int QUAD_LEVEL = -1;
+
+	// Stands in for a zero direction, so t stays finite and never reaches the far side of anything
+	const float MIN_DIRECTION = 1e-20f;
+
+	unsigned int getShift(unsigned int powerOfTwo)
+	{
+		unsigned int shift = 0;
+		while ((1u << shift) < powerOfTwo) {
+			shift++;
+		}
+		return shift;
+	}
+
+	float getSafeInverse(float value)
+	{
+		return 1.0f / (fabsf(value) < MIN_DIRECTION ? (value < 0.0f ? -MIN_DIRECTION : MIN_DIRECTION) : value);
+	}
+
+	// Where the ray between tStart and tEnd first gets to a plane, from how far above it the ray is at either end
+	bool meetPlane(float tStart, float tEnd, float aboveStart, float aboveEnd, float& t)
+	{
+		if (aboveStart <= 0.0f) {
+			t = tStart;
+			return true;
+		}
+		if (aboveEnd <= 0.0f) {
+			t = tStart + (tEnd - tStart) * aboveStart / (aboveStart - aboveEnd);
+			return true;
+		}
+		return false;
+	}
+
+	// The ray from tStart to tEnd against a quad of the given size with its first corner at (cornerX, cornerZ),
+	// cut into two triangles as the patch and getHeightAt cut it
+	bool intersectQuad(const glm::vec3& origin, const glm::vec3& direction, float cornerX, float cornerZ, float invSize,
+		float h00, float h10, float h01, float h11, float tStart, float tEnd, float& t)
+	{
+		// Above the upper triangle where u > v, the lower one elsewhere
+		auto above = [&](float at, bool upper) {
+			const float u = (origin.x + direction.x * at - cornerX) * invSize;
+			const float v = (origin.z + direction.z * at - cornerZ) * invSize;
+			const float ground = upper ? h00 + (h10 - h00) * u + (h11 - h10) * v : h00 + (h11 - h01) * u + (h01 - h00) * v;
+			return origin.y + direction.y * at - ground;
+		};
+		const float diagonalStart = (origin.x + direction.x * tStart - cornerX) * invSize - (origin.z + direction.z * tStart - cornerZ) * invSize;
+		const float diagonalEnd = (origin.x + direction.x * tEnd - cornerX) * invSize - (origin.z + direction.z * tEnd - cornerZ) * invSize;
+		const bool upperFirst = diagonalStart > 0.0f || (diagonalStart == 0.0f && diagonalEnd > 0.0f);
+		const bool crosses = (diagonalStart > 0.0f) != (diagonalEnd > 0.0f) && diagonalStart != diagonalEnd;
+		if (!crosses) {
+			return meetPlane(tStart, tEnd, above(tStart, upperFirst), above(tEnd, upperFirst), t);
+		}
+		const float tSplit = tStart + (tEnd - tStart) * diagonalStart / (diagonalStart - diagonalEnd);
+		return meetPlane(tStart, tSplit, above(tStart, upperFirst), above(tSplit, upperFirst), t)
+			|| meetPlane(tSplit, tEnd, above(tSplit, !upperFirst), above(tEnd, !upperFirst), t);
+	}
+}
+
+HeightPyramid::HeightPyramid()
+	: m_width(0)
+	, m_height(0)
+	, m_tileShift(0)
+	, m_maxStride(1)
+	, m_levelCount(0)
+{
+}
+
+void HeightPyramid::clear()
+{
+	m_maxHeights.clear();
+	m_levelCount = 0;
+}
+
+void HeightPyramid::build(const TiledHeightmap& heightmap)
+{
+	clear();
+	const unsigned int tileSize = heightmap.tileSize;
+	if (heightmap.width < 2 || heightmap.height < 2 || heightmap.tileLevels == 0 || tileSize < CELL_QUADS
+		|| (tileSize & (tileSize - 1)) != 0 || (1u << (heightmap.tileLevels - 1)) > tileSize) {
+		return;
+	}
+	m_width = heightmap.width;
+	m_height = heightmap.height;
+	m_tileShift = getShift(tileSize);
+	m_maxStride = 1u << (heightmap.tileLevels - 1);
+
+	unsigned int levelCount = 0;
+	size_t cellCount = 0;
+	unsigned int cellsX = (m_width - 1 + CELL_QUADS - 1) / CELL_QUADS;
+	unsigned int cellsZ = (m_height - 1 + CELL_QUADS - 1) / CELL_QUADS;
+	for (;;) {
+		if (levelCount == MAX_PYRAMID_LEVELS) {
+			return;
+		}
+		m_levelOffsets[levelCount] = (unsigned int)cellCount;
+		m_cellsX[levelCount] = cellsX;
+		m_cellsZ[levelCount] = cellsZ;
+		cellCount += (size_t)cellsX * cellsZ;
+		levelCount++;
+		if (cellsX == 1 && cellsZ == 1) {
+			break;
+		}
+		cellsX = (cellsX + 1) / 2;
+		cellsZ = (cellsZ + 1) / 2;
+	}
+	m_maxHeights.assign(cellCount + 1, 0);
+
+	// The finest level from the level 0 tiles, each filling the cells inside it. The samples on a cell's
+	// edges count as well, the quads either side share them
+	const unsigned int tileWidth = heightmapFile::getTileWidth(tileSize);
+	const unsigned int cellsPerTile = tileSize / CELL_QUADS;
+	const unsigned int tilesX = heightmap.tilesX[0];
+	ThreadPool::instance().parallelFor(tilesX * heightmap.tilesZ[0], [&](unsigned int index) {
+		const HeightmapTile& tile = heightmap.tiles[0][index];
+		std::vector<uint16_t> samples((size_t)tileWidth * tileWidth);
+		if (!heightmapFile::decodeTile(heightmap, tile, &samples[0])) {
+			std::fill(samples.begin(), samples.end(), tile.minHeight);
+		}
+		const unsigned int originX = (index % tilesX) * tileSize;
+		const unsigned int originZ = (index / tilesX) * tileSize;
+		const unsigned int lastCellX = std::min(originX / CELL_QUADS + cellsPerTile, m_cellsX[0]);
+		const unsigned int lastCellZ = std::min(originZ / CELL_QUADS + cellsPerTile, m_cellsZ[0]);
+		for (unsigned int cellZ = originZ / CELL_QUADS; cellZ < lastCellZ; cellZ++) {
+			const unsigned int lastZ = std::min(cellZ * CELL_QUADS + CELL_QUADS, m_height - 1);
+			for (unsigned int cellX = originX / CELL_QUADS; cellX < lastCellX; cellX++) {
+				const unsigned int lastX = std::min(cellX * CELL_QUADS + CELL_QUADS, m_width - 1);
+				uint16_t highest = 0;
+				for (unsigned int z = cellZ * CELL_QUADS; z <= lastZ; z++) {
+					const uint16_t* row = &samples[(size_t)(z - originZ + 1) * tileWidth];
+					for (unsigned int x = cellX * CELL_QUADS; x <= lastX; x++) {
+						highest = std::max(highest, row[x - originX + 1]);
+					}
+				}
+				m_maxHeights[m_levelOffsets[0] + cellZ * m_cellsX[0] + cellX] = highest;
+			}
+		}
+	});
+
+	for (unsigned int level = 1; level < levelCount; level++) {
+		const unsigned int belowX = m_cellsX[level - 1];
+		const unsigned int belowZ = m_cellsZ[level - 1];
+		const uint16_t* below = &m_maxHeights[m_levelOffsets[level - 1]];
+		uint16_t* cells = &m_maxHeights[m_levelOffsets[level]];
+		for (unsigned int cellZ = 0; cellZ < m_cellsZ[level]; cellZ++) {
+			const unsigned int z0 = cellZ * 2;
+			const unsigned int z1 = std::min(z0 + 1, belowZ - 1);
+			for (unsigned int cellX = 0; cellX < m_cellsX[level]; cellX++) {
+				const unsigned int x0 = cellX * 2;
+				const unsigned int x1 = std::min(x0 + 1, belowX - 1);
+				cells[cellZ * m_cellsX[level] + cellX] = std::max(std::max(below[z0 * belowX + x0], below[z0 * belowX + x1]),
+					std::max(below[z1 * belowX + x0], below[z1 * belowX + x1]));
+			}
+		}
+	}
+	m_levelCount = levelCount;
+}
+
+void HeightPyramid::update(const HeightmapPager& pager, unsigned int x0, unsigned int z0, unsigned int x1, unsigned int z1)
+{
+	if (!isBuilt() || x0 > x1 || z0 > z1 || x1 >= m_width || z1 >= m_height) {
+		return;
+	}
+	// A cell's edges are shared with its neighbours, so a sample on one counts for both
+	unsigned int cellX0 = x0 > 0 ? (x0 - 1) / CELL_QUADS : 0;
+	unsigned int cellZ0 = z0 > 0 ? (z0 - 1) / CELL_QUADS : 0;
+	unsigned int cellX1 = std::min(x1 / CELL_QUADS, m_cellsX[0] - 1);
+	unsigned int cellZ1 = std::min(z1 / CELL_QUADS, m_cellsZ[0] - 1);
+	const unsigned int readX0 = cellX0 * CELL_QUADS;
+	const unsigned int readZ0 = cellZ0 * CELL_QUADS;
+	const unsigned int readX1 = std::min(cellX1 * CELL_QUADS + CELL_QUADS, m_width - 1);
+	const unsigned int readZ1 = std::min(cellZ1 * CELL_QUADS + CELL_QUADS, m_height - 1);
+	const unsigned int rowLength = readX1 - readX0 + 1;
+	std::vector<uint16_t> samples((size_t)rowLength * (readZ1 - readZ0 + 1));
+	pager.readSamples(readX0, readZ0, readX1, readZ1, &samples[0]);
+	for (unsigned int cellZ = cellZ0; cellZ <= cellZ1; cellZ++) {
+		const unsigned int lastZ = std::min(cellZ * CELL_QUADS + CELL_QUADS, m_height - 1);
+		for (unsigned int cellX = cellX0; cellX <= cellX1; cellX++) {
+			const unsigned int lastX = std::min(cellX * CELL_QUADS + CELL_QUADS, m_width - 1);
+			uint16_t highest = 0;
+			for (unsigned int z = cellZ * CELL_QUADS; z <= lastZ; z++) {
+				const uint16_t* row = &samples[(size_t)(z - readZ0) * rowLength];
+				for (unsigned int x = cellX * CELL_QUADS; x <= lastX; x++) {
+					highest = std::max(highest, row[x - readX0]);
+				}
+			}
+			m_maxHeights[m_levelOffsets[0] + cellZ * m_cellsX[0] + cellX] = highest;
+		}
+	}
+
+	for (unsigned int level = 1; level < m_levelCount; level++) {
+		cellX0 >>= 1;
+		cellZ0 >>= 1;
+		cellX1 >>= 1;
+		cellZ1 >>= 1;
+		const unsigned int belowX = m_cellsX[level - 1];
+		const unsigned int belowZ = m_cellsZ[level - 1];
+		const uint16_t* below = &m_maxHeights[m_levelOffsets[level - 1]];
+		uint16_t* cells = &m_maxHeights[m_levelOffsets[level]];
+		for (unsigned int cellZ = cellZ0; cellZ <= cellZ1; cellZ++) {
+			const unsigned int belowZ0 = cellZ * 2;
+			const unsigned int belowZ1 = std::min(belowZ0 + 1, belowZ - 1);
+			for (unsigned int cellX = cellX0; cellX <= cellX1; cellX++) {
+				const unsigned int belowX0 = cellX * 2;
+				const unsigned int belowX1 = std::min(belowX0 + 1, belowX - 1);
+				cells[cellZ * m_cellsX[level] + cellX] = std::max(std::max(below[belowZ0 * belowX + belowX0], below[belowZ0 * belowX + belowX1]),
+					std::max(below[belowZ1 * belowX + belowX0], below[belowZ1 * belowX + belowX1]));
+			}
+		}
+	}
+}
+
+bool HeightPyramid::clipRay(const glm::vec3& origin, const glm::vec3& inverseDirection, float maxT, float& tStart, float& tEnd) const
+{
+	tStart = 0.0f;
+	tEnd = maxT;
+	const float x0 = -origin.x * inverseDirection.x;
+	const float x1 = (m_width - 1 - origin.x) * inverseDirection.x;
+	tStart = std::max(tStart, std::min(x0, x1));
+	tEnd = std::min(tEnd, std::max(x0, x1));
+	const float z0 = -origin.z * inverseDirection.z;
+	const float z1 = (m_height - 1 - origin.z) * inverseDirection.z;
+	tStart = std::max(tStart, std::min(z0, z1));
+	tEnd = std::min(tEnd, std::max(z0, z1));
+
+	// Nothing stands above the top cell
+	const float top = (getMaxHeight(m_levelCount - 1, 0, 0) - origin.y) * inverseDirection.y;
+	if (inverseDirection.y > 0.0f) {
+		tEnd = std::min(tEnd, top);
+	}
+	else {
+		tStart = std::max(tStart, top);
+	}
+	return tStart <= tEnd;
+}
+
+bool HeightPyramid::raycast(const HeightmapPager& pager, const glm::vec3& origin, const glm::vec3& direction, float maxT, float& hitT) const
+{
+	const glm::vec3 inverse(getSafeInverse(direction.x), getSafeInverse(direction.y), getSafeInverse(direction.z));
+	float t, tEnd;
+	if (m_levelCount == 0 || !clipRay(origin, inverse, maxT, t, tEnd)) {
+		return false;
+	}
+
+	// Start in the top level and walk the cells the ray passes through, a cell at a time
+	int level = (int)m_levelCount - 1;
+	const float invTopSize = 1.0f / (float)(CELL_QUADS << level);
+	int cellX = std::min(std::max((int)floorf((origin.x + direction.x * t) * invTopSize), 0), (int)m_cellsX[level] - 1);
+	int cellZ = std::min(std::max((int)floorf((origin.z + direction.z * t) * invTopSize), 0), (int)m_cellsZ[level] - 1);
+	const int stepX = direction.x < 0.0f ? -1 : 1;
+	const int stepZ = direction.z < 0.0f ? -1 : 1;
+
+	// The tile and the cell a ray among the quads came down from
+	PagedTile tile;
+	int parentLevel = 0;
+	int parentShift = 0;
+	for (;;) {
+		const float size = level >= 0 ? (float)(CELL_QUADS << level) : (float)tile.stride;
+		const float tX = ((cellX + (stepX > 0 ? 1 : 0)) * size - origin.x) * inverse.x;
+		const float tZ = ((cellZ + (stepZ > 0 ? 1 : 0)) * size - origin.z) * inverse.z;
+		const float tExit = std::min(std::min(tX, tZ), tEnd);
+		if (level >= 0) {
+			const float lowest = origin.y + direction.y * (direction.y < 0.0f ? tExit : t);
+			if (lowest <= getMaxHeight(level, cellX, cellZ)) {
+				// Down while the cells stay at least as wide as the quads of the ground under them
+				bool down = level > 0 && size * 0.5f >= m_maxStride;
+				if (!down) {
+					if (!pager.findTile(0, cellX * (CELL_QUADS << level), cellZ * (CELL_QUADS << level), tile)) {
+						return false;
+					}
+
+					// A coarser tile stands in for the ground here, whose quads only the parent bounds
+					if (tile.stride > size) {
+						level++;
+						cellX >>= 1;
+						cellZ >>= 1;
+						continue;
+					}
+					down = level > 0 && size * 0.5f >= tile.stride;
+				}
+				if (down) {
+					level--;
+					const float invHalf = 2.0f / size;
+					cellX = std::min(std::max((int)floorf((origin.x + direction.x * t) * invHalf), cellX * 2), std::min(cellX * 2 + 1, (int)m_cellsX[level] - 1));
+					cellZ = std::min(std::max((int)floorf((origin.z + direction.z * t) * invHalf), cellZ * 2), std::min(cellZ * 2 + 1, (int)m_cellsZ[level] - 1));
+					continue;
+				}
+
+				// Into the quads of the tile under the cell
+				parentLevel = level;
+				parentShift = (int)(CELL_SHIFT + level - getShift(tile.stride));
+				const float invStride = 1.0f / tile.stride;
+				cellX = std::min(std::max((int)floorf((origin.x + direction.x * t) * invStride), cellX << parentShift), ((cellX + 1) << parentShift) - 1);
+				cellZ = std::min(std::max((int)floorf((origin.z + direction.z * t) * invStride), cellZ << parentShift), ((cellZ + 1) << parentShift) - 1);
+				level = QUAD_LEVEL;
+				continue;
+			}
+		}
+		else {
+			const unsigned int i = cellX - tile.originX / tile.stride + 1;
+			const unsigned int j = cellZ - tile.originZ / tile.stride + 1;
+			if (intersectQuad(origin, direction, cellX * size, cellZ * size, 1.0f / size, tile.getSample(i, j), tile.getSample(i + 1, j),
+				tile.getSample(i, j + 1), tile.getSample(i + 1, j + 1), t, tExit, hitT)) {
+				return true;
+			}
+		}
+
+		// On to the next cell along the ray
+		if (tExit >= tEnd) {
+			return false;
+		}
+		t = std::max(t, tExit);
+		const int previousX = cellX;
+		const int previousZ = cellZ;
+		if (tX <= tZ) {
+			cellX += stepX;
+		}
+		else {
+			cellZ += stepZ;
+		}
+		if (level >= 0) {
+			// Up a level on crossing into another parent, which the ray has not been tested against yet
+			if (level + 1 < (int)m_levelCount && ((cellX >> 1) != (previousX >> 1) || (cellZ >> 1) != (previousZ >> 1))) {
+				level++;
+				cellX >>= 1;
+				cellZ >>= 1;
+			}
+		}
+		else if ((cellX >> parentShift) != (previousX >> parentShift) || (cellZ >> parentShift) != (previousZ >> parentShift)) {
+			level = parentLevel;
+			cellX >>= parentShift;
+			cellZ >>= parentShift;
+		}
+		if (level >= 0 && (cellX < 0 || cellZ < 0 || cellX >= (int)m_cellsX[level] || cellZ >= (int)m_cellsZ[level])) {
+			return false;
+		}
+	}
+}
+
+#ifdef HEIGHT_PYRAMID_AVX2
+unsigned int HeightPyramid::raycastPacket(const HeightmapPager& pager, const HeightRayPacket& rays, float hits[8]) const
+{
+	PagedLevel finest;
+	if (m_levelCount == 0 || !pager.getLevel(0, finest)) {
+		return 0;
+	}
+
+	// Where each tile level starts in the residency table, to find the finest tile under a cell
+	int slotOffsets[MAX_HEIGHTMAP_LEVELS];
+	int tilesX[MAX_HEIGHTMAP_LEVELS];
+	int lastTilesX[MAX_HEIGHTMAP_LEVELS];
+	int lastTilesZ[MAX_HEIGHTMAP_LEVELS];
+	int tileLevels = 0;
+	PagedLevel paged;
+	while (tileLevels < (int)MAX_HEIGHTMAP_LEVELS && pager.getLevel(tileLevels, paged)) {
+		slotOffsets[tileLevels] = (int)(paged.tileSlots - finest.tileSlots);
+		tilesX[tileLevels] = paged.tilesX;
+		lastTilesX[tileLevels] = paged.tilesX - 1;
+		lastTilesZ[tileLevels] = paged.tilesZ - 1;
+		tileLevels++;
+	}
+	const int* residentSlots = finest.tileSlots;
+	const int* samples = (const int*)finest.samples;
+	const int* maxHeights = (const int*)&m_maxHeights[0];
+	const int* levelOffsets = (const int*)m_levelOffsets;
+	const int* cellsX = (const int*)m_cellsX;
+	const int* cellsZ = (const int*)m_cellsZ;
+
+	const __m256 zero = _mm256_setzero_ps();
+	const __m256 one = _mm256_set1_ps(1.0f);
+	const __m256 half = _mm256_set1_ps(0.5f);
+	const __m256 signBit = _mm256_set1_ps(-0.0f);
+	const __m256i zeroInt = _mm256_setzero_si256();
+	const __m256i oneInt = _mm256_set1_epi32(1);
+	const __m256i none = _mm256_set1_epi32(-1);
+	const __m256i heightMask = _mm256_set1_epi32(0xffff);
+	const __m256i spread = _mm256_setr_epi32(spreadBlockBits(0), spreadBlockBits(1), spreadBlockBits(2), spreadBlockBits(3),
+		spreadBlockBits(4), spreadBlockBits(5), spreadBlockBits(6), spreadBlockBits(7));
+	const __m256i blocksPerRow = _mm256_set1_epi32(finest.blocksPerRow);
+	const __m256i slotSamples = _mm256_set1_epi32(finest.slotSamples);
+	const __m256i tileShift = _mm256_set1_epi32(m_tileShift);
+	const __m256i topLevel = _mm256_set1_epi32(m_levelCount - 1);
+	const __m256 maxStride = _mm256_set1_ps((float)m_maxStride);
+
+	const __m256 originX = _mm256_loadu_ps(rays.originX);
+	const __m256 originY = _mm256_loadu_ps(rays.originY);
+	const __m256 originZ = _mm256_loadu_ps(rays.originZ);
+	const __m256 directionX = _mm256_loadu_ps(rays.directionX);
+	const __m256 directionY = _mm256_loadu_ps(rays.directionY);
+	const __m256 directionZ = _mm256_loadu_ps(rays.directionZ);
+	auto safeInverse = [&](__m256 value) {
+		const __m256 small = _mm256_cmp_ps(_mm256_andnot_ps(signBit, value), _mm256_set1_ps(MIN_DIRECTION), _CMP_LT_OQ);
+		const __m256 replaced = _mm256_or_ps(_mm256_set1_ps(MIN_DIRECTION), _mm256_and_ps(value, signBit));
+		return _mm256_div_ps(one, _mm256_blendv_ps(value, replaced, small));
+	};
+	const __m256 inverseX = safeInverse(directionX);
+	const __m256 inverseY = safeInverse(directionY);
+	const __m256 inverseZ = safeInverse(directionZ);
+
+	// clipRay in every lane
+	__m256 t = zero;
+	__m256 tEnd = _mm256_loadu_ps(rays.maxT);
+	const __m256 x0 = _mm256_mul_ps(_mm256_sub_ps(zero, originX), inverseX);
+	const __m256 x1 = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps((float)(m_width - 1)), originX), inverseX);
+	t = _mm256_max_ps(t, _mm256_min_ps(x0, x1));
+	tEnd = _mm256_min_ps(tEnd, _mm256_max_ps(x0, x1));
+	const __m256 z0 = _mm256_mul_ps(_mm256_sub_ps(zero, originZ), inverseZ);
+	const __m256 z1 = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps((float)(m_height - 1)), originZ), inverseZ);
+	t = _mm256_max_ps(t, _mm256_min_ps(z0, z1));
+	tEnd = _mm256_min_ps(tEnd, _mm256_max_ps(z0, z1));
+	const __m256 top = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(getMaxHeight(m_levelCount - 1, 0, 0)), originY), inverseY);
+	const __m256 rising = _mm256_cmp_ps(inverseY, zero, _CMP_GT_OQ);
+	tEnd = _mm256_blendv_ps(tEnd, _mm256_min_ps(tEnd, top), rising);
+	t = _mm256_blendv_ps(_mm256_max_ps(t, top), t, rising);
+	__m256i active = _mm256_castps_si256(_mm256_cmp_ps(t, tEnd, _CMP_LE_OQ));
+
+	// Every lane starts in the top level
+	__m256i level = topLevel;
+	const __m256 invTopSize = _mm256_set1_ps(1.0f / (float)(CELL_QUADS << (m_levelCount - 1)));
+	__m256i cellX = _mm256_min_epi32(_mm256_max_epi32(_mm256_cvttps_epi32(_mm256_floor_ps(
+		_mm256_mul_ps(_mm256_add_ps(originX, _mm256_mul_ps(directionX, t)), invTopSize))), zeroInt), _mm256_set1_epi32(m_cellsX[m_levelCount - 1] - 1));
+	__m256i cellZ = _mm256_min_epi32(_mm256_max_epi32(_mm256_cvttps_epi32(_mm256_floor_ps(
+		_mm256_mul_ps(_mm256_add_ps(originZ, _mm256_mul_ps(directionZ, t)), invTopSize))), zeroInt), _mm256_set1_epi32(m_cellsZ[m_levelCount - 1] - 1));
+	const __m256 negativeX = _mm256_cmp_ps(directionX, zero, _CMP_LT_OQ);
+	const __m256 negativeZ = _mm256_cmp_ps(directionZ, zero, _CMP_LT_OQ);
+	const __m256 falling = _mm256_cmp_ps(directionY, zero, _CMP_LT_OQ);
+	const __m256i stepX = _mm256_blendv_epi8(oneInt, none, _mm256_castps_si256(negativeX));
+	const __m256i stepZ = _mm256_blendv_epi8(oneInt, none, _mm256_castps_si256(negativeZ));
+	const __m256i exitSideX = _mm256_andnot_si256(_mm256_castps_si256(negativeX), oneInt);
+	const __m256i exitSideZ = _mm256_andnot_si256(_mm256_castps_si256(negativeZ), oneInt);
+
+	// State of the lanes among the quads of a tile
+	__m256i parentLevel = zeroInt;
+	__m256i parentShift = zeroInt;
+	__m256i quadStride = oneInt;
+	__m256i quadSlotBase = zeroInt;
+	__m256i quadOffsetX = zeroInt;
+	__m256i quadOffsetZ = zeroInt;
+
+	__m256 hitT = zero;
+	__m256i hit = zeroInt;
+	auto any = [](__m256i mask) { return !_mm256_testz_si256(mask, mask); };
+	auto floorToInt = [](__m256 value) { return _mm256_cvttps_epi32(_mm256_floor_ps(value)); };
+	auto clampInt = [](__m256i value, __m256i lo, __m256i hi) { return _mm256_min_epi32(_mm256_max_epi32(value, lo), hi); };
+	while (any(active)) {
+		const __m256i quads = _mm256_cmpgt_epi32(zeroInt, level);
+		const __m256i levelIndex = _mm256_max_epi32(level, zeroInt);
+		const __m256i cellSizeInt = _mm256_sllv_epi32(_mm256_set1_epi32(CELL_QUADS), levelIndex);
+		const __m256 cellSize = _mm256_cvtepi32_ps(cellSizeInt);
+		const __m256 size = _mm256_blendv_ps(cellSize, _mm256_cvtepi32_ps(quadStride), _mm256_castsi256_ps(quads));
+		const __m256 tX = _mm256_mul_ps(_mm256_sub_ps(_mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_add_epi32(cellX, exitSideX)), size), originX), inverseX);
+		const __m256 tZ = _mm256_mul_ps(_mm256_sub_ps(_mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_add_epi32(cellZ, exitSideZ)), size), originZ), inverseZ);
+		const __m256 tExit = _mm256_min_ps(_mm256_min_ps(tX, tZ), tEnd);
+		const __m256 atX = _mm256_add_ps(originX, _mm256_mul_ps(directionX, t));
+		const __m256 atZ = _mm256_add_ps(originZ, _mm256_mul_ps(directionZ, t));
+
+		// Cells the ray passes over are stepped past, the others are gone down into
+		const __m256i cells = _mm256_andnot_si256(quads, active);
+		const __m256i cellIndex = _mm256_add_epi32(_mm256_add_epi32(_mm256_i32gather_epi32(levelOffsets, levelIndex, 4),
+			_mm256_mullo_epi32(cellZ, _mm256_i32gather_epi32(cellsX, levelIndex, 4))), cellX);
+		const __m256 highest = _mm256_cvtepi32_ps(_mm256_and_si256(
+			_mm256_mask_i32gather_epi32(zeroInt, maxHeights, cellIndex, cells, 2), heightMask));
+		const __m256 lowest = _mm256_add_ps(originY, _mm256_mul_ps(directionY, _mm256_blendv_ps(t, tExit, falling)));
+		const __m256i below = _mm256_and_si256(cells, _mm256_castps_si256(_mm256_cmp_ps(lowest, highest, _CMP_LE_OQ)));
+		const __m256i clear = _mm256_andnot_si256(below, cells);
+		const __m256 halfSize = _mm256_mul_ps(cellSize, half);
+		const __m256i aboveFinest = _mm256_cmpgt_epi32(level, zeroInt);
+		__m256i down = _mm256_and_si256(_mm256_and_si256(below, aboveFinest), _mm256_castps_si256(_mm256_cmp_ps(halfSize, maxStride, _CMP_GE_OQ)));
+		const __m256i lookup = _mm256_andnot_si256(down, below);
+		if (any(lookup)) {
+			// Finest resident tile under the cell, as findTile walks the levels
+			const __m256i sampleX = _mm256_sllv_epi32(cellX, _mm256_add_epi32(levelIndex, _mm256_set1_epi32(CELL_SHIFT)));
+			const __m256i sampleZ = _mm256_sllv_epi32(cellZ, _mm256_add_epi32(levelIndex, _mm256_set1_epi32(CELL_SHIFT)));
+			__m256i pending = lookup;
+			__m256i tileLevel = zeroInt;
+			__m256i tileSlot = zeroInt;
+			__m256i tileX = zeroInt;
+			__m256i tileZ = zeroInt;
+			for (int tileLevelIndex = 0; tileLevelIndex < tileLevels && any(pending); tileLevelIndex++) {
+				const __m256i shift = _mm256_add_epi32(tileShift, _mm256_set1_epi32(tileLevelIndex));
+				const __m256i x = _mm256_min_epi32(_mm256_srlv_epi32(sampleX, shift), _mm256_set1_epi32(lastTilesX[tileLevelIndex]));
+				const __m256i z = _mm256_min_epi32(_mm256_srlv_epi32(sampleZ, shift), _mm256_set1_epi32(lastTilesZ[tileLevelIndex]));
+				const __m256i slot = _mm256_mask_i32gather_epi32(none, residentSlots, _mm256_add_epi32(_mm256_set1_epi32(slotOffsets[tileLevelIndex]),
+					_mm256_add_epi32(_mm256_mullo_epi32(z, _mm256_set1_epi32(tilesX[tileLevelIndex])), x)), pending, 4);
+				const __m256i found = _mm256_and_si256(pending, _mm256_cmpgt_epi32(slot, none));
+				tileLevel = _mm256_blendv_epi8(tileLevel, _mm256_set1_epi32(tileLevelIndex), found);
+				tileSlot = _mm256_blendv_epi8(tileSlot, slot, found);
+				tileX = _mm256_blendv_epi8(tileX, x, found);
+				tileZ = _mm256_blendv_epi8(tileZ, z, found);
+				pending = _mm256_andnot_si256(found, pending);
+			}
+			active = _mm256_andnot_si256(pending, active);
+			const __m256i stride = _mm256_sllv_epi32(oneInt, tileLevel);
+
+			// Back up a level where a coarser tile stands in for the ground, whose quads only the parent bounds
+			const __m256i coarser = _mm256_andnot_si256(pending, _mm256_and_si256(lookup, _mm256_cmpgt_epi32(stride, cellSizeInt)));
+			const __m256i looked = _mm256_andnot_si256(_mm256_or_si256(pending, coarser), lookup);
+			level = _mm256_add_epi32(level, _mm256_and_si256(coarser, oneInt));
+			cellX = _mm256_blendv_epi8(cellX, _mm256_srai_epi32(cellX, 1), coarser);
+			cellZ = _mm256_blendv_epi8(cellZ, _mm256_srai_epi32(cellZ, 1), coarser);
+			const __m256i downLooked = _mm256_and_si256(_mm256_and_si256(looked, aboveFinest),
+				_mm256_castps_si256(_mm256_cmp_ps(halfSize, _mm256_cvtepi32_ps(stride), _CMP_GE_OQ)));
+			down = _mm256_or_si256(down, downLooked);
+
+			// Into the quads of the tile under the cell
+			const __m256i enter = _mm256_andnot_si256(downLooked, looked);
+			if (any(enter)) {
+				const __m256i shift = _mm256_sub_epi32(_mm256_add_epi32(levelIndex, _mm256_set1_epi32(CELL_SHIFT)), tileLevel);
+				const __m256 invStride = _mm256_div_ps(one, _mm256_cvtepi32_ps(stride));
+				const __m256i firstX = _mm256_sllv_epi32(cellX, shift);
+				const __m256i firstZ = _mm256_sllv_epi32(cellZ, shift);
+				const __m256i span = _mm256_sub_epi32(_mm256_sllv_epi32(oneInt, shift), oneInt);
+				const __m256i quadX = clampInt(floorToInt(_mm256_mul_ps(atX, invStride)), firstX, _mm256_add_epi32(firstX, span));
+				const __m256i quadZ = clampInt(floorToInt(_mm256_mul_ps(atZ, invStride)), firstZ, _mm256_add_epi32(firstZ, span));
+				parentLevel = _mm256_blendv_epi8(parentLevel, level, enter);
+				parentShift = _mm256_blendv_epi8(parentShift, shift, enter);
+				quadStride = _mm256_blendv_epi8(quadStride, stride, enter);
+				quadSlotBase = _mm256_blendv_epi8(quadSlotBase, _mm256_mullo_epi32(tileSlot, slotSamples), enter);
+				quadOffsetX = _mm256_blendv_epi8(quadOffsetX, _mm256_sub_epi32(oneInt, _mm256_sllv_epi32(tileX, tileShift)), enter);
+				quadOffsetZ = _mm256_blendv_epi8(quadOffsetZ, _mm256_sub_epi32(oneInt, _mm256_sllv_epi32(tileZ, tileShift)), enter);
+				level = _mm256_blendv_epi8(level, none, enter);
+				cellX = _mm256_blendv_epi8(cellX, quadX, enter);
+				cellZ = _mm256_blendv_epi8(cellZ, quadZ, enter);
+			}
+		}
+		if (any(down)) {
+			const __m256i childLevel = _mm256_max_epi32(_mm256_sub_epi32(levelIndex, oneInt), zeroInt);
+			const __m256 invHalf = _mm256_div_ps(one, halfSize);
+			const __m256i firstX = _mm256_slli_epi32(cellX, 1);
+			const __m256i firstZ = _mm256_slli_epi32(cellZ, 1);
+			const __m256i lastX = _mm256_min_epi32(_mm256_add_epi32(firstX, oneInt), _mm256_sub_epi32(_mm256_i32gather_epi32(cellsX, childLevel, 4), oneInt));
+			const __m256i lastZ = _mm256_min_epi32(_mm256_add_epi32(firstZ, oneInt), _mm256_sub_epi32(_mm256_i32gather_epi32(cellsZ, childLevel, 4), oneInt));
+			cellX = _mm256_blendv_epi8(cellX, clampInt(floorToInt(_mm256_mul_ps(atX, invHalf)), firstX, lastX), down);
+			cellZ = _mm256_blendv_epi8(cellZ, clampInt(floorToInt(_mm256_mul_ps(atZ, invHalf)), firstZ, lastZ), down);
+			level = _mm256_blendv_epi8(level, childLevel, down);
+		}
+
+		// The quads, against their two triangles as intersectQuad does
+		const __m256i quadLanes = _mm256_and_si256(quads, active);
+		__m256i quadHit = zeroInt;
+		if (any(quadLanes)) {
+			const __m256i i0 = _mm256_add_epi32(cellX, quadOffsetX);
+			const __m256i j0 = _mm256_add_epi32(cellZ, quadOffsetZ);
+			auto corner = [&](__m256i x, __m256i z) {
+				const __m256i block = _mm256_add_epi32(_mm256_mullo_epi32(_mm256_srli_epi32(z, 3), blocksPerRow), _mm256_srli_epi32(x, 3));
+				const __m256i inner = _mm256_or_si256(_mm256_permutevar8x32_epi32(spread, x), _mm256_slli_epi32(_mm256_permutevar8x32_epi32(spread, z), 1));
+				const __m256i index = _mm256_add_epi32(quadSlotBase, _mm256_add_epi32(_mm256_slli_epi32(block, 6), inner));
+				return _mm256_cvtepi32_ps(_mm256_and_si256(_mm256_mask_i32gather_epi32(zeroInt, samples, index, quadLanes, 2), heightMask));
+			};
+			const __m256 h00 = corner(i0, j0);
+			const __m256 h10 = corner(_mm256_add_epi32(i0, oneInt), j0);
+			const __m256 h01 = corner(i0, _mm256_add_epi32(j0, oneInt));
+			const __m256 h11 = corner(_mm256_add_epi32(i0, oneInt), _mm256_add_epi32(j0, oneInt));
+			const __m256 cornerX = _mm256_mul_ps(_mm256_cvtepi32_ps(cellX), size);
+			const __m256 cornerZ = _mm256_mul_ps(_mm256_cvtepi32_ps(cellZ), size);
+			const __m256 invSize = _mm256_div_ps(one, size);
+			auto acrossX = [&](__m256 at) { return _mm256_mul_ps(_mm256_sub_ps(_mm256_add_ps(originX, _mm256_mul_ps(directionX, at)), cornerX), invSize); };
+			auto acrossZ = [&](__m256 at) { return _mm256_mul_ps(_mm256_sub_ps(_mm256_add_ps(originZ, _mm256_mul_ps(directionZ, at)), cornerZ), invSize); };
+			auto above = [&](__m256 at, __m256 upper) {
+				const __m256 u = acrossX(at);
+				const __m256 v = acrossZ(at);
+				const __m256 upperGround = _mm256_add_ps(_mm256_add_ps(h00, _mm256_mul_ps(_mm256_sub_ps(h10, h00), u)), _mm256_mul_ps(_mm256_sub_ps(h11, h10), v));
+				const __m256 lowerGround = _mm256_add_ps(_mm256_add_ps(h00, _mm256_mul_ps(_mm256_sub_ps(h11, h01), u)), _mm256_mul_ps(_mm256_sub_ps(h01, h00), v));
+				return _mm256_sub_ps(_mm256_add_ps(originY, _mm256_mul_ps(directionY, at)), _mm256_blendv_ps(lowerGround, upperGround, upper));
+			};
+			const __m256 diagonalStart = _mm256_sub_ps(acrossX(t), acrossZ(t));
+			const __m256 diagonalEnd = _mm256_sub_ps(acrossX(tExit), acrossZ(tExit));
+			const __m256 startUpper = _mm256_cmp_ps(diagonalStart, zero, _CMP_GT_OQ);
+			const __m256 endUpper = _mm256_cmp_ps(diagonalEnd, zero, _CMP_GT_OQ);
+			const __m256 upperFirst = _mm256_or_ps(startUpper, _mm256_and_ps(_mm256_cmp_ps(diagonalStart, zero, _CMP_EQ_OQ), endUpper));
+			const __m256 crosses = _mm256_and_ps(_mm256_xor_ps(startUpper, endUpper), _mm256_cmp_ps(diagonalStart, diagonalEnd, _CMP_NEQ_OQ));
+			const __m256 tSplit = _mm256_blendv_ps(tExit, _mm256_add_ps(t, _mm256_div_ps(_mm256_mul_ps(_mm256_sub_ps(tExit, t), diagonalStart),
+				_mm256_sub_ps(diagonalStart, diagonalEnd))), crosses);
+			const __m256 upperSecond = _mm256_xor_ps(upperFirst, _mm256_castsi256_ps(none));
+			const __m256 firstStart = above(t, upperFirst);
+			const __m256 firstEnd = above(tSplit, upperFirst);
+			const __m256 secondStart = above(tSplit, upperSecond);
+			const __m256 secondEnd = above(tExit, upperSecond);
+			const __m256 firstAtStart = _mm256_cmp_ps(firstStart, zero, _CMP_LE_OQ);
+			const __m256 firstHit = _mm256_or_ps(firstAtStart, _mm256_cmp_ps(firstEnd, zero, _CMP_LE_OQ));
+			const __m256 secondAtStart = _mm256_cmp_ps(secondStart, zero, _CMP_LE_OQ);
+			const __m256 secondHit = _mm256_and_ps(crosses, _mm256_or_ps(secondAtStart, _mm256_cmp_ps(secondEnd, zero, _CMP_LE_OQ)));
+			const __m256 firstT = _mm256_blendv_ps(_mm256_add_ps(t, _mm256_div_ps(_mm256_mul_ps(_mm256_sub_ps(tSplit, t), firstStart),
+				_mm256_sub_ps(firstStart, firstEnd))), t, firstAtStart);
+			const __m256 secondT = _mm256_blendv_ps(_mm256_add_ps(tSplit, _mm256_div_ps(_mm256_mul_ps(_mm256_sub_ps(tExit, tSplit), secondStart),
+				_mm256_sub_ps(secondStart, secondEnd))), tSplit, secondAtStart);
+			quadHit = _mm256_and_si256(quadLanes, _mm256_castps_si256(_mm256_or_ps(firstHit, secondHit)));
+			hitT = _mm256_blendv_ps(hitT, _mm256_blendv_ps(secondT, firstT, firstHit), _mm256_castsi256_ps(quadHit));
+			hit = _mm256_or_si256(hit, quadHit);
+			active = _mm256_andnot_si256(quadHit, active);
+		}
+
+		// On to the next cell along the ray
+		const __m256i advance = _mm256_or_si256(clear, _mm256_andnot_si256(quadHit, quadLanes));
+		const __m256i finished = _mm256_and_si256(advance, _mm256_castps_si256(_mm256_cmp_ps(tExit, tEnd, _CMP_GE_OQ)));
+		active = _mm256_andnot_si256(finished, active);
+		const __m256i move = _mm256_andnot_si256(finished, advance);
+		if (any(move)) {
+			t = _mm256_blendv_ps(t, _mm256_max_ps(t, tExit), _mm256_castsi256_ps(move));
+			const __m256i alongX = _mm256_castps_si256(_mm256_cmp_ps(tX, tZ, _CMP_LE_OQ));
+			const __m256i nextX = _mm256_add_epi32(cellX, _mm256_and_si256(_mm256_and_si256(move, alongX), stepX));
+			const __m256i nextZ = _mm256_add_epi32(cellZ, _mm256_and_si256(_mm256_andnot_si256(alongX, move), stepZ));
+
+			// Up a level on crossing into another parent, back to the cell the quads came from on leaving it
+			const __m256i newParent = _mm256_or_si256(
+				_mm256_xor_si256(_mm256_cmpeq_epi32(_mm256_srai_epi32(nextX, 1), _mm256_srai_epi32(cellX, 1)), none),
+				_mm256_xor_si256(_mm256_cmpeq_epi32(_mm256_srai_epi32(nextZ, 1), _mm256_srai_epi32(cellZ, 1)), none));
+			const __m256i up = _mm256_and_si256(_mm256_andnot_si256(quads, move), _mm256_and_si256(newParent, _mm256_cmpgt_epi32(topLevel, level)));
+			const __m256i leaveQuads = _mm256_and_si256(_mm256_and_si256(quads, move), _mm256_or_si256(
+				_mm256_xor_si256(_mm256_cmpeq_epi32(_mm256_srav_epi32(nextX, parentShift), _mm256_srav_epi32(cellX, parentShift)), none),
+				_mm256_xor_si256(_mm256_cmpeq_epi32(_mm256_srav_epi32(nextZ, parentShift), _mm256_srav_epi32(cellZ, parentShift)), none)));
+			cellX = _mm256_blendv_epi8(nextX, _mm256_srai_epi32(nextX, 1), up);
+			cellZ = _mm256_blendv_epi8(nextZ, _mm256_srai_epi32(nextZ, 1), up);
+			level = _mm256_add_epi32(level, _mm256_and_si256(up, oneInt));
+			cellX = _mm256_blendv_epi8(cellX, _mm256_srav_epi32(cellX, parentShift), leaveQuads);
+			cellZ = _mm256_blendv_epi8(cellZ, _mm256_srav_epi32(cellZ, parentShift), leaveQuads);
+			level = _mm256_blendv_epi8(level, parentLevel, leaveQuads);
+
+			// Off the side of the pyramid
+			const __m256i onCells = _mm256_andnot_si256(_mm256_cmpgt_epi32(zeroInt, level), move);
+			const __m256i movedLevel = _mm256_max_epi32(level, zeroInt);
+			const __m256i inside = _mm256_and_si256(
+				_mm256_and_si256(_mm256_cmpgt_epi32(cellX, none), _mm256_cmpgt_epi32(cellZ, none)),
+				_mm256_and_si256(_mm256_cmpgt_epi32(_mm256_i32gather_epi32(cellsX, movedLevel, 4), cellX),
+					_mm256_cmpgt_epi32(_mm256_i32gather_epi32(cellsZ, movedLevel, 4), cellZ)));
+			active = _mm256_andnot_si256(_mm256_andnot_si256(inside, onCells), active);
+		}
+	}
+
+	_mm256_storeu_ps(hits, hitT);
+	return (unsigned int)_mm256_movemask_ps(_mm256_castsi256_ps(hit));
+}
+#else
+unsigned int HeightPyramid::raycastPacket(const HeightmapPager& pager, const HeightRayPacket& rays, float hits[8]) const
+{
+	unsigned int hitMask = 0;
+	for (unsigned int lane = 0; lane < 8; lane++) {
+		hits[lane] = 0.0f;
+		if (raycast(pager, glm::vec3(rays.originX[lane], rays.originY[lane], rays.originZ[lane]),
+			glm::vec3(rays.directionX[lane], rays.directionY[lane], rays.directionZ[lane]), rays.maxT[lane], hits[lane])) {
+			hitMask |= 1u << lane;
+		}
+	}
+	return hitMask;
+}
+#endif
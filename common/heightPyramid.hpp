@@ -0,0 +1,74 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "heightmapPager.hpp"
+
+const unsigned int MAX_PYRAMID_LEVELS = 24;
+
+// Eight rays for HeightPyramid::raycastPacket, one per lane
+struct HeightRayPacket
+{
+	float originX[8];
+	float originY[8];
+	float originZ[8];
+	float directionX[8];
+	float directionY[8];
+	float directionZ[8];
+	float maxT[8];
+};
+
+// Highest sample over square cells of a heightmap, from cells of 4x4 quads up to one cell over the whole
+// map. Rays are marched against it in the heightmap's own units, x and z in level 0 samples and y in 16 bit
+// heights, stepping over a whole cell of empty space at a time and going down a level only where they pass
+// below a cell's top. At the bottom they meet the ground the pager's finest resident tiles hold, which is
+// the ground Terrain::getHeightAt reports. A cell is never smaller than the quads of the tile it is tested
+// against, so its maximum bounds a coarser tile standing in for a finer one as well
+class HeightPyramid
+{
+public:
+	HeightPyramid();
+
+	// Decode the finest tiles across the thread pool and reduce them, any thread. Leaves the pyramid
+	// empty for tiles that are not a power of two in size or coarser levels with quads wider than a tile
+	void build(const TiledHeightmap& heightmap);
+	void clear();
+
+	// Take the cells over level 0 samples from (x0, z0) to (x1, z1), inclusive, again from the pager's
+	// samples as edited, and every cell above them
+	void update(const HeightmapPager& pager, unsigned int x0, unsigned int z0, unsigned int x1, unsigned int z1);
+
+	bool isBuilt() const { return m_levelCount > 0; }
+	size_t getMemoryBytes() const { return m_maxHeights.size() * sizeof(uint16_t); }
+
+	// Smallest t up to maxT at which origin + direction * t meets the ground. A ray that starts below the
+	// ground, or comes in below it through the side of the map, meets it where it starts or comes in
+	bool raycast(const HeightmapPager& pager, const glm::vec3& origin, const glm::vec3& direction, float maxT, float& t) const;
+
+	// raycast for eight rays, each lane marching on its own, 8 wide with AVX2 when the build enables it.
+	// Returns a bit for each ray that hit, with its t in hits
+	unsigned int raycastPacket(const HeightmapPager& pager, const HeightRayPacket& rays, float hits[8]) const;
+
+private:
+	// Range of t over which the ray is above the map and below its highest sample
+	bool clipRay(const glm::vec3& origin, const glm::vec3& inverseDirection, float maxT, float& tStart, float& tEnd) const;
+	uint16_t getMaxHeight(unsigned int level, int cellX, int cellZ) const
+	{
+		return m_maxHeights[m_levelOffsets[level] + cellZ * m_cellsX[level] + cellX];
+	}
+
+private:
+	unsigned int m_width;
+	unsigned int m_height;
+	unsigned int m_tileShift;		// from a level 0 sample to its tile
+	unsigned int m_maxStride;		// level 0 samples between those of the coarsest tiles
+
+	// Every level row by row, finest first, and one more height so it can be read two at a time
+	std::vector<uint16_t> m_maxHeights;
+	unsigned int m_levelCount;
+	unsigned int m_levelOffsets[MAX_PYRAMID_LEVELS];
+	unsigned int m_cellsX[MAX_PYRAMID_LEVELS];
+	unsigned int m_cellsZ[MAX_PYRAMID_LEVELS];
+};
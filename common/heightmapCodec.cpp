@@ -0,0 +1,338 @@
+#include "heightmapCodec.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+namespace
+{
+	enum BlockMethod
+	{
+		METHOD_PACKED = 0,			// every sample in the range's bits
+		METHOD_PREDICTED			// Rice coded residuals
+	};
+
+	// A residual whose unary part would be this long is stored as the sample itself instead
+	const unsigned int ESCAPE_ZEROS = 24;
+
+	// Bits of the Rice parameter at the start of each row, which goes up to 17 for 16 bit residuals
+	const unsigned int PARAMETER_BITS = 5;
+	const unsigned int MAX_PARAMETER = 17;
+
+	// Bits needed for values up to range
+	unsigned int getRangeBits(unsigned int range)
+	{
+		unsigned int bits = 0;
+		while (bits < 32 && (range >> bits) != 0) {
+			bits++;
+		}
+		return bits;
+	}
+
+	inline unsigned int countTrailingZeros(uint64_t value)
+	{
+#if defined(_MSC_VER) && defined(_M_X64)
+		unsigned long index;
+		_BitScanForward64(&index, value);
+		return (unsigned int)index;
+#elif defined(__GNUC__)
+		return (unsigned int)__builtin_ctzll(value);
+#else
+		unsigned int count = 0;
+		while (!(value & 1)) {
+			value >>= 1;
+			count++;
+		}
+		return count;
+#endif
+	}
+
+	// Left + up - upper left, kept within the range so a residual never has to reach outside it
+	inline int predictPlanar(int left, int up, int upLeft, int range)
+	{
+		return std::min(std::max(left + up - upLeft, 0), range);
+	}
+
+	// Signed residuals interleaved as 0, -1, 1, -2, ..., without branches, since the sign is a coin toss
+	inline uint32_t zigzag(int value)
+	{
+		return ((uint32_t)value << 1) ^ (uint32_t)(value >> 31);
+	}
+
+	inline int unzigzag(uint32_t value)
+	{
+		return (int)(value >> 1) ^ -(int)(value & 1);
+	}
+
+	// Least significant bit first, into storage sized for the largest encoding and 8 bytes more up front.
+	// Every write stores a whole word and keeps the partial byte, so there is no branch to mispredict
+	class BitWriter
+	{
+	public:
+		explicit BitWriter(unsigned char* out)
+			: m_out(out), m_position(0), m_bits(0), m_count(0)
+		{
+		}
+
+		// Up to 56 bits at once
+		void write(uint64_t value, unsigned int count)
+		{
+			m_bits |= value << m_count;
+			m_count += count;
+			memcpy(m_out + m_position, &m_bits, sizeof(m_bits));
+			const unsigned int bytes = m_count >> 3;
+			m_position += bytes;
+			m_bits >>= bytes * 8;
+			m_count &= 7;
+		}
+
+		// Bytes written, including the last partial one
+		size_t flush() const
+		{
+			return m_position + (m_count > 0 ? 1 : 0);
+		}
+
+	private:
+		unsigned char* m_out;
+		size_t m_position;
+		uint64_t m_bits;
+		unsigned int m_count;
+	};
+
+	class BitReader
+	{
+	public:
+		BitReader(const unsigned char* data, size_t size)
+			: m_data(data), m_size(size), m_position(0), m_bits(0), m_count(0)
+		{
+		}
+
+		// Leaves at least 56 bits to read, zeros once the data runs out
+		void refill()
+		{
+			if (m_position + 8 <= m_size) {
+				uint64_t word;
+				memcpy(&word, m_data + m_position, sizeof(word));
+				m_bits |= word << m_count;
+				m_position += (63 - m_count) >> 3;
+				m_count |= 56;
+				return;
+			}
+			while (m_count <= 56) {
+				uint64_t byte = m_position < m_size ? m_data[m_position] : 0;
+				m_bits |= byte << m_count;
+				m_position++;
+				m_count += 8;
+			}
+		}
+
+		uint64_t peek() const { return m_bits; }
+		unsigned int available() const { return m_count; }
+
+		void skip(unsigned int count)
+		{
+			m_bits >>= count;
+			m_count -= count;
+		}
+
+		uint32_t read(unsigned int count)
+		{
+			uint32_t value = (uint32_t)(m_bits & ((1ull << count) - 1));
+			skip(count);
+			return value;
+		}
+
+		// False if more bits were read than the data holds
+		bool isValid() const { return m_position * 8 - m_count <= (uint64_t)m_size * 8; }
+
+	private:
+		const unsigned char* m_data;
+		size_t m_size;
+		size_t m_position;
+		uint64_t m_bits;
+		unsigned int m_count;
+	};
+
+	// Rice parameter that codes the row's residuals in the fewest bits, searched around the mean
+	unsigned int chooseParameter(const uint32_t* residuals, unsigned int count, unsigned int rangeBits)
+	{
+		uint64_t sum = 0;
+		for (unsigned int i = 0; i < count; i++) {
+			sum += residuals[i];
+		}
+		const unsigned int estimate = getRangeBits((unsigned int)(sum / count));
+		unsigned int best = 0;
+		uint64_t bestBits = ~0ull;
+		for (unsigned int k = estimate > 1 ? estimate - 1 : 0; k <= std::min(estimate + 1, MAX_PARAMETER); k++) {
+			uint64_t bits = 0;
+			for (unsigned int i = 0; i < count; i++) {
+				uint32_t quotient = residuals[i] >> k;
+				bits += quotient < ESCAPE_ZEROS ? quotient + 1 + k : ESCAPE_ZEROS + rangeBits;
+			}
+			if (bits < bestBits) {
+				best = k;
+				bestBits = bits;
+			}
+		}
+		return best;
+	}
+}
+
+namespace heightmapCodec
+{
+	size_t getMaxEncodedSize(size_t count)
+	{
+		// Prediction is only kept when it beats packing, which takes at most 16 bits a sample
+		return 1 + count * sizeof(uint16_t);
+	}
+
+	void encode(const uint16_t* samples, unsigned int width, unsigned int height, uint16_t minHeight, uint16_t maxHeight,
+		std::vector<unsigned char>& out)
+	{
+		out.clear();
+		const int range = maxHeight - minHeight;
+		if (range <= 0 || width == 0 || height == 0) {
+			return;
+		}
+		const unsigned int rangeBits = getRangeBits(range);
+		const size_t count = (size_t)width * height;
+
+		std::vector<uint16_t> values(count);
+		for (size_t i = 0; i < count; i++) {
+			values[i] = (uint16_t)(samples[i] - minHeight);
+		}
+
+		// Room for every sample escaped and a word of slack, trimmed once the size is known
+		out.resize(1 + (count * (ESCAPE_ZEROS + 16) + height * PARAMETER_BITS) / 8 + 8);
+		out[0] = METHOD_PREDICTED;
+		BitWriter writer(&out[1]);
+		std::vector<uint32_t> residuals(width);
+		for (unsigned int y = 0; y < height; y++) {
+			const uint16_t* row = &values[(size_t)y * width];
+			const uint16_t* above = row - width;
+			if (y == 0) {
+				residuals[0] = zigzag(row[0]);
+				for (unsigned int x = 1; x < width; x++) {
+					residuals[x] = zigzag((int)row[x] - row[x - 1]);
+				}
+			}
+			else {
+				residuals[0] = zigzag((int)row[0] - above[0]);
+				for (unsigned int x = 1; x < width; x++) {
+					residuals[x] = zigzag((int)row[x] - predictPlanar(row[x - 1], above[x], above[x - 1], range));
+				}
+			}
+
+			const unsigned int k = chooseParameter(&residuals[0], width, rangeBits);
+			writer.write(k, PARAMETER_BITS);
+			for (unsigned int x = 0; x < width; x++) {
+				const uint32_t quotient = residuals[x] >> k;
+				if (quotient < ESCAPE_ZEROS) {
+					writer.write((1ull << quotient) | ((uint64_t)(residuals[x] & ((1u << k) - 1)) << (quotient + 1)), quotient + 1 + k);
+				}
+				else {
+					writer.write(0, ESCAPE_ZEROS);
+					writer.write(row[x], rangeBits);
+				}
+			}
+		}
+		size_t size = 1 + writer.flush();
+
+		const size_t packedSize = 1 + (count * rangeBits + 7) / 8;
+		if (size >= packedSize) {
+			out[0] = METHOD_PACKED;
+			BitWriter packer(&out[1]);
+			for (size_t i = 0; i < count; i++) {
+				packer.write(values[i], rangeBits);
+			}
+			size = 1 + packer.flush();
+		}
+		out.resize(size);
+	}
+
+	bool decode(const unsigned char* data, size_t size, unsigned int width, unsigned int height, uint16_t minHeight,
+		uint16_t maxHeight, uint16_t* samples)
+	{
+		const size_t count = (size_t)width * height;
+		const int range = maxHeight - minHeight;
+		if (range < 0) {
+			return false;
+		}
+		if (range == 0) {
+			std::fill(samples, samples + count, minHeight);
+			return size == 0;
+		}
+		if (size < 1 || size > getMaxEncodedSize(count)) {
+			return false;
+		}
+		const unsigned int rangeBits = getRangeBits(range);
+		BitReader reader(data + 1, size - 1);
+
+		// Decode relative to the lowest height in place, then shift everything up at the end
+		if (data[0] == METHOD_PACKED) {
+			for (size_t i = 0; i < count; i++) {
+				if (reader.available() < rangeBits) {
+					reader.refill();
+				}
+				samples[i] = (uint16_t)reader.read(rangeBits);
+			}
+		}
+		else if (data[0] == METHOD_PREDICTED) {
+			for (unsigned int y = 0; y < height; y++) {
+				uint16_t* row = samples + (size_t)y * width;
+				const uint16_t* above = row - width;
+				reader.refill();
+				const unsigned int k = reader.read(PARAMETER_BITS);
+				if (k > MAX_PARAMETER) {
+					return false;
+				}
+				const uint64_t remainderMask = (1ull << k) - 1;
+				for (unsigned int x = 0; x < width; x++) {
+					// Refilling every time is cheaper than mispredicting when to. It leaves room for the
+					// longest code, the escape's zeros or a unary run and its terminator, plus 17 bits
+					reader.refill();
+					const uint64_t bits = reader.peek();
+					int value;
+					if ((bits & ((1ull << ESCAPE_ZEROS) - 1)) == 0) {
+						reader.skip(ESCAPE_ZEROS);
+						value = (int)reader.read(rangeBits);
+					}
+					else {
+						const unsigned int quotient = countTrailingZeros(bits);
+						const uint32_t residual = (quotient << k) | (uint32_t)((bits >> (quotient + 1)) & remainderMask);
+						reader.skip(quotient + 1 + k);
+						int prediction;
+						if (y == 0) {
+							prediction = x > 0 ? row[x - 1] : 0;
+						}
+						else if (x == 0) {
+							prediction = above[0];
+						}
+						else {
+							prediction = predictPlanar(row[x - 1], above[x], above[x - 1], range);
+						}
+						value = prediction + unzigzag(residual);
+					}
+					if ((unsigned int)value > (unsigned int)range) {
+						return false;
+					}
+					row[x] = (uint16_t)value;
+				}
+			}
+		}
+		else {
+			return false;
+		}
+		if (!reader.isValid()) {
+			return false;
+		}
+
+		for (size_t i = 0; i < count; i++) {
+			samples[i] = (uint16_t)(samples[i] + minHeight);
+		}
+		return true;
+	}
+}
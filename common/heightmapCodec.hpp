@@ -0,0 +1,22 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Lossless codec for a block of 16 bit heights with a known range. Samples are stored relative to the
+// lowest one, in as few bits as the range needs. Each is predicted from its left, upper and upper left
+// neighbours and the residual is Rice coded, with the Rice parameter picked per row. A block where
+// prediction does not pay is bit packed instead, and one with a single height takes no bytes at all
+namespace heightmapCodec
+{
+	// Largest encoding of a block of count samples
+	size_t getMaxEncodedSize(size_t count);
+
+	// Replaces out with the encoding of width x height samples, all within minHeight to maxHeight
+	void encode(const uint16_t* samples, unsigned int width, unsigned int height, uint16_t minHeight, uint16_t maxHeight,
+		std::vector<unsigned char>& out);
+
+	// Expand a block written by encode, false if the data is corrupt
+	bool decode(const unsigned char* data, size_t size, unsigned int width, unsigned int height, uint16_t minHeight,
+		uint16_t maxHeight, uint16_t* samples);
+}
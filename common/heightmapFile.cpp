@@ -0,0 +1,595 @@
+#include "heightmapFile.hpp"
+#include "contentHash.hpp"
+#include "heightmapCodec.hpp"
+#include "threadPool.hpp"
+#include "timer.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define HEIGHTMAP_SSE2
+#include <emmintrin.h>
+#endif
+
+namespace
+{
+	const char HEIGHTMAP_FILE_MAGIC[4] = { 'C', 'G', 'H', 'T' };
+
+	// Bump whenever the layout below or the codec changes
+	const uint32_t HEIGHTMAP_FILE_VERSION = 2;
+
+	// Rows per thread pool item when decoding a band, enough to outweigh the cost of handing them out
+	const unsigned int ROWS_PER_JOB = 16;
+
+	// Layout benchmarkConvert builds, the one the terrain uses
+	const unsigned int BENCHMARK_TILE_SIZE = 256;
+	const unsigned int BENCHMARK_PATCH_SIZE = 32;
+
+	// File layout: header, node bounds level by level, tile index level by level, then the tiles encoded
+	// by heightmapCodec, every block 16 byte aligned
+	struct HeightmapFileHeader
+	{
+		char magic[4];
+		uint32_t version;
+		uint64_t sourceSize;
+		uint64_t sourceHash;
+		uint32_t width;
+		uint32_t height;
+		uint32_t tileSize;
+		uint32_t tileLevels;
+		uint32_t tilesX[MAX_HEIGHTMAP_LEVELS];
+		uint32_t tilesZ[MAX_HEIGHTMAP_LEVELS];
+		uint64_t tileIndexOffset[MAX_HEIGHTMAP_LEVELS];
+		uint32_t patchSize;
+		uint32_t boundsLevels;
+		uint32_t boundsNodes[MAX_HEIGHTMAP_LEVELS];
+		uint64_t boundsOffset[MAX_HEIGHTMAP_LEVELS];
+	};
+
+	inline uint64_t alignUp(uint64_t value)
+	{
+		return (value + 15) & ~(uint64_t)15;
+	}
+
+	// Little endian sample scaled to the full 16 bit range
+	inline uint16_t decodeSample(const unsigned char* data, unsigned int bytesPerSample)
+	{
+		switch (bytesPerSample) {
+		case 1: return (uint16_t)(data[0] * 257);
+		case 2: return (uint16_t)(data[1] << 8 | data[0]);
+		default: return (uint16_t)(data[3] << 8 | data[2]);
+		}
+	}
+
+	// A run of samples at once, a byte at a time when simd is off or unavailable
+	void decodeRow(const unsigned char* data, unsigned int bytesPerSample, unsigned int count, bool simd, uint16_t* out)
+	{
+		unsigned int i = 0;
+#ifdef HEIGHTMAP_SSE2
+		if (simd) {
+			switch (bytesPerSample) {
+			case 1:
+				// Times 257 is the byte repeated in both halves
+				for (; i + 16 <= count; i += 16) {
+					__m128i bytes = _mm_loadu_si128((const __m128i*)(data + i));
+					_mm_storeu_si128((__m128i*)(out + i), _mm_unpacklo_epi8(bytes, bytes));
+					_mm_storeu_si128((__m128i*)(out + i + 8), _mm_unpackhi_epi8(bytes, bytes));
+				}
+				break;
+			case 2:
+				for (; i + 8 <= count; i += 8) {
+					_mm_storeu_si128((__m128i*)(out + i), _mm_loadu_si128((const __m128i*)(data + (size_t)i * 2)));
+				}
+				break;
+			default:
+				// An arithmetic shift keeps the high halves in signed range, which the saturating pack leaves alone
+				for (; i + 8 <= count; i += 8) {
+					__m128i low = _mm_srai_epi32(_mm_loadu_si128((const __m128i*)(data + (size_t)i * 4)), 16);
+					__m128i high = _mm_srai_epi32(_mm_loadu_si128((const __m128i*)(data + (size_t)i * 4 + 16)), 16);
+					_mm_storeu_si128((__m128i*)(out + i), _mm_packs_epi32(low, high));
+				}
+				break;
+			}
+		}
+#endif
+		for (; i < count; i++) {
+			out[i] = decodeSample(data + (size_t)i * bytesPerSample, bytesPerSample);
+		}
+	}
+
+	// Widens low and high to take in a run of samples
+	void growRange(const uint16_t* samples, unsigned int count, bool simd, uint16_t& low, uint16_t& high)
+	{
+		unsigned int i = 0;
+#ifdef HEIGHTMAP_SSE2
+		if (simd && count >= 8) {
+			// SSE2 only compares signed 16 bit values, flipping the top bit keeps the order of unsigned ones
+			const __m128i flip = _mm_set1_epi16((short)0x8000);
+			__m128i lows = _mm_set1_epi16((short)(low ^ 0x8000));
+			__m128i highs = _mm_set1_epi16((short)(high ^ 0x8000));
+			for (; i + 8 <= count; i += 8) {
+				__m128i values = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(samples + i)), flip);
+				lows = _mm_min_epi16(lows, values);
+				highs = _mm_max_epi16(highs, values);
+			}
+			uint16_t lanes[16];
+			_mm_storeu_si128((__m128i*)lanes, _mm_xor_si128(lows, flip));
+			_mm_storeu_si128((__m128i*)(lanes + 8), _mm_xor_si128(highs, flip));
+			for (int lane = 0; lane < 8; lane++) {
+				low = std::min(low, lanes[lane]);
+				high = std::max(high, lanes[lane + 8]);
+			}
+		}
+#endif
+		for (; i < count; i++) {
+			low = std::min(low, samples[i]);
+			high = std::max(high, samples[i]);
+		}
+	}
+
+	void forEach(unsigned int count, bool parallel, const std::function<void(unsigned int)>& body)
+	{
+		if (parallel) {
+			ThreadPool::instance().parallelFor(count, body);
+			return;
+		}
+		for (unsigned int i = 0; i < count; i++) {
+			body(i);
+		}
+	}
+
+	// Zeros from written up to offset, then the data. Keeps the writes sequential, fseek takes a long
+	bool writePadded(FILE* file, uint64_t& written, uint64_t offset, const void* data, size_t size)
+	{
+		static const unsigned char zeros[4096] = { 0 };
+		while (written < offset) {
+			size_t count = (size_t)std::min<uint64_t>(offset - written, sizeof(zeros));
+			if (fwrite(zeros, 1, count, file) != count) {
+				return false;
+			}
+			written += count;
+		}
+		written += size;
+		return size == 0 || fwrite(data, size, 1, file) == 1;
+	}
+
+	// Only for the header and the tile index, which sit near the start
+	bool writeAt(FILE* file, uint64_t offset, const void* data, size_t size)
+	{
+		return fseek(file, (long)offset, SEEK_SET) == 0 && fwrite(data, size, 1, file) == 1;
+	}
+
+	// Tiles a level at a time and a row of tiles at a time. The rows of the source a row of tiles reads are
+	// decoded into a band first, then the band is cut into tiles, and on level 0 into leaf bounds as well.
+	// With parallel on, each step is spread over the thread pool and decoding uses SIMD; the tiles are
+	// still written in order, so the file is the same either way
+	bool build(const unsigned char* samples, unsigned int bytesPerSample, unsigned int width, unsigned int height,
+		unsigned long long sourceHash, unsigned int tileSize, unsigned int patchSize, const std::string& cachePath, bool parallel)
+	{
+		if (width < 2 || height < 2 || (bytesPerSample != 1 && bytesPerSample != 2 && bytesPerSample != 4)
+			|| patchSize == 0 || tileSize % patchSize != 0) {
+			return false;
+		}
+
+		HeightmapFileHeader header;
+		memset(&header, 0, sizeof(header));
+		memcpy(header.magic, HEIGHTMAP_FILE_MAGIC, sizeof(header.magic));
+		header.version = HEIGHTMAP_FILE_VERSION;
+		header.sourceSize = (uint64_t)bytesPerSample * width * height;
+		header.sourceHash = sourceHash;
+		header.width = width;
+		header.height = height;
+		header.tileSize = tileSize;
+		header.patchSize = patchSize;
+
+		// Quadtree over the whole map, rounded up to a power of two times the patch
+		unsigned int rootSize = patchSize;
+		header.boundsLevels = 1;
+		while (rootSize < width - 1 || rootSize < height - 1) {
+			rootSize *= 2;
+			header.boundsLevels++;
+		}
+
+		// Tile levels until one tile covers the map
+		header.tileLevels = 0;
+		do {
+			const unsigned int span = tileSize << header.tileLevels;
+			header.tilesX[header.tileLevels] = (width - 2) / span + 1;
+			header.tilesZ[header.tileLevels] = (height - 2) / span + 1;
+			header.tileLevels++;
+		} while (header.tileLevels < MAX_HEIGHTMAP_LEVELS
+			&& (header.tilesX[header.tileLevels - 1] > 1 || header.tilesZ[header.tileLevels - 1] > 1));
+		if (header.boundsLevels > MAX_HEIGHTMAP_LEVELS || header.tilesX[header.tileLevels - 1] > 1
+			|| header.tilesZ[header.tileLevels - 1] > 1) {
+			return false;
+		}
+
+		uint64_t offset = alignUp(sizeof(header));
+		for (unsigned int level = 0; level < header.boundsLevels; level++) {
+			header.boundsNodes[level] = (rootSize / patchSize) >> level;
+			header.boundsOffset[level] = offset;
+			offset = alignUp(offset + (uint64_t)header.boundsNodes[level] * header.boundsNodes[level] * 2 * sizeof(uint16_t));
+		}
+		for (unsigned int level = 0; level < header.tileLevels; level++) {
+			header.tileIndexOffset[level] = offset;
+			offset = alignUp(offset + (uint64_t)header.tilesX[level] * header.tilesZ[level] * sizeof(HeightmapTile));
+		}
+
+		std::vector<std::vector<uint16_t> > bounds(header.boundsLevels);
+		const unsigned int leaves = header.boundsNodes[0];
+		bounds[0].resize((size_t)leaves * leaves * 2);
+		for (size_t i = 0; i < bounds[0].size(); i += 2) {
+			bounds[0][i] = 0xffff;
+			bounds[0][i + 1] = 0;
+		}
+
+		// Write to a temporary file first so a crash never leaves a truncated cache behind
+		std::string tempPath = cachePath + ".tmp";
+		FILE* file = fopen(tempPath.c_str(), "wb");
+		if (!file) {
+			return false;
+		}
+
+		const unsigned int tileWidth = heightmapFile::getTileWidth(tileSize);
+		const size_t tileSamples = (size_t)tileWidth * tileWidth;
+		std::vector<uint16_t> band((size_t)tileWidth * width);
+		std::vector<uint16_t> tiles((size_t)header.tilesX[0] * tileSamples);
+		std::vector<std::vector<unsigned char> > encoded(header.tilesX[0]);
+		std::vector<std::vector<HeightmapTile> > indices(header.tileLevels);
+		uint64_t written = 0;
+		bool ok = true;
+		for (unsigned int level = 0; ok && level < header.tileLevels; level++) {
+			const unsigned int stride = 1u << level;
+			const unsigned int tilesX = header.tilesX[level];
+			std::vector<HeightmapTile>& index = indices[level];
+			index.resize((size_t)tilesX * header.tilesZ[level]);
+			for (unsigned int tileZ = 0; ok && tileZ < header.tilesZ[level]; tileZ++) {
+				// Row j of the band is row j - 1 of the tiles, clamped to the map
+				const long long originZ = (long long)tileZ * tileSize * stride;
+				forEach((tileWidth + ROWS_PER_JOB - 1) / ROWS_PER_JOB, parallel, [&](unsigned int job) {
+					const unsigned int end = std::min((job + 1) * ROWS_PER_JOB, tileWidth);
+					for (unsigned int j = job * ROWS_PER_JOB; j < end; j++) {
+						long long z = std::min(std::max(originZ + ((long long)j - 1) * stride, 0ll), (long long)height - 1);
+						decodeRow(samples + (size_t)z * width * bytesPerSample, bytesPerSample, width, parallel, &band[(size_t)j * width]);
+					}
+				});
+
+				// Leaf rows starting in this band, the last band also takes a leaf that only holds the map's last row
+				unsigned int firstLeaf = 0, endLeaf = 0;
+				if (level == 0) {
+					firstLeaf = (unsigned int)(originZ / patchSize);
+					endLeaf = tileZ + 1 < header.tilesZ[0] ? firstLeaf + tileSize / patchSize : (height - 1) / patchSize + 1;
+					endLeaf = std::min(endLeaf, leaves);
+				}
+
+				forEach(tilesX + (endLeaf - firstLeaf), parallel, [&](unsigned int item) {
+					if (item >= tilesX) {
+						// Samples on the edge between two leaves count for both
+						const unsigned int nodeZ = firstLeaf + item - tilesX;
+						const unsigned int z0 = nodeZ * patchSize;
+						const unsigned int z1 = std::min(z0 + patchSize, height - 1);
+						for (unsigned int nodeX = 0; nodeX < leaves && nodeX * patchSize <= width - 1; nodeX++) {
+							const unsigned int x0 = nodeX * patchSize;
+							const unsigned int x1 = std::min(x0 + patchSize, width - 1);
+							uint16_t* node = &bounds[0][((size_t)nodeZ * leaves + nodeX) * 2];
+							for (unsigned int z = z0; z <= z1; z++) {
+								growRange(&band[(size_t)(z - originZ + 1) * width + x0], x1 - x0 + 1, parallel, node[0], node[1]);
+							}
+						}
+						return;
+					}
+
+					// Only the columns past either edge of the map need clamping
+					const long long originX = (long long)item * tileSize * stride;
+					const unsigned int firstInside = originX > 0 ? 0 : 1;
+					const unsigned int endInside = (unsigned int)std::min<long long>(tileWidth, (width - 1 - originX) / stride + 2);
+					uint16_t* tile = &tiles[item * tileSamples];
+					for (unsigned int j = 0; j < tileWidth; j++) {
+						const uint16_t* row = &band[(size_t)j * width];
+						uint16_t* out = tile + (size_t)j * tileWidth;
+						const uint16_t* in = row + originX + ((long long)firstInside - 1) * stride;
+						if (stride == 1) {
+							memcpy(out + firstInside, in, (endInside - firstInside) * sizeof(uint16_t));
+						}
+						else {
+							for (unsigned int i = firstInside; i < endInside; i++, in += stride) {
+								out[i] = *in;
+							}
+						}
+						for (unsigned int i = 0; i < firstInside; i++) {
+							out[i] = row[0];
+						}
+						for (unsigned int i = endInside; i < tileWidth; i++) {
+							out[i] = row[width - 1];
+						}
+					}
+					HeightmapTile& entry = index[(size_t)tileZ * tilesX + item];
+					entry.minHeight = 0xffff;
+					entry.maxHeight = 0;
+					growRange(tile, (unsigned int)tileSamples, parallel, entry.minHeight, entry.maxHeight);
+					heightmapCodec::encode(tile, tileWidth, tileWidth, entry.minHeight, entry.maxHeight, encoded[item]);
+				});
+
+				for (unsigned int tileX = 0; ok && tileX < tilesX; tileX++) {
+					HeightmapTile& entry = index[(size_t)tileZ * tilesX + tileX];
+					entry.offset = offset;
+					entry.size = (uint32_t)encoded[tileX].size();
+					ok = writePadded(file, written, offset, encoded[tileX].data(), entry.size);
+					offset = alignUp(offset + entry.size);
+				}
+			}
+		}
+
+		// Parents from their four children, a row of parents per item
+		for (unsigned int level = 1; level < header.boundsLevels; level++) {
+			const unsigned int nodes = header.boundsNodes[level];
+			bounds[level].resize((size_t)nodes * nodes * 2);
+			forEach(nodes, parallel && nodes >= ROWS_PER_JOB, [&](unsigned int nodeZ) {
+				for (unsigned int nodeX = 0; nodeX < nodes; nodeX++) {
+					uint16_t low = 0xffff, high = 0;
+					for (unsigned int i = 0; i < 4; i++) {
+						const uint16_t* child = &bounds[level - 1][((size_t)(nodeZ * 2 + (i >> 1)) * nodes * 2 + nodeX * 2 + (i & 1)) * 2];
+						low = std::min(low, child[0]);
+						high = std::max(high, child[1]);
+					}
+					bounds[level][((size_t)nodeZ * nodes + nodeX) * 2] = low;
+					bounds[level][((size_t)nodeZ * nodes + nodeX) * 2 + 1] = high;
+				}
+			});
+		}
+
+		// Bounds and the index sit before the tiles but are only complete once every tile has been through
+		for (unsigned int level = 0; ok && level < header.boundsLevels; level++) {
+			ok = writeAt(file, header.boundsOffset[level], bounds[level].data(), bounds[level].size() * sizeof(uint16_t));
+		}
+		for (unsigned int level = 0; ok && level < header.tileLevels; level++) {
+			ok = writeAt(file, header.tileIndexOffset[level], indices[level].data(), indices[level].size() * sizeof(HeightmapTile));
+		}
+		ok = ok && writeAt(file, 0, &header, sizeof(header));
+		ok = (fclose(file) == 0) && ok;
+
+		if (!ok) {
+			remove(tempPath.c_str());
+			return false;
+		}
+
+		remove(cachePath.c_str());
+		if (rename(tempPath.c_str(), cachePath.c_str()) != 0) {
+			remove(tempPath.c_str());
+			return false;
+		}
+		return true;
+	}
+
+	// Smooth rolling hills with some finer detail, so every tile has a spread of heights
+	void makeBenchmarkHeights(unsigned int size, uint16_t* samples)
+	{
+		ThreadPool::instance().parallelFor(size, [size, samples](unsigned int z) {
+			const float v = z * 12.0f / size;
+			for (unsigned int x = 0; x < size; x++) {
+				const float u = x * 12.0f / size;
+				float h = 0.5f + 0.2f * sinf(u) * cosf(v * 1.3f) + 0.1f * sinf(u * 4.1f + v * 2.7f) + 0.05f * sinf(u * 17.0f + v * 13.0f);
+
+				// A few bits of noise, as scanned or eroded heights have, so the codec is not flattered
+				uint32_t hash = (x * 0x9e3779b1u) ^ (z * 0x85ebca6bu);
+				hash = (hash ^ (hash >> 15)) * 0x2c1b3c6du;
+				int noise = (int)((hash ^ (hash >> 12)) & 63) - 32;
+				int sample = (int)(std::min(std::max(h, 0.0f), 1.0f) * 65535.0f) + noise;
+				samples[(size_t)z * size + x] = (uint16_t)std::min(std::max(sample, 0), 65535);
+			}
+		});
+	}
+
+	// Time both ways of building a tiled file from 16 bit samples, then how well its tiles compressed and
+	// how fast they decode, on one thread and across the pool
+	bool benchmarkSource(const char* name, const uint16_t* samples, unsigned int width, unsigned int height,
+		const std::string& cachePath)
+	{
+		// Untimed run so the output file's pages are already allocated for both timed ones
+		const unsigned char* data = (const unsigned char*)samples;
+		bool ok = build(data, 2, width, height, 0, BENCHMARK_TILE_SIZE, BENCHMARK_PATCH_SIZE, cachePath, true);
+		Timer serialTimer;
+		ok = ok && build(data, 2, width, height, 0, BENCHMARK_TILE_SIZE, BENCHMARK_PATCH_SIZE, cachePath, false);
+		double serialMs = serialTimer.elapsedMs();
+		Timer parallelTimer;
+		ok = ok && build(data, 2, width, height, 0, BENCHMARK_TILE_SIZE, BENCHMARK_PATCH_SIZE, cachePath, true);
+		double parallelMs = parallelTimer.elapsedMs();
+
+		MappedFile file;
+		TiledHeightmap heightmap;
+		ok = ok && heightmapFile::open(cachePath, file, heightmap);
+		if (!ok) {
+			remove(cachePath.c_str());
+			printf("  %s: failed to write %s\n", name, cachePath.c_str());
+			return false;
+		}
+
+		std::vector<const HeightmapTile*> tiles;
+		unsigned long long encodedBytes = 0;
+		for (unsigned int level = 0; level < heightmap.tileLevels; level++) {
+			for (unsigned int i = 0; i < heightmap.tilesX[level] * heightmap.tilesZ[level]; i++) {
+				tiles.push_back(&heightmap.tiles[level][i]);
+				encodedBytes += heightmap.tiles[level][i].size;
+			}
+		}
+		const unsigned int tileWidth = heightmapFile::getTileWidth(heightmap.tileSize);
+		const size_t tileSamples = (size_t)tileWidth * tileWidth;
+		const unsigned long long tileBytes = (unsigned long long)tiles.size() * tileSamples * sizeof(uint16_t);
+
+		// The untimed pass faults the mapping in, so both timed ones decode from memory
+		std::vector<uint16_t> decoded(tiles.size() * tileSamples);
+		ThreadPool& pool = ThreadPool::instance();
+		pool.parallelFor((unsigned int)tiles.size(), [&](unsigned int i) {
+			heightmapFile::decodeTile(heightmap, *tiles[i], &decoded[i * tileSamples]);
+		});
+		Timer serialDecodeTimer;
+		for (size_t i = 0; i < tiles.size(); i++) {
+			ok = heightmapFile::decodeTile(heightmap, *tiles[i], &decoded[i * tileSamples]) && ok;
+		}
+		double serialDecodeMs = serialDecodeTimer.elapsedMs();
+		std::atomic<bool> decodedAll(true);
+		Timer parallelDecodeTimer;
+		pool.parallelFor((unsigned int)tiles.size(), [&](unsigned int i) {
+			if (!heightmapFile::decodeTile(heightmap, *tiles[i], &decoded[i * tileSamples])) {
+				decodedAll = false;
+			}
+		});
+		double parallelDecodeMs = parallelDecodeTimer.elapsedMs();
+		const size_t fileSize = file.size();
+		file.close();
+		remove(cachePath.c_str());
+
+		const double megasamples = (double)width * height / 1.0e6;
+		const double decodedMegasamples = (double)tiles.size() * tileSamples / 1.0e6;
+		printf("  %s %ux%u: build %.1f ms scalar on 1 thread, %.1f ms SIMD on %u threads (%.1fx), %.0f Msamples/s\n",
+			name, width, height, serialMs, parallelMs, pool.getThreadCount() + 1,
+			parallelMs > 0.0 ? serialMs / parallelMs : 1.0, parallelMs > 0.0 ? megasamples * 1000.0 / parallelMs : 0.0);
+		printf("    tiles %.2f MB -> %.2f MB (%.2f:1, %.2f bits a sample), file %.2f MB for a %.2f MB source\n",
+			tileBytes / 1048576.0, encodedBytes / 1048576.0, encodedBytes > 0 ? (double)tileBytes / encodedBytes : 0.0,
+			encodedBytes * 8.0 / (tiles.size() * tileSamples), fileSize / 1048576.0, width * height * 2 / 1048576.0);
+		printf("    decode %.0f Msamples/s on 1 thread, %.0f Msamples/s on %u threads%s\n",
+			serialDecodeMs > 0.0 ? decodedMegasamples * 1000.0 / serialDecodeMs : 0.0,
+			parallelDecodeMs > 0.0 ? decodedMegasamples * 1000.0 / parallelDecodeMs : 0.0, pool.getThreadCount() + 1,
+			ok && decodedAll ? "" : ", FAILED");
+		return true;
+	}
+}
+
+namespace heightmapFile
+{
+	std::string getCachePath(const char* sourcePath)
+	{
+		std::string path(sourcePath);
+		size_t dot = path.find_last_of('.');
+		size_t slash = path.find_last_of("/\\");
+		if (dot != std::string::npos && (slash == std::string::npos || dot > slash)) {
+			path.erase(dot);
+		}
+		return path + ".cgheight";
+	}
+
+	bool convert(const std::string& sourcePath, unsigned int bytesPerSample, unsigned int width, unsigned int height,
+		unsigned int tileSize, unsigned int patchSize, const std::string& cachePath, bool parallel)
+	{
+		MappedFile source;
+		if (!source.open(sourcePath.c_str()) || source.size() != (size_t)bytesPerSample * width * height) {
+			return false;
+		}
+		return build(source.data(), bytesPerSample, width, height, contentHash(source.data(), source.size()),
+			tileSize, patchSize, cachePath, parallel);
+	}
+
+	bool convertSamples(const uint16_t* samples, unsigned int width, unsigned int height, unsigned long long sourceHash,
+		unsigned int tileSize, unsigned int patchSize, const std::string& cachePath, bool parallel)
+	{
+		return build((const unsigned char*)samples, sizeof(uint16_t), width, height, sourceHash, tileSize, patchSize,
+			cachePath, parallel);
+	}
+
+	void benchmarkConvert(const std::string& sourcePath, unsigned int width, unsigned int height)
+	{
+		const unsigned int sizes[] = { 257, 513, 1025, 2049, 4097, 8193 };
+		const std::string cachePath = getCachePath(sourcePath.c_str()) + ".benchmark";
+		printf("Terrain build into %u quad tiles, SIMD %s:\n", BENCHMARK_TILE_SIZE,
+#ifdef HEIGHTMAP_SSE2
+			"on"
+#else
+			"unavailable"
+#endif
+			);
+
+		std::vector<uint16_t> samples;
+		MappedFile source;
+		if (source.open(sourcePath.c_str()) && source.size() == (size_t)width * height * sizeof(uint16_t)) {
+			samples.resize((size_t)width * height);
+			decodeRow(source.data(), 2, (unsigned int)samples.size(), true, samples.data());
+			source.close();
+			if (!benchmarkSource("bundled", samples.data(), width, height, cachePath)) {
+				return;
+			}
+		}
+
+		for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+			const unsigned int size = sizes[s];
+			samples.resize((size_t)size * size);
+			makeBenchmarkHeights(size, samples.data());
+			if (!benchmarkSource("generated", samples.data(), size, size, cachePath)) {
+				return;
+			}
+		}
+	}
+
+	bool decodeTile(const TiledHeightmap& heightmap, const HeightmapTile& tile, uint16_t* samples)
+	{
+		const unsigned int tileWidth = getTileWidth(heightmap.tileSize);
+		return heightmapCodec::decode(heightmap.data + tile.offset, tile.size, tileWidth, tileWidth,
+			tile.minHeight, tile.maxHeight, samples);
+	}
+
+	bool open(const std::string& path, MappedFile& file, TiledHeightmap& heightmap)
+	{
+		if (!file.open(path.c_str())) {
+			return false;
+		}
+
+		if (file.size() < sizeof(HeightmapFileHeader)) {
+			file.close();
+			return false;
+		}
+
+		HeightmapFileHeader header;
+		memcpy(&header, file.data(), sizeof(header));
+
+		bool valid = memcmp(header.magic, HEIGHTMAP_FILE_MAGIC, sizeof(header.magic)) == 0
+			&& header.version == HEIGHTMAP_FILE_VERSION
+			&& header.width >= 2 && header.height >= 2 && header.tileSize > 0 && header.patchSize > 0
+			&& header.tileLevels >= 1 && header.tileLevels <= MAX_HEIGHTMAP_LEVELS
+			&& header.boundsLevels >= 1 && header.boundsLevels <= MAX_HEIGHTMAP_LEVELS;
+		for (uint32_t level = 0; valid && level < header.boundsLevels; level++) {
+			valid = header.boundsOffset[level] >= sizeof(header)
+				&& header.boundsOffset[level] + (uint64_t)header.boundsNodes[level] * header.boundsNodes[level] * 2 * sizeof(uint16_t) <= file.size();
+		}
+		const uint64_t maxTileSize = heightmapCodec::getMaxEncodedSize((size_t)getTileWidth(header.tileSize) * getTileWidth(header.tileSize));
+		for (uint32_t level = 0; valid && level < header.tileLevels; level++) {
+			const uint64_t count = (uint64_t)header.tilesX[level] * header.tilesZ[level];
+			valid = count > 0 && header.tileIndexOffset[level] >= sizeof(header)
+				&& header.tileIndexOffset[level] + count * sizeof(HeightmapTile) <= file.size();
+			const HeightmapTile* tiles = valid ? (const HeightmapTile*)(file.data() + header.tileIndexOffset[level]) : NULL;
+			for (uint64_t i = 0; valid && i < count; i++) {
+				valid = tiles[i].size <= maxTileSize && tiles[i].minHeight <= tiles[i].maxHeight
+					&& tiles[i].offset >= sizeof(header) && tiles[i].offset + tiles[i].size <= file.size();
+			}
+		}
+		if (!valid) {
+			file.close();
+			return false;
+		}
+
+		heightmap = TiledHeightmap();
+		heightmap.width = header.width;
+		heightmap.height = header.height;
+		heightmap.sourceSize = header.sourceSize;
+		heightmap.sourceHash = header.sourceHash;
+		heightmap.tileSize = header.tileSize;
+		heightmap.tileLevels = header.tileLevels;
+		for (uint32_t level = 0; level < header.tileLevels; level++) {
+			heightmap.tilesX[level] = header.tilesX[level];
+			heightmap.tilesZ[level] = header.tilesZ[level];
+			heightmap.tiles[level] = (const HeightmapTile*)(file.data() + header.tileIndexOffset[level]);
+		}
+		heightmap.patchSize = header.patchSize;
+		heightmap.boundsLevels = header.boundsLevels;
+		for (uint32_t level = 0; level < header.boundsLevels; level++) {
+			heightmap.boundsNodes[level] = header.boundsNodes[level];
+			heightmap.bounds[level] = (const uint16_t*)(file.data() + header.boundsOffset[level]);
+		}
+		heightmap.data = file.data();
+		return true;
+	}
+}
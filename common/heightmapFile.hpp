@@ -0,0 +1,72 @@
+#pragma once
+#include <cstdint>
+#include <string>
+
+#include "mappedFile.hpp"
+
+const unsigned int MAX_HEIGHTMAP_LEVELS = 16;
+
+// Entry of the tile index, with the range of the heights inside the tile
+struct HeightmapTile
+{
+	uint64_t offset;
+	uint32_t size;
+	uint16_t minHeight;
+	uint16_t maxHeight;
+};
+
+// Heightmap cut into square tiles, pointing into a mapped .cgheight file. Heights are normalised to
+// 16 bits and each tile is compressed with heightmapCodec, within the range in its index entry. Level 0
+// holds every sample and each level above keeps every other sample of the one below, up to a level a
+// single tile covers. A tile has tileSize + 1 samples along each side plus one more past every edge, so
+// normals can be taken across tile boundaries; samples past the map repeat its edge.
+// The file also holds the lowest and highest sample under every node of a quadtree of patchSize leaves
+struct TiledHeightmap
+{
+	unsigned int width;
+	unsigned int height;
+	unsigned long long sourceSize;
+	unsigned long long sourceHash;
+
+	unsigned int tileSize;
+	unsigned int tileLevels;
+	unsigned int tilesX[MAX_HEIGHTMAP_LEVELS];
+	unsigned int tilesZ[MAX_HEIGHTMAP_LEVELS];
+	const HeightmapTile* tiles[MAX_HEIGHTMAP_LEVELS];	// row by row
+
+	unsigned int patchSize;
+	unsigned int boundsLevels;							// leaves first
+	unsigned int boundsNodes[MAX_HEIGHTMAP_LEVELS];		// nodes along each side
+	const uint16_t* bounds[MAX_HEIGHTMAP_LEVELS];		// min then max of each node row by row, min above max when empty
+
+	const unsigned char* data;
+};
+
+// Tiled copy of a raw heightmap stored next to it, e.g. terrain.raw -> terrain.cgheight
+namespace heightmapFile
+{
+	std::string getCachePath(const char* sourcePath);
+
+	// Samples along each side of a tile, with the extra sample past each edge
+	inline unsigned int getTileWidth(unsigned int tileSize) { return tileSize + 3; }
+
+	// Build the tiled file from a raw heightmap of 8, 16 or 32 bits per sample. Reads the source
+	// through a mapping and writes one row of tiles at a time, so neither has to fit in memory.
+	// Parallel spreads the work over the thread pool and decodes with SIMD, off is the reference path
+	bool convert(const std::string& sourcePath, unsigned int bytesPerSample, unsigned int width, unsigned int height,
+		unsigned int tileSize, unsigned int patchSize, const std::string& cachePath, bool parallel = true);
+
+	// As above from 16 bit samples in memory, row by row, with sourceHash standing for where they came from
+	bool convertSamples(const uint16_t* samples, unsigned int width, unsigned int height, unsigned long long sourceHash,
+		unsigned int tileSize, unsigned int patchSize, const std::string& cachePath, bool parallel = true);
+
+	// Time the build of a 16 bit raw heightmap and of generated ones from 257x257 to 8193x8193, both
+	// ways, then report how well the tiles compressed and how fast they decode. Writes next to sourcePath
+	void benchmarkConvert(const std::string& sourcePath, unsigned int width, unsigned int height);
+
+	// Map a tiled file, fails if it is missing, corrupt or from another format version
+	bool open(const std::string& path, MappedFile& file, TiledHeightmap& heightmap);
+
+	// Expand a tile into getTileWidth squared samples, false if it is corrupt
+	bool decodeTile(const TiledHeightmap& heightmap, const HeightmapTile& tile, uint16_t* samples);
+}
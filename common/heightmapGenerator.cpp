@@ -0,0 +1,608 @@
+#include "heightmapGenerator.hpp"
+#include "contentHash.hpp"
+#include "heightmapFile.hpp"
+#include "threadPool.hpp"
+#include "timer.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+
+#if defined(__AVX2__)
+#define GENERATOR_AVX2
+#include <immintrin.h>
+#endif
+
+namespace
+{
+	// Bump whenever the samples the same settings give change, so tiled copies of older ones are rebuilt
+	const uint32_t GENERATOR_VERSION = 1;
+
+	// Samples along the side of a tile filled as one thread pool item
+	const unsigned int FILL_TILE_SIZE = 256;
+
+	// Rows per thread pool item of an erosion pass
+	const unsigned int ROWS_PER_JOB = 16;
+
+	// From the square grid to the simplex grid and back, (sqrt(3) - 1) / 2 and (3 - sqrt(3)) / 6
+	const float SKEW = 0.366025403784f;
+	const float UNSKEW = 0.211324865405f;
+
+	// Brings the sum of a point's three corners to within -1 and 1 for unit gradients
+	const float SIMPLEX_SCALE = 99.2f;
+
+	// Eight unit gradients 45 degrees apart, picked by the top bits of a corner's hash, the best mixed
+	const float DIAGONAL = 0.707106781f;
+	const float GRADIENT_X[8] = { 1.0f, -1.0f, 0.0f, 0.0f, DIAGONAL, -DIAGONAL, DIAGONAL, -DIAGONAL };
+	const float GRADIENT_Y[8] = { 0.0f, 0.0f, 1.0f, -1.0f, DIAGONAL, DIAGONAL, -DIAGONAL, -DIAGONAL };
+
+	// Seeds of each octave, and of the two fields NOISE_WARPED pushes points by, apart from the map's
+	const uint32_t OCTAVE_SEED_STEP = 0x9e3779b9u;
+	const uint32_t WARP_SEED_X = 0x68bc21ebu;
+	const uint32_t WARP_SEED_Z = 0x02e5be93u;
+	const float WARP_OFFSET = 5.2f;
+
+	// Thermal erosion moves this much of the slope past the talus between two neighbours each pass. Each
+	// sample has four, so it stays well under the quarter that would overshoot
+	const float THERMAL_RATE = 0.1f;
+
+	// Hydraulic erosion: water flows by this much of the difference in level, takes up to this much
+	// sediment per unit of water moving, and takes up, drops and loses to the air these fractions each step
+	const float WATER_FLOW = 0.2f;
+	const float SEDIMENT_CAPACITY = 4.0f;
+	const float EROSION_RATE = 0.3f;
+	const float DEPOSITION_RATE = 0.3f;
+	const float EVAPORATION = 0.02f;
+
+	// Sizes benchmark times the noise at, then generates and tiles end to end
+	const unsigned int BENCHMARK_SIZE = 1025;
+	const unsigned int BENCHMARK_PIPELINE_SIZE = 4097;
+	const unsigned int BENCHMARK_EROSION_STEPS = 8;
+
+	// Layout the pipeline is tiled into, the one the terrain uses
+	const unsigned int BENCHMARK_TILE_SIZE = 256;
+	const unsigned int BENCHMARK_PATCH_SIZE = 32;
+
+	// Octave loop constants shared by every sample of a map
+	struct Octaves
+	{
+		unsigned int count;
+		float lacunarity;
+		float gain;
+		float normalize;		// one over the sum of the amplitudes
+	};
+
+	Octaves getOctaves(const HeightmapGeneratorSettings& settings)
+	{
+		Octaves octaves;
+		octaves.count = std::max(settings.octaves, 1u);
+		octaves.lacunarity = settings.lacunarity;
+		octaves.gain = settings.gain;
+		float amplitude = 1.0f, sum = 0.0f;
+		for (unsigned int i = 0; i < octaves.count; i++) {
+			sum += amplitude;
+			amplitude *= settings.gain;
+		}
+		octaves.normalize = sum > 0.0f ? 1.0f / sum : 1.0f;
+		return octaves;
+	}
+
+	void forEach(unsigned int count, bool parallel, const std::function<void(unsigned int)>& body)
+	{
+		if (parallel) {
+			ThreadPool::instance().parallelFor(count, body);
+			return;
+		}
+		for (unsigned int i = 0; i < count; i++) {
+			body(i);
+		}
+	}
+
+	inline uint32_t hashCorner(int32_t i, int32_t j, uint32_t seed)
+	{
+		uint32_t hash = ((uint32_t)i * 0x8da6b343u) ^ ((uint32_t)j * 0xd8163841u) ^ seed;
+		hash ^= hash >> 15;
+		hash *= 0x2c1b3c6du;
+		hash ^= hash >> 12;
+		return hash;
+	}
+
+	inline float getCorner(float x, float y, uint32_t hash)
+	{
+		float t = std::max(0.5f - x * x - y * y, 0.0f);
+		t *= t;
+		const uint32_t gradient = hash >> 29;
+		return t * t * (GRADIENT_X[gradient] * x + GRADIENT_Y[gradient] * y);
+	}
+
+	// 2D simplex noise, within -1 and 1
+	float simplex(float x, float y, uint32_t seed)
+	{
+		const float skew = (x + y) * SKEW;
+		const float i = floorf(x + skew);
+		const float j = floorf(y + skew);
+		const float unskew = (i + j) * UNSKEW;
+		const float x0 = x - (i - unskew);
+		const float y0 = y - (j - unskew);
+
+		// The middle corner is across x or across y, whichever the point is nearer
+		const float i1 = x0 > y0 ? 1.0f : 0.0f;
+		const float j1 = 1.0f - i1;
+		const float x1 = x0 - i1 + UNSKEW;
+		const float y1 = y0 - j1 + UNSKEW;
+		const float x2 = x0 - 1.0f + 2.0f * UNSKEW;
+		const float y2 = y0 - 1.0f + 2.0f * UNSKEW;
+		const int32_t cellX = (int32_t)i;
+		const int32_t cellY = (int32_t)j;
+		return SIMPLEX_SCALE * (getCorner(x0, y0, hashCorner(cellX, cellY, seed))
+			+ getCorner(x1, y1, hashCorner(cellX + (int32_t)i1, cellY + (int32_t)j1, seed))
+			+ getCorner(x2, y2, hashCorner(cellX + 1, cellY + 1, seed)));
+	}
+
+	float fbm(float x, float y, const Octaves& octaves, uint32_t seed)
+	{
+		float sum = 0.0f, amplitude = 1.0f;
+		for (unsigned int i = 0; i < octaves.count; i++) {
+			sum += amplitude * simplex(x, y, seed + i * OCTAVE_SEED_STEP);
+			x *= octaves.lacunarity;
+			y *= octaves.lacunarity;
+			amplitude *= octaves.gain;
+		}
+		return sum * octaves.normalize;
+	}
+
+	// Within 0 and 1, each octave's ridges only showing where the octave before was high
+	float ridged(float x, float y, const Octaves& octaves, uint32_t seed)
+	{
+		float sum = 0.0f, amplitude = 1.0f, weight = 1.0f;
+		for (unsigned int i = 0; i < octaves.count; i++) {
+			float ridge = 1.0f - fabsf(simplex(x, y, seed + i * OCTAVE_SEED_STEP));
+			ridge *= ridge * weight;
+			weight = std::min(std::max(ridge * 2.0f, 0.0f), 1.0f);
+			sum += amplitude * ridge;
+			x *= octaves.lacunarity;
+			y *= octaves.lacunarity;
+			amplitude *= octaves.gain;
+		}
+		return sum * octaves.normalize;
+	}
+
+	// Height at (x, y) in featureSizes, within 0 and 1
+	float getHeight(float x, float y, const HeightmapGeneratorSettings& settings, const Octaves& octaves)
+	{
+		float height;
+		switch (settings.noise) {
+		case NOISE_RIDGED:
+			height = ridged(x, y, octaves, settings.seed);
+			break;
+		case NOISE_WARPED: {
+			const float pushX = fbm(x, y, octaves, settings.seed ^ WARP_SEED_X);
+			const float pushY = fbm(x + WARP_OFFSET, y + WARP_OFFSET, octaves, settings.seed ^ WARP_SEED_Z);
+			height = 0.5f + 0.5f * fbm(x + settings.warp * pushX, y + settings.warp * pushY, octaves, settings.seed);
+			break;
+		}
+		default:
+			height = 0.5f + 0.5f * fbm(x, y, octaves, settings.seed);
+			break;
+		}
+		return std::min(std::max(height, 0.0f), 1.0f);
+	}
+
+#ifdef GENERATOR_AVX2
+	// The scalar functions above 8 points at a time, one per lane
+
+	inline __m256i hashCorners(__m256i i, __m256i j, __m256i seed)
+	{
+		__m256i hash = _mm256_xor_si256(_mm256_xor_si256(_mm256_mullo_epi32(i, _mm256_set1_epi32((int)0x8da6b343u)),
+			_mm256_mullo_epi32(j, _mm256_set1_epi32((int)0xd8163841u))), seed);
+		hash = _mm256_xor_si256(hash, _mm256_srli_epi32(hash, 15));
+		hash = _mm256_mullo_epi32(hash, _mm256_set1_epi32(0x2c1b3c6d));
+		return _mm256_xor_si256(hash, _mm256_srli_epi32(hash, 12));
+	}
+
+	inline __m256 getCorners(__m256 x, __m256 y, __m256i hash)
+	{
+		const __m256i index = _mm256_srli_epi32(hash, 29);
+		const __m256 gradientX = _mm256_permutevar8x32_ps(_mm256_loadu_ps(GRADIENT_X), index);
+		const __m256 gradientY = _mm256_permutevar8x32_ps(_mm256_loadu_ps(GRADIENT_Y), index);
+		__m256 t = _mm256_sub_ps(_mm256_sub_ps(_mm256_set1_ps(0.5f), _mm256_mul_ps(x, x)), _mm256_mul_ps(y, y));
+		t = _mm256_max_ps(t, _mm256_setzero_ps());
+		t = _mm256_mul_ps(t, t);
+		return _mm256_mul_ps(_mm256_mul_ps(t, t), _mm256_add_ps(_mm256_mul_ps(gradientX, x), _mm256_mul_ps(gradientY, y)));
+	}
+
+	__m256 simplex8(__m256 x, __m256 y, uint32_t seed)
+	{
+		const __m256 skew = _mm256_mul_ps(_mm256_add_ps(x, y), _mm256_set1_ps(SKEW));
+		const __m256 i = _mm256_floor_ps(_mm256_add_ps(x, skew));
+		const __m256 j = _mm256_floor_ps(_mm256_add_ps(y, skew));
+		const __m256 unskew = _mm256_mul_ps(_mm256_add_ps(i, j), _mm256_set1_ps(UNSKEW));
+		const __m256 x0 = _mm256_sub_ps(x, _mm256_sub_ps(i, unskew));
+		const __m256 y0 = _mm256_sub_ps(y, _mm256_sub_ps(j, unskew));
+
+		const __m256 one = _mm256_set1_ps(1.0f);
+		const __m256 i1 = _mm256_and_ps(_mm256_cmp_ps(x0, y0, _CMP_GT_OQ), one);
+		const __m256 j1 = _mm256_sub_ps(one, i1);
+		const __m256 unskew1 = _mm256_set1_ps(UNSKEW);
+		const __m256 unskew2 = _mm256_set1_ps(2.0f * UNSKEW);
+		const __m256 x1 = _mm256_add_ps(_mm256_sub_ps(x0, i1), unskew1);
+		const __m256 y1 = _mm256_add_ps(_mm256_sub_ps(y0, j1), unskew1);
+		const __m256 x2 = _mm256_add_ps(_mm256_sub_ps(x0, one), unskew2);
+		const __m256 y2 = _mm256_add_ps(_mm256_sub_ps(y0, one), unskew2);
+		const __m256i cellX = _mm256_cvttps_epi32(i);
+		const __m256i cellY = _mm256_cvttps_epi32(j);
+		const __m256i seeds = _mm256_set1_epi32((int)seed);
+		const __m256i step = _mm256_set1_epi32(1);
+		__m256 sum = getCorners(x0, y0, hashCorners(cellX, cellY, seeds));
+		sum = _mm256_add_ps(sum, getCorners(x1, y1, hashCorners(_mm256_add_epi32(cellX, _mm256_cvttps_epi32(i1)),
+			_mm256_add_epi32(cellY, _mm256_cvttps_epi32(j1)), seeds)));
+		sum = _mm256_add_ps(sum, getCorners(x2, y2, hashCorners(_mm256_add_epi32(cellX, step), _mm256_add_epi32(cellY, step), seeds)));
+		return _mm256_mul_ps(sum, _mm256_set1_ps(SIMPLEX_SCALE));
+	}
+
+	__m256 fbm8(__m256 x, __m256 y, const Octaves& octaves, uint32_t seed)
+	{
+		const __m256 lacunarity = _mm256_set1_ps(octaves.lacunarity);
+		__m256 sum = _mm256_setzero_ps();
+		float amplitude = 1.0f;
+		for (unsigned int i = 0; i < octaves.count; i++) {
+			sum = _mm256_add_ps(sum, _mm256_mul_ps(_mm256_set1_ps(amplitude), simplex8(x, y, seed + i * OCTAVE_SEED_STEP)));
+			x = _mm256_mul_ps(x, lacunarity);
+			y = _mm256_mul_ps(y, lacunarity);
+			amplitude *= octaves.gain;
+		}
+		return _mm256_mul_ps(sum, _mm256_set1_ps(octaves.normalize));
+	}
+
+	__m256 ridged8(__m256 x, __m256 y, const Octaves& octaves, uint32_t seed)
+	{
+		const __m256 lacunarity = _mm256_set1_ps(octaves.lacunarity);
+		const __m256 one = _mm256_set1_ps(1.0f);
+		const __m256 signBit = _mm256_set1_ps(-0.0f);
+		__m256 sum = _mm256_setzero_ps();
+		__m256 weight = one;
+		float amplitude = 1.0f;
+		for (unsigned int i = 0; i < octaves.count; i++) {
+			__m256 ridge = _mm256_sub_ps(one, _mm256_andnot_ps(signBit, simplex8(x, y, seed + i * OCTAVE_SEED_STEP)));
+			ridge = _mm256_mul_ps(ridge, _mm256_mul_ps(ridge, weight));
+			weight = _mm256_min_ps(_mm256_max_ps(_mm256_add_ps(ridge, ridge), _mm256_setzero_ps()), one);
+			sum = _mm256_add_ps(sum, _mm256_mul_ps(_mm256_set1_ps(amplitude), ridge));
+			x = _mm256_mul_ps(x, lacunarity);
+			y = _mm256_mul_ps(y, lacunarity);
+			amplitude *= octaves.gain;
+		}
+		return _mm256_mul_ps(sum, _mm256_set1_ps(octaves.normalize));
+	}
+
+	__m256 getHeights8(__m256 x, __m256 y, const HeightmapGeneratorSettings& settings, const Octaves& octaves)
+	{
+		const __m256 half = _mm256_set1_ps(0.5f);
+		__m256 height;
+		switch (settings.noise) {
+		case NOISE_RIDGED:
+			height = ridged8(x, y, octaves, settings.seed);
+			break;
+		case NOISE_WARPED: {
+			const __m256 offset = _mm256_set1_ps(WARP_OFFSET);
+			const __m256 warp = _mm256_set1_ps(settings.warp);
+			const __m256 pushX = fbm8(x, y, octaves, settings.seed ^ WARP_SEED_X);
+			const __m256 pushY = fbm8(_mm256_add_ps(x, offset), _mm256_add_ps(y, offset), octaves, settings.seed ^ WARP_SEED_Z);
+			height = fbm8(_mm256_add_ps(x, _mm256_mul_ps(warp, pushX)), _mm256_add_ps(y, _mm256_mul_ps(warp, pushY)), octaves, settings.seed);
+			height = _mm256_add_ps(half, _mm256_mul_ps(half, height));
+			break;
+		}
+		default:
+			height = _mm256_add_ps(half, _mm256_mul_ps(half, fbm8(x, y, octaves, settings.seed)));
+			break;
+		}
+		return _mm256_min_ps(_mm256_max_ps(height, _mm256_setzero_ps()), _mm256_set1_ps(1.0f));
+	}
+#endif
+
+	// Heights of one row of a tile, within 0 and 1
+	void fillRow(const HeightmapGeneratorSettings& settings, const Octaves& octaves, unsigned int x0, unsigned int count,
+		unsigned int z, bool simd, float* heights)
+	{
+		const float scale = 1.0f / std::max(settings.featureSize, 1.0f);
+		const float y = z * scale;
+		unsigned int i = 0;
+#ifdef GENERATOR_AVX2
+		if (simd) {
+			// The last few samples of a row as well, through a spare group of lanes
+			const __m256 lanes = _mm256_setr_ps(0.0f, 1.0f, 2.0f, 3.0f, 4.0f, 5.0f, 6.0f, 7.0f);
+			const __m256 ys = _mm256_set1_ps(y);
+			for (; i < count; i += 8) {
+				const __m256 xs = _mm256_mul_ps(_mm256_add_ps(_mm256_set1_ps((float)(x0 + i)), lanes), _mm256_set1_ps(scale));
+				const __m256 group = getHeights8(xs, ys, settings, octaves);
+				if (i + 8 <= count) {
+					_mm256_storeu_ps(heights + i, group);
+				}
+				else {
+					float spare[8];
+					_mm256_storeu_ps(spare, group);
+					std::copy(spare, spare + (count - i), heights + i);
+				}
+			}
+			return;
+		}
+#else
+		(void)simd;
+#endif
+		for (; i < count; i++) {
+			heights[i] = getHeight((x0 + i) * scale, y, settings, octaves);
+		}
+	}
+
+	inline uint16_t toSample(float height)
+	{
+		return (uint16_t)std::min(std::max(height * 65535.0f + 0.5f, 0.0f), 65535.0f);
+	}
+
+	// Noise over the whole map, into heights when erosion follows and straight into samples otherwise
+	void fillTiles(const HeightmapGeneratorSettings& settings, bool parallel, bool simd, float* heights, uint16_t* samples)
+	{
+		const Octaves octaves = getOctaves(settings);
+		const unsigned int tilesX = (settings.width + FILL_TILE_SIZE - 1) / FILL_TILE_SIZE;
+		const unsigned int tilesZ = (settings.height + FILL_TILE_SIZE - 1) / FILL_TILE_SIZE;
+		forEach(tilesX * tilesZ, parallel, [&](unsigned int tile) {
+			const unsigned int x0 = (tile % tilesX) * FILL_TILE_SIZE;
+			const unsigned int z0 = (tile / tilesX) * FILL_TILE_SIZE;
+			const unsigned int count = std::min(FILL_TILE_SIZE, settings.width - x0);
+			const unsigned int endZ = std::min(z0 + FILL_TILE_SIZE, settings.height);
+			float row[FILL_TILE_SIZE];
+			for (unsigned int z = z0; z < endZ; z++) {
+				const size_t first = (size_t)z * settings.width + x0;
+				if (heights) {
+					fillRow(settings, octaves, x0, count, z, simd, heights + first);
+					continue;
+				}
+				fillRow(settings, octaves, x0, count, z, simd, row);
+				for (unsigned int i = 0; i < count; i++) {
+					samples[first + i] = toSample(row[i]);
+				}
+			}
+		});
+	}
+
+	// Material one sample moves towards a neighbour difference above it, none within talus either way
+	inline float slide(float difference, float talus)
+	{
+		return std::max(difference - talus, 0.0f) + std::min(difference + talus, 0.0f);
+	}
+
+	// Material slides from each sample to any neighbour more than talus below it. Every pair of neighbours
+	// trades the same amount each way, so a pass only reads the last one and rows can go in any order
+	void erodeThermal(std::vector<float>& heights, unsigned int width, unsigned int height, unsigned int passes,
+		float talus, bool parallel)
+	{
+		std::vector<float> next(heights.size());
+		for (unsigned int pass = 0; pass < passes; pass++) {
+			const float* from = &heights[0];
+			float* to = &next[0];
+			forEach((height + ROWS_PER_JOB - 1) / ROWS_PER_JOB, parallel, [=](unsigned int job) {
+				const unsigned int endZ = std::min((job + 1) * ROWS_PER_JOB, height);
+				for (unsigned int z = job * ROWS_PER_JOB; z < endZ; z++) {
+					// Past the map's edge a sample is its own neighbour, which trades nothing
+					const float* row = from + (size_t)z * width;
+					const float* above = z > 0 ? row - width : row;
+					const float* below = z + 1 < height ? row + width : row;
+					float* out = to + (size_t)z * width;
+					out[0] = row[0] + THERMAL_RATE * (slide(row[1] - row[0], talus)
+						+ slide(above[0] - row[0], talus) + slide(below[0] - row[0], talus));
+					const unsigned int last = width - 1;
+					out[last] = row[last] + THERMAL_RATE * (slide(row[last - 1] - row[last], talus)
+						+ slide(above[last] - row[last], talus) + slide(below[last] - row[last], talus));
+
+					// The rest without a branch, so the compiler can take it a vector at a time
+					for (unsigned int x = 1; x < last; x++) {
+						const float center = row[x];
+						out[x] = center + THERMAL_RATE * (slide(row[x - 1] - center, talus) + slide(row[x + 1] - center, talus)
+							+ slide(above[x] - center, talus) + slide(below[x] - center, talus));
+					}
+				}
+			});
+			heights.swap(next);
+		}
+	}
+
+	// What one sample gives a neighbour each step: water by the difference in level, but no more than a
+	// quarter of either side's so neither goes below zero, and sediment at the concentration of the side
+	// the water leaves. Adds up what the sample gives and how much water passes through it
+	inline void exchange(float level, float water, float concentration, float otherLevel, float otherWater,
+		float otherConcentration, float& waterOut, float& sedimentOut, float& moving)
+	{
+		const float flow = std::min(std::max(WATER_FLOW * (level - otherLevel), -0.25f * otherWater), 0.25f * water);
+		waterOut += flow;
+		sedimentOut += flow * (flow > 0.0f ? concentration : otherConcentration);
+		moving += fabsf(flow);
+	}
+
+	// Rain falls on every sample each step and flows downhill to the neighbours, taking up ground where it
+	// moves fast enough to carry more sediment than it has and dropping it where it slows. As for thermal
+	// erosion every pair of neighbours trades water and sediment evenly, so a step only reads the last one
+	void erodeHydraulic(std::vector<float>& heights, unsigned int width, unsigned int height, unsigned int steps,
+		float rain, bool parallel)
+	{
+		const size_t count = heights.size();
+		std::vector<float> water(count, 0.0f), sediment(count, 0.0f), nextWater(count);
+		std::vector<float> levels(count), concentrations(count);
+		const unsigned int jobs = (height + ROWS_PER_JOB - 1) / ROWS_PER_JOB;
+		for (unsigned int step = 0; step < steps; step++) {
+			float* h = &heights[0];
+			float* w = &water[0];
+			float* s = &sediment[0];
+			float* level = &levels[0];
+			float* concentration = &concentrations[0];
+			float* outW = &nextWater[0];
+
+			// The rain, then what the neighbours need to see of each sample
+			forEach(jobs, parallel, [=](unsigned int job) {
+				const size_t first = (size_t)job * ROWS_PER_JOB * width;
+				const size_t end = std::min(first + (size_t)ROWS_PER_JOB * width, count);
+				for (size_t i = first; i < end; i++) {
+					w[i] += rain;
+					level[i] = h[i] + w[i];
+					concentration[i] = w[i] > 0.0f ? s[i] / w[i] : 0.0f;
+				}
+			});
+
+			// Each sample only writes its own ground and sediment, and reads its neighbours' through the above
+			forEach(jobs, parallel, [=](unsigned int job) {
+				const unsigned int endZ = std::min((job + 1) * ROWS_PER_JOB, height);
+				for (unsigned int z = job * ROWS_PER_JOB; z < endZ; z++) {
+					const size_t row = (size_t)z * width;
+					const size_t up = z > 0 ? row - width : row;
+					const size_t down = z + 1 < height ? row + width : row;
+					for (unsigned int x = 0; x < width; x++) {
+						const size_t i = row + x;
+						const size_t left = x > 0 ? i - 1 : i;
+						const size_t right = x + 1 < width ? i + 1 : i;
+						float waterOut = 0.0f, sedimentOut = 0.0f, moving = 0.0f;
+						exchange(level[i], w[i], concentration[i], level[left], w[left], concentration[left], waterOut, sedimentOut, moving);
+						exchange(level[i], w[i], concentration[i], level[right], w[right], concentration[right], waterOut, sedimentOut, moving);
+						exchange(level[i], w[i], concentration[i], level[up + x], w[up + x], concentration[up + x], waterOut, sedimentOut, moving);
+						exchange(level[i], w[i], concentration[i], level[down + x], w[down + x], concentration[down + x], waterOut, sedimentOut, moving);
+
+						// Past its capacity water drops some of what it carries, below it takes up more
+						const float excess = s[i] - sedimentOut - SEDIMENT_CAPACITY * moving;
+						const float settled = excess * (excess > 0.0f ? DEPOSITION_RATE : EROSION_RATE);
+						h[i] += settled;
+						s[i] = std::max(s[i] - sedimentOut - settled, 0.0f);
+						outW[i] = (w[i] - waterOut) * (1.0f - EVAPORATION);
+					}
+				}
+			});
+			water.swap(nextWater);
+		}
+
+		// What the water still carries settles where it is
+		for (size_t i = 0; i < count; i++) {
+			heights[i] += sediment[i];
+		}
+	}
+
+	void generateWith(const HeightmapGeneratorSettings& settings, bool parallel, bool simd, std::vector<uint16_t>& samples)
+	{
+		const size_t count = (size_t)settings.width * settings.height;
+		samples.resize(count);
+		if (count == 0) {
+			return;
+		}
+		if (settings.thermalPasses == 0 && settings.hydraulicSteps == 0) {
+			fillTiles(settings, parallel, simd, NULL, &samples[0]);
+			return;
+		}
+
+		std::vector<float> heights(count);
+		fillTiles(settings, parallel, simd, &heights[0], NULL);
+		erodeHydraulic(heights, settings.width, settings.height, settings.hydraulicSteps, settings.rain, parallel);
+		erodeThermal(heights, settings.width, settings.height, settings.thermalPasses, settings.talus, parallel);
+		forEach((settings.height + ROWS_PER_JOB - 1) / ROWS_PER_JOB, parallel, [&](unsigned int job) {
+			const size_t first = (size_t)job * ROWS_PER_JOB * settings.width;
+			const size_t end = std::min(first + (size_t)ROWS_PER_JOB * settings.width, count);
+			for (size_t i = first; i < end; i++) {
+				samples[i] = toSample(heights[i]);
+			}
+		});
+	}
+}
+
+namespace heightmapGenerator
+{
+	void generate(const HeightmapGeneratorSettings& settings, std::vector<uint16_t>& samples)
+	{
+		generateWith(settings, true, true, samples);
+	}
+
+	unsigned long long getSettingsHash(const HeightmapGeneratorSettings& settings)
+	{
+		// Field by field, so padding never counts
+		const uint32_t fields[] = {
+			GENERATOR_VERSION, settings.width, settings.height, settings.seed, (uint32_t)settings.noise, settings.octaves,
+			settings.thermalPasses, settings.hydraulicSteps
+		};
+		const float values[] = { settings.featureSize, settings.lacunarity, settings.gain, settings.warp, settings.talus, settings.rain };
+		return contentHash(values, sizeof(values), contentHash(fields, sizeof(fields)));
+	}
+
+	void benchmark()
+	{
+		ThreadPool& pool = ThreadPool::instance();
+		const unsigned int threads = pool.getThreadCount() + 1;
+#ifdef GENERATOR_AVX2
+		const char* path = "AVX2";
+#else
+		const char* path = "scalar, build with ENABLE_AVX2 for AVX2";
+#endif
+		printf("Heightmap generator at %ux%u, %s, ms per megasample:\n", BENCHMARK_SIZE, BENCHMARK_SIZE, path);
+		printf("  %-24s %12s %12s %12s %12s\n", "", "scalar 1", "SIMD 1", "SIMD pool", "difference");
+
+		HeightmapGeneratorSettings settings;
+		settings.width = BENCHMARK_SIZE;
+		settings.height = BENCHMARK_SIZE;
+		const double megasamples = (double)settings.width * settings.height / 1.0e6;
+		const char* names[HEIGHTMAP_NOISE_TYPES] = { "fBm, 8 octaves", "ridged, 8 octaves", "domain warped, 8 octaves" };
+		std::vector<uint16_t> scalar, simd;
+		for (int noise = 0; noise < HEIGHTMAP_NOISE_TYPES; noise++) {
+			settings.noise = (HeightmapNoise)noise;
+			Timer timer;
+			generateWith(settings, false, false, scalar);
+			const double scalarMs = timer.elapsedMs();
+			timer.reset();
+			generateWith(settings, false, true, simd);
+			const double simdMs = timer.elapsedMs();
+			timer.reset();
+			generateWith(settings, true, true, simd);
+			const double poolMs = timer.elapsedMs();
+
+			// The SIMD path may round differently, a sample or two of 65535 at most
+			int difference = 0;
+			for (size_t i = 0; i < scalar.size(); i++) {
+				difference = std::max(difference, abs((int)scalar[i] - (int)simd[i]));
+			}
+			printf("  %-24s %12.2f %12.2f %12.2f %12d\n", names[noise], scalarMs / megasamples, simdMs / megasamples,
+				poolMs / megasamples, difference);
+		}
+
+		// Erosion alone, a pass at a time over the same fBm heights
+		settings.noise = NOISE_FBM;
+		std::vector<float> noise((size_t)settings.width * settings.height);
+		fillTiles(settings, true, true, &noise[0], NULL);
+		for (int kind = 0; kind < 2; kind++) {
+			double passMs[2];
+			for (int parallel = 0; parallel < 2; parallel++) {
+				std::vector<float> heights(noise);
+				Timer timer;
+				if (kind == 0) {
+					erodeThermal(heights, settings.width, settings.height, BENCHMARK_EROSION_STEPS, settings.talus, parallel != 0);
+				}
+				else {
+					erodeHydraulic(heights, settings.width, settings.height, BENCHMARK_EROSION_STEPS, settings.rain, parallel != 0);
+				}
+				passMs[parallel] = timer.elapsedMs();
+			}
+			printf("  %-24s %12s %12.2f %12.2f    a pass\n", kind == 0 ? "thermal erosion" : "hydraulic erosion", "",
+				passMs[0] / BENCHMARK_EROSION_STEPS / megasamples, passMs[1] / BENCHMARK_EROSION_STEPS / megasamples);
+		}
+
+		// A large map from nothing to a tiled file, as Terrain does it
+		std::vector<uint16_t> samples;
+		settings.width = BENCHMARK_PIPELINE_SIZE;
+		settings.height = BENCHMARK_PIPELINE_SIZE;
+		const std::string cachePath = "generator.benchmark.cgheight";
+		Timer timer;
+		generate(settings, samples);
+		const double generateMs = timer.elapsedMs();
+		timer.reset();
+		const bool tiled = heightmapFile::convertSamples(&samples[0], settings.width, settings.height,
+			getSettingsHash(settings), BENCHMARK_TILE_SIZE, BENCHMARK_PATCH_SIZE, cachePath);
+		const double tileMs = timer.elapsedMs();
+		remove(cachePath.c_str());
+		const double pipelineMegasamples = (double)settings.width * settings.height / 1.0e6;
+		printf("  %ux%u fBm on %u threads: generated in %.1f ms (%.2f ms per megasample), tiled in %.1f ms%s\n",
+			settings.width, settings.height, threads, generateMs, generateMs / pipelineMegasamples, tileMs,
+			tiled ? "" : ", FAILED");
+	}
+}
@@ -0,0 +1,60 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+enum HeightmapNoise
+{
+	NOISE_FBM = 0,			// octaves of simplex noise added up
+	NOISE_RIDGED,			// sharp crests where each octave crosses zero, weighted by the octave before
+	NOISE_WARPED,			// fBm looked up where two more fBm fields push each point
+	HEIGHTMAP_NOISE_TYPES
+};
+
+// Everything a generated heightmap depends on, the same settings always give the same samples
+struct HeightmapGeneratorSettings
+{
+	unsigned int width;
+	unsigned int height;
+	unsigned int seed;
+	HeightmapNoise noise;
+	float featureSize;				// samples across the largest hills
+	unsigned int octaves;
+	float lacunarity;				// frequency of each octave over the one before
+	float gain;						// amplitude of each octave over the one before
+	float warp;						// how far NOISE_WARPED pushes a point, in featureSizes
+	unsigned int thermalPasses;		// of thermal erosion, none by default
+	float talus;					// steepest slope thermal erosion leaves, in the full height range per sample
+	unsigned int hydraulicSteps;	// of hydraulic erosion, none by default
+	float rain;						// water added to every sample each step, in the full height range
+
+	HeightmapGeneratorSettings()
+		: width(1025)
+		, height(1025)
+		, seed(1)
+		, noise(NOISE_FBM)
+		, featureSize(512.0f)
+		, octaves(8)
+		, lacunarity(2.0f)
+		, gain(0.5f)
+		, warp(0.5f)
+		, thermalPasses(0)
+		, talus(0.002f)
+		, hydraulicSteps(0)
+		, rain(0.0002f)
+	{
+	}
+};
+
+namespace heightmapGenerator
+{
+	// Width * height 16 bit samples row by row. The map is filled in square tiles across the thread pool,
+	// 8 samples at a time with AVX2 when the build enables it, then eroded as a whole if the settings ask
+	void generate(const HeightmapGeneratorSettings& settings, std::vector<uint16_t>& samples);
+
+	// Stands for the samples the settings give, to tell a tiled copy of them is current
+	unsigned long long getSettingsHash(const HeightmapGeneratorSettings& settings);
+
+	// Time each kind of noise and each erosion per megasample, scalar on one thread against SIMD on one
+	// thread and across the pool, then generating and tiling a large map end to end
+	void benchmark();
+}
@@ -0,0 +1,617 @@
+#include "heightmapPager.hpp"
+#include "threadPool.hpp"
+#include "timer.hpp"
+
+#include <GL/glew.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <thread>
+
+namespace
+{
+	// How far ahead of the camera the tiles are fetched, at its current speed
+	const float PREFETCH_SECONDS = 1.0f;
+
+	// Copies handed to the workers at once, so a burst of wanted tiles cannot flood the ring
+	const size_t MAX_LOADS_IN_FLIGHT = 8;
+}
+
+HeightmapPager::HeightmapPager()
+	: m_tileBytes(0)
+	, m_blocksPerRow(0)
+	, m_slotSamples(0)
+	, m_frame(0)
+	, m_textureArray(0)
+{
+	memset(&m_heightmap, 0, sizeof(m_heightmap));
+	memset(m_levelOffsets, 0, sizeof(m_levelOffsets));
+	memset(&m_stats, 0, sizeof(m_stats));
+}
+
+HeightmapPager::~HeightmapPager()
+{
+	// The workers read from the mapping, which closes with the pager
+	waitForLoads();
+}
+
+bool HeightmapPager::open(const std::string& path)
+{
+	if (!heightmapFile::open(path, m_file, m_heightmap)) {
+		return false;
+	}
+
+	unsigned int tiles = 0;
+	for (unsigned int level = 0; level < m_heightmap.tileLevels; level++) {
+		m_levelOffsets[level] = tiles;
+		tiles += m_heightmap.tilesX[level] * m_heightmap.tilesZ[level];
+	}
+	m_tileSlots.assign(tiles, -1);
+	m_residentSlots.assign(tiles, -1);
+	m_tileWanted.assign(tiles, 0);
+	m_editedTiles.assign(tiles, std::vector<uint16_t>());
+	const unsigned int tileWidth = heightmapFile::getTileWidth(m_heightmap.tileSize);
+	m_tileBytes = (size_t)tileWidth * tileWidth * sizeof(uint16_t);
+	m_blocksPerRow = (tileWidth + HEIGHT_BLOCK_SIZE - 1) / HEIGHT_BLOCK_SIZE;
+	m_slotSamples = m_blocksPerRow * m_blocksPerRow * HEIGHT_BLOCK_SIZE * HEIGHT_BLOCK_SIZE;
+	return true;
+}
+
+bool HeightmapPager::createSlots(size_t budgetBytes)
+{
+	if (!m_file.isOpen()) {
+		return false;
+	}
+
+	// Each slot costs its CPU copy and its layer, the top level needs one slot per tile whatever the budget
+	const unsigned int top = m_heightmap.tileLevels - 1;
+	const unsigned int pinned = m_heightmap.tilesX[top] * m_heightmap.tilesZ[top];
+	GLint maxLayers = 0;
+	glGetIntegerv(GL_MAX_ARRAY_TEXTURE_LAYERS, &maxLayers);
+	const size_t slotBytes = m_tileBytes + m_slotSamples * sizeof(uint16_t);
+	unsigned int slotCount = (unsigned int)std::min<size_t>(budgetBytes / slotBytes, (size_t)maxLayers);
+	slotCount = std::max(slotCount, pinned);
+
+	m_slots.resize(slotCount);
+	for (unsigned int i = 0; i < slotCount; i++) {
+		m_slots[i].tile = -1;
+		m_slots[i].resident = false;
+		m_slots[i].lastWanted = 0;
+	}
+	// Never reallocated while the slots exist, the workers write into it. The sample past the end is
+	// for readers that fetch two at a time
+	m_samples.assign((size_t)slotCount * m_slotSamples + 1, 0);
+
+	const unsigned int tileWidth = heightmapFile::getTileWidth(m_heightmap.tileSize);
+	glGenTextures(1, &m_textureArray);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, m_textureArray);
+	glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_R16, tileWidth, tileWidth, slotCount, 0, GL_RED, GL_UNSIGNED_SHORT, NULL);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, 0);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+	// The top level is a handful of tiles, decoded across the pool while the render thread waits
+	std::vector<std::vector<uint16_t> > decoded(pinned);
+	ThreadPool::instance().parallelFor(pinned, [this, top, &decoded](unsigned int i) {
+		decodeTile(m_heightmap.tiles[top][i], decoded[i]);
+		storeTile(i, decoded[i]);
+	});
+	for (unsigned int i = 0; i < pinned; i++) {
+		const unsigned int tile = m_levelOffsets[top] + i;
+		Slot& slot = m_slots[i];
+		slot.tile = tile;
+		slot.resident = true;
+		m_tileSlots[tile] = i;
+		m_residentSlots[tile] = i;
+		uploadTile(i, &decoded[i][0]);
+	}
+
+	m_stats.slots = slotCount;
+	m_stats.residentTiles = pinned;
+	m_stats.budgetBytes = budgetBytes;
+	m_stats.bytesResident = (unsigned long long)pinned * slotBytes;
+	return true;
+}
+
+void HeightmapPager::close()
+{
+	waitForLoads();
+	glDeleteTextures(1, &m_textureArray);
+	m_textureArray = 0;
+	m_slots.clear();
+	m_tileSlots.clear();
+	m_residentSlots.clear();
+	m_samples.clear();
+	m_tileWanted.clear();
+	m_editedTiles.clear();
+	for (unsigned int level = 0; level < MAX_HEIGHTMAP_LEVELS; level++) {
+		m_editedBounds[level].clear();
+	}
+	m_file.close();
+	memset(&m_heightmap, 0, sizeof(m_heightmap));
+	m_stats.slots = 0;
+	m_stats.residentTiles = 0;
+	m_stats.bytesResident = 0;
+	m_stats.editedTiles = 0;
+	m_stats.bytesEdited = 0;
+}
+
+void HeightmapPager::update(const glm::vec2& center, const glm::vec2& velocity, const std::vector<float>& radii, double budgetMs)
+{
+	if (m_slots.empty() || radii.empty()) {
+		return;
+	}
+	Timer timer;
+	m_frame++;
+
+	// Coarse levels first, they stand in for the finer ones until those arrive
+	m_wanted.clear();
+	const glm::vec2 ahead = center + velocity * PREFETCH_SECONDS;
+	for (unsigned int level = m_heightmap.tileLevels; level-- > 0;) {
+		const float radius = radii[std::min<size_t>(level, radii.size() - 1)];
+		wantTiles(level, center, radius, m_wanted);
+		wantTiles(level, ahead, radius, m_wanted);
+	}
+
+	// Upload what the workers have finished
+	unsigned int uploads = 0;
+	for (size_t i = 0; i < m_loads.size();) {
+		if (!m_loads[i]->ready.load() || (uploads > 0 && timer.elapsedMs() >= budgetMs)) {
+			i++;
+			continue;
+		}
+		finishLoad(*m_loads[i]);
+		m_loads.erase(m_loads.begin() + i);
+		uploads++;
+	}
+
+	// Mark every wanted tile before any is evicted to make room
+	m_stats.pendingTiles = 0;
+	for (size_t i = 0; i < m_wanted.size(); i++) {
+		const int slot = m_tileSlots[m_wanted[i]];
+		if (slot >= 0) {
+			m_slots[slot].lastWanted = m_frame;
+		}
+		if (slot < 0 || !m_slots[slot].resident) {
+			m_stats.pendingTiles++;
+		}
+	}
+	for (size_t i = 0; i < m_wanted.size() && m_loads.size() < MAX_LOADS_IN_FLIGHT; i++) {
+		if (m_tileSlots[m_wanted[i]] < 0 && !startLoad(m_wanted[i])) {
+			break;
+		}
+	}
+	m_stats.wantedTiles = (unsigned int)m_wanted.size();
+}
+
+void HeightmapPager::wantTiles(unsigned int level, const glm::vec2& center, float radius, std::vector<unsigned int>& wanted)
+{
+	const float span = (float)(m_heightmap.tileSize << level);
+	const int lastX = (int)m_heightmap.tilesX[level] - 1;
+	const int lastZ = (int)m_heightmap.tilesZ[level] - 1;
+	const int x0 = std::max((int)floorf((center.x - radius) / span), 0);
+	const int x1 = std::min((int)floorf((center.x + radius) / span), lastX);
+	const int z0 = std::max((int)floorf((center.y - radius) / span), 0);
+	const int z1 = std::min((int)floorf((center.y + radius) / span), lastZ);
+	for (int tileZ = z0; tileZ <= z1; tileZ++) {
+		for (int tileX = x0; tileX <= x1; tileX++) {
+			const unsigned int tile = getTileIndex(level, tileX, tileZ);
+			if (m_tileWanted[tile] != m_frame) {
+				m_tileWanted[tile] = m_frame;
+				wanted.push_back(tile);
+			}
+		}
+	}
+}
+
+bool HeightmapPager::startLoad(unsigned int tile)
+{
+	int slot = -1;
+	for (size_t i = 0; i < m_slots.size() && slot < 0; i++) {
+		if (m_slots[i].tile < 0) {
+			slot = (int)i;
+		}
+	}
+	if (slot < 0) {
+		slot = findEvictable();
+		if (slot < 0) {
+			return false;
+		}
+		m_tileSlots[m_slots[slot].tile] = -1;
+		m_residentSlots[m_slots[slot].tile] = -1;
+		m_stats.residentTiles--;
+		m_stats.tilesEvicted++;
+		m_stats.bytesResident -= m_tileBytes + m_slotSamples * sizeof(uint16_t);
+	}
+
+	Slot& target = m_slots[slot];
+	target.tile = (int)tile;
+	target.resident = false;
+	target.lastWanted = m_frame;
+	m_tileSlots[tile] = slot;
+
+	std::shared_ptr<Load> load = std::make_shared<Load>();
+	load->slot = slot;
+	load->ready = false;
+	m_loads.push_back(load);
+
+	// An edited tile is already in memory, finishLoad takes it from there
+	if (!m_editedTiles[tile].empty()) {
+		load->ready = true;
+		return true;
+	}
+	const HeightmapTile* source = &getTileEntry(tile);
+	UploadRing::instance().allocate(m_tileBytes, load->slice);
+
+	// Reading and decoding take the tile's page faults off the render thread. Nothing reads the slot's
+	// CPU copy until the load finishes
+	const size_t bytes = m_tileBytes;
+	ThreadPool::instance().enqueue([this, load, source, bytes]() {
+		decodeTile(*source, load->samples);
+		storeTile(load->slot, load->samples);
+		if (load->slice.data) {
+			memcpy(load->slice.data, &load->samples[0], bytes);
+		}
+		load->ready = true;
+	});
+	return true;
+}
+
+void HeightmapPager::finishLoad(Load& load)
+{
+	Slot& slot = m_slots[load.slot];
+	UploadRing& ring = UploadRing::instance();
+	const std::vector<uint16_t>& edited = m_editedTiles[slot.tile];
+	if (!edited.empty()) {
+		// Edited while loading or before, the file's samples are out of date
+		ring.cancel(load.slice);
+		storeTile(load.slot, edited);
+		uploadTile(load.slot, &edited[0]);
+	}
+	else if (load.slice.data) {
+		ring.bindUnpack();
+		uploadTile(load.slot, UploadRing::getUnpackOffset(load.slice, 0));
+		ring.unbindUnpack();
+		ring.submit(load.slice);
+	}
+	else {
+		uploadTile(load.slot, &load.samples[0]);
+	}
+	slot.resident = true;
+	m_residentSlots[slot.tile] = (int)load.slot;
+	m_stats.residentTiles++;
+	m_stats.tilesLoaded++;
+	m_stats.bytesResident += m_tileBytes + m_slotSamples * sizeof(uint16_t);
+}
+
+void HeightmapPager::decodeTile(const HeightmapTile& tile, std::vector<uint16_t>& samples) const
+{
+	// A corrupt tile reads as flat ground rather than garbage
+	samples.resize(m_tileBytes / sizeof(uint16_t));
+	if (!heightmapFile::decodeTile(m_heightmap, tile, &samples[0])) {
+		std::fill(samples.begin(), samples.end(), tile.minHeight);
+	}
+}
+
+const uint16_t* HeightmapPager::getTileRows(unsigned int tile, std::vector<uint16_t>& scratch) const
+{
+	if (!m_editedTiles[tile].empty()) {
+		return &m_editedTiles[tile][0];
+	}
+	const int slot = m_residentSlots[tile];
+	if (slot < 0) {
+		decodeTile(getTileEntry(tile), scratch);
+		return &scratch[0];
+	}
+	const unsigned int tileWidth = heightmapFile::getTileWidth(m_heightmap.tileSize);
+	const uint16_t* tiled = &m_samples[(size_t)slot * m_slotSamples];
+	scratch.resize((size_t)tileWidth * tileWidth);
+	for (unsigned int z = 0; z < tileWidth; z++) {
+		uint16_t* row = &scratch[(size_t)z * tileWidth];
+		for (unsigned int x = 0; x < tileWidth; x++) {
+			row[x] = tiled[getTiledSampleIndex(x, z, m_blocksPerRow)];
+		}
+	}
+	return &scratch[0];
+}
+
+const HeightmapTile& HeightmapPager::getTileEntry(unsigned int tile) const
+{
+	// Find the tile's level for its place in the file
+	unsigned int level = 0;
+	while (level + 1 < m_heightmap.tileLevels && tile >= m_levelOffsets[level + 1]) {
+		level++;
+	}
+	return m_heightmap.tiles[level][tile - m_levelOffsets[level]];
+}
+
+void HeightmapPager::storeTile(unsigned int slot, const std::vector<uint16_t>& samples)
+{
+	const unsigned int tileWidth = heightmapFile::getTileWidth(m_heightmap.tileSize);
+	uint16_t* tiled = &m_samples[(size_t)slot * m_slotSamples];
+	for (unsigned int z = 0; z < tileWidth; z++) {
+		const uint16_t* row = &samples[(size_t)z * tileWidth];
+		for (unsigned int x = 0; x < tileWidth; x++) {
+			tiled[getTiledSampleIndex(x, z, m_blocksPerRow)] = row[x];
+		}
+	}
+}
+
+void HeightmapPager::uploadTile(unsigned int slot, const void* pixels)
+{
+	// Rows of an odd width are only 2 byte aligned
+	const unsigned int tileWidth = heightmapFile::getTileWidth(m_heightmap.tileSize);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, m_textureArray);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 2);
+	glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, slot, tileWidth, tileWidth, 1, GL_RED, GL_UNSIGNED_SHORT, pixels);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+}
+
+void HeightmapPager::waitForLoads()
+{
+	for (size_t i = 0; i < m_loads.size(); i++) {
+		while (!m_loads[i]->ready.load()) {
+			std::this_thread::yield();
+		}
+		UploadRing::instance().cancel(m_loads[i]->slice);
+	}
+	m_loads.clear();
+}
+
+int HeightmapPager::findEvictable() const
+{
+	// Resident, not wanted this frame and not on the top level, the one wanted longest ago
+	const unsigned int topOffset = m_levelOffsets[m_heightmap.tileLevels - 1];
+	int best = -1;
+	for (size_t i = 0; i < m_slots.size(); i++) {
+		const Slot& slot = m_slots[i];
+		if (!slot.resident || slot.lastWanted == m_frame || (unsigned int)slot.tile >= topOffset) {
+			continue;
+		}
+		if (best < 0 || slot.lastWanted < m_slots[best].lastWanted) {
+			best = (int)i;
+		}
+	}
+	return best;
+}
+
+bool HeightmapPager::findTile(unsigned int level, unsigned int x, unsigned int z, PagedTile& tile) const
+{
+	if (m_slots.empty()) {
+		return false;
+	}
+	for (level = std::min(level, m_heightmap.tileLevels - 1); level < m_heightmap.tileLevels; level++) {
+		const unsigned int span = m_heightmap.tileSize << level;
+		const unsigned int tileX = std::min(x / span, m_heightmap.tilesX[level] - 1);
+		const unsigned int tileZ = std::min(z / span, m_heightmap.tilesZ[level] - 1);
+		const int slot = m_tileSlots[getTileIndex(level, tileX, tileZ)];
+		if (slot < 0 || !m_slots[slot].resident) {
+			continue;
+		}
+		tile.level = level;
+		tile.originX = tileX * span;
+		tile.originZ = tileZ * span;
+		tile.stride = 1u << level;
+		tile.layer = (unsigned int)slot;
+		tile.samples = &m_samples[(size_t)slot * m_slotSamples];
+		tile.blocksPerRow = m_blocksPerRow;
+		return true;
+	}
+	return false;
+}
+
+bool HeightmapPager::getLevel(unsigned int level, PagedLevel& paged) const
+{
+	if (m_slots.empty() || level >= m_heightmap.tileLevels) {
+		return false;
+	}
+	paged.samples = &m_samples[0];
+	paged.tileSlots = &m_residentSlots[m_levelOffsets[level]];
+	paged.tilesX = m_heightmap.tilesX[level];
+	paged.tilesZ = m_heightmap.tilesZ[level];
+	paged.tileSize = m_heightmap.tileSize;
+	paged.slotSamples = m_slotSamples;
+	paged.blocksPerRow = m_blocksPerRow;
+	return true;
+}
+
+void HeightmapPager::editSamples(unsigned int x0, unsigned int z0, unsigned int x1, unsigned int z1, const uint16_t* samples)
+{
+	if (m_slots.empty() || x0 > x1 || z0 > z1 || x1 >= m_heightmap.width || z1 >= m_heightmap.height) {
+		return;
+	}
+
+	// Every tile holding one of the samples and which of its own samples they are, past the map's edge
+	// the edge repeats
+	struct TileEdit
+	{
+		unsigned int tile;
+		unsigned int originX, originZ, stride;
+		std::vector<unsigned int> columns;
+		std::vector<unsigned int> rows;
+	};
+	std::vector<TileEdit> edits;
+	std::vector<unsigned int> copies;
+	const unsigned int tileWidth = heightmapFile::getTileWidth(m_heightmap.tileSize);
+	for (unsigned int level = 0; level < m_heightmap.tileLevels; level++) {
+		const unsigned int stride = 1u << level;
+		const unsigned int span = m_heightmap.tileSize << level;
+		const unsigned int tileX0 = x0 / span > 0 ? x0 / span - 1 : 0;
+		const unsigned int tileZ0 = z0 / span > 0 ? z0 / span - 1 : 0;
+		const unsigned int tileX1 = std::min(x1 / span + 1, m_heightmap.tilesX[level] - 1);
+		const unsigned int tileZ1 = std::min(z1 / span + 1, m_heightmap.tilesZ[level] - 1);
+		for (unsigned int tileZ = tileZ0; tileZ <= tileZ1; tileZ++) {
+			for (unsigned int tileX = tileX0; tileX <= tileX1; tileX++) {
+				TileEdit edit;
+				edit.tile = getTileIndex(level, tileX, tileZ);
+				edit.originX = tileX * span;
+				edit.originZ = tileZ * span;
+				edit.stride = stride;
+				for (unsigned int i = 0; i < tileWidth; i++) {
+					const int x = std::min(std::max((int)edit.originX + ((int)i - 1) * (int)stride, 0), (int)m_heightmap.width - 1);
+					if ((unsigned int)x >= x0 && (unsigned int)x <= x1) {
+						edit.columns.push_back(i);
+					}
+					const int z = std::min(std::max((int)edit.originZ + ((int)i - 1) * (int)stride, 0), (int)m_heightmap.height - 1);
+					if ((unsigned int)z >= z0 && (unsigned int)z <= z1) {
+						edit.rows.push_back(i);
+					}
+				}
+				if (edit.columns.empty() || edit.rows.empty()) {
+					continue;
+				}
+				if (m_editedTiles[edit.tile].empty()) {
+					copies.push_back(edit.tile);
+				}
+				edits.push_back(edit);
+			}
+		}
+	}
+
+	// The first edit of a tile copies it, decoding it if it is not resident, a tile for each level at
+	// least, so the copies go across the pool
+	ThreadPool::instance().parallelFor((unsigned int)copies.size(), [this, &copies, tileWidth](unsigned int i) {
+		std::vector<uint16_t> scratch;
+		const uint16_t* current = getTileRows(copies[i], scratch);
+		std::vector<uint16_t> edited(current, current + (size_t)tileWidth * tileWidth);
+		m_editedTiles[copies[i]].swap(edited);
+	});
+	m_stats.editedTiles += (unsigned int)copies.size();
+	m_stats.bytesEdited += copies.size() * m_tileBytes;
+
+	const unsigned int rowLength = x1 - x0 + 1;
+	for (size_t e = 0; e < edits.size(); e++) {
+		const TileEdit& edit = edits[e];
+		std::vector<uint16_t>& edited = m_editedTiles[edit.tile];
+		const int slot = m_residentSlots[edit.tile];
+		uint16_t* tiled = slot >= 0 ? &m_samples[(size_t)slot * m_slotSamples] : NULL;
+		for (size_t j = 0; j < edit.rows.size(); j++) {
+			const unsigned int z = std::min(std::max((int)edit.originZ + ((int)edit.rows[j] - 1) * (int)edit.stride, 0), (int)m_heightmap.height - 1);
+			const uint16_t* source = samples + (size_t)(z - z0) * rowLength;
+			for (size_t i = 0; i < edit.columns.size(); i++) {
+				const unsigned int x = std::min(std::max((int)edit.originX + ((int)edit.columns[i] - 1) * (int)edit.stride, 0), (int)m_heightmap.width - 1);
+				edited[(size_t)edit.rows[j] * tileWidth + edit.columns[i]] = source[x - x0];
+				if (tiled) {
+					tiled[getTiledSampleIndex(edit.columns[i], edit.rows[j], m_blocksPerRow)] = source[x - x0];
+				}
+			}
+		}
+
+		// Only the changed rectangle of the layer, straight out of the edited rows. A tile still loading
+		// picks the edited copy up when it finishes
+		if (slot >= 0) {
+			glBindTexture(GL_TEXTURE_2D_ARRAY, m_textureArray);
+			glPixelStorei(GL_UNPACK_ALIGNMENT, 2);
+			glPixelStorei(GL_UNPACK_ROW_LENGTH, tileWidth);
+			glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, edit.columns.front(), edit.rows.front(), slot,
+				edit.columns.back() - edit.columns.front() + 1, edit.rows.back() - edit.rows.front() + 1, 1, GL_RED, GL_UNSIGNED_SHORT,
+				&edited[(size_t)edit.rows.front() * tileWidth + edit.columns.front()]);
+			glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+			glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+			glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+		}
+	}
+	updateBounds(x0, z0, x1, z1);
+}
+
+void HeightmapPager::readSamples(unsigned int x0, unsigned int z0, unsigned int x1, unsigned int z1, uint16_t* samples) const
+{
+	if (m_editedTiles.empty() || x0 > x1 || z0 > z1 || x1 >= m_heightmap.width || z1 >= m_heightmap.height) {
+		return;
+	}
+	const unsigned int tileSize = m_heightmap.tileSize;
+	const unsigned int tileWidth = heightmapFile::getTileWidth(tileSize);
+	const unsigned int rowLength = x1 - x0 + 1;
+	std::vector<uint16_t> scratch;
+	const unsigned int tileX1 = std::min(x1 / tileSize, m_heightmap.tilesX[0] - 1);
+	const unsigned int tileZ1 = std::min(z1 / tileSize, m_heightmap.tilesZ[0] - 1);
+	for (unsigned int tileZ = std::min(z0 / tileSize, tileZ1); tileZ <= tileZ1; tileZ++) {
+		for (unsigned int tileX = std::min(x0 / tileSize, tileX1); tileX <= tileX1; tileX++) {
+			// The samples this tile owns, the last tile of a row or column runs to the edge of the map
+			const unsigned int originX = tileX * tileSize;
+			const unsigned int originZ = tileZ * tileSize;
+			const unsigned int fromX = std::max(x0, originX);
+			const unsigned int fromZ = std::max(z0, originZ);
+			const unsigned int toX = tileX + 1 < m_heightmap.tilesX[0] ? std::min(x1, originX + tileSize - 1) : x1;
+			const unsigned int toZ = tileZ + 1 < m_heightmap.tilesZ[0] ? std::min(z1, originZ + tileSize - 1) : z1;
+			const uint16_t* rows = getTileRows(getTileIndex(0, tileX, tileZ), scratch);
+			for (unsigned int z = fromZ; z <= toZ; z++) {
+				const uint16_t* row = rows + (size_t)(z - originZ + 1) * tileWidth + (fromX - originX + 1);
+				memcpy(samples + (size_t)(z - z0) * rowLength + (fromX - x0), row, (toX - fromX + 1) * sizeof(uint16_t));
+			}
+		}
+	}
+}
+
+void HeightmapPager::updateBounds(unsigned int x0, unsigned int z0, unsigned int x1, unsigned int z1)
+{
+	// The mapping is read only, the bounds move to memory the first time they change
+	if (m_editedBounds[0].empty()) {
+		for (unsigned int level = 0; level < m_heightmap.boundsLevels; level++) {
+			const size_t count = (size_t)m_heightmap.boundsNodes[level] * m_heightmap.boundsNodes[level] * 2;
+			m_editedBounds[level].assign(m_heightmap.bounds[level], m_heightmap.bounds[level] + count);
+			m_heightmap.bounds[level] = &m_editedBounds[level][0];
+		}
+	}
+
+	// A leaf covers patchSize quads, so its far edge is shared with the next one, if there is a next one
+	const unsigned int patchSize = m_heightmap.patchSize;
+	const unsigned int leaves = m_heightmap.boundsNodes[0];
+	const unsigned int leafX0 = x0 > 0 ? (x0 - 1) / patchSize : 0;
+	const unsigned int leafZ0 = z0 > 0 ? (z0 - 1) / patchSize : 0;
+	const unsigned int leafX1 = std::min(std::min(x1 / patchSize, (m_heightmap.width - 1) / patchSize), leaves - 1);
+	const unsigned int leafZ1 = std::min(std::min(z1 / patchSize, (m_heightmap.height - 1) / patchSize), leaves - 1);
+	const unsigned int readX0 = leafX0 * patchSize;
+	const unsigned int readZ0 = leafZ0 * patchSize;
+	const unsigned int readX1 = std::min(leafX1 * patchSize + patchSize, m_heightmap.width - 1);
+	const unsigned int readZ1 = std::min(leafZ1 * patchSize + patchSize, m_heightmap.height - 1);
+	const unsigned int rowLength = readX1 - readX0 + 1;
+	std::vector<uint16_t> samples((size_t)rowLength * (readZ1 - readZ0 + 1));
+	readSamples(readX0, readZ0, readX1, readZ1, &samples[0]);
+	for (unsigned int nodeZ = leafZ0; nodeZ <= leafZ1; nodeZ++) {
+		for (unsigned int nodeX = leafX0; nodeX <= leafX1; nodeX++) {
+			uint16_t low = 0xffff;
+			uint16_t high = 0;
+			const unsigned int fromX = nodeX * patchSize;
+			const unsigned int toX = std::min(fromX + patchSize, m_heightmap.width - 1);
+			const unsigned int toZ = std::min(nodeZ * patchSize + patchSize, m_heightmap.height - 1);
+			for (unsigned int z = nodeZ * patchSize; z <= toZ; z++) {
+				const uint16_t* row = &samples[(size_t)(z - readZ0) * rowLength];
+				for (unsigned int x = fromX; x <= toX; x++) {
+					low = std::min(low, row[x - readX0]);
+					high = std::max(high, row[x - readX0]);
+				}
+			}
+			m_editedBounds[0][((size_t)nodeZ * leaves + nodeX) * 2] = low;
+			m_editedBounds[0][((size_t)nodeZ * leaves + nodeX) * 2 + 1] = high;
+		}
+	}
+
+	// Then each parent over the nodes below it, which are empty past the map
+	unsigned int nodeX0 = leafX0, nodeZ0 = leafZ0, nodeX1 = leafX1, nodeZ1 = leafZ1;
+	for (unsigned int level = 1; level < m_heightmap.boundsLevels; level++) {
+		nodeX0 >>= 1;
+		nodeZ0 >>= 1;
+		nodeX1 >>= 1;
+		nodeZ1 >>= 1;
+		const unsigned int nodes = m_heightmap.boundsNodes[level];
+		for (unsigned int nodeZ = nodeZ0; nodeZ <= nodeZ1; nodeZ++) {
+			for (unsigned int nodeX = nodeX0; nodeX <= nodeX1; nodeX++) {
+				uint16_t low = 0xffff;
+				uint16_t high = 0;
+				for (unsigned int i = 0; i < 4; i++) {
+					const uint16_t* child = &m_editedBounds[level - 1][((size_t)(nodeZ * 2 + (i >> 1)) * nodes * 2 + nodeX * 2 + (i & 1)) * 2];
+					low = std::min(low, child[0]);
+					high = std::max(high, child[1]);
+				}
+				m_editedBounds[level][((size_t)nodeZ * nodes + nodeX) * 2] = low;
+				m_editedBounds[level][((size_t)nodeZ * nodes + nodeX) * 2 + 1] = high;
+			}
+		}
+	}
+}
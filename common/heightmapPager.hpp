@@ -0,0 +1,176 @@
+#pragma once
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "heightmapFile.hpp"
+#include "uploadRing.hpp"
+
+struct HeightmapPagerStats
+{
+	unsigned int slots;
+	unsigned int residentTiles;
+	unsigned int wantedTiles;		// asked for by the last update
+	unsigned int pendingTiles;		// wanted but not resident yet
+	unsigned int tilesLoaded;
+	unsigned int tilesEvicted;
+	unsigned long long budgetBytes;
+	unsigned long long bytesResident;	// CPU and GPU copies of the resident tiles
+	unsigned int editedTiles;			// holding edited samples, kept whether resident or not
+	unsigned long long bytesEdited;
+};
+
+// The CPU copies of the tiles are stored in blocks of 8x8 samples, Morton ordered within each block, so
+// the four samples around a point mostly share a cache line and nearby points share blocks
+const unsigned int HEIGHT_BLOCK_SIZE = 8;
+
+// Bits of a coordinate within a block spread to every other bit
+inline unsigned int spreadBlockBits(unsigned int value)
+{
+	return (value & 1) | ((value & 2) << 1) | ((value & 4) << 2);
+}
+
+// Index of sample (x, z) in a tile's CPU copy, with blocksPerRow blocks to each row of blocks
+inline unsigned int getTiledSampleIndex(unsigned int x, unsigned int z, unsigned int blocksPerRow)
+{
+	const unsigned int block = (z / HEIGHT_BLOCK_SIZE) * blocksPerRow + x / HEIGHT_BLOCK_SIZE;
+	return block * HEIGHT_BLOCK_SIZE * HEIGHT_BLOCK_SIZE
+		+ (spreadBlockBits(x % HEIGHT_BLOCK_SIZE) | (spreadBlockBits(z % HEIGHT_BLOCK_SIZE) << 1));
+}
+
+// Resident tile as seen by the terrain, origin and stride in level 0 samples
+struct PagedTile
+{
+	unsigned int level;
+	unsigned int originX;
+	unsigned int originZ;
+	unsigned int stride;
+	unsigned int layer;				// of the pager's texture array
+	const uint16_t* samples;		// heightmapFile::getTileWidth squared, starting one sample before the origin
+	unsigned int blocksPerRow;
+
+	// Sample (x, z) of the tile, counted from its first
+	uint16_t getSample(unsigned int x, unsigned int z) const { return samples[getTiledSampleIndex(x, z, blocksPerRow)]; }
+};
+
+// Where the resident tiles of one level are, for code that looks up many samples without findTile
+struct PagedLevel
+{
+	const uint16_t* samples;		// CPU copies of every slot, slotSamples apart, readable one sample past the end
+	const int* tileSlots;			// slot of each of the level's tiles row by row, -1 unless resident
+	unsigned int tilesX;
+	unsigned int tilesZ;
+	unsigned int tileSize;			// quads along the side of a tile
+	unsigned int slotSamples;
+	unsigned int blocksPerRow;
+};
+
+// Keeps the tiles of a mapped .cgheight around the camera in memory, within a fixed budget. Every slot
+// holds a tile on the CPU, for height queries, and in one layer of a texture array, for drawing. Tiles are
+// decoded out of the mapping by worker threads, so page faults never stall the frame, and evicted when
+// nobody has wanted them for longest. The top level is read in up front and never evicted, so a coarser
+// tile can always stand in for one that has not arrived yet
+class HeightmapPager
+{
+public:
+	HeightmapPager();
+	~HeightmapPager();
+
+	// Any thread: map the tiled file
+	bool open(const std::string& path);
+	bool isOpen() const { return m_file.isOpen(); }
+	const TiledHeightmap& getHeightmap() const { return m_heightmap; }
+
+	// Render thread: create the slots, as many as fit in budgetBytes, and read in the top level
+	bool createSlots(size_t budgetBytes);
+
+	// Wait for the copies in flight, delete the texture array and unmap the file
+	void close();
+
+	// Render thread, once per frame: want the tiles of each level within radii[level] samples of center,
+	// and of where center is heading at velocity, in samples per second. Coarse levels load first, and
+	// the finished loads are uploaded until budgetMs has passed
+	void update(const glm::vec2& center, const glm::vec2& velocity, const std::vector<float>& radii, double budgetMs);
+
+	// Finest resident tile of the level or above that holds sample (x, z)
+	bool findTile(unsigned int level, unsigned int x, unsigned int z, PagedTile& tile) const;
+
+	// The resident tiles of a level, valid until the next update
+	bool getLevel(unsigned int level, PagedLevel& paged) const;
+
+	// Render thread: replace the level 0 samples from (x0, z0) to (x1, z1), inclusive, with samples, row
+	// by row. Every tile of every level holding one of them, in its border as well, keeps an edited copy
+	// from then on, which loads in place of the file's. Resident tiles are patched on the CPU and only
+	// the changed rectangle of their layer is uploaded. The quadtree bounds over the samples are taken again
+	void editSamples(unsigned int x0, unsigned int z0, unsigned int x1, unsigned int z1, const uint16_t* samples);
+
+	// Level 0 samples from (x0, z0) to (x1, z1), inclusive, row by row, as edited. Tiles that are not
+	// resident are decoded on the calling thread
+	void readSamples(unsigned int x0, unsigned int z0, unsigned int x1, unsigned int z1, uint16_t* samples) const;
+
+	unsigned int getTextureArray() const { return m_textureArray; }
+	HeightmapPagerStats getStats() const { return m_stats; }
+
+private:
+	HeightmapPager(const HeightmapPager&);
+	HeightmapPager& operator=(const HeightmapPager&);
+
+	struct Slot
+	{
+		int tile;						// index into m_tileSlots, -1 when free
+		bool resident;					// false while the tile is being decoded
+		unsigned int lastWanted;		// frame
+	};
+
+	// Tile being decoded out of the mapping by a worker, which also writes the slot's CPU copy
+	struct Load
+	{
+		unsigned int slot;
+		std::vector<uint16_t> samples;		// rows, for when the ring has no room
+		UploadSlice slice;
+		std::atomic<bool> ready;
+	};
+
+	void wantTiles(unsigned int level, const glm::vec2& center, float radius, std::vector<unsigned int>& wanted);
+	bool startLoad(unsigned int tile);
+	void finishLoad(Load& load);
+	void decodeTile(const HeightmapTile& tile, std::vector<uint16_t>& samples) const;
+	// Rows of a tile as they stand, from its edited copy, its slot or the file, through scratch if need be
+	const uint16_t* getTileRows(unsigned int tile, std::vector<uint16_t>& scratch) const;
+	const HeightmapTile& getTileEntry(unsigned int tile) const;
+	// Bounds of the quadtree nodes over level 0 samples from (x0, z0) to (x1, z1), from the edited samples
+	void updateBounds(unsigned int x0, unsigned int z0, unsigned int x1, unsigned int z1);
+	void storeTile(unsigned int slot, const std::vector<uint16_t>& samples);
+	void uploadTile(unsigned int slot, const void* pixels);
+	int findEvictable() const;
+	void waitForLoads();
+	unsigned int getTileIndex(unsigned int level, unsigned int tileX, unsigned int tileZ) const
+	{
+		return m_levelOffsets[level] + tileZ * m_heightmap.tilesX[level] + tileX;
+	}
+
+private:
+	MappedFile m_file;
+	TiledHeightmap m_heightmap;
+	unsigned int m_levelOffsets[MAX_HEIGHTMAP_LEVELS];	// first tile of each level in m_tileSlots
+	size_t m_tileBytes;				// of a tile's rows, as uploaded
+	unsigned int m_blocksPerRow;
+	unsigned int m_slotSamples;		// of a tile's CPU copy, rounded up to whole blocks
+
+	std::vector<int> m_tileSlots;				// slot of every tile in the file, -1 when it has none
+	std::vector<int> m_residentSlots;			// as above but -1 until the tile has arrived
+	std::vector<uint16_t> m_samples;			// CPU copies of the slots
+	std::vector<std::vector<uint16_t> > m_editedTiles;	// rows of every edited tile, empty for the rest
+	std::vector<uint16_t> m_editedBounds[MAX_HEIGHTMAP_LEVELS];	// what m_heightmap.bounds points at once edited
+	std::vector<unsigned int> m_tileWanted;		// frame each tile was last wanted
+	std::vector<Slot> m_slots;
+	std::vector<std::shared_ptr<Load> > m_loads;
+	std::vector<unsigned int> m_wanted;
+	unsigned int m_frame;
+
+	unsigned int m_textureArray;
+	HeightmapPagerStats m_stats;
+};
@@ -0,0 +1,57 @@
+#include "image.hpp"
+#include "stb_image.hpp"
+
+#include <cstring>
+
+namespace image
+{
+	bool decode(const char* path, Image& out, bool flipVertically)
+	{
+		// The flip flag is per thread, so workers decoding other images are not affected
+		stbi_set_flip_vertically_on_load_thread(flipVertically ? 1 : 0);
+		out.width = 0;
+		out.height = 0;
+		out.components = 0;
+		out.pixels = stbi_load(path, &out.width, &out.height, &out.components, 0);
+		return out.pixels != NULL;
+	}
+
+	GLenum getFormat(int components)
+	{
+		if (components == 1)
+			return GL_RED;
+		if (components == 4)
+			return GL_RGBA;
+		return GL_RGB;
+	}
+
+	void toRgba(const Image& image, std::vector<unsigned char>& rgba)
+	{
+		const size_t pixelCount = (size_t)image.width * image.height;
+		rgba.resize(pixelCount * 4);
+		for (size_t i = 0; i < pixelCount; i++) {
+			const unsigned char* in = image.pixels + i * image.components;
+			unsigned char* out = &rgba[i * 4];
+			switch (image.components) {
+			case 1:
+				out[0] = in[0]; out[1] = 0; out[2] = 0; out[3] = 255;
+				break;
+			case 2:
+				out[0] = in[0]; out[1] = in[0]; out[2] = in[0]; out[3] = in[1];
+				break;
+			case 3:
+				out[0] = in[0]; out[1] = in[1]; out[2] = in[2]; out[3] = 255;
+				break;
+			default:
+				memcpy(out, in, 4);
+				break;
+			}
+		}
+	}
+
+	void release(Image& image)
+	{
+		stbi_image_free(image.pixels);
+		image.pixels = NULL;
+	}
+}
@@ -0,0 +1,27 @@
+#pragma once
+#include <vector>
+
+#include <GL/glew.h>
+
+// 8 bit image decoded by stb_image, pixels are owned until image::release
+struct Image
+{
+	int width;
+	int height;
+	int components;
+	unsigned char* pixels;
+};
+
+namespace image
+{
+	// Decode a file without touching GL, safe on worker threads
+	bool decode(const char* path, Image& out, bool flipVertically = false);
+
+	// GL_RED, GL_RGB or GL_RGBA for the component count
+	GLenum getFormat(int components);
+
+	// Widen to RGBA8, one channel images go to red and grey with alpha to all three colours
+	void toRgba(const Image& image, std::vector<unsigned char>& rgba);
+
+	void release(Image& image);
+}
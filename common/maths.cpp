@@ -80,4 +80,54 @@ namespace maths
 		return matrix;
 	}
 
+	void frustumPlanes(const mat4& viewProjection, vec4 planes[6])
+	{
+		// Gribb and Hartmann: each plane is the last row of the matrix plus or minus one of the others
+		vec4 row0(viewProjection[0][0], viewProjection[1][0], viewProjection[2][0], viewProjection[3][0]);
+		vec4 row1(viewProjection[0][1], viewProjection[1][1], viewProjection[2][1], viewProjection[3][1]);
+		vec4 row2(viewProjection[0][2], viewProjection[1][2], viewProjection[2][2], viewProjection[3][2]);
+		vec4 row3(viewProjection[0][3], viewProjection[1][3], viewProjection[2][3], viewProjection[3][3]);
+
+		planes[0] = row3 + row0;
+		planes[1] = row3 - row0;
+		planes[2] = row3 + row1;
+		planes[3] = row3 - row1;
+		planes[4] = row3 + row2;
+		planes[5] = row3 - row2;
+
+		for (int i = 0; i < 6; i++) {
+			planes[i] /= length(vec3(planes[i]));
+		}
+	}
+
+	bool sphereInFrustum(const vec4 planes[6], const vec3& center, float radius)
+	{
+		for (int i = 0; i < 6; i++) {
+			if (dot(vec3(planes[i]), center) + planes[i].w < -radius) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	bool boxInFrustum(const vec4 planes[6], const vec3& boxMin, const vec3& boxMax)
+	{
+		// Only the corner furthest along each plane's normal has to be tested
+		for (int i = 0; i < 6; i++) {
+			vec3 corner(planes[i].x >= 0.0f ? boxMax.x : boxMin.x,
+				planes[i].y >= 0.0f ? boxMax.y : boxMin.y,
+				planes[i].z >= 0.0f ? boxMax.z : boxMin.z);
+			if (dot(vec3(planes[i]), corner) + planes[i].w < 0.0f) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	bool boxInSphere(const vec3& boxMin, const vec3& boxMax, const vec3& center, float radius)
+	{
+		vec3 nearest = clamp(center, boxMin, boxMax);
+		vec3 offset = nearest - center;
+		return dot(offset, offset) <= radius * radius;
+	}
 }
@@ -11,4 +11,16 @@ namespace maths
 	mat4 lookAt(const vec3& eye, const vec3& target, const vec3& up);
 
 	float* perspective(float fovy, float aspect, float near, float far);
+
+	// Normalised left, right, bottom, top, near and far planes of a view projection matrix,
+	// with normals pointing into the frustum
+	void frustumPlanes(const mat4& viewProjection, vec4 planes[6]);
+
+	bool sphereInFrustum(const vec4 planes[6], const vec3& center, float radius);
+
+	// False only when the box is wholly behind one of the planes, which need not be normalised
+	bool boxInFrustum(const vec4 planes[6], const vec3& boxMin, const vec3& boxMax);
+
+	// True when any part of the box is within radius of center
+	bool boxInSphere(const vec3& boxMin, const vec3& boxMax, const vec3& center, float radius);
 }
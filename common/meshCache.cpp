@@ -0,0 +1,170 @@
+#include "meshCache.hpp"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+namespace
+{
+	const char MESH_CACHE_MAGIC[4] = { 'C', 'G', 'M', 'S' };
+
+	// Bump whenever the layout below or the mesh processing that produced it changes
+	const uint32_t MESH_CACHE_VERSION = 6;
+
+	// File layout: header, vertex block, index block, meshlet block, each block 16 byte aligned
+	struct MeshCacheHeader
+	{
+		char magic[4];
+		uint32_t version;
+		uint64_t sourceSize;
+		uint64_t sourceHash;
+		uint32_t vertexCount;
+		uint32_t vertexStride;
+		uint32_t indexCount;
+		uint32_t indexSize;
+		float boundsMin[3];
+		float boundsMax[3];
+		uint64_t vertexOffset;
+		uint64_t indexOffset;
+		uint32_t lodCount;
+		MeshLod lods[MAX_MESH_LODS];
+		uint32_t meshletCount;
+		uint32_t meshletStride;
+		uint64_t meshletOffset;
+	};
+
+	inline uint64_t alignUp(uint64_t value)
+	{
+		return (value + 15) & ~(uint64_t)15;
+	}
+}
+
+namespace meshCache
+{
+	std::string getCachePath(const char* sourcePath)
+	{
+		std::string path(sourcePath);
+		size_t dot = path.find_last_of('.');
+		size_t slash = path.find_last_of("/\\");
+		if (dot != std::string::npos && (slash == std::string::npos || dot > slash)) {
+			path.erase(dot);
+		}
+		return path + ".cgmesh";
+	}
+
+	bool open(const std::string& cachePath, unsigned long long sourceSize, unsigned long long sourceHash,
+		MappedFile& file, MeshBuffers& buffers)
+	{
+		if (!file.open(cachePath.c_str())) {
+			return false;
+		}
+
+		if (file.size() < sizeof(MeshCacheHeader)) {
+			file.close();
+			return false;
+		}
+
+		MeshCacheHeader header;
+		memcpy(&header, file.data(), sizeof(header));
+
+		const uint64_t vertexBytes = (uint64_t)header.vertexCount * header.vertexStride;
+		const uint64_t indexBytes = (uint64_t)header.indexCount * header.indexSize;
+		const uint64_t meshletBytes = (uint64_t)header.meshletCount * header.meshletStride;
+		bool valid = memcmp(header.magic, MESH_CACHE_MAGIC, sizeof(header.magic)) == 0
+			&& header.version == MESH_CACHE_VERSION
+			&& header.sourceSize == sourceSize
+			&& header.sourceHash == sourceHash
+			&& header.vertexStride == sizeof(PackedVertex)
+			&& (header.indexSize == 2 || header.indexSize == 4)
+			&& header.vertexOffset >= sizeof(header)
+			&& header.vertexOffset + vertexBytes <= file.size()
+			&& header.indexOffset >= header.vertexOffset + vertexBytes
+			&& header.indexOffset + indexBytes <= file.size()
+			&& header.meshletStride == sizeof(Meshlet)
+			&& header.meshletOffset >= header.indexOffset + indexBytes
+			&& header.meshletOffset + meshletBytes <= file.size()
+			&& header.lodCount >= 1 && header.lodCount <= MAX_MESH_LODS;
+		for (uint32_t i = 0; valid && i < header.lodCount; i++) {
+			valid = header.lods[i].indexOffset <= header.indexCount
+				&& header.lods[i].indexCount <= header.indexCount - header.lods[i].indexOffset
+				&& header.lods[i].meshletOffset <= header.meshletCount
+				&& header.lods[i].meshletCount <= header.meshletCount - header.lods[i].meshletOffset;
+		}
+		if (!valid) {
+			file.close();
+			return false;
+		}
+
+		buffers.vertices = (const PackedVertex*)(file.data() + header.vertexOffset);
+		buffers.vertexCount = header.vertexCount;
+		buffers.indices = file.data() + header.indexOffset;
+		buffers.indexCount = header.indexCount;
+		buffers.indexSize = header.indexSize;
+		buffers.boundsMin = glm::vec3(header.boundsMin[0], header.boundsMin[1], header.boundsMin[2]);
+		buffers.boundsMax = glm::vec3(header.boundsMax[0], header.boundsMax[1], header.boundsMax[2]);
+		buffers.lodCount = header.lodCount;
+		memcpy(buffers.lods, header.lods, sizeof(header.lods));
+		buffers.meshlets = (const Meshlet*)(file.data() + header.meshletOffset);
+		buffers.meshletCount = header.meshletCount;
+		return true;
+	}
+
+	bool write(const std::string& cachePath, unsigned long long sourceSize, unsigned long long sourceHash,
+		const MeshBuffers& buffers)
+	{
+		MeshCacheHeader header;
+		memset(&header, 0, sizeof(header));
+		memcpy(header.magic, MESH_CACHE_MAGIC, sizeof(header.magic));
+		header.version = MESH_CACHE_VERSION;
+		header.sourceSize = sourceSize;
+		header.sourceHash = sourceHash;
+		header.vertexCount = buffers.vertexCount;
+		header.vertexStride = sizeof(PackedVertex);
+		header.indexCount = buffers.indexCount;
+		header.indexSize = buffers.indexSize;
+		for (int i = 0; i < 3; i++) {
+			header.boundsMin[i] = buffers.boundsMin[i];
+			header.boundsMax[i] = buffers.boundsMax[i];
+		}
+		header.lodCount = buffers.lodCount;
+		memcpy(header.lods, buffers.lods, sizeof(header.lods));
+		header.meshletCount = buffers.meshletCount;
+		header.meshletStride = sizeof(Meshlet);
+
+		const uint64_t vertexBytes = (uint64_t)buffers.vertexCount * sizeof(PackedVertex);
+		const uint64_t indexBytes = (uint64_t)buffers.indexCount * buffers.indexSize;
+		const uint64_t meshletBytes = (uint64_t)buffers.meshletCount * sizeof(Meshlet);
+		header.vertexOffset = alignUp(sizeof(header));
+		header.indexOffset = alignUp(header.vertexOffset + vertexBytes);
+		header.meshletOffset = alignUp(header.indexOffset + indexBytes);
+
+		// Write to a temporary file first so a crash never leaves a truncated cache behind
+		std::string tempPath = cachePath + ".tmp";
+		FILE* file = fopen(tempPath.c_str(), "wb");
+		if (!file) {
+			return false;
+		}
+
+		static const unsigned char padding[16] = { 0 };
+		bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+		ok = ok && fwrite(padding, 1, header.vertexOffset - sizeof(header), file) == header.vertexOffset - sizeof(header);
+		ok = ok && (vertexBytes == 0 || fwrite(buffers.vertices, vertexBytes, 1, file) == 1);
+		ok = ok && fwrite(padding, 1, header.indexOffset - header.vertexOffset - vertexBytes, file) == header.indexOffset - header.vertexOffset - vertexBytes;
+		ok = ok && (indexBytes == 0 || fwrite(buffers.indices, indexBytes, 1, file) == 1);
+		ok = ok && fwrite(padding, 1, header.meshletOffset - header.indexOffset - indexBytes, file) == header.meshletOffset - header.indexOffset - indexBytes;
+		ok = ok && (meshletBytes == 0 || fwrite(buffers.meshlets, meshletBytes, 1, file) == 1);
+		ok = (fclose(file) == 0) && ok;
+
+		if (!ok) {
+			remove(tempPath.c_str());
+			return false;
+		}
+
+		remove(cachePath.c_str());
+		if (rename(tempPath.c_str(), cachePath.c_str()) != 0) {
+			remove(tempPath.c_str());
+			return false;
+		}
+		return true;
+	}
+}
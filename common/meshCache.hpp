@@ -0,0 +1,52 @@
+#pragma once
+#include <string>
+#include <cstddef>
+
+#include <glm/glm.hpp>
+
+#include "mappedFile.hpp"
+#include "vertexFormat.hpp"
+#include "meshlets.hpp"
+
+const unsigned int MAX_MESH_LODS = 5;
+
+// Range of the index buffer drawn for one level of detail, and the meshlets that cover it
+struct MeshLod
+{
+	unsigned int indexOffset;
+	unsigned int indexCount;
+	float error;				// largest deviation from the full mesh, in model units
+	unsigned int meshletOffset;
+	unsigned int meshletCount;
+};
+
+// GPU ready mesh data, either built from an .obj or pointing into a mapped .cgmesh file,
+// the vertices are quantised against boundsMin and boundsMax
+struct MeshBuffers
+{
+	const PackedVertex* vertices;
+	unsigned int vertexCount;
+	const void* indices;
+	unsigned int indexCount;
+	unsigned int indexSize;		// 2 or 4 bytes
+	glm::vec3 boundsMin;
+	glm::vec3 boundsMax;
+	unsigned int lodCount;
+	MeshLod lods[MAX_MESH_LODS];	// finest first, all sharing the vertex buffer
+	const Meshlet* meshlets;
+	unsigned int meshletCount;
+};
+
+// Binary mesh cache stored next to the source asset, e.g. rock.obj -> rock.cgmesh
+namespace meshCache
+{
+	std::string getCachePath(const char* sourcePath);
+
+	// Map a cache file and point buffers at its contents, fails if it is missing, corrupt,
+	// from another format version or was built from a different source file
+	bool open(const std::string& cachePath, unsigned long long sourceSize, unsigned long long sourceHash,
+		MappedFile& file, MeshBuffers& buffers);
+
+	bool write(const std::string& cachePath, unsigned long long sourceSize, unsigned long long sourceHash,
+		const MeshBuffers& buffers);
+}
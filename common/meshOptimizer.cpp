@@ -0,0 +1,334 @@
+#include "meshOptimizer.hpp"
+
+#include <algorithm>
+#include <stdio.h>
+
+namespace
+{
+	const unsigned int UNUSED_VERTEX = 0xffffffffu;
+
+	// FIFO cache simulated with insertion timestamps: a vertex is resident while fewer than
+	// cacheSize other vertices have been inserted after it
+	inline unsigned int touchVertex(unsigned int v, std::vector<unsigned int>& cacheTime, unsigned int& timestamp, unsigned int cacheSize)
+	{
+		if (timestamp - cacheTime[v] > cacheSize) {
+			cacheTime[v] = timestamp++;
+			return 1;
+		}
+		return 0;
+	}
+
+	inline unsigned int touchTriangle(const unsigned int* triangle, std::vector<unsigned int>& cacheTime, unsigned int& timestamp, unsigned int cacheSize)
+	{
+		return touchVertex(triangle[0], cacheTime, timestamp, cacheSize)
+			+ touchVertex(triangle[1], cacheTime, timestamp, cacheSize)
+			+ touchVertex(triangle[2], cacheTime, timestamp, cacheSize);
+	}
+
+	// Next vertex to fan around once none of the recently emitted vertices still has triangles
+	int skipDeadEnd(std::vector<unsigned int>& deadEnd, const std::vector<unsigned int>& live, unsigned int& cursor)
+	{
+		while (!deadEnd.empty()) {
+			unsigned int v = deadEnd.back();
+			deadEnd.pop_back();
+			if (live[v] > 0) {
+				return (int)v;
+			}
+		}
+
+		for (; cursor < live.size(); cursor++) {
+			if (live[cursor] > 0) {
+				return (int)cursor;
+			}
+		}
+
+		return -1;
+	}
+
+	struct Cluster
+	{
+		unsigned int start;
+		unsigned int end;
+		float sortKey;
+	};
+
+	bool drawsBefore(const Cluster& a, const Cluster& b)
+	{
+		return a.sortKey > b.sortKey;
+	}
+}
+
+namespace meshOptimizer
+{
+	VertexCacheStats analyzeVertexCache(const std::vector<unsigned int>& indices, size_t vertexCount, unsigned int cacheSize)
+	{
+		std::vector<unsigned int> cacheTime(vertexCount, 0);
+		std::vector<unsigned char> referenced(vertexCount, 0);
+		unsigned int timestamp = cacheSize + 1;
+
+		VertexCacheStats stats;
+		stats.misses = 0;
+		for (size_t i = 0; i < indices.size(); i++) {
+			stats.misses += touchVertex(indices[i], cacheTime, timestamp, cacheSize);
+			referenced[indices[i]] = 1;
+		}
+
+		size_t numReferenced = std::count(referenced.begin(), referenced.end(), 1);
+		size_t numTriangles = indices.size() / 3;
+		stats.acmr = numTriangles ? (float)stats.misses / numTriangles : 0.0f;
+		stats.atvr = numReferenced ? (float)stats.misses / numReferenced : 0.0f;
+		return stats;
+	}
+
+	void optimizeVertexCache(std::vector<unsigned int>& indices, size_t vertexCount, unsigned int cacheSize)
+	{
+		const size_t numTriangles = indices.size() / 3;
+		if (numTriangles == 0 || vertexCount == 0) {
+			return;
+		}
+
+		// Triangles that use each vertex, stored as one array with per vertex offsets
+		std::vector<unsigned int> offsets(vertexCount + 1, 0);
+		for (size_t i = 0; i < indices.size(); i++) {
+			offsets[indices[i] + 1]++;
+		}
+		for (size_t v = 0; v < vertexCount; v++) {
+			offsets[v + 1] += offsets[v];
+		}
+
+		std::vector<unsigned int> adjacency(indices.size());
+		std::vector<unsigned int> fill(offsets.begin(), offsets.end() - 1);
+		for (size_t i = 0; i < indices.size(); i++) {
+			adjacency[fill[indices[i]]++] = (unsigned int)(i / 3);
+		}
+
+		// Number of triangles still to be emitted for each vertex
+		std::vector<unsigned int> live(vertexCount);
+		for (size_t v = 0; v < vertexCount; v++) {
+			live[v] = offsets[v + 1] - offsets[v];
+		}
+
+		std::vector<unsigned int> cacheTime(vertexCount, 0);
+		std::vector<unsigned char> emitted(numTriangles, 0);
+		std::vector<unsigned int> deadEnd;
+		std::vector<unsigned int> candidates;
+		std::vector<unsigned int> result;
+		deadEnd.reserve(indices.size());
+		result.reserve(indices.size());
+
+		unsigned int timestamp = cacheSize + 1;
+		unsigned int cursor = 0;
+		int fanning = 0;
+
+		while (fanning >= 0) {
+			// Emit every remaining triangle around the fanning vertex
+			candidates.clear();
+			for (unsigned int a = offsets[fanning]; a < offsets[fanning + 1]; a++) {
+				unsigned int t = adjacency[a];
+				if (emitted[t]) {
+					continue;
+				}
+
+				for (unsigned int k = 0; k < 3; k++) {
+					unsigned int v = indices[t * 3 + k];
+					result.push_back(v);
+					deadEnd.push_back(v);
+					candidates.push_back(v);
+					live[v]--;
+					touchVertex(v, cacheTime, timestamp, cacheSize);
+				}
+				emitted[t] = 1;
+			}
+
+			// Prefer the oldest candidate that will still be in the cache after its remaining triangles are emitted
+			int best = -1;
+			int bestPriority = -1;
+			for (size_t c = 0; c < candidates.size(); c++) {
+				unsigned int v = candidates[c];
+				if (live[v] == 0) {
+					continue;
+				}
+
+				int priority = 0;
+				unsigned int age = timestamp - cacheTime[v];
+				if (age + 2 * live[v] <= cacheSize) {
+					priority = (int)age;
+				}
+				if (priority > bestPriority) {
+					bestPriority = priority;
+					best = (int)v;
+				}
+			}
+
+			fanning = (best >= 0) ? best : skipDeadEnd(deadEnd, live, cursor);
+		}
+
+		indices.swap(result);
+	}
+
+	void optimizeOverdraw(std::vector<unsigned int>& indices, const std::vector<glm::vec3>& positions,
+		float threshold, unsigned int cacheSize)
+	{
+		const unsigned int numTriangles = (unsigned int)(indices.size() / 3);
+		if (numTriangles == 0) {
+			return;
+		}
+
+		std::vector<unsigned int> cacheTime(positions.size(), 0);
+		unsigned int timestamp = cacheSize + 1;
+
+		// Hard boundaries where the cache was effectively flushed because every vertex of the triangle missed
+		std::vector<unsigned int> hardBoundaries;
+		for (unsigned int t = 0; t < numTriangles; t++) {
+			unsigned int misses = touchTriangle(&indices[t * 3], cacheTime, timestamp, cacheSize);
+			if (t == 0 || misses == 3) {
+				hardBoundaries.push_back(t);
+			}
+		}
+
+		// Soft boundaries: close a cluster as soon as its running ACMR is within the threshold of the whole hard cluster
+		std::vector<unsigned int> boundaries;
+		for (size_t h = 0; h < hardBoundaries.size(); h++) {
+			unsigned int start = hardBoundaries[h];
+			unsigned int end = (h + 1 < hardBoundaries.size()) ? hardBoundaries[h + 1] : numTriangles;
+
+			timestamp += cacheSize + 1;
+			unsigned int clusterMisses = 0;
+			for (unsigned int t = start; t < end; t++) {
+				clusterMisses += touchTriangle(&indices[t * 3], cacheTime, timestamp, cacheSize);
+			}
+			float targetAcmr = threshold * clusterMisses / (float)(end - start);
+
+			boundaries.push_back(start);
+			timestamp += cacheSize + 1;
+			unsigned int runningMisses = 0;
+			unsigned int runningTriangles = 0;
+			for (unsigned int t = start; t < end; t++) {
+				runningMisses += touchTriangle(&indices[t * 3], cacheTime, timestamp, cacheSize);
+				runningTriangles++;
+				if (runningMisses <= targetAcmr * runningTriangles) {
+					boundaries.push_back(t + 1);
+					timestamp += cacheSize + 1;
+					runningMisses = 0;
+					runningTriangles = 0;
+				}
+			}
+
+			// The last piece is usually a poor cluster on its own, merge it into the one before
+			if (boundaries.back() != start) {
+				boundaries.pop_back();
+			}
+		}
+
+		// Area weighted centroid of the whole mesh
+		glm::vec3 meshCentroid(0.0f);
+		float meshArea = 0.0f;
+		for (unsigned int t = 0; t < numTriangles; t++) {
+			const glm::vec3& p0 = positions[indices[t * 3 + 0]];
+			const glm::vec3& p1 = positions[indices[t * 3 + 1]];
+			const glm::vec3& p2 = positions[indices[t * 3 + 2]];
+			float area = glm::length(glm::cross(p1 - p0, p2 - p0));
+			meshCentroid += (p0 + p1 + p2) * (area / 3.0f);
+			meshArea += area;
+		}
+		if (meshArea > 0.0f) {
+			meshCentroid /= meshArea;
+		}
+
+		// Clusters that face away from the centre occlude the rest, so they are drawn first
+		std::vector<Cluster> clusters(boundaries.size());
+		for (size_t c = 0; c < boundaries.size(); c++) {
+			Cluster& cluster = clusters[c];
+			cluster.start = boundaries[c];
+			cluster.end = (c + 1 < boundaries.size()) ? boundaries[c + 1] : numTriangles;
+
+			glm::vec3 centroid(0.0f), normal(0.0f);
+			float area = 0.0f;
+			for (unsigned int t = cluster.start; t < cluster.end; t++) {
+				const glm::vec3& p0 = positions[indices[t * 3 + 0]];
+				const glm::vec3& p1 = positions[indices[t * 3 + 1]];
+				const glm::vec3& p2 = positions[indices[t * 3 + 2]];
+				glm::vec3 faceNormal = glm::cross(p1 - p0, p2 - p0);
+				float faceArea = glm::length(faceNormal);
+				centroid += (p0 + p1 + p2) * (faceArea / 3.0f);
+				normal += faceNormal;
+				area += faceArea;
+			}
+			if (area > 0.0f) {
+				centroid /= area;
+			}
+
+			float normalLength = glm::length(normal);
+			cluster.sortKey = normalLength > 0.0f ? glm::dot(centroid - meshCentroid, normal) / normalLength : 0.0f;
+		}
+		std::stable_sort(clusters.begin(), clusters.end(), drawsBefore);
+
+		std::vector<unsigned int> result;
+		result.reserve(indices.size());
+		for (size_t c = 0; c < clusters.size(); c++) {
+			result.insert(result.end(), indices.begin() + clusters[c].start * 3, indices.begin() + clusters[c].end * 3);
+		}
+		indices.swap(result);
+	}
+
+	std::vector<unsigned int> optimizeVertexFetch(std::vector<unsigned int>& indices, size_t vertexCount)
+	{
+		std::vector<unsigned int> remap(vertexCount, UNUSED_VERTEX);
+		unsigned int next = 0;
+
+		for (size_t i = 0; i < indices.size(); i++) {
+			unsigned int& v = indices[i];
+			if (remap[v] == UNUSED_VERTEX) {
+				remap[v] = next++;
+			}
+			v = remap[v];
+		}
+
+		for (size_t v = 0; v < vertexCount; v++) {
+			if (remap[v] == UNUSED_VERTEX) {
+				remap[v] = next++;
+			}
+		}
+
+		return remap;
+	}
+
+	std::vector<unsigned int> optimize(std::vector<unsigned int>& indices, const std::vector<glm::vec3>& positions, const char* name)
+	{
+		VertexCacheStats before = analyzeVertexCache(indices, positions.size());
+
+		optimizeVertexCache(indices, positions.size());
+		optimizeOverdraw(indices, positions);
+		std::vector<unsigned int> remap = optimizeVertexFetch(indices, positions.size());
+
+		VertexCacheStats after = analyzeVertexCache(indices, positions.size());
+		printf("Optimised %s for a %u entry vertex cache: ACMR %.3f -> %.3f, ATVR %.3f -> %.3f\n",
+			name, CACHE_SIZE, before.acmr, after.acmr, before.atvr, after.atvr);
+
+		return remap;
+	}
+
+	std::vector<unsigned int> stripToList(const std::vector<unsigned int>& strip)
+	{
+		std::vector<unsigned int> list;
+		if (strip.size() < 3) {
+			return list;
+		}
+
+		list.reserve((strip.size() - 2) * 3);
+		for (size_t i = 0; i + 2 < strip.size(); i++) {
+			// Every other strip triangle has reversed winding
+			unsigned int a = strip[i + ((i & 1) ? 1 : 0)];
+			unsigned int b = strip[i + ((i & 1) ? 0 : 1)];
+			unsigned int c = strip[i + 2];
+			if (a == b || b == c || a == c) {
+				continue;
+			}
+			list.push_back(a);
+			list.push_back(b);
+			list.push_back(c);
+		}
+
+		return list;
+	}
+}
@@ -0,0 +1,51 @@
+#pragma once
+#include <vector>
+#include <cstddef>
+
+#include <glm/glm.hpp>
+
+// Triangle and vertex reordering passes for indexed triangle lists
+namespace meshOptimizer
+{
+	// FIFO post-transform cache size the passes optimise for and the report simulates
+	const unsigned int CACHE_SIZE = 16;
+
+	struct VertexCacheStats
+	{
+		unsigned int misses;
+		float acmr;		// average cache misses per triangle, 0.5 is ideal for a regular grid
+		float atvr;		// average transforms per referenced vertex, 1.0 is ideal
+	};
+
+	VertexCacheStats analyzeVertexCache(const std::vector<unsigned int>& indices, size_t vertexCount, unsigned int cacheSize = CACHE_SIZE);
+
+	// Tipsify triangle order (Sander et al. 2007), linear time
+	void optimizeVertexCache(std::vector<unsigned int>& indices, size_t vertexCount, unsigned int cacheSize = CACHE_SIZE);
+
+	// Split cache optimised triangles into clusters and draw the outward facing ones first,
+	// allowing cluster ACMR to grow by at most the threshold factor
+	void optimizeOverdraw(std::vector<unsigned int>& indices, const std::vector<glm::vec3>& positions,
+		float threshold = 1.05f, unsigned int cacheSize = CACHE_SIZE);
+
+	// Renumber vertices in the order the index list first uses them, returns the old to new index map
+	// (unreferenced vertices are moved to the end)
+	std::vector<unsigned int> optimizeVertexFetch(std::vector<unsigned int>& indices, size_t vertexCount);
+
+	// Reorder a vertex array with a map from optimizeVertexFetch
+	template <typename T>
+	void remapVertices(std::vector<T>& vertices, const std::vector<unsigned int>& remap)
+	{
+		std::vector<T> result(vertices.size());
+		for (size_t i = 0; i < vertices.size(); i++) {
+			result[remap[i]] = vertices[i];
+		}
+		vertices.swap(result);
+	}
+
+	// Run all three passes and print the ACMR/ATVR before and after,
+	// the vertex arrays must then be reordered with remapVertices
+	std::vector<unsigned int> optimize(std::vector<unsigned int>& indices, const std::vector<glm::vec3>& positions, const char* name);
+
+	// Convert GL_TRIANGLE_STRIP indices to a triangle list, dropping degenerate triangles
+	std::vector<unsigned int> stripToList(const std::vector<unsigned int>& strip);
+}
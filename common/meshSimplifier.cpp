@@ -0,0 +1,526 @@
+#include "meshSimplifier.hpp"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+namespace
+{
+	const unsigned int NO_EDGE = 0xffffffffu;
+	const unsigned int MULTIPLE_EDGES = 0xfffffffeu;
+
+	// Open edges are weighted up so borders and seams keep their shape
+	const float BORDER_WEIGHT = 2.0f;
+
+	enum VertexKind
+	{
+		KIND_MANIFOLD,	// interior vertex, collapses onto any neighbour
+		KIND_BORDER,	// on an open edge of the mesh, collapses along the border
+		KIND_SEAM,		// one of two wedges with different attributes, collapses along the seam
+		KIND_LOCKED		// corners and anything more complex never move
+	};
+
+	// Symmetric 4x4 error matrix stored as its 10 unique entries plus the accumulated weight
+	struct Quadric
+	{
+		float a00, a11, a22;
+		float a10, a20, a21;
+		float b0, b1, b2;
+		float c;
+		float w;
+	};
+
+	struct Collapse
+	{
+		unsigned int v0;
+		unsigned int v1;
+		float error;
+	};
+
+	// Outgoing half edges of each vertex
+	struct EdgeAdjacency
+	{
+		std::vector<unsigned int> offsets;
+		std::vector<unsigned int> targets;
+	};
+
+	Quadric planeQuadric(const glm::vec3& normal, float distance, float weight)
+	{
+		Quadric q;
+		q.a00 = normal.x * normal.x * weight;
+		q.a11 = normal.y * normal.y * weight;
+		q.a22 = normal.z * normal.z * weight;
+		q.a10 = normal.y * normal.x * weight;
+		q.a20 = normal.z * normal.x * weight;
+		q.a21 = normal.z * normal.y * weight;
+		q.b0 = normal.x * distance * weight;
+		q.b1 = normal.y * distance * weight;
+		q.b2 = normal.z * distance * weight;
+		q.c = distance * distance * weight;
+		q.w = weight;
+		return q;
+	}
+
+	void addQuadric(Quadric& q, const Quadric& r)
+	{
+		q.a00 += r.a00;
+		q.a11 += r.a11;
+		q.a22 += r.a22;
+		q.a10 += r.a10;
+		q.a20 += r.a20;
+		q.a21 += r.a21;
+		q.b0 += r.b0;
+		q.b1 += r.b1;
+		q.b2 += r.b2;
+		q.c += r.c;
+		q.w += r.w;
+	}
+
+	// Weighted mean squared distance from p to the planes in the quadric
+	float quadricError(const Quadric& q, const glm::vec3& p)
+	{
+		float e = q.a00 * p.x * p.x + q.a11 * p.y * p.y + q.a22 * p.z * p.z
+			+ 2.0f * (q.a10 * p.x * p.y + q.a20 * p.x * p.z + q.a21 * p.y * p.z)
+			+ 2.0f * (q.b0 * p.x + q.b1 * p.y + q.b2 * p.z)
+			+ q.c;
+		return q.w > 0.0f ? fabsf(e) / q.w : 0.0f;
+	}
+
+	void buildEdgeAdjacency(EdgeAdjacency& adjacency, const std::vector<unsigned int>& indices, size_t vertexCount)
+	{
+		adjacency.offsets.assign(vertexCount + 1, 0);
+		for (size_t i = 0; i < indices.size(); i++) {
+			adjacency.offsets[indices[i] + 1]++;
+		}
+		for (size_t v = 0; v < vertexCount; v++) {
+			adjacency.offsets[v + 1] += adjacency.offsets[v];
+		}
+
+		adjacency.targets.resize(indices.size());
+		std::vector<unsigned int> fill(adjacency.offsets.begin(), adjacency.offsets.end() - 1);
+		for (size_t i = 0; i < indices.size(); i += 3) {
+			for (int k = 0; k < 3; k++) {
+				unsigned int a = indices[i + k];
+				unsigned int b = indices[i + (k + 1) % 3];
+				adjacency.targets[fill[a]++] = b;
+			}
+		}
+	}
+
+	bool hasEdge(const EdgeAdjacency& adjacency, unsigned int a, unsigned int b)
+	{
+		for (unsigned int e = adjacency.offsets[a]; e < adjacency.offsets[a + 1]; e++) {
+			if (adjacency.targets[e] == b) {
+				return true;
+			}
+		}
+		return false;
+	}
+
+	// An edge used by only one triangle, in either direction
+	bool isOpenEdge(const EdgeAdjacency& adjacency, unsigned int a, unsigned int b)
+	{
+		return hasEdge(adjacency, a, b) != hasEdge(adjacency, b, a);
+	}
+
+	inline bool isSingleEdge(unsigned int edge)
+	{
+		return edge != NO_EDGE && edge != MULTIPLE_EDGES;
+	}
+
+	// remap points every vertex at the first vertex with the same position,
+	// wedge links the vertices sharing a position into a loop
+	void buildPositionRemap(const std::vector<glm::vec3>& positions,
+		std::vector<unsigned int>& remap, std::vector<unsigned int>& wedge)
+	{
+		std::vector<unsigned int> order(positions.size());
+		for (size_t i = 0; i < order.size(); i++) {
+			order[i] = (unsigned int)i;
+		}
+
+		struct PositionLess
+		{
+			const std::vector<glm::vec3>* positions;
+			bool operator()(unsigned int a, unsigned int b) const
+			{
+				const glm::vec3& pa = (*positions)[a];
+				const glm::vec3& pb = (*positions)[b];
+				if (pa.x != pb.x) return pa.x < pb.x;
+				if (pa.y != pb.y) return pa.y < pb.y;
+				if (pa.z != pb.z) return pa.z < pb.z;
+				return a < b;
+			}
+		};
+		PositionLess less = { &positions };
+		std::sort(order.begin(), order.end(), less);
+
+		remap.resize(positions.size());
+		wedge.resize(positions.size());
+		for (size_t start = 0; start < order.size();) {
+			size_t end = start + 1;
+			while (end < order.size() && positions[order[end]] == positions[order[start]]) {
+				end++;
+			}
+			for (size_t i = start; i < end; i++) {
+				remap[order[i]] = order[start];
+				wedge[order[i]] = order[(i + 1 < end) ? i + 1 : start];
+			}
+			start = end;
+		}
+	}
+
+	void classifyVertices(const std::vector<unsigned int>& indices, const std::vector<unsigned int>& remap,
+		const std::vector<unsigned int>& wedge, std::vector<unsigned char>& kinds)
+	{
+		const size_t vertexCount = remap.size();
+		EdgeAdjacency adjacency;
+		buildEdgeAdjacency(adjacency, indices, vertexCount);
+
+		// The single open edge leaving and entering each vertex, if there is exactly one
+		std::vector<unsigned int> openOut(vertexCount, NO_EDGE);
+		std::vector<unsigned int> openIn(vertexCount, NO_EDGE);
+		for (unsigned int a = 0; a < vertexCount; a++) {
+			for (unsigned int e = adjacency.offsets[a]; e < adjacency.offsets[a + 1]; e++) {
+				unsigned int b = adjacency.targets[e];
+				if (!hasEdge(adjacency, b, a)) {
+					openOut[a] = (openOut[a] == NO_EDGE) ? b : MULTIPLE_EDGES;
+					openIn[b] = (openIn[b] == NO_EDGE) ? a : MULTIPLE_EDGES;
+				}
+			}
+		}
+
+		kinds.assign(vertexCount, KIND_LOCKED);
+		for (unsigned int v = 0; v < vertexCount; v++) {
+			if (remap[v] != v) {
+				continue;
+			}
+
+			unsigned char kind = KIND_LOCKED;
+			unsigned int w = wedge[v];
+			if (w == v) {
+				if (openOut[v] == NO_EDGE && openIn[v] == NO_EDGE) {
+					kind = KIND_MANIFOLD;
+				}
+				else if (isSingleEdge(openOut[v]) && isSingleEdge(openIn[v])) {
+					kind = KIND_BORDER;
+				}
+			}
+			else if (wedge[w] == v) {
+				// Both wedges run along the same two neighbouring positions in opposite directions
+				if (isSingleEdge(openOut[v]) && isSingleEdge(openIn[v]) && isSingleEdge(openOut[w]) && isSingleEdge(openIn[w])
+					&& remap[openOut[v]] == remap[openIn[w]] && remap[openIn[v]] == remap[openOut[w]]) {
+					kind = KIND_SEAM;
+				}
+			}
+
+			unsigned int s = v;
+			do {
+				kinds[s] = kind;
+				s = wedge[s];
+			} while (s != v);
+		}
+	}
+
+	bool canCollapse(const std::vector<unsigned char>& kinds, const EdgeAdjacency& adjacency, unsigned int v0, unsigned int v1)
+	{
+		switch (kinds[v0]) {
+		case KIND_MANIFOLD:
+			return true;
+		case KIND_BORDER:
+			return (kinds[v1] == KIND_BORDER || kinds[v1] == KIND_LOCKED) && isOpenEdge(adjacency, v0, v1);
+		case KIND_SEAM:
+			return (kinds[v1] == KIND_SEAM || kinds[v1] == KIND_LOCKED) && isOpenEdge(adjacency, v0, v1);
+		default:
+			return false;
+		}
+	}
+
+	// Wedge of v1's position joined to s by an edge, the wedge s should collapse onto
+	unsigned int findWedgeTarget(const EdgeAdjacency& adjacency, const std::vector<unsigned int>& wedge, unsigned int s, unsigned int v1)
+	{
+		unsigned int t = v1;
+		do {
+			if (hasEdge(adjacency, s, t) || hasEdge(adjacency, t, s)) {
+				return t;
+			}
+			t = wedge[t];
+		} while (t != v1);
+		return NO_EDGE;
+	}
+
+	// Moving v0 onto v1 must not turn any of the remaining triangles around v0 over
+	bool flipsTriangle(const std::vector<unsigned int>& indices, const std::vector<glm::vec3>& positions,
+		const std::vector<unsigned int>& remap, const std::vector<unsigned int>& triangleOffsets,
+		const std::vector<unsigned int>& triangles, unsigned int v0, unsigned int v1)
+	{
+		const unsigned int p0 = remap[v0];
+		const unsigned int p1 = remap[v1];
+		const glm::vec3& target = positions[v1];
+
+		for (unsigned int a = triangleOffsets[p0]; a < triangleOffsets[p0 + 1]; a++) {
+			const unsigned int* tri = &indices[triangles[a] * 3];
+			unsigned int r0 = remap[tri[0]], r1 = remap[tri[1]], r2 = remap[tri[2]];
+			if (r0 == p1 || r1 == p1 || r2 == p1) {
+				continue;
+			}
+
+			glm::vec3 q0 = positions[tri[0]], q1 = positions[tri[1]], q2 = positions[tri[2]];
+			glm::vec3 before = glm::cross(q1 - q0, q2 - q0);
+			if (r0 == p0) q0 = target;
+			if (r1 == p0) q1 = target;
+			if (r2 == p0) q2 = target;
+			glm::vec3 after = glm::cross(q1 - q0, q2 - q0);
+			if (glm::dot(before, after) <= 0.0f) {
+				return true;
+			}
+		}
+		return false;
+	}
+}
+
+namespace meshSimplifier
+{
+	std::vector<unsigned int> simplify(const std::vector<unsigned int>& indices, const std::vector<glm::vec3>& inPositions,
+		size_t targetIndexCount, float targetError, float& error)
+	{
+		error = 0.0f;
+		std::vector<unsigned int> result(indices);
+		const size_t vertexCount = inPositions.size();
+		if (vertexCount == 0 || result.size() <= targetIndexCount) {
+			return result;
+		}
+
+		// Work in a unit cube so errors do not depend on the model scale
+		glm::vec3 minCorner = inPositions[0], maxCorner = inPositions[0];
+		for (size_t i = 1; i < vertexCount; i++) {
+			minCorner = glm::min(minCorner, inPositions[i]);
+			maxCorner = glm::max(maxCorner, inPositions[i]);
+		}
+		glm::vec3 size = maxCorner - minCorner;
+		float extent = glm::max(size.x, glm::max(size.y, size.z));
+		float scale = extent > 0.0f ? 1.0f / extent : 0.0f;
+		std::vector<glm::vec3> positions(vertexCount);
+		for (size_t i = 0; i < vertexCount; i++) {
+			positions[i] = (inPositions[i] - minCorner) * scale;
+		}
+
+		std::vector<unsigned int> remap, wedge;
+		buildPositionRemap(positions, remap, wedge);
+
+		std::vector<unsigned char> kinds;
+		classifyVertices(result, remap, wedge, kinds);
+
+		// Face planes weighted by area, plus planes through open edges perpendicular to their face
+		EdgeAdjacency adjacency;
+		buildEdgeAdjacency(adjacency, result, vertexCount);
+		Quadric zero = planeQuadric(glm::vec3(0.0f), 0.0f, 0.0f);
+		std::vector<Quadric> quadrics(vertexCount, zero);
+		for (size_t i = 0; i < result.size(); i += 3) {
+			const glm::vec3& p0 = positions[result[i + 0]];
+			const glm::vec3& p1 = positions[result[i + 1]];
+			const glm::vec3& p2 = positions[result[i + 2]];
+			glm::vec3 normal = glm::cross(p1 - p0, p2 - p0);
+			float area = glm::length(normal);
+			if (area <= 0.0f) {
+				continue;
+			}
+			normal /= area;
+
+			Quadric face = planeQuadric(normal, -glm::dot(normal, p0), area * 0.5f);
+			for (int k = 0; k < 3; k++) {
+				addQuadric(quadrics[remap[result[i + k]]], face);
+			}
+
+			for (int k = 0; k < 3; k++) {
+				unsigned int a = result[i + k];
+				unsigned int b = result[i + (k + 1) % 3];
+				if (hasEdge(adjacency, b, a)) {
+					continue;
+				}
+
+				glm::vec3 edge = positions[b] - positions[a];
+				float length = glm::length(edge);
+				if (length <= 0.0f) {
+					continue;
+				}
+				glm::vec3 edgeNormal = glm::normalize(glm::cross(edge, normal));
+				Quadric border = planeQuadric(edgeNormal, -glm::dot(edgeNormal, positions[a]), length * length * BORDER_WEIGHT);
+				addQuadric(quadrics[remap[a]], border);
+				addQuadric(quadrics[remap[b]], border);
+			}
+		}
+
+		const float errorLimitSquared = (targetError * scale) * (targetError * scale);
+		float resultErrorSquared = 0.0f;
+
+		std::vector<Collapse> collapses;
+		std::vector<unsigned int> collapseOrder;
+		std::vector<unsigned int> collapseRemap(vertexCount);
+		std::vector<unsigned char> locked(vertexCount);
+		std::vector<unsigned int> triangleOffsets;
+		std::vector<unsigned int> triangles;
+		std::vector<unsigned int> wedgeTargets;
+		bool relaxed = false;
+
+		while (result.size() > targetIndexCount) {
+			buildEdgeAdjacency(adjacency, result, vertexCount);
+
+			// Triangles around each position
+			const unsigned int numTriangles = (unsigned int)(result.size() / 3);
+			triangleOffsets.assign(vertexCount + 1, 0);
+			for (size_t i = 0; i < result.size(); i++) {
+				triangleOffsets[remap[result[i]] + 1]++;
+			}
+			for (size_t v = 0; v < vertexCount; v++) {
+				triangleOffsets[v + 1] += triangleOffsets[v];
+			}
+			triangles.resize(result.size());
+			std::vector<unsigned int> fill(triangleOffsets.begin(), triangleOffsets.end() - 1);
+			for (size_t i = 0; i < result.size(); i++) {
+				triangles[fill[remap[result[i]]]++] = (unsigned int)(i / 3);
+			}
+
+			// Cheapest allowed direction of every edge, interior edges are only visited from one side
+			collapses.clear();
+			for (size_t i = 0; i < result.size(); i += 3) {
+				for (int k = 0; k < 3; k++) {
+					unsigned int a = result[i + k];
+					unsigned int b = result[i + (k + 1) % 3];
+					if (a > b && hasEdge(adjacency, b, a)) {
+						continue;
+					}
+
+					Collapse collapse;
+					collapse.error = FLT_MAX;
+					if (canCollapse(kinds, adjacency, a, b)) {
+						collapse.v0 = a;
+						collapse.v1 = b;
+						collapse.error = quadricError(quadrics[remap[a]], positions[b]);
+					}
+					if (canCollapse(kinds, adjacency, b, a)) {
+						float reverseError = quadricError(quadrics[remap[b]], positions[a]);
+						if (reverseError < collapse.error) {
+							collapse.v0 = b;
+							collapse.v1 = a;
+							collapse.error = reverseError;
+						}
+					}
+					if (collapse.error < FLT_MAX) {
+						collapses.push_back(collapse);
+					}
+				}
+			}
+			if (collapses.empty()) {
+				break;
+			}
+
+			collapseOrder.resize(collapses.size());
+			for (size_t c = 0; c < collapses.size(); c++) {
+				collapseOrder[c] = (unsigned int)c;
+			}
+			struct ErrorLess
+			{
+				const std::vector<Collapse>* collapses;
+				bool operator()(unsigned int a, unsigned int b) const
+				{
+					return (*collapses)[a].error < (*collapses)[b].error;
+				}
+			};
+			ErrorLess less = { &collapses };
+			std::sort(collapseOrder.begin(), collapseOrder.end(), less);
+
+			// Most collapses remove two triangles and about half are blocked by a neighbour
+			// collapsing in the same pass, so stop once the pass has gone somewhat past the goal
+			const unsigned int triangleGoal = (unsigned int)((result.size() - targetIndexCount) / 3);
+			const unsigned int edgeGoal = triangleGoal / 2;
+			float passLimit = errorLimitSquared;
+			if (!relaxed && edgeGoal < collapseOrder.size()) {
+				passLimit = glm::min(passLimit, 1.5f * collapses[collapseOrder[edgeGoal]].error);
+			}
+
+			for (size_t v = 0; v < vertexCount; v++) {
+				collapseRemap[v] = (unsigned int)v;
+			}
+			std::fill(locked.begin(), locked.end(), 0);
+
+			unsigned int collapsedTriangles = 0;
+			unsigned int appliedCollapses = 0;
+			for (size_t c = 0; c < collapseOrder.size(); c++) {
+				const Collapse& collapse = collapses[collapseOrder[c]];
+				if (collapse.error > passLimit || collapsedTriangles >= triangleGoal) {
+					break;
+				}
+
+				const unsigned int p0 = remap[collapse.v0];
+				const unsigned int p1 = remap[collapse.v1];
+				if (locked[p0] || locked[p1]) {
+					continue;
+				}
+
+				if (flipsTriangle(result, positions, remap, triangleOffsets, triangles, collapse.v0, collapse.v1)) {
+					continue;
+				}
+
+				// Every wedge of the source position has to land on a wedge of the target
+				wedgeTargets.clear();
+				bool paired = true;
+				unsigned int s = collapse.v0;
+				do {
+					unsigned int t = (s == collapse.v0) ? collapse.v1 : findWedgeTarget(adjacency, wedge, s, collapse.v1);
+					if (t == NO_EDGE) {
+						paired = false;
+						break;
+					}
+					wedgeTargets.push_back(t);
+					s = wedge[s];
+				} while (s != collapse.v0);
+				if (!paired) {
+					continue;
+				}
+
+				s = collapse.v0;
+				for (size_t w = 0; w < wedgeTargets.size(); w++) {
+					collapseRemap[s] = wedgeTargets[w];
+					s = wedge[s];
+				}
+
+				addQuadric(quadrics[p1], quadrics[p0]);
+				locked[p0] = 1;
+				locked[p1] = 1;
+
+				collapsedTriangles += (kinds[collapse.v0] == KIND_MANIFOLD) ? 2 : 1;
+				appliedCollapses++;
+				resultErrorSquared = glm::max(resultErrorSquared, collapse.error);
+			}
+
+			// Cheap collapses that were blocked by flips stay blocked, so when a pass falls well short of
+			// its goal let the next one take anything under the target error
+			if (appliedCollapses == 0) {
+				if (relaxed) {
+					break;
+				}
+				relaxed = true;
+				continue;
+			}
+			relaxed = collapsedTriangles * 10 < triangleGoal;
+
+			// Apply the collapses and drop triangles that became degenerate
+			size_t write = 0;
+			for (unsigned int t = 0; t < numTriangles; t++) {
+				unsigned int a = collapseRemap[result[t * 3 + 0]];
+				unsigned int b = collapseRemap[result[t * 3 + 1]];
+				unsigned int c = collapseRemap[result[t * 3 + 2]];
+				if (remap[a] == remap[b] || remap[b] == remap[c] || remap[a] == remap[c]) {
+					continue;
+				}
+				result[write++] = a;
+				result[write++] = b;
+				result[write++] = c;
+			}
+			result.resize(write);
+		}
+
+		error = extent > 0.0f ? sqrtf(resultErrorSquared) * extent : 0.0f;
+		return result;
+	}
+}
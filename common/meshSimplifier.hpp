@@ -0,0 +1,16 @@
+#pragma once
+#include <vector>
+#include <cstddef>
+
+#include <glm/glm.hpp>
+
+// Quadric error metric edge collapse (Garland and Heckbert 1997) for indexed triangle lists.
+// Vertices only ever collapse onto a neighbour, so the result indexes the original vertex array,
+// and uv seams and open borders only collapse along themselves
+namespace meshSimplifier
+{
+	// Reduce indices towards targetIndexCount without exceeding targetError (in position units),
+	// error receives the largest collapse error that was accepted
+	std::vector<unsigned int> simplify(const std::vector<unsigned int>& indices, const std::vector<glm::vec3>& positions,
+		size_t targetIndexCount, float targetError, float& error);
+}
@@ -0,0 +1,79 @@
+#include "meshWelder.hpp"
+
+namespace
+{
+	const unsigned int EMPTY_SLOT = 0xffffffffu;
+
+	inline unsigned int hashCorner(const ObjIndex& corner)
+	{
+		// Mix the three indices, vt and vn may be -1
+		unsigned int h = (unsigned int)corner.v * 73856093u;
+		h ^= (unsigned int)corner.vt * 19349663u;
+		h ^= (unsigned int)corner.vn * 83492791u;
+		h ^= h >> 15;
+		h *= 0x2c1b3c6du;
+		h ^= h >> 12;
+		return h;
+	}
+
+	inline bool sameCorner(const ObjIndex& a, const ObjIndex& b)
+	{
+		return a.v == b.v && a.vt == b.vt && a.vn == b.vn;
+	}
+}
+
+namespace meshWelder
+{
+	void weld(const ObjData& obj,
+		std::vector<glm::vec3>& positions,
+		std::vector<glm::vec2>& uvs,
+		std::vector<glm::vec3>& normals,
+		std::vector<unsigned int>& indices)
+	{
+		const size_t numCorners = obj.corners.size();
+
+		positions.clear();
+		uvs.clear();
+		normals.clear();
+		indices.resize(numCorners);
+
+		// Open addressing table from corner to vertex, kept at most half full
+		size_t capacity = 16;
+		while (capacity < numCorners * 2) {
+			capacity *= 2;
+		}
+		const size_t mask = capacity - 1;
+		std::vector<unsigned int> table(capacity, EMPTY_SLOT);
+
+		// First corner that produced each unique vertex, used to compare on collision
+		std::vector<unsigned int> firstCorner;
+		firstCorner.reserve(numCorners / 2);
+
+		for (size_t i = 0; i < numCorners; i++) {
+			const ObjIndex& corner = obj.corners[i];
+
+			size_t slot = hashCorner(corner) & mask;
+			while (table[slot] != EMPTY_SLOT && !sameCorner(obj.corners[firstCorner[table[slot]]], corner)) {
+				slot = (slot + 1) & mask;
+			}
+
+			if (table[slot] == EMPTY_SLOT) {
+				table[slot] = (unsigned int)firstCorner.size();
+				firstCorner.push_back((unsigned int)i);
+			}
+			indices[i] = table[slot];
+		}
+
+		// Copy the attributes of each unique vertex
+		const size_t numVertices = firstCorner.size();
+		positions.resize(numVertices);
+		uvs.resize(numVertices);
+		normals.resize(numVertices);
+		for (size_t i = 0; i < numVertices; i++) {
+			const ObjIndex& corner = obj.corners[firstCorner[i]];
+			positions[i] = obj.positions[corner.v];
+			uvs[i] = corner.vt >= 0 ? obj.uvs[corner.vt] : glm::vec2(0.0f);
+			normals[i] = corner.vn >= 0 ? obj.normals[corner.vn] : glm::vec3(0.0f);
+		}
+	}
+}
@@ -0,0 +1,16 @@
+#pragma once
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "objLoader.hpp"
+
+namespace meshWelder
+{
+	// Collapse face corners with identical (v, vt, vn) indices into unique vertices plus an index list
+	void weld(const ObjData& obj,
+		std::vector<glm::vec3>& positions,
+		std::vector<glm::vec2>& uvs,
+		std::vector<glm::vec3>& normals,
+		std::vector<unsigned int>& indices);
+}
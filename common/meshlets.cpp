@@ -0,0 +1,333 @@
+#include "meshlets.hpp"
+#include "maths.hpp"
+
+#include <cfloat>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <unordered_map>
+
+namespace
+{
+	const unsigned int NOT_IN_MESHLET = 0xffffffffu;
+
+	// Cones wider than this many degrees of normal spread are not worth testing
+	const float MIN_CONE_DOT = 0.1f;
+
+	// Slopes of the troughs and ridges checkCones builds, and the grid of camera positions it tries
+	const float CHECK_SLOPES[] = { 0.5f, 1.0f, 2.0f };
+	const float CHECK_EXTENT = 3.0f;
+	const float CHECK_STEP = 0.25f;
+
+	// Map every vertex to the first vertex with the same position, so meshlets can grow across uv seams
+	std::vector<unsigned int> positionIds(const std::vector<glm::vec3>& positions)
+	{
+		struct PositionHash
+		{
+			size_t operator()(const glm::vec3& p) const
+			{
+				unsigned int bits[3];
+				memcpy(bits, &p, sizeof(bits));
+				return (bits[0] * 73856093u) ^ (bits[1] * 19349663u) ^ (bits[2] * 83492791u);
+			}
+		};
+
+		std::vector<unsigned int> ids(positions.size());
+		std::unordered_map<glm::vec3, unsigned int, PositionHash> firstVertex;
+		firstVertex.reserve(positions.size());
+		for (size_t v = 0; v < positions.size(); v++) {
+			ids[v] = firstVertex.insert(std::make_pair(positions[v], (unsigned int)v)).first->second;
+		}
+		return ids;
+	}
+
+	glm::vec3 triangleNormal(const std::vector<glm::vec3>& positions, const unsigned int* tri)
+	{
+		glm::vec3 n = glm::cross(positions[tri[1]] - positions[tri[0]], positions[tri[2]] - positions[tri[0]]);
+		float length = glm::length(n);
+		return length > 0.0f ? n / length : glm::vec3(0.0f);
+	}
+
+	// Two triangles over the quad a, b, c, d, wound so they face along normal
+	void addQuad(std::vector<glm::vec3>& positions, std::vector<unsigned int>& indices, const glm::vec3& a,
+		const glm::vec3& b, const glm::vec3& c, const glm::vec3& d, const glm::vec3& normal)
+	{
+		const unsigned int first = (unsigned int)positions.size();
+		positions.push_back(a);
+		positions.push_back(b);
+		positions.push_back(c);
+		positions.push_back(d);
+		const bool flip = glm::dot(glm::cross(b - a, c - a), normal) < 0.0f;
+		const unsigned int quad[6] = { 0, 1, 2, 0, 2, 3 };
+		for (int i = 0; i < 6; i += 3) {
+			indices.push_back(first + quad[i]);
+			indices.push_back(first + quad[flip ? i + 2 : i + 1]);
+			indices.push_back(first + quad[flip ? i + 1 : i + 2]);
+		}
+	}
+
+	// Faces y = slope * |x|, bent up from the x = 0 crease like a trough, or down like a ridge
+	void addFold(std::vector<glm::vec3>& positions, std::vector<unsigned int>& indices, float slope, bool trough)
+	{
+		const float side = trough ? slope : -slope;
+		addQuad(positions, indices, glm::vec3(-1.0f, side, 0.0f), glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f),
+			glm::vec3(-1.0f, side, 1.0f), glm::vec3(side, 1.0f, 0.0f));
+		addQuad(positions, indices, glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(1.0f, side, 0.0f), glm::vec3(1.0f, side, 1.0f),
+			glm::vec3(0.0f, 0.0f, 1.0f), glm::vec3(-side, 1.0f, 0.0f));
+	}
+
+	void computeBounds(Meshlet& meshlet, const std::vector<unsigned int>& indices,
+		const std::vector<unsigned int>& vertices, const std::vector<glm::vec3>& positions)
+	{
+		glm::vec3 minCorner = positions[vertices[0]], maxCorner = positions[vertices[0]];
+		for (size_t i = 1; i < vertices.size(); i++) {
+			minCorner = glm::min(minCorner, positions[vertices[i]]);
+			maxCorner = glm::max(maxCorner, positions[vertices[i]]);
+		}
+		meshlet.center = (minCorner + maxCorner) * 0.5f;
+		meshlet.radius = 0.0f;
+		for (size_t i = 0; i < vertices.size(); i++) {
+			meshlet.radius = glm::max(meshlet.radius, glm::length(positions[vertices[i]] - meshlet.center));
+		}
+
+		// Cone axis is the mean triangle normal, the cutoff comes from the normal furthest from it
+		const unsigned int* tris = &indices[meshlet.indexOffset];
+		glm::vec3 normalSum(0.0f);
+		for (unsigned int t = 0; t < meshlet.triangleCount; t++) {
+			normalSum += triangleNormal(positions, tris + t * 3);
+		}
+
+		meshlet.coneAxis = glm::vec3(0.0f, 0.0f, 1.0f);
+		meshlet.coneApex = meshlet.center;
+		meshlet.coneCutoff = 2.0f;
+		float axisLength = glm::length(normalSum);
+		if (axisLength <= 0.0f) {
+			return;
+		}
+		glm::vec3 axis = normalSum / axisLength;
+
+		float minDot = 1.0f;
+		for (unsigned int t = 0; t < meshlet.triangleCount; t++) {
+			glm::vec3 n = triangleNormal(positions, tris + t * 3);
+			if (n != glm::vec3(0.0f)) {
+				minDot = glm::min(minDot, glm::dot(n, axis));
+			}
+		}
+		if (minDot <= MIN_CONE_DOT) {
+			return;
+		}
+
+		// Move the apex back along the axis until it is behind every triangle's plane
+		float maxT = 0.0f;
+		for (unsigned int t = 0; t < meshlet.triangleCount; t++) {
+			glm::vec3 n = triangleNormal(positions, tris + t * 3);
+			float dn = glm::dot(n, axis);
+			if (dn > 0.0f) {
+				float dc = glm::dot(meshlet.center - positions[tris[t * 3]], n);
+				maxT = glm::max(maxT, dc / dn);
+			}
+		}
+
+		meshlet.coneAxis = axis;
+		meshlet.coneApex = meshlet.center - axis * maxT;
+		meshlet.coneCutoff = sqrtf(1.0f - minDot * minDot);
+	}
+}
+
+namespace meshlets
+{
+	std::vector<Meshlet> build(std::vector<unsigned int>& indices, size_t first, size_t count,
+		const std::vector<glm::vec3>& positions, unsigned int maxVertices, unsigned int maxTriangles)
+	{
+		std::vector<Meshlet> result;
+		const unsigned int numTriangles = (unsigned int)(count / 3);
+		const size_t vertexCount = positions.size();
+		if (numTriangles == 0) {
+			return result;
+		}
+		const unsigned int* source = &indices[first];
+
+		// Live triangles around each position, emitted triangles are swapped out of the end of each list
+		const std::vector<unsigned int> positionId = positionIds(positions);
+		std::vector<unsigned int> offsets(vertexCount + 1, 0);
+		for (size_t i = 0; i < count; i++) {
+			offsets[positionId[source[i]] + 1]++;
+		}
+		for (size_t v = 0; v < vertexCount; v++) {
+			offsets[v + 1] += offsets[v];
+		}
+		std::vector<unsigned int> live(vertexCount, 0);
+		std::vector<unsigned int> adjacency(count);
+		for (unsigned int t = 0; t < numTriangles; t++) {
+			for (int k = 0; k < 3; k++) {
+				unsigned int v = positionId[source[t * 3 + k]];
+				adjacency[offsets[v] + live[v]++] = t;
+			}
+		}
+
+		std::vector<glm::vec3> normals(numTriangles);
+		for (unsigned int t = 0; t < numTriangles; t++) {
+			normals[t] = triangleNormal(positions, source + t * 3);
+		}
+
+		std::vector<unsigned char> emitted(numTriangles, 0);
+		std::vector<unsigned int> meshletOf(vertexCount, NOT_IN_MESHLET);
+		std::vector<unsigned int> output;
+		output.reserve(count);
+		std::vector<unsigned int> vertices;
+		vertices.reserve(maxVertices);
+
+		unsigned int cursor = 0;
+		while (true) {
+			// Seed each meshlet with the first remaining triangle, which keeps the cache optimised order
+			while (cursor < numTriangles && emitted[cursor]) {
+				cursor++;
+			}
+			if (cursor == numTriangles) {
+				break;
+			}
+
+			const unsigned int id = (unsigned int)result.size();
+			Meshlet meshlet = Meshlet();
+			meshlet.indexOffset = (unsigned int)(first + output.size());
+			vertices.clear();
+			glm::vec3 normalSum(0.0f);
+
+			unsigned int next = cursor;
+			while (true) {
+				// Add the triangle and take it out of its vertices' live lists
+				const unsigned int* tri = source + next * 3;
+				for (int k = 0; k < 3; k++) {
+					unsigned int v = tri[k];
+					if (meshletOf[v] != id) {
+						meshletOf[v] = id;
+						vertices.push_back(v);
+					}
+					const unsigned int p = positionId[v];
+					unsigned int* list = &adjacency[offsets[p]];
+					for (unsigned int a = 0; a < live[p]; a++) {
+						if (list[a] == next) {
+							list[a] = list[--live[p]];
+							break;
+						}
+					}
+					output.push_back(v);
+				}
+				emitted[next] = 1;
+				normalSum += normals[next];
+				meshlet.triangleCount++;
+				if (meshlet.triangleCount == maxTriangles) {
+					break;
+				}
+
+				// Best neighbour: fewest new vertices, then closest to the meshlet's mean normal
+				glm::vec3 axis = glm::length(normalSum) > 0.0f ? glm::normalize(normalSum) : glm::vec3(0.0f);
+				unsigned int best = NOT_IN_MESHLET;
+				float bestScore = FLT_MAX;
+				for (size_t i = 0; i < vertices.size(); i++) {
+					const unsigned int p = positionId[vertices[i]];
+					const unsigned int* list = &adjacency[offsets[p]];
+					for (unsigned int a = 0; a < live[p]; a++) {
+						unsigned int t = list[a];
+						const unsigned int* candidate = source + t * 3;
+						unsigned int newVertices = (meshletOf[candidate[0]] != id) + (meshletOf[candidate[1]] != id) + (meshletOf[candidate[2]] != id);
+						if (vertices.size() + newVertices > maxVertices) {
+							continue;
+						}
+						float score = newVertices + (1.0f - glm::dot(normals[t], axis));
+						if (score < bestScore) {
+							bestScore = score;
+							best = t;
+						}
+					}
+				}
+				if (best == NOT_IN_MESHLET) {
+					break;
+				}
+				next = best;
+			}
+
+			meshlet.vertexCount = (unsigned int)vertices.size();
+			result.push_back(meshlet);
+		}
+
+		memcpy(&indices[first], output.data(), count * sizeof(unsigned int));
+		for (size_t m = 0; m < result.size(); m++) {
+			// Collect the meshlet's vertices again for its bounds
+			vertices.assign(indices.begin() + result[m].indexOffset, indices.begin() + result[m].indexOffset + result[m].triangleCount * 3);
+			computeBounds(result[m], indices, vertices, positions);
+		}
+		return result;
+	}
+
+	CullView makeCullView(const glm::mat4& viewProjection, const glm::vec3& viewPos)
+	{
+		CullView view;
+		maths::frustumPlanes(viewProjection, view.frustumPlanes);
+		view.viewPos = viewPos;
+		return view;
+	}
+
+	bool isBackfacing(const Meshlet& meshlet, const glm::vec3& localViewPos)
+	{
+		glm::vec3 toApex = meshlet.coneApex - localViewPos;
+		float distance = glm::length(toApex);
+		return glm::dot(toApex, meshlet.coneAxis) >= meshlet.coneCutoff * distance;
+	}
+
+	void resetStats(ClusterCullStats& stats)
+	{
+		memset(&stats, 0, sizeof(stats));
+	}
+
+	bool checkCones()
+	{
+		std::vector<std::vector<glm::vec3> > shapes;
+		std::vector<std::vector<unsigned int> > shapeIndices;
+		for (size_t s = 0; s < sizeof(CHECK_SLOPES) / sizeof(CHECK_SLOPES[0]); s++) {
+			for (int trough = 0; trough < 2; trough++) {
+				shapes.push_back(std::vector<glm::vec3>());
+				shapeIndices.push_back(std::vector<unsigned int>());
+				addFold(shapes.back(), shapeIndices.back(), CHECK_SLOPES[s], trough != 0);
+			}
+		}
+		shapes.push_back(std::vector<glm::vec3>());
+		shapeIndices.push_back(std::vector<unsigned int>());
+		addFold(shapes.back(), shapeIndices.back(), 0.0f, true);
+
+		unsigned int clusters = 0, views = 0, culled = 0, wrong = 0;
+		for (size_t s = 0; s < shapes.size(); s++) {
+			const std::vector<glm::vec3>& positions = shapes[s];
+			std::vector<unsigned int>& indices = shapeIndices[s];
+			const std::vector<Meshlet> built = build(indices, 0, indices.size(), positions);
+			for (size_t m = 0; m < built.size(); m++) {
+				const Meshlet& meshlet = built[m];
+				const unsigned int* tris = &indices[meshlet.indexOffset];
+				clusters++;
+				for (float x = -CHECK_EXTENT; x <= CHECK_EXTENT; x += CHECK_STEP) {
+					for (float y = -CHECK_EXTENT; y <= CHECK_EXTENT; y += CHECK_STEP) {
+						for (float z = -CHECK_EXTENT; z <= CHECK_EXTENT; z += CHECK_STEP) {
+							const glm::vec3 viewPos(x, y, z);
+							views++;
+							if (!isBackfacing(meshlet, viewPos)) {
+								continue;
+							}
+							culled++;
+							for (unsigned int t = 0; t < meshlet.triangleCount; t++) {
+								const glm::vec3 n = triangleNormal(positions, tris + t * 3);
+								if (glm::dot(viewPos - positions[tris[t * 3]], n) > 1e-4f) {
+									wrong++;
+									break;
+								}
+							}
+						}
+					}
+				}
+			}
+		}
+
+		printf("Meshlet cones: %u clusters from %u camera positions, %u culled, %u culled while facing the camera\n",
+			clusters, views, culled, wrong);
+		return wrong == 0;
+	}
+}
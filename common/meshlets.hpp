@@ -0,0 +1,59 @@
+#pragma once
+#include <vector>
+#include <cstddef>
+
+#include <glm/glm.hpp>
+
+// Small cluster of triangles stored contiguously in the index buffer, with the bounds used to cull it
+struct Meshlet
+{
+	glm::vec3 center;			// bounding sphere
+	float radius;
+	glm::vec3 coneApex;			// every triangle faces away from points inside the cone behind the apex
+	float coneCutoff;			// sine of the cone half angle, above 1 when the normals are too spread to cull
+	glm::vec3 coneAxis;
+	unsigned int indexOffset;	// first index in the model's index buffer
+	unsigned int triangleCount;
+	unsigned int vertexCount;
+};
+
+// Camera state the clusters are tested against, built once per frame
+struct CullView
+{
+	glm::vec4 frustumPlanes[6];
+	glm::vec3 viewPos;
+};
+
+// Per frame totals over every culled draw
+struct ClusterCullStats
+{
+	unsigned int clusters;
+	unsigned int frustumCulled;
+	unsigned int backfaceCulled;
+	unsigned int trianglesDrawn;
+	unsigned int trianglesRejected;
+};
+
+namespace meshlets
+{
+	const unsigned int MAX_VERTICES = 64;
+	const unsigned int MAX_TRIANGLES = 124;
+
+	// Split indices[first, first + count) into meshlets, reordering the triangles in that range so each
+	// meshlet is contiguous. Meshlets grow through shared positions and favour triangles facing the same way
+	std::vector<Meshlet> build(std::vector<unsigned int>& indices, size_t first, size_t count,
+		const std::vector<glm::vec3>& positions,
+		unsigned int maxVertices = MAX_VERTICES, unsigned int maxTriangles = MAX_TRIANGLES);
+
+	CullView makeCullView(const glm::mat4& viewProjection, const glm::vec3& viewPos);
+
+	// True when every triangle faces away from a camera at localViewPos, in the meshlet's model space
+	bool isBackfacing(const Meshlet& meshlet, const glm::vec3& localViewPos);
+
+	void resetStats(ClusterCullStats& stats);
+
+	// Build concave troughs, convex ridges and a flat sheet, then look at each from a grid of camera
+	// positions around it. Prints how often isBackfacing culled a cluster with a triangle still facing the
+	// camera, which must be never, and returns false if it did
+	bool checkCones();
+}
@@ -0,0 +1,353 @@
+#include "mipChain.hpp"
+#include "threadPool.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <functional>
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#define MIP_CHAIN_SSE
+#include <xmmintrin.h>
+#endif
+#if defined(__AVX__)
+#include <immintrin.h>
+#endif
+
+namespace
+{
+	const int MAX_TAPS = 8;
+
+	// Window shape, and the filter's reach either side in destination texels
+	const float KAISER_ALPHA = 4.0f;
+	const float KAISER_WIDTH = 2.0f;
+
+	// Entries in the linear to sRGB table, fine enough to stay within one 8 bit step near black
+	const int LINEAR_STEPS = 4096;
+
+	// Rows per thread pool item, enough to outweigh the cost of handing them out
+	const int ROWS_PER_JOB = 16;
+
+	// Weights for one 2:1 step, destination texel x reads source texels 2x + first onwards
+	struct Kernel
+	{
+		int first;
+		int taps;
+		float weights[MAX_TAPS];
+	};
+
+	float besselI0(float x)
+	{
+		float sum = 1.0f, term = 1.0f;
+		for (int k = 1; k < 20; k++) {
+			term *= (x / (2.0f * k)) * (x / (2.0f * k));
+			sum += term;
+		}
+		return sum;
+	}
+
+	Kernel makeKernel(MipFilter filter)
+	{
+		Kernel kernel;
+		if (filter == MIP_FILTER_BOX) {
+			kernel.first = 0;
+			kernel.taps = 2;
+			kernel.weights[0] = 0.5f;
+			kernel.weights[1] = 0.5f;
+			return kernel;
+		}
+
+		kernel.first = -3;
+		kernel.taps = MAX_TAPS;
+		float sum = 0.0f;
+		for (int k = 0; k < kernel.taps; k++) {
+			// Source texel centre relative to the destination texel centre, in destination texels
+			float t = (kernel.first + k - 0.5f) * 0.5f;
+			float sinc = t == 0.0f ? 1.0f : sinf(3.14159265f * t) / (3.14159265f * t);
+			float x = t / KAISER_WIDTH;
+			float window = besselI0(KAISER_ALPHA * sqrtf(std::max(1.0f - x * x, 0.0f))) / besselI0(KAISER_ALPHA);
+			kernel.weights[k] = sinc * window;
+			sum += kernel.weights[k];
+		}
+		for (int k = 0; k < kernel.taps; k++) {
+			kernel.weights[k] /= sum;
+		}
+		return kernel;
+	}
+
+	struct ColourTables
+	{
+		float toLinear[256];
+		unsigned char toSrgb[LINEAR_STEPS + 1];
+
+		ColourTables()
+		{
+			for (int i = 0; i < 256; i++) {
+				float c = i / 255.0f;
+				toLinear[i] = c <= 0.04045f ? c / 12.92f : powf((c + 0.055f) / 1.055f, 2.4f);
+			}
+			for (int i = 0; i <= LINEAR_STEPS; i++) {
+				float l = (float)i / LINEAR_STEPS;
+				float s = l <= 0.0031308f ? l * 12.92f : 1.055f * powf(l, 1.0f / 2.4f) - 0.055f;
+				toSrgb[i] = (unsigned char)(s * 255.0f + 0.5f);
+			}
+		}
+	};
+
+	const ColourTables& colourTables()
+	{
+		static const ColourTables tables;
+		return tables;
+	}
+
+	void parallelRows(int rows, const std::function<void(int)>& body)
+	{
+		ThreadPool::instance().parallelFor((rows + ROWS_PER_JOB - 1) / ROWS_PER_JOB, [&](unsigned int job) {
+			const int end = std::min((int)(job + 1) * ROWS_PER_JOB, rows);
+			for (int y = job * ROWS_PER_JOB; y < end; y++) {
+				body(y);
+			}
+		});
+	}
+
+	void toFloat(const unsigned char* rgba, int width, bool srgb, float* out)
+	{
+		const ColourTables& tables = colourTables();
+		for (int i = 0; i < width * 4; i++) {
+			out[i] = (srgb && (i & 3) != 3) ? tables.toLinear[rgba[i]] : rgba[i] / 255.0f;
+		}
+	}
+
+	void toBytes(const float* in, int width, bool srgb, unsigned char* out)
+	{
+		const ColourTables& tables = colourTables();
+		for (int i = 0; i < width * 4; i++) {
+			// The Kaiser filter's negative lobes can overshoot either end
+			float v = std::min(std::max(in[i], 0.0f), 1.0f);
+			if (srgb && (i & 3) != 3) {
+				out[i] = tables.toSrgb[(int)(v * LINEAR_STEPS + 0.5f)];
+			}
+			else {
+				out[i] = (unsigned char)(v * 255.0f + 0.5f);
+			}
+		}
+	}
+
+	// Horizontal pass, one RGBA texel per SSE register
+	void filterRow(const float* source, int width, float* result, int resultWidth, const Kernel& kernel)
+	{
+#ifdef MIP_CHAIN_SSE
+		__m128 weights[MAX_TAPS];
+		for (int k = 0; k < kernel.taps; k++) {
+			weights[k] = _mm_set1_ps(kernel.weights[k]);
+		}
+#endif
+		for (int x = 0; x < resultWidth; x++) {
+			const int first = 2 * x + kernel.first;
+#ifdef MIP_CHAIN_SSE
+			__m128 sum = _mm_setzero_ps();
+			for (int k = 0; k < kernel.taps; k++) {
+				const int sx = std::min(std::max(first + k, 0), width - 1);
+				sum = _mm_add_ps(sum, _mm_mul_ps(weights[k], _mm_loadu_ps(source + sx * 4)));
+			}
+			_mm_storeu_ps(result + x * 4, sum);
+#else
+			float sum[4] = {};
+			for (int k = 0; k < kernel.taps; k++) {
+				const int sx = std::min(std::max(first + k, 0), width - 1);
+				for (int c = 0; c < 4; c++) {
+					sum[c] += kernel.weights[k] * source[sx * 4 + c];
+				}
+			}
+			memcpy(result + x * 4, sum, sizeof(sum));
+#endif
+		}
+	}
+
+	// Vertical pass, a weighted sum of whole rows so it runs 8 floats at a time with AVX
+	void filterColumns(const float* const* rows, const Kernel& kernel, int count, float* result)
+	{
+		int i = 0;
+#ifdef __AVX__
+		for (; i + 8 <= count; i += 8) {
+			__m256 sum = _mm256_setzero_ps();
+			for (int k = 0; k < kernel.taps; k++) {
+				sum = _mm256_add_ps(sum, _mm256_mul_ps(_mm256_set1_ps(kernel.weights[k]), _mm256_loadu_ps(rows[k] + i)));
+			}
+			_mm256_storeu_ps(result + i, sum);
+		}
+#endif
+#ifdef MIP_CHAIN_SSE
+		for (; i + 4 <= count; i += 4) {
+			__m128 sum = _mm_setzero_ps();
+			for (int k = 0; k < kernel.taps; k++) {
+				sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(kernel.weights[k]), _mm_loadu_ps(rows[k] + i)));
+			}
+			_mm_storeu_ps(result + i, sum);
+		}
+#endif
+		for (; i < count; i++) {
+			float sum = 0.0f;
+			for (int k = 0; k < kernel.taps; k++) {
+				sum += kernel.weights[k] * rows[k][i];
+			}
+			result[i] = sum;
+		}
+	}
+
+	void downsample(const std::vector<float>& source, int width, int height, const Kernel& kernel,
+		std::vector<float>& scratch, std::vector<float>& result)
+	{
+		const int halfWidth = std::max(width / 2, 1);
+		const int halfHeight = std::max(height / 2, 1);
+
+		// Single column levels skip the horizontal pass
+		const float* columns = source.data();
+		if (width > 1) {
+			scratch.resize((size_t)height * halfWidth * 4);
+			parallelRows(height, [&](int y) {
+				filterRow(&source[(size_t)y * width * 4], width, &scratch[(size_t)y * halfWidth * 4], halfWidth, kernel);
+			});
+			columns = scratch.data();
+		}
+
+		result.resize((size_t)halfWidth * halfHeight * 4);
+		if (height == 1) {
+			memcpy(result.data(), columns, result.size() * sizeof(float));
+			return;
+		}
+		parallelRows(halfHeight, [&](int y) {
+			const float* rows[MAX_TAPS];
+			for (int k = 0; k < kernel.taps; k++) {
+				const int sy = std::min(std::max(2 * y + kernel.first + k, 0), height - 1);
+				rows[k] = columns + (size_t)sy * halfWidth * 4;
+			}
+			filterColumns(rows, kernel, halfWidth * 4, &result[(size_t)y * halfWidth * 4]);
+		});
+	}
+
+	// Source texels and weights for one destination texel along one axis of resample
+	struct Taps
+	{
+		int first;
+		std::vector<float> weights;
+	};
+
+	void makeTaps(int size, int newSize, std::vector<Taps>& taps)
+	{
+		const float scale = (float)size / newSize;
+		const float radius = std::max(scale, 1.0f);
+		taps.resize(newSize);
+		for (int x = 0; x < newSize; x++) {
+			const float centre = (x + 0.5f) * scale - 0.5f;
+			const int first = (int)ceilf(centre - radius);
+			const int last = (int)floorf(centre + radius);
+			Taps& tap = taps[x];
+			tap.first = first;
+			tap.weights.clear();
+			float sum = 0.0f;
+			for (int s = first; s <= last; s++) {
+				float weight = std::max(1.0f - fabsf(s - centre) / radius, 0.0f);
+				tap.weights.push_back(weight);
+				sum += weight;
+			}
+			for (size_t k = 0; k < tap.weights.size(); k++) {
+				tap.weights[k] /= sum;
+			}
+		}
+	}
+}
+
+namespace mipChain
+{
+	const char* getFilterName(MipFilter filter)
+	{
+		return filter == MIP_FILTER_KAISER ? "Kaiser" : "box";
+	}
+
+	unsigned int getLevelCount(int width, int height)
+	{
+		unsigned int count = 1;
+		for (int size = std::max(width, height); size > 1; size /= 2) {
+			count++;
+		}
+		return count;
+	}
+
+	void build(const unsigned char* rgba, int width, int height, MipFilter filter, bool srgb, MipLevels& levels)
+	{
+		const unsigned int levelCount = getLevelCount(width, height);
+		levels.offsets.resize(levelCount);
+		levels.widths.resize(levelCount);
+		levels.heights.resize(levelCount);
+		size_t total = 0;
+		for (unsigned int i = 0; i < levelCount; i++) {
+			levels.offsets[i] = total;
+			levels.widths[i] = std::max(width >> i, 1);
+			levels.heights[i] = std::max(height >> i, 1);
+			total += (size_t)levels.widths[i] * levels.heights[i] * 4;
+		}
+		levels.pixels.resize(total);
+		memcpy(levels.pixels.data(), rgba, (size_t)width * height * 4);
+		if (levelCount == 1) {
+			return;
+		}
+
+		const Kernel kernel = makeKernel(filter);
+		std::vector<float> current((size_t)width * height * 4), next, scratch;
+		parallelRows(height, [&](int y) {
+			toFloat(rgba + (size_t)y * width * 4, width, srgb, &current[(size_t)y * width * 4]);
+		});
+
+		for (unsigned int i = 1; i < levelCount; i++) {
+			downsample(current, levels.widths[i - 1], levels.heights[i - 1], kernel, scratch, next);
+			const int levelWidth = levels.widths[i];
+			unsigned char* out = &levels.pixels[levels.offsets[i]];
+			parallelRows(levels.heights[i], [&](int y) {
+				toBytes(&next[(size_t)y * levelWidth * 4], levelWidth, srgb, out + (size_t)y * levelWidth * 4);
+			});
+			current.swap(next);
+		}
+	}
+
+	void resample(const unsigned char* rgba, int width, int height, int newWidth, int newHeight, bool srgb,
+		std::vector<unsigned char>& result)
+	{
+		result.resize((size_t)newWidth * newHeight * 4);
+		std::vector<Taps> columns, rows;
+		makeTaps(width, newWidth, columns);
+		makeTaps(height, newHeight, rows);
+
+		// Rows are scaled across first, then every destination row sums the scaled rows its taps cover
+		std::vector<float> source((size_t)width * height * 4), across((size_t)newWidth * height * 4);
+		parallelRows(height, [&](int y) {
+			float* in = &source[(size_t)y * width * 4];
+			toFloat(rgba + (size_t)y * width * 4, width, srgb, in);
+			float* out = &across[(size_t)y * newWidth * 4];
+			for (int x = 0; x < newWidth; x++) {
+				const Taps& tap = columns[x];
+				float sum[4] = {};
+				for (size_t k = 0; k < tap.weights.size(); k++) {
+					const int sx = std::min(std::max(tap.first + (int)k, 0), width - 1);
+					for (int c = 0; c < 4; c++) {
+						sum[c] += tap.weights[k] * in[sx * 4 + c];
+					}
+				}
+				memcpy(out + x * 4, sum, sizeof(sum));
+			}
+		});
+
+		parallelRows(newHeight, [&](int y) {
+			const Taps& tap = rows[y];
+			std::vector<float> sum((size_t)newWidth * 4, 0.0f);
+			for (size_t k = 0; k < tap.weights.size(); k++) {
+				const int sy = std::min(std::max(tap.first + (int)k, 0), height - 1);
+				const float* in = &across[(size_t)sy * newWidth * 4];
+				for (int i = 0; i < newWidth * 4; i++) {
+					sum[i] += tap.weights[k] * in[i];
+				}
+			}
+			toBytes(sum.data(), newWidth, srgb, &result[(size_t)y * newWidth * 4]);
+		});
+	}
+}
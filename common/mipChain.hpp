@@ -0,0 +1,39 @@
+#pragma once
+#include <cstddef>
+#include <vector>
+
+enum MipFilter
+{
+	MIP_FILTER_BOX = 0,		// 2x2 average
+	MIP_FILTER_KAISER		// 8 tap Kaiser windowed sinc, sharper distant textures
+};
+
+// Levels of a tightly packed RGBA8 image, largest first and one after another
+struct MipLevels
+{
+	std::vector<unsigned char> pixels;
+	std::vector<size_t> offsets;
+	std::vector<int> widths;
+	std::vector<int> heights;
+
+	unsigned int getLevelCount() const { return (unsigned int)offsets.size(); }
+};
+
+// CPU mip generation with SSE, and AVX when the build enables it. Levels are filtered in float from the
+// previous float level, so rounding never accumulates down the chain
+namespace mipChain
+{
+	const char* getFilterName(MipFilter filter);
+
+	// Levels from width x height down to 1x1
+	unsigned int getLevelCount(int width, int height);
+
+	// Every level of the image, level 0 is a copy. With srgb set the colour channels are filtered in
+	// linear light and alpha stays linear. Rows are spread over the thread pool
+	void build(const unsigned char* rgba, int width, int height, MipFilter filter, bool srgb, MipLevels& levels);
+
+	// Scale an RGBA8 image to any size with a tent filter that widens when shrinking, so every source
+	// texel is covered. Filtered in linear light like build
+	void resample(const unsigned char* rgba, int width, int height, int newWidth, int newHeight, bool srgb,
+		std::vector<unsigned char>& result);
+}
@@ -3,23 +3,199 @@
 #include <string>
 #include <cstring>
 #include <iostream>
+#include <cstddef>
+#include <cmath>
+#include <memory>
 
 #include <GL/glew.h>
 #include <glm/glm.hpp>
 
 #include "model.hpp"
-#include "stb_image.hpp"
+#include "objLoader.hpp"
+#include "meshWelder.hpp"
+#include "meshOptimizer.hpp"
+#include "meshSimplifier.hpp"
+#include "meshlets.hpp"
+#include "maths.hpp"
+#include "vertexFormat.hpp"
+#include "contentHash.hpp"
+#include "threadPool.hpp"
+#include "assetLoader.hpp"
+#include "textureArrayBuilder.hpp"
+#include "textureCache.hpp"
+#include "timer.hpp"
+
+// A coarser level is only picked once its error is this far under the limit, so instances sitting
+// near a switching distance do not flicker between two levels
+static const float LOD_HYSTERESIS = 0.75f;
+
+// Each level of detail aims for half the triangles of the one before
+static const float LOD_REDUCTION = 0.5f;
+
+// Stop adding levels once a level saves less than this or its error exceeds this fraction of the model size
+static const float LOD_MIN_REDUCTION = 0.85f;
+static const float LOD_MAX_ERROR = 0.05f;
+
+int Model::forcedLod = -1;
 
 Model::Model(const char *path)
+    : boundsMin(0.0f), boundsMax(0.0f), lodPixelError(1.0f), VAO(0), vertexBuffer(0), elementBuffer(0),
+      lodCount(0), indexType(GL_UNSIGNED_INT), mapShader(0), pendingUploads(0)
+{
+    if (loadMesh(path))
+        uploadMesh();
+}
+
+Model::Model(const char *path, AssetLoader &loader)
+    : boundsMin(0.0f), boundsMax(0.0f), lodPixelError(1.0f), VAO(0), vertexBuffer(0), elementBuffer(0),
+      lodCount(0), indexType(GL_UNSIGNED_INT), mapShader(0), pendingUploads(1)
+{
+    std::string meshPath = path;
+    loader.load(meshPath, [this, meshPath]()
+                {
+                    if (!loadMesh(meshPath.c_str()))
+                        return false;
+                    stageMesh();
+                    return true;
+                },
+                [this]() { uploadMesh(); pendingUploads--; });
+}
+
+bool Model::isLoaded() const
+{
+    return lodCount > 0 && pendingUploads == 0;
+}
+
+bool Model::loadMesh(const char *path)
 {
+    // Use the binary cache next to the .obj when it was built from the same file contents
+    unsigned long long sourceSize = 0, sourceHash = 0;
+    bool hashed = hashFile(path, sourceSize, sourceHash);
+    std::string cachePath = meshCache::getCachePath(path);
+    if (hashed && loadCache(cachePath, sourceSize, sourceHash))
+    {
+        printLods(path, stagedBuffers);
+        return true;
+    }
+    
     // Load object
-    bool res = loadObj(path, vertices, uvs, normals);
+    std::vector<MeshLod> meshLods;
+    if (!loadObj(path, vertices, uvs, normals, indices, meshLods))
+        return false;
+    buildMeshlets(path, meshLods);
+    buildMeshBuffers(stagedVertices, stagedIndices, meshLods, stagedBuffers);
+    printLods(path, stagedBuffers);
     
-    // Setup buffers
-    setupBuffers();
+    // Save the processed mesh so the next run can skip parsing
+    if (hashed)
+    {
+        if (meshCache::write(cachePath, sourceSize, sourceHash, stagedBuffers))
+            printf("Wrote mesh cache %s\n", cachePath.c_str());
+        else
+            printf("Could not write mesh cache %s\n", cachePath.c_str());
+    }
+    return true;
 }
 
-void Model::draw(unsigned int &shaderID)
+void Model::stageMesh()
+{
+    UploadRing &ring = UploadRing::instance();
+    ring.stage(stagedBuffers.vertices, stagedBuffers.vertexCount * sizeof(PackedVertex), vertexSlice);
+    ring.stage(stagedBuffers.indices, stagedBuffers.indexCount * stagedBuffers.indexSize, indexSlice);
+}
+
+void Model::uploadMesh()
+{
+    setupBuffers(stagedBuffers);
+    
+    // The GL buffers hold the only copy the draws need now
+    stagedBuffers = MeshBuffers();
+    std::vector<PackedVertex>().swap(stagedVertices);
+    std::vector<unsigned char>().swap(stagedIndices);
+    cacheFile.close();
+    
+    // Slices an empty mesh never uploaded
+    if (vertexSlice.data)
+        UploadRing::instance().cancel(vertexSlice);
+    if (indexSlice.data)
+        UploadRing::instance().cancel(indexSlice);
+}
+
+void Model::draw(unsigned int &shaderID, unsigned int lod)
+{
+    if (lodCount == 0)
+        return;
+    if (lod >= lodCount)
+        lod = lodCount - 1;
+    
+    bindMaterial(shaderID);
+    
+    // Draw the triangles of the chosen level
+    const size_t indexSize = (indexType == GL_UNSIGNED_SHORT) ? sizeof(unsigned short) : sizeof(unsigned int);
+    glBindVertexArray(VAO);
+    glDrawElements(GL_TRIANGLES, lods[lod].indexCount, indexType, (void*)(lods[lod].indexOffset * indexSize));
+    glBindVertexArray(0);
+}
+
+void Model::drawCulled(unsigned int &shaderID, unsigned int lod, const glm::mat4 &transform,
+                       const CullView &view, ClusterCullStats &stats)
+{
+    if (lodCount == 0)
+        return;
+    if (lod >= lodCount)
+        lod = lodCount - 1;
+    
+    // Cone tests run in model space, sphere tests in world space
+    const glm::vec3 localViewPos = glm::vec3(glm::inverse(transform) * glm::vec4(view.viewPos, 1.0f));
+    const float scale = glm::max(glm::length(glm::vec3(transform[0])),
+                                 glm::max(glm::length(glm::vec3(transform[1])), glm::length(glm::vec3(transform[2]))));
+    
+    // Merge the surviving meshlets that sit next to each other in the index buffer into one range
+    const size_t indexSize = (indexType == GL_UNSIGNED_SHORT) ? sizeof(unsigned short) : sizeof(unsigned int);
+    drawCounts.clear();
+    drawOffsets.clear();
+    unsigned int rangeEnd = 0;
+    const MeshLod &level = lods[lod];
+    for (unsigned int i = level.meshletOffset; i < level.meshletOffset + level.meshletCount; i++)
+    {
+        const Meshlet &meshlet = meshlets[i];
+        stats.clusters++;
+        
+        glm::vec3 center = glm::vec3(transform * glm::vec4(meshlet.center, 1.0f));
+        if (!maths::sphereInFrustum(view.frustumPlanes, center, meshlet.radius * scale))
+        {
+            stats.frustumCulled++;
+            stats.trianglesRejected += meshlet.triangleCount;
+            continue;
+        }
+        if (meshlets::isBackfacing(meshlet, localViewPos))
+        {
+            stats.backfaceCulled++;
+            stats.trianglesRejected += meshlet.triangleCount;
+            continue;
+        }
+        
+        stats.trianglesDrawn += meshlet.triangleCount;
+        if (!drawCounts.empty() && rangeEnd == meshlet.indexOffset)
+            drawCounts.back() += meshlet.triangleCount * 3;
+        else
+        {
+            drawCounts.push_back(meshlet.triangleCount * 3);
+            drawOffsets.push_back((const void*)(meshlet.indexOffset * indexSize));
+        }
+        rangeEnd = meshlet.indexOffset + meshlet.triangleCount * 3;
+    }
+    
+    if (drawCounts.empty())
+        return;
+    
+    bindMaterial(shaderID);
+    glBindVertexArray(VAO);
+    glMultiDrawElements(GL_TRIANGLES, drawCounts.data(), indexType, drawOffsets.data(), (GLsizei)drawCounts.size());
+    glBindVertexArray(0);
+}
+
+void Model::bindMaterial(unsigned int &shaderID)
 {
     // Send material properties to the shader
     glUniform1f(glGetUniformLocation(shaderID, "ka"), ka);
@@ -27,62 +203,252 @@ void Model::draw(unsigned int &shaderID)
     glUniform1f(glGetUniformLocation(shaderID, "ks"), ks);
     glUniform1f(glGetUniformLocation(shaderID, "Ns"), Ns);
     
-    // Bind the textures
-    unsigned int diffuseNum = 0;
-    unsigned int normalNum = 0;
+    // Give each array a texture unit and find the sampler and layer uniforms of every map
+    if (shaderID != mapShader || mapUnits.size() != textures.size())
+    {
+        mapShader = shaderID;
+        mapUnits.resize(textures.size());
+        mapLocations.resize(textures.size());
+        layerLocations.resize(textures.size());
+        unsigned int unitCount = 0;
+        for (unsigned int i = 0; i < textures.size(); i++)
+        {
+            mapUnits[i] = unitCount;
+            for (unsigned int j = 0; j < i; j++)
+            {
+                if (textures[j].id == textures[i].id)
+                {
+                    mapUnits[i] = mapUnits[j];
+                    break;
+                }
+            }
+            if (mapUnits[i] == unitCount)
+                unitCount++;
+            mapLocations[i] = glGetUniformLocation(shaderID, (textures[i].type + "Map").c_str());
+            layerLocations[i] = glGetUniformLocation(shaderID, (textures[i].type + "Layer").c_str());
+        }
+    }
+    
+    // Bind each array once, the maps sample it by layer
+    unsigned int boundUnits = 0;
     for (unsigned int i = 0; i < textures.size(); i++)
     {
-        // Bind texture
-        std::string name = textures[i].type;
-        glActiveTexture(GL_TEXTURE0 + i);
-        glUniform1i(glGetUniformLocation(shaderID, (name + "Map").c_str()), i);
-        glBindTexture(GL_TEXTURE_2D, textures[i].id);
+        if (mapUnits[i] >= boundUnits)
+        {
+            glActiveTexture(GL_TEXTURE0 + mapUnits[i]);
+            glBindTexture(GL_TEXTURE_2D_ARRAY, textures[i].id);
+            boundUnits = mapUnits[i] + 1;
+        }
+        glUniform1i(mapLocations[i], mapUnits[i]);
+        glUniform1i(layerLocations[i], textures[i].layer);
+    }
+    
+    // Dequantise positions against the model bounds
+    glm::vec3 positionOffset = vertexFormat::getPositionOffset(boundsMin, boundsMax);
+    glm::vec3 positionScale = vertexFormat::getPositionScale(boundsMin, boundsMax);
+    glUniform3f(glGetUniformLocation(shaderID, "positionOffset"), positionOffset.x, positionOffset.y, positionOffset.z);
+    glUniform3f(glGetUniformLocation(shaderID, "positionScale"), positionScale.x, positionScale.y, positionScale.z);
+}
+
+unsigned int Model::selectLod(const glm::mat4 &transform, const glm::vec3 &viewPos, float projectionScale,
+                              unsigned int &currentLod) const
+{
+    if (lodCount == 0)
+        return 0;
+    
+    if (forcedLod >= 0)
+    {
+        currentLod = glm::min((unsigned int)forcedLod, lodCount - 1);
+        return currentLod;
     }
     
-    // Draw the triangles
-    glBindVertexArray(VAO);
-    glDrawArrays(GL_TRIANGLES, 0, static_cast<unsigned int>(vertices.size()));
-    glBindVertexArray(0);
+    // Distance to the nearest point of the bounding sphere in world space
+    glm::vec3 center = glm::vec3(transform * glm::vec4((boundsMin + boundsMax) * 0.5f, 1.0f));
+    float scale = glm::max(glm::length(glm::vec3(transform[0])),
+                           glm::max(glm::length(glm::vec3(transform[1])), glm::length(glm::vec3(transform[2]))));
+    float radius = glm::length(boundsMax - boundsMin) * 0.5f * scale;
+    float distance = glm::max(glm::length(center - viewPos) - radius, 1e-3f);
+    
+    // Pixels covered by one unit of model space error at that distance
+    float pixelsPerUnit = projectionScale * scale / distance;
+    
+    if (currentLod >= lodCount)
+        currentLod = 0;
+    
+    // Coarsen when a coarser level is comfortably within the limit, refine as soon as the current one exceeds it
+    unsigned int coarser = currentLod;
+    while (coarser + 1 < lodCount && lods[coarser + 1].error * pixelsPerUnit <= lodPixelError * LOD_HYSTERESIS)
+        coarser++;
+    
+    if (coarser > currentLod)
+        currentLod = coarser;
+    else
+        while (currentLod > 0 && lods[currentLod].error * pixelsPerUnit > lodPixelError)
+            currentLod--;
+    
+    return currentLod;
+}
+
+void Model::requestTextureDetail(const glm::mat4 &transform, const glm::vec3 &viewPos, float projectionScale) const
+{
+    // Screen size of the bounding sphere from its nearest point, as in selectLod
+    glm::vec3 center = glm::vec3(transform * glm::vec4((boundsMin + boundsMax) * 0.5f, 1.0f));
+    float scale = glm::max(glm::length(glm::vec3(transform[0])),
+                           glm::max(glm::length(glm::vec3(transform[1])), glm::length(glm::vec3(transform[2]))));
+    float radius = glm::length(boundsMax - boundsMin) * 0.5f * scale;
+    float distance = glm::max(glm::length(center - viewPos) - radius, 1e-3f);
+    float screenPixels = 2.0f * radius * projectionScale / distance;
+    
+    for (unsigned int i = 0; i < textures.size(); i++)
+        TextureCache::instance().requestDetail(textures[i].id, screenPixels);
 }
 
-void Model::setupBuffers()
+unsigned int Model::getLodCount() const
 {
+    return lodCount;
+}
+
+unsigned int Model::getLodTriangleCount(unsigned int lod) const
+{
+    return lod < lodCount ? lods[lod].indexCount / 3 : 0;
+}
+
+void Model::printLods(const char *path, const MeshBuffers &buffers) const
+{
+    printf("Levels of detail for %s:", path);
+    for (unsigned int i = 0; i < buffers.lodCount; i++)
+        printf(" %u", buffers.lods[i].indexCount / 3);
+    printf(" triangles\n");
+}
+
+bool Model::loadCache(const std::string &cachePath, unsigned long long sourceSize, unsigned long long sourceHash)
+{
+    Timer timer;
+    
+    // The mapping stays open so the upload reads straight from the mapped pages
+    if (!meshCache::open(cachePath, sourceSize, sourceHash, cacheFile, stagedBuffers))
+        return false;
+    
+    printf("Loaded mesh cache %s: %u vertices, %u triangles, %.1f KB in %.2f ms\n",
+           cachePath.c_str(), stagedBuffers.vertexCount, stagedBuffers.lods[0].indexCount / 3,
+           cacheFile.size() / 1024.0, timer.elapsedMs());
+    return true;
+}
+
+void Model::buildMeshBuffers(std::vector<PackedVertex> &packed,
+                             std::vector<unsigned char> &indexData,
+                             const std::vector<MeshLod> &meshLods,
+                             MeshBuffers &buffers)
+{
+    // Find the bounds the positions are quantised against
+    glm::vec3 minCorner(0.0f), maxCorner(0.0f);
+    for (size_t i = 0; i < vertices.size(); i++)
+    {
+        minCorner = (i == 0) ? vertices[i] : glm::min(minCorner, vertices[i]);
+        maxCorner = (i == 0) ? vertices[i] : glm::max(maxCorner, vertices[i]);
+    }
+    
+    // Pack the attributes into one interleaved stream
+    glm::vec3 positionOffset = vertexFormat::getPositionOffset(minCorner, maxCorner);
+    glm::vec3 positionScale = vertexFormat::getPositionScale(minCorner, maxCorner);
+    packed.resize(vertices.size());
+    for (size_t i = 0; i < vertices.size(); i++)
+        vertexFormat::packVertex(vertices[i], uvs[i], normals[i], positionOffset, positionScale, packed[i]);
+    
+    const size_t unpackedSize = sizeof(glm::vec3) + sizeof(glm::vec2) + sizeof(glm::vec3);
+    printf("Packed %u vertices into %u bytes each (%u unpacked), %.1f KB -> %.1f KB\n",
+           (unsigned int)packed.size(), (unsigned int)sizeof(PackedVertex), (unsigned int)unpackedSize,
+           packed.size() * unpackedSize / 1024.0, packed.size() * sizeof(PackedVertex) / 1024.0);
+    
+    // Use 16 bit indices when the model is small enough
+    if (vertices.size() <= 0xffff)
+    {
+        indexData.resize(indices.size() * sizeof(unsigned short));
+        unsigned short *shortIndices = (unsigned short*)indexData.data();
+        for (size_t i = 0; i < indices.size(); i++)
+            shortIndices[i] = (unsigned short)indices[i];
+        buffers.indexSize = sizeof(unsigned short);
+    }
+    else
+    {
+        indexData.resize(indices.size() * sizeof(unsigned int));
+        memcpy(indexData.data(), indices.data(), indexData.size());
+        buffers.indexSize = sizeof(unsigned int);
+    }
+    
+    buffers.vertices = packed.data();
+    buffers.vertexCount = static_cast<unsigned int>(packed.size());
+    buffers.indices = indexData.data();
+    buffers.indexCount = static_cast<unsigned int>(indices.size());
+    buffers.boundsMin = minCorner;
+    buffers.boundsMax = maxCorner;
+    buffers.lodCount = static_cast<unsigned int>(meshLods.size());
+    for (size_t i = 0; i < meshLods.size(); i++)
+        buffers.lods[i] = meshLods[i];
+    buffers.meshlets = meshlets.data();
+    buffers.meshletCount = static_cast<unsigned int>(meshlets.size());
+}
+
+void Model::buildMeshlets(const char *path, std::vector<MeshLod> &meshLods)
+{
+    Timer timer;
+    
+    // Each level is reordered within its own index range, so the ranges stay where they are
+    meshlets.clear();
+    unsigned int numVertices = 0;
+    for (size_t i = 0; i < meshLods.size(); i++)
+    {
+        std::vector<Meshlet> levelMeshlets = meshlets::build(indices, meshLods[i].indexOffset, meshLods[i].indexCount, vertices);
+        meshLods[i].meshletOffset = static_cast<unsigned int>(meshlets.size());
+        meshLods[i].meshletCount = static_cast<unsigned int>(levelMeshlets.size());
+        for (size_t m = 0; m < levelMeshlets.size(); m++)
+            numVertices += levelMeshlets[m].vertexCount;
+        meshlets.insert(meshlets.end(), levelMeshlets.begin(), levelMeshlets.end());
+    }
+    
+    const unsigned int numMeshlets = static_cast<unsigned int>(meshlets.size());
+    printf("Built %u meshlets for %s in %.2f ms, %.1f triangles and %.1f vertices each\n",
+           numMeshlets, path, timer.elapsedMs(),
+           numMeshlets ? (double)indices.size() / 3 / numMeshlets : 0.0,
+           numMeshlets ? (double)numVertices / numMeshlets : 0.0);
+}
+
+void Model::setupBuffers(const MeshBuffers &buffers)
+{
+    if (buffers.vertexCount == 0)
+        return;
+    
+    lodCount = buffers.lodCount;
+    for (unsigned int i = 0; i < lodCount; i++)
+        lods[i] = buffers.lods[i];
+    if (buffers.meshlets != meshlets.data())
+        meshlets.assign(buffers.meshlets, buffers.meshlets + buffers.meshletCount);
+    indexType = (buffers.indexSize == sizeof(unsigned short)) ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+    boundsMin = buffers.boundsMin;
+    boundsMax = buffers.boundsMax;
+    
     // Create and bind the Vertex Array Object (VAO)
     glGenVertexArrays(1, &VAO);
     glBindVertexArray(VAO);
     
-    // Create Vertex Buffer Object
-    unsigned int vertexBuffer;
+    // Create the interleaved Vertex Buffer Object, copied from the upload ring when the loader staged it
     glGenBuffers(1, &vertexBuffer);
     glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
-    glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(glm::vec3), &vertices[0], GL_STATIC_DRAW);
-    
-    // Create uv buffer
-    unsigned int uvBuffer;
-    glGenBuffers(1, &uvBuffer);
-    glBindBuffer(GL_ARRAY_BUFFER, uvBuffer);
-    glBufferData(GL_ARRAY_BUFFER, uvs.size() * sizeof(glm::vec2), &uvs[0], GL_STATIC_DRAW);
+    UploadRing::instance().bufferData(GL_ARRAY_BUFFER, buffers.vertices, buffers.vertexCount * sizeof(PackedVertex), vertexSlice);
     
-    // Create normal buffer
-    unsigned int normalBuffer;
-    glGenBuffers(1, &normalBuffer);
-    glBindBuffer(GL_ARRAY_BUFFER, normalBuffer);
-    glBufferData(GL_ARRAY_BUFFER, normals.size() * sizeof(glm::vec3), &normals[0], GL_STATIC_DRAW);
-    
-    // Bind the vertex buffer
+    // Bind the snorm16 position, half float uv and octahedral normal attributes,
+    // the normal reads the 4 bytes from position z onwards and the shader uses .zw
     glEnableVertexAttribArray(0);
-    glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, (void*)0);
-    
-    // Bind the uv buffer
+    glVertexAttribPointer(0, 3, GL_SHORT, GL_TRUE, sizeof(PackedVertex), (void*)offsetof(PackedVertex, position));
     glEnableVertexAttribArray(1);
-    glBindBuffer(GL_ARRAY_BUFFER, uvBuffer);
-    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 0, (void*)0);
-    
-    // Bind the normal buffer
+    glVertexAttribPointer(1, 2, GL_HALF_FLOAT, GL_FALSE, sizeof(PackedVertex), (void*)offsetof(PackedVertex, uv));
     glEnableVertexAttribArray(2);
-    glBindBuffer(GL_ARRAY_BUFFER, normalBuffer);
-    glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, 0, (void*)0);
+    glVertexAttribPointer(2, 4, GL_BYTE, GL_TRUE, sizeof(PackedVertex), (void*)(offsetof(PackedVertex, position) + 2 * sizeof(short)));
+    
+    // Create the element buffer
+    glGenBuffers(1, &elementBuffer);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, elementBuffer);
+    UploadRing::instance().bufferData(GL_ELEMENT_ARRAY_BUFFER, buffers.indices, buffers.indexCount * buffers.indexSize, indexSlice);
     
      // Bind the VAO
     glBindVertexArray(0);
@@ -91,120 +457,87 @@ void Model::setupBuffers()
 void Model::deleteBuffers()
 {
     glDeleteBuffers(1, &vertexBuffer);
-    glDeleteBuffers(1, &uvBuffer);
-    glDeleteBuffers(1, &normalBuffer);
+    glDeleteBuffers(1, &elementBuffer);
     glDeleteVertexArrays(1, &VAO);
+    for (unsigned int i = 0; i < textures.size(); i++)
+        TextureCache::instance().release(textures[i].id);
+    textures.clear();
 }
 
 bool Model::loadObj(const char *path,
                     std::vector<glm::vec3> &outVertices,
                     std::vector<glm::vec2> &outUVs,
-                    std::vector<glm::vec3> &outNormals)
+                    std::vector<glm::vec3> &outNormals,
+                    std::vector<unsigned int> &outIndices,
+                    std::vector<MeshLod> &outLods)
 {
     
     printf("Loading file %s\n", path);
     
-    std::vector<unsigned int> vertexIndices, uvIndices, normalIndices;
-    std::vector<glm::vec3> tempVertices;
-    std::vector<glm::vec2> tempUVs;
-    std::vector<glm::vec3> tempNormals;
-    
-    FILE *file = fopen(path, "r");
-    if (file==NULL)
+    // Parse the file on the worker threads
+    ObjData obj;
+    if (!objLoader::load(path, obj))
     {
-        printf("Impossible to open the file. Check paths and directories.");
-        getchar();
         return false;
     }
     
-    while (true)
+    // Share vertices between the faces that use the same position, uv and normal
+    meshWelder::weld(obj, outVertices, outUVs, outNormals, outIndices);
+    
+    // Reorder triangles for the vertex cache and overdraw, then vertices for fetch locality
+    std::vector<unsigned int> remap = meshOptimizer::optimize(outIndices, outVertices, path);
+    meshOptimizer::remapVertices(outVertices, remap);
+    meshOptimizer::remapVertices(outUVs, remap);
+    meshOptimizer::remapVertices(outNormals, remap);
+    
+    // Report the saving over one vertex per face corner
+    const size_t vertexSize = sizeof(glm::vec3) + sizeof(glm::vec2) + sizeof(glm::vec3);
+    const size_t indexSize = outVertices.size() <= 0xffff ? sizeof(unsigned short) : sizeof(unsigned int);
+    const size_t numCorners = outIndices.size();
+    const size_t numVertices = outVertices.size();
+    const double expandedKB = numCorners * vertexSize / 1024.0;
+    const double indexedKB = (numVertices * vertexSize + numCorners * indexSize) / 1024.0;
+    printf("Welded %u corners into %u vertices (%.1f%% fewer), buffers %.1f KB -> %.1f KB with %u-bit indices\n",
+           (unsigned int)numCorners, (unsigned int)numVertices,
+           numCorners ? 100.0 * (1.0 - (double)numVertices / numCorners) : 0.0,
+           expandedKB, indexedKB, (unsigned int)indexSize * 8);
+    
+    // Simplify the full mesh into coarser levels, appended after it in the index list
+    Timer timer;
+    glm::vec3 minCorner(0.0f), maxCorner(0.0f);
+    for (size_t i = 0; i < outVertices.size(); i++)
     {
-        // Read the first word of the line
-        char lineHeader[128];
-        int res = fscanf(file, "%s", lineHeader);
-        if (res == EOF)
-        {
-            // If end of file reached exit the loop
-            break;
-        }
-        
-        if (strcmp(lineHeader, "v") == 0)
-        {
-            // Read vertices
-            glm::vec3 vertex;
-            fscanf(file, "%f %f %f\n", &vertex.x, &vertex.y, &vertex.z);
-            tempVertices.push_back(vertex);
-        }
-        else if (strcmp(lineHeader, "vt") == 0)
-        {
-            // Read texture co-ordinates
-            glm::vec2 uv;
-            fscanf(file, "%f %f\n", &uv.x, &uv.y);
-            tempUVs.push_back(uv);
-        }
-        else if (strcmp(lineHeader, "vn") == 0)
-        {
-            // Read vertex normals
-            glm::vec3 normal;
-            fscanf(file, "%f %f %f\n", &normal.x, &normal.y, &normal.z);
-            tempNormals.push_back(normal);
-        }
-        else if (strcmp(lineHeader, "f") == 0)
-        {
-            // Read vertex indices
-            std::string vertex1, vertex2, vertex3;
-            unsigned int vertexIndex[3], uvIndex[3], normalIndex[3];
-            int matches = fscanf(file, "%d/%d/%d %d/%d/%d %d/%d/%d\n",
-                                 &vertexIndex[0], &uvIndex[0], &normalIndex[0],
-                                 &vertexIndex[1], &uvIndex[1], &normalIndex[1],
-                                 &vertexIndex[2], &uvIndex[2], &normalIndex[2]);
-            
-            // Check for error
-            if (matches != 9)
-            {
-                printf("File can't be read by loadObj().\n");
-                fclose(file);
-                return false;
-            }
-            vertexIndices.push_back(vertexIndex[0]);
-            vertexIndices.push_back(vertexIndex[1]);
-            vertexIndices.push_back(vertexIndex[2]);
-            uvIndices    .push_back(uvIndex[0]);
-            uvIndices    .push_back(uvIndex[1]);
-            uvIndices    .push_back(uvIndex[2]);
-            normalIndices.push_back(normalIndex[0]);
-            normalIndices.push_back(normalIndex[1]);
-            normalIndices.push_back(normalIndex[2]);
-        }
-        else
-        {
-            // Remove comment line
-            char commentBuffer[1000];
-            fgets(commentBuffer, 1000, file);
-        }
+        minCorner = (i == 0) ? outVertices[i] : glm::min(minCorner, outVertices[i]);
+        maxCorner = (i == 0) ? outVertices[i] : glm::max(maxCorner, outVertices[i]);
     }
+    const float maxError = glm::length(maxCorner - minCorner) * LOD_MAX_ERROR;
     
-    // For each vertex of the triangle
-    for (unsigned int i = 0; i < vertexIndices.size(); i++)
+    // Every level is simplified from the full mesh, so they are built in parallel
+    const std::vector<unsigned int> fullIndices(outIndices);
+    std::vector<std::vector<unsigned int> > lodIndices(MAX_MESH_LODS - 1);
+    std::vector<float> lodErrors(MAX_MESH_LODS - 1, 0.0f);
+    ThreadPool::instance().parallelFor(MAX_MESH_LODS - 1, [&](unsigned int i)
     {
-        // Get the indices of its attributes
-        unsigned int vertexIndex = vertexIndices[i];
-        unsigned int uvIndex = uvIndices[i];
-        unsigned int normalIndex = normalIndices[i];
-        
-        // Get the attributes
-        glm::vec3 vertex = tempVertices[vertexIndex - 1];
-        glm::vec2 uv = tempUVs[uvIndex - 1];
-        glm::vec3 normal = tempNormals[normalIndex - 1];
+        const float reduction = powf(LOD_REDUCTION, (float)(i + 1));
+        const size_t targetCount = static_cast<size_t>(fullIndices.size() / 3 * reduction) * 3;
+        lodIndices[i] = meshSimplifier::simplify(fullIndices, outVertices, targetCount, maxError, lodErrors[i]);
+        meshOptimizer::optimizeVertexCache(lodIndices[i], outVertices.size());
+    });
+    
+    // Keep levels while they still save enough over the one before. Their meshlets are found once every
+    // level is known
+    MeshLod full = { 0, static_cast<unsigned int>(fullIndices.size()), 0.0f, 0, 0 };
+    outLods.assign(1, full);
+    for (size_t i = 0; i < lodIndices.size(); i++)
+    {
+        if (lodIndices[i].empty() || lodIndices[i].size() > outLods.back().indexCount * LOD_MIN_REDUCTION)
+            break;
         
-        // Copy the attributes to the buffers
-        outVertices.push_back(vertex);
-        outUVs.push_back(uv);
-        outNormals.push_back(normal);
+        MeshLod lod = { static_cast<unsigned int>(outIndices.size()), static_cast<unsigned int>(lodIndices[i].size()), lodErrors[i], 0, 0 };
+        outIndices.insert(outIndices.end(), lodIndices[i].begin(), lodIndices[i].end());
+        outLods.push_back(lod);
     }
-    
-    // Close .obj file
-    fclose(file);
+    printf("Built %u levels of detail for %s in %.2f ms\n", (unsigned int)outLods.size(), path, timer.elapsedMs());
     
     return true;
 }
@@ -212,43 +545,41 @@ bool Model::loadObj(const char *path,
 void Model::addTexture(const char *path, const std::string type)
 {
     Texture texture;
-    texture.id = loadTexture(path);
+    texture.id = TextureCache::instance().acquireArray(std::vector<std::string>(1, path), getMapOptions(type));
     texture.type = type;
+    texture.layer = 0;
     textures.push_back(texture);
 }
 
-unsigned int Model::loadTexture(const char *path)
+void Model::addTexture(const char *path, const std::string type, AssetLoader &loader)
 {
-    unsigned int textureID;
-    glGenTextures(1, &textureID);
-
-    int width, height, numComponents;
-    unsigned char *data = stbi_load(path, &width, &height, &numComponents, 0);
-    if (data)
+    pendingUploads++;
+    TextureCache::instance().acquireArray(std::vector<std::string>(1, path), getMapOptions(type), loader,
+                                          [this, type](unsigned int textureID)
     {
-        GLenum format;
-        if (numComponents == 1)
-            format = GL_RED;
-        else if (numComponents == 3)
-            format = GL_RGB;
-        else if (numComponents == 4)
-            format = GL_RGBA;
-
-        glBindTexture(GL_TEXTURE_2D, textureID);
-        glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
-        glGenerateMipmap(GL_TEXTURE_2D);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        Texture texture;
+        texture.id = textureID;
+        texture.type = type;
+        texture.layer = 0;
+        textures.push_back(texture);
+        pendingUploads--;
+    });
+}
 
-        stbi_image_free(data);
-    }
-    else
+void Model::addTexture(const char *path, const std::string type, TextureArrayBuilder &maps)
+{
+    Texture texture;
+    texture.id = 0;
+    texture.type = type;
+    texture.layer = maps.addLayer(path);
+    textures.push_back(texture);
+    
+    // The id arrives once the array is built, the model is not drawn before then
+    size_t index = textures.size() - 1;
+    pendingUploads++;
+    maps.addUser([this, index](unsigned int arrayID)
     {
-        std::cout << "Texture " << path << " failed to load." << std::endl;
-        stbi_image_free(data);
-    }
-
-    return textureID;
+        textures[index].id = arrayID;
+        pendingUploads--;
+    });
 }
@@ -7,53 +7,155 @@
 #include <GL/glew.h>
 #include <glm/glm.hpp>
 
-// Texture struct
+#include "meshCache.hpp"
+#include "mappedFile.hpp"
+#include "uploadRing.hpp"
+
+class AssetLoader;
+class TextureArrayBuilder;
+
+// Texture struct, every map is a layer of a texture array
 struct Texture
 {
     unsigned int id;
     std::string type;
+    int layer;
 };
 
 class Model
 {
 public:
-    // Model attributes
+    // Model attributes, the vertex arrays are only filled when the .obj is parsed rather than loaded from the cache,
+    // indices holds every level of detail back to back
     std::vector<glm::vec3> vertices;
     std::vector<glm::vec2> uvs;
     std::vector<glm::vec3> normals;
+    std::vector<unsigned int> indices;
     std::vector<Texture>   textures;
     unsigned int textureID;
     float ka, kd, ks, Ns;
+    glm::vec3 boundsMin, boundsMax;
+    
+    // Largest on screen error in pixels a level of detail may have before a finer one is drawn
+    float lodPixelError;
+    
+    // Debug override for every model, -1 selects levels from the screen space error
+    static int forcedLod;
     
-    // Constructor
+    // Constructor, loads and uploads the mesh straight away
     Model(const char *path);
     
-    // Draw model
-    void draw(unsigned int &shaderID);
+    // Load the mesh in the background, the model can be drawn once isLoaded returns true
+    Model(const char *path, AssetLoader &loader);
+    
+    // Draw model, level 0 is the full mesh
+    void draw(unsigned int &shaderID, unsigned int lod = 0);
+    
+    // Draw one instance of a level, skipping the meshlets outside the frustum or facing away from the camera
+    void drawCulled(unsigned int &shaderID, unsigned int lod, const glm::mat4 &transform,
+                    const CullView &view, ClusterCullStats &stats);
+    
+    // Pick the level of detail for one instance, currentLod is that instance's level from the previous
+    // frame and is updated. projectionScale is the camera's pixels per unit at a distance of one
+    unsigned int selectLod(const glm::mat4 &transform, const glm::vec3 &viewPos, float projectionScale,
+                           unsigned int &currentLod) const;
     
-    // Add textures
+    // Ask the texture cache for the detail one instance needs, assuming the textures cover the model once
+    void requestTextureDetail(const glm::mat4 &transform, const glm::vec3 &viewPos, float projectionScale) const;
+    
+    // Level of detail statistics
+    unsigned int getLodCount() const;
+    unsigned int getLodTriangleCount(unsigned int lod) const;
+    
+    // Add textures, the loader version decodes on a worker and uploads later. Each is an array of one layer
     void addTexture(const char *path, const std::string type);
+    void addTexture(const char *path, const std::string type, AssetLoader &loader);
+    
+    // Add a texture as a layer of a shared array, the model can be drawn once the array has been built
+    void addTexture(const char *path, const std::string type, TextureArrayBuilder &maps);
+    
+    // True once the mesh and every texture have been uploaded
+    bool isLoaded() const;
     
     // Cleanup
     void deleteBuffers();
     
 private:
     
-    // Array buffers
+    // Array buffers, the vertex buffer holds PackedVertex data
     unsigned int VAO;
     unsigned int vertexBuffer;
-    unsigned int uvBuffer;
-    unsigned int normalBuffer;
+    unsigned int elementBuffer;
+    
+    // Index ranges of the levels of detail, finest first
+    unsigned int lodCount;
+    MeshLod lods[MAX_MESH_LODS];
+    
+    // Meshlets of every level, each level's meshlets cover its index range
+    std::vector<Meshlet> meshlets;
+    
+    // Index ranges that survived culling, reused between draws
+    std::vector<GLsizei> drawCounts;
+    std::vector<const void*> drawOffsets;
+    
+    // Index buffer element type, GL_UNSIGNED_SHORT when every index fits in 16 bits
+    GLenum indexType;
+    
+    // Texture unit and uniform locations of each map, looked up again when drawn with another shader.
+    // Maps in the same array share its unit
+    unsigned int mapShader;
+    std::vector<unsigned int> mapUnits;
+    std::vector<GLint> mapLocations;
+    std::vector<GLint> layerLocations;
+    
+    // Loader uploads that have not run yet
+    unsigned int pendingUploads;
+    
+    // Processed mesh waiting for upload, the buffers point into the staging arrays or the mapped cache
+    MeshBuffers stagedBuffers;
+    std::vector<PackedVertex> stagedVertices;
+    std::vector<unsigned char> stagedIndices;
+    MappedFile cacheFile;
+    
+    // The staged buffers copied into the upload ring by the loader's worker
+    UploadSlice vertexSlice;
+    UploadSlice indexSlice;
+    
+    // Read the cache or process the .obj into the staged buffers, does not touch GL
+    bool loadMesh(const char *path);
+    
+    // Copy the staged buffers into the upload ring, safe on worker threads
+    void stageMesh();
+    
+    // Create the GL buffers from the staged mesh and release it
+    void uploadMesh();
+    
+    // Load the .cgmesh cache if it was built from the current .obj
+    bool loadCache(const std::string &cachePath, unsigned long long sourceSize, unsigned long long sourceHash);
+    
+    // Print the triangle count of each level of detail
+    void printLods(const char *path, const MeshBuffers &buffers) const;
+    
+    // Send the material, textures and dequantisation uniforms
+    void bindMaterial(unsigned int &shaderID);
     
     // Load .obj file method
     bool loadObj(const char *path,
                  std::vector<glm::vec3> &inVertices,
                  std::vector<glm::vec2> &inUVs,
-                 std::vector<glm::vec3> &inNormals);
+                 std::vector<glm::vec3> &inNormals,
+                 std::vector<unsigned int> &inIndices,
+                 std::vector<MeshLod> &inLods);
     
-    // Setup buffers
-    void setupBuffers();
+    // Quantise the vertex arrays and pack the indices ready for upload
+    void buildMeshBuffers(std::vector<PackedVertex> &packed,
+                          std::vector<unsigned char> &indexData,
+                          const std::vector<MeshLod> &meshLods,
+                          MeshBuffers &buffers);
+    
+    // Split every level of detail into meshlets
+    void buildMeshlets(const char *path, std::vector<MeshLod> &meshLods);
     
-    // Load texture
-    unsigned int loadTexture(const char *path);
+    // Setup buffers
+    void setupBuffers(const MeshBuffers &buffers);
 };
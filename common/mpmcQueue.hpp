@@ -0,0 +1,106 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+// Bounded lock-free multi producer multi consumer queue (Vyukov). Each cell carries a sequence number
+// that tells producers and consumers whose turn it is, so neither side ever takes a lock
+template <typename T>
+class MpmcQueue
+{
+public:
+	// capacity is rounded up to a power of two
+	explicit MpmcQueue(size_t capacity)
+		: m_mask(roundUpPow2(capacity) - 1)
+		, m_cells(m_mask + 1)
+		, m_enqueuePos(0)
+		, m_dequeuePos(0)
+	{
+		for (size_t i = 0; i <= m_mask; i++) {
+			m_cells[i].sequence.store(i, std::memory_order_relaxed);
+		}
+	}
+
+	// False when the queue is full
+	bool push(const T& value)
+	{
+		size_t pos = m_enqueuePos.load(std::memory_order_relaxed);
+		Cell* cell;
+		while (true) {
+			cell = &m_cells[pos & m_mask];
+			size_t sequence = cell->sequence.load(std::memory_order_acquire);
+			ptrdiff_t diff = (ptrdiff_t)sequence - (ptrdiff_t)pos;
+			if (diff == 0) {
+				if (m_enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+					break;
+				}
+			}
+			else if (diff < 0) {
+				return false;
+			}
+			else {
+				pos = m_enqueuePos.load(std::memory_order_relaxed);
+			}
+		}
+		cell->value = value;
+		cell->sequence.store(pos + 1, std::memory_order_release);
+		return true;
+	}
+
+	// False when the queue is empty
+	bool pop(T& value)
+	{
+		size_t pos = m_dequeuePos.load(std::memory_order_relaxed);
+		Cell* cell;
+		while (true) {
+			cell = &m_cells[pos & m_mask];
+			size_t sequence = cell->sequence.load(std::memory_order_acquire);
+			ptrdiff_t diff = (ptrdiff_t)sequence - (ptrdiff_t)(pos + 1);
+			if (diff == 0) {
+				if (m_dequeuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+					break;
+				}
+			}
+			else if (diff < 0) {
+				return false;
+			}
+			else {
+				pos = m_dequeuePos.load(std::memory_order_relaxed);
+			}
+		}
+		value = cell->value;
+		cell->sequence.store(pos + m_mask + 1, std::memory_order_release);
+		return true;
+	}
+
+private:
+	MpmcQueue(const MpmcQueue&);
+	MpmcQueue& operator=(const MpmcQueue&);
+
+	static size_t roundUpPow2(size_t value)
+	{
+		size_t result = 2;
+		while (result < value) {
+			result <<= 1;
+		}
+		return result;
+	}
+
+	struct Cell
+	{
+		std::atomic<size_t> sequence;
+		T value;
+	};
+
+	// Keep the two ends on separate cache lines so producers and consumers do not share one
+	static const size_t CACHE_LINE = 64;
+
+private:
+	const size_t m_mask;
+	std::vector<Cell> m_cells;
+	char m_padding0[CACHE_LINE];
+	std::atomic<size_t> m_enqueuePos;
+	char m_padding1[CACHE_LINE];
+	std::atomic<size_t> m_dequeuePos;
+	char m_padding2[CACHE_LINE];
+};
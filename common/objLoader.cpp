@@ -0,0 +1,442 @@
+#include "objLoader.hpp"
+#include "mappedFile.hpp"
+#include "threadPool.hpp"
+#include "timer.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <stdio.h>
+
+namespace
+{
+	// Smallest slice of a file that is worth handing to its own thread
+	const size_t MIN_CHUNK_SIZE = 256 * 1024;
+
+	const double POWERS_OF_TEN[] = {
+		1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+		1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+	};
+
+	// Corner of a polygon before it is split into triangles
+	struct PolygonCorner
+	{
+		ObjIndex index;
+		unsigned char relativeMask;	// bit n set when component n was a negative (relative) index
+	};
+
+	// Results of parsing one line aligned slice of the file
+	struct ObjChunk
+	{
+		std::vector<glm::vec3> positions;
+		std::vector<glm::vec2> uvs;
+		std::vector<glm::vec3> normals;
+		std::vector<ObjIndex> corners;
+
+		// Corner components that are relative to this chunk's attribute counts, stored as corner * 3 + component
+		std::vector<unsigned int> relativeIndices;
+
+		const char* error;
+	};
+
+	inline bool isSpace(char c)
+	{
+		return c == ' ' || c == '\t' || c == '\r';
+	}
+
+	inline bool isDigit(char c)
+	{
+		return c >= '0' && c <= '9';
+	}
+
+	inline const char* skipSpace(const char* p, const char* end)
+	{
+		while (p < end && isSpace(*p)) {
+			p++;
+		}
+		return p;
+	}
+
+	inline const char* nextLine(const char* p, const char* end)
+	{
+		const char* newline = (const char*)memchr(p, '\n', end - p);
+		return newline ? newline + 1 : end;
+	}
+
+	// Parse a decimal float with optional sign, fraction and exponent, returns nullptr if there is no number
+	const char* parseFloat(const char* p, const char* end, float& out)
+	{
+		p = skipSpace(p, end);
+
+		bool negative = false;
+		if (p < end && (*p == '-' || *p == '+')) {
+			negative = (*p == '-');
+			p++;
+		}
+
+		unsigned long long mantissa = 0;
+		int significant = 0;
+		int exponent = 0;
+		bool anyDigits = false;
+
+		while (p < end && isDigit(*p)) {
+			if (significant < 19) {
+				mantissa = mantissa * 10 + (*p - '0');
+				if (mantissa != 0) {
+					significant++;
+				}
+			}
+			else {
+				exponent++;
+			}
+			anyDigits = true;
+			p++;
+		}
+
+		if (p < end && *p == '.') {
+			p++;
+			while (p < end && isDigit(*p)) {
+				if (significant < 19) {
+					mantissa = mantissa * 10 + (*p - '0');
+					if (mantissa != 0) {
+						significant++;
+					}
+					exponent--;
+				}
+				anyDigits = true;
+				p++;
+			}
+		}
+
+		if (!anyDigits) {
+			return nullptr;
+		}
+
+		if (p < end && (*p == 'e' || *p == 'E')) {
+			const char* q = p + 1;
+			bool negativeExponent = false;
+			if (q < end && (*q == '-' || *q == '+')) {
+				negativeExponent = (*q == '-');
+				q++;
+			}
+			if (q < end && isDigit(*q)) {
+				int value = 0;
+				while (q < end && isDigit(*q)) {
+					if (value < 10000) {
+						value = value * 10 + (*q - '0');
+					}
+					q++;
+				}
+				exponent += negativeExponent ? -value : value;
+				p = q;
+			}
+		}
+
+		double value = (double)mantissa;
+		if (exponent < 0) {
+			for (; exponent < -22; exponent += 22) {
+				value /= POWERS_OF_TEN[22];
+			}
+			value /= POWERS_OF_TEN[-exponent];
+		}
+		else {
+			for (; exponent > 22; exponent -= 22) {
+				value *= POWERS_OF_TEN[22];
+			}
+			value *= POWERS_OF_TEN[exponent];
+		}
+
+		out = (float)(negative ? -value : value);
+		return p;
+	}
+
+	// Parse a signed integer without leading white space, returns nullptr if there is no number
+	const char* parseInt(const char* p, const char* end, int& out)
+	{
+		bool negative = false;
+		if (p < end && (*p == '-' || *p == '+')) {
+			negative = (*p == '-');
+			p++;
+		}
+		if (p >= end || !isDigit(*p)) {
+			return nullptr;
+		}
+
+		int value = 0;
+		while (p < end && isDigit(*p)) {
+			value = value * 10 + (*p - '0');
+			p++;
+		}
+
+		out = negative ? -value : value;
+		return p;
+	}
+
+	// Convert a one based (or negative, relative) .obj index to zero based
+	inline bool resolveIndex(int raw, size_t count, int& out, unsigned char& relativeMask, unsigned char bit)
+	{
+		if (raw > 0) {
+			out = raw - 1;
+		}
+		else if (raw < 0) {
+			// Relative to the attributes seen so far in this chunk, rebased once all chunks are merged
+			out = (int)count + raw;
+			relativeMask |= bit;
+		}
+		else {
+			return false;
+		}
+		return true;
+	}
+
+	// Parse one of "v", "v/vt", "v//vn" or "v/vt/vn"
+	const char* parseCorner(const char* p, const char* end, const ObjChunk& chunk, PolygonCorner& corner)
+	{
+		corner.index.v = -1;
+		corner.index.vt = -1;
+		corner.index.vn = -1;
+		corner.relativeMask = 0;
+
+		int raw;
+		p = parseInt(p, end, raw);
+		if (!p || !resolveIndex(raw, chunk.positions.size(), corner.index.v, corner.relativeMask, 1)) {
+			return nullptr;
+		}
+
+		if (p < end && *p == '/') {
+			p++;
+			if (p < end && *p != '/') {
+				p = parseInt(p, end, raw);
+				if (!p || !resolveIndex(raw, chunk.uvs.size(), corner.index.vt, corner.relativeMask, 2)) {
+					return nullptr;
+				}
+			}
+			if (p < end && *p == '/') {
+				p++;
+				p = parseInt(p, end, raw);
+				if (!p || !resolveIndex(raw, chunk.normals.size(), corner.index.vn, corner.relativeMask, 4)) {
+					return nullptr;
+				}
+			}
+		}
+
+		return p;
+	}
+
+	void emitCorner(const PolygonCorner& corner, ObjChunk& chunk)
+	{
+		unsigned int slot = (unsigned int)chunk.corners.size() * 3;
+		for (unsigned int component = 0; component < 3; component++) {
+			if (corner.relativeMask & (1 << component)) {
+				chunk.relativeIndices.push_back(slot + component);
+			}
+		}
+		chunk.corners.push_back(corner.index);
+	}
+
+	void parseChunk(const char* p, const char* end, ObjChunk& chunk)
+	{
+		chunk.error = nullptr;
+		std::vector<PolygonCorner> polygon;
+
+		while (p < end) {
+			const char* line = p;
+			p = skipSpace(p, end);
+			if (p >= end) {
+				break;
+			}
+
+			const char c0 = p[0];
+			const char c1 = (p + 1 < end) ? p[1] : '\n';
+			const char c2 = (p + 2 < end) ? p[2] : '\n';
+
+			if (c0 == 'v' && isSpace(c1)) {
+				// Vertex position
+				glm::vec3 position;
+				p = parseFloat(p + 1, end, position.x);
+				if (p) p = parseFloat(p, end, position.y);
+				if (p) p = parseFloat(p, end, position.z);
+				if (!p) {
+					chunk.error = line;
+					return;
+				}
+				chunk.positions.push_back(position);
+			}
+			else if (c0 == 'v' && c1 == 't' && isSpace(c2)) {
+				// Texture co-ordinate
+				glm::vec2 uv;
+				p = parseFloat(p + 2, end, uv.x);
+				if (p) p = parseFloat(p, end, uv.y);
+				if (!p) {
+					chunk.error = line;
+					return;
+				}
+				chunk.uvs.push_back(uv);
+			}
+			else if (c0 == 'v' && c1 == 'n' && isSpace(c2)) {
+				// Vertex normal
+				glm::vec3 normal;
+				p = parseFloat(p + 2, end, normal.x);
+				if (p) p = parseFloat(p, end, normal.y);
+				if (p) p = parseFloat(p, end, normal.z);
+				if (!p) {
+					chunk.error = line;
+					return;
+				}
+				chunk.normals.push_back(normal);
+			}
+			else if (c0 == 'f' && isSpace(c1)) {
+				// Polygon, split into a triangle fan
+				polygon.clear();
+				p = skipSpace(p + 1, end);
+				while (p < end && *p != '\n' && *p != '#') {
+					PolygonCorner corner;
+					p = parseCorner(p, end, chunk, corner);
+					if (!p) {
+						chunk.error = line;
+						return;
+					}
+					polygon.push_back(corner);
+					p = skipSpace(p, end);
+				}
+
+				if (polygon.size() < 3) {
+					chunk.error = line;
+					return;
+				}
+				for (size_t i = 1; i + 1 < polygon.size(); i++) {
+					emitCorner(polygon[0], chunk);
+					emitCorner(polygon[i], chunk);
+					emitCorner(polygon[i + 1], chunk);
+				}
+			}
+
+			// Anything else (comments, groups, materials, smoothing) is skipped
+			p = nextLine(p, end);
+		}
+	}
+
+	template <typename T>
+	void appendRange(const std::vector<T>& source, std::vector<T>& dest, size_t offset)
+	{
+		if (!source.empty()) {
+			std::copy(source.begin(), source.end(), dest.begin() + offset);
+		}
+	}
+}
+
+namespace objLoader
+{
+	bool load(const char* path, ObjData& out)
+	{
+		Timer timer;
+
+		MappedFile file;
+		if (!file.open(path)) {
+			printf("Impossible to open the file. Check paths and directories.\n");
+			return false;
+		}
+
+		if (!parse((const char*)file.data(), file.size(), out)) {
+			printf("File %s can't be read by loadObj().\n", path);
+			return false;
+		}
+
+		double seconds = timer.elapsedSeconds();
+		double megabytes = file.size() / (1024.0 * 1024.0);
+		printf("Parsed %s: %.2f MB in %.2f ms (%.1f MB/s), %u triangles\n",
+			path, megabytes, seconds * 1000.0, seconds > 0.0 ? megabytes / seconds : 0.0,
+			(unsigned int)(out.corners.size() / 3));
+
+		return true;
+	}
+
+	bool parse(const char* text, size_t length, ObjData& out)
+	{
+		ThreadPool& pool = ThreadPool::instance();
+
+		// Split into line aligned chunks, a few per thread so uneven chunks still balance
+		size_t maxChunks = (pool.getThreadCount() + 1) * 4;
+		size_t numChunks = std::max<size_t>(1, std::min(length / MIN_CHUNK_SIZE, maxChunks));
+
+		std::vector<const char*> boundaries(numChunks + 1);
+		boundaries[0] = text;
+		boundaries[numChunks] = text + length;
+		for (size_t i = 1; i < numChunks; i++) {
+			const char* split = text + (length * i) / numChunks;
+			split = std::max(split, boundaries[i - 1]);
+			boundaries[i] = nextLine(split, text + length);
+		}
+
+		std::vector<ObjChunk> chunks(numChunks);
+		pool.parallelFor((unsigned int)numChunks, [&](unsigned int i) {
+			parseChunk(boundaries[i], boundaries[i + 1], chunks[i]);
+		});
+
+		// Offsets of each chunk's attributes in the merged arrays
+		std::vector<size_t> positionBase(numChunks), uvBase(numChunks), normalBase(numChunks), cornerBase(numChunks);
+		size_t numPositions = 0, numUVs = 0, numNormals = 0, numCorners = 0;
+		for (size_t i = 0; i < numChunks; i++) {
+			if (chunks[i].error) {
+				size_t lineNumber = 1 + std::count(text, chunks[i].error, '\n');
+				printf("Unsupported or malformed line %u in .obj file.\n", (unsigned int)lineNumber);
+				return false;
+			}
+
+			positionBase[i] = numPositions;
+			uvBase[i] = numUVs;
+			normalBase[i] = numNormals;
+			cornerBase[i] = numCorners;
+			numPositions += chunks[i].positions.size();
+			numUVs += chunks[i].uvs.size();
+			numNormals += chunks[i].normals.size();
+			numCorners += chunks[i].corners.size();
+		}
+
+		out.positions.resize(numPositions);
+		out.uvs.resize(numUVs);
+		out.normals.resize(numNormals);
+		out.corners.resize(numCorners);
+
+		// Merge the chunks in parallel, rebasing any relative indices and validating the rest
+		std::vector<unsigned char> valid(numChunks, 1);
+		pool.parallelFor((unsigned int)numChunks, [&](unsigned int i) {
+			ObjChunk& chunk = chunks[i];
+			appendRange(chunk.positions, out.positions, positionBase[i]);
+			appendRange(chunk.uvs, out.uvs, uvBase[i]);
+			appendRange(chunk.normals, out.normals, normalBase[i]);
+
+			for (size_t j = 0; j < chunk.relativeIndices.size(); j++) {
+				unsigned int slot = chunk.relativeIndices[j];
+				ObjIndex& corner = chunk.corners[slot / 3];
+				int& component = (slot % 3 == 0) ? corner.v : (slot % 3 == 1) ? corner.vt : corner.vn;
+				const size_t base = (slot % 3 == 0) ? positionBase[i] : (slot % 3 == 1) ? uvBase[i] : normalBase[i];
+				component += (int)base;
+				if (component < 0) {
+					valid[i] = 0;
+				}
+			}
+
+			for (size_t j = 0; j < chunk.corners.size(); j++) {
+				const ObjIndex& corner = chunk.corners[j];
+				if (corner.v < 0 || corner.v >= (int)numPositions ||
+					corner.vt >= (int)numUVs || corner.vn >= (int)numNormals) {
+					valid[i] = 0;
+				}
+			}
+			appendRange(chunk.corners, out.corners, cornerBase[i]);
+
+			// Release the chunk as soon as it has been merged
+			std::vector<glm::vec3>().swap(chunk.positions);
+			std::vector<glm::vec2>().swap(chunk.uvs);
+			std::vector<glm::vec3>().swap(chunk.normals);
+			std::vector<ObjIndex>().swap(chunk.corners);
+		});
+
+		if (std::find(valid.begin(), valid.end(), 0) != valid.end()) {
+			printf("Face index out of range in .obj file.\n");
+			return false;
+		}
+
+		return true;
+	}
+}
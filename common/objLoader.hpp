@@ -0,0 +1,31 @@
+#pragma once
+#include <vector>
+#include <cstddef>
+
+#include <glm/glm.hpp>
+
+// Zero based indices of one face corner, -1 when the attribute is absent
+struct ObjIndex
+{
+	int v;
+	int vt;
+	int vn;
+};
+
+// Contents of a .obj file, faces are triangulated so there are three corners per triangle
+struct ObjData
+{
+	std::vector<glm::vec3> positions;
+	std::vector<glm::vec2> uvs;
+	std::vector<glm::vec3> normals;
+	std::vector<ObjIndex> corners;
+};
+
+namespace objLoader
+{
+	// Memory map the file and parse it in line aligned chunks across the thread pool
+	bool load(const char* path, ObjData& out);
+
+	// Parse .obj text that is already in memory
+	bool parse(const char* text, size_t length, ObjData& out);
+}
@@ -1,9 +1,34 @@
 #include "skyBox.hpp"
+#include "textureCache.hpp"
+
+namespace
+{
+	// In GL_TEXTURE_CUBE_MAP_POSITIVE_X + i order
+	const char* const FACE_PATHS[6] = {
+		"../assets/skybox/right.jpg",
+		"../assets/skybox/left.jpg",
+		"../assets/skybox/top.jpg",
+		"../assets/skybox/bottom.jpg",
+		"../assets/skybox/front.jpg",
+		"../assets/skybox/back.jpg"
+	};
+}
 
 SkyBox::SkyBox()
 	:m_skyTexture(-1)
+	,m_loaded(true)
+{
+	m_skyTexture = TextureCache::instance().acquireCubeMap(FACE_PATHS);
+}
+
+SkyBox::SkyBox(AssetLoader& loader)
+	:m_skyTexture(-1)
+	,m_loaded(false)
 {
-	initSkyTexture();
+	TextureCache::instance().acquireCubeMap(FACE_PATHS, loader, [this](unsigned int textureID) {
+		m_skyTexture = textureID;
+		m_loaded = true;
+	});
 }
 
 SkyBox::~SkyBox()
@@ -18,37 +43,3 @@ void SkyBox::draw(unsigned int shaderID)
 
 	m_sphere.draw(shaderID);
 }
-
-void SkyBox::initSkyTexture()
-{
-	std::vector<std::string> faces;
-	faces.push_back("../assets/skybox/right.jpg");
-	faces.push_back("../assets/skybox/left.jpg");
-	faces.push_back("../assets/skybox/top.jpg");
-	faces.push_back("../assets/skybox/bottom.jpg");
-	faces.push_back("../assets/skybox/front.jpg");
-	faces.push_back("../assets/skybox/back.jpg");
-
-	glGenTextures(1, &m_skyTexture);
-	glBindTexture(GL_TEXTURE_CUBE_MAP, m_skyTexture);
-
-	for (int i = 0; i < faces.size(); i++) {
-		int width, height, nrComponents;
-		unsigned char* data = stbi_load((faces[i]).c_str(), &width, &height, &nrComponents, 0);
-		if (data) {
-			glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, data);
-			stbi_image_free(data);
-		}
-		else {
-			std::cout << "Failed to load texture when create cube map texture: " << faces[i] << std::endl;
-			stbi_image_free(data);
-		}
-	}
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
-
-	glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
-}
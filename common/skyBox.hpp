@@ -1,18 +1,22 @@
 #pragma once
 #include "sphere.hpp"
 
+class AssetLoader;
+
 class SkyBox
 {
 public:
 	SkyBox();
+	// Decode the six faces in the background, the sky can be drawn once isLoaded returns true
+	explicit SkyBox(AssetLoader& loader);
 	~SkyBox();
 
 	void draw(unsigned int shaderID);
 
-private:
-	void initSkyTexture();
+	bool isLoaded() const { return m_loaded; }
 
 private:
 	Sphere m_sphere;
 	unsigned int m_skyTexture;
+	bool m_loaded;
 };
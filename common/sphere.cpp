@@ -1,5 +1,9 @@
 #include "sphere.hpp"
 #include "maths.hpp"
+#include "meshOptimizer.hpp"
+#include "vertexFormat.hpp"
+#include "assetLoader.hpp"
+#include "textureCache.hpp"
 
 Sphere::Sphere()
 	: m_color(1.0f)
@@ -9,6 +13,9 @@ Sphere::Sphere()
 	, m_diffuseTexture(-1)
 	, m_specularTexture(-1)
 	, m_normalTexture(-1)
+	, m_pendingTextures(0)
+	, m_positionOffset(0.0f)
+	, m_positionScale(1.0f)
 {
 	initRenderData();
 }
@@ -21,17 +28,34 @@ Sphere::~Sphere()
 void Sphere::draw(unsigned int shaderID)
 {
 	glUniform3f(glGetUniformLocation(shaderID, "color"), m_color.r, m_color.g, m_color.b);
+	glUniform3f(glGetUniformLocation(shaderID, "positionOffset"), m_positionOffset.x, m_positionOffset.y, m_positionOffset.z);
+	glUniform3f(glGetUniformLocation(shaderID, "positionScale"), m_positionScale.x, m_positionScale.y, m_positionScale.z);
 
 	glBindVertexArray(m_VAO);
-	glDrawElements(GL_TRIANGLE_STRIP, m_indices.size(), GL_UNSIGNED_INT, 0);
+	glDrawElements(GL_TRIANGLES, m_indices.size(), GL_UNSIGNED_SHORT, 0);
 	glBindVertexArray(0);
 }
 
 void Sphere::initTextures(const char* diffusePath, const char* specularPath, const char* normalPath)
 {
-	m_diffuseTexture = loadTexture(diffusePath);
-	m_specularTexture = loadTexture(specularPath);
-	m_normalTexture = loadTexture(normalPath);
+	m_diffuseTexture = TextureCache::instance().acquire(diffusePath, getMapOptions("diffuse"));
+	m_specularTexture = TextureCache::instance().acquire(specularPath, getMapOptions("specular"));
+	m_normalTexture = TextureCache::instance().acquire(normalPath, getMapOptions("normal"));
+}
+
+void Sphere::initTextures(const char* diffusePath, const char* specularPath, const char* normalPath, AssetLoader& loader)
+{
+	const char* paths[3] = { diffusePath, specularPath, normalPath };
+	const char* types[3] = { "diffuse", "specular", "normal" };
+	unsigned int* textures[3] = { &m_diffuseTexture, &m_specularTexture, &m_normalTexture };
+	for (int i = 0; i < 3; i++) {
+		unsigned int* texture = textures[i];
+		m_pendingTextures++;
+		TextureCache::instance().acquire(paths[i], getMapOptions(types[i]), loader, [this, texture](unsigned int textureID) {
+			*texture = textureID;
+			m_pendingTextures--;
+		});
+	}
 }
 
 void Sphere::drawPhong(unsigned int shaderID)
@@ -45,12 +69,28 @@ void Sphere::drawPhong(unsigned int shaderID)
 	glActiveTexture(GL_TEXTURE2);
 	glUniform1i(glGetUniformLocation(shaderID, "normalMap"), 2);
 	glBindTexture(GL_TEXTURE_2D, m_normalTexture);
+	glUniform3f(glGetUniformLocation(shaderID, "positionOffset"), m_positionOffset.x, m_positionOffset.y, m_positionOffset.z);
+	glUniform3f(glGetUniformLocation(shaderID, "positionScale"), m_positionScale.x, m_positionScale.y, m_positionScale.z);
 
 	glBindVertexArray(m_VAO);
-	glDrawElements(GL_TRIANGLE_STRIP, m_indices.size(), GL_UNSIGNED_INT, 0);
+	glDrawElements(GL_TRIANGLES, m_indices.size(), GL_UNSIGNED_SHORT, 0);
 	glBindVertexArray(0);
 }
 
+void Sphere::requestTextureDetail(const glm::mat4& transform, const glm::vec3& viewPos, float projectionScale)
+{
+	// Unit sphere, the maps wrap around it once so their width spans pi times the sphere's screen diameter
+	glm::vec3 center = glm::vec3(transform[3]);
+	float radius = glm::max(glm::length(glm::vec3(transform[0])),
+		glm::max(glm::length(glm::vec3(transform[1])), glm::length(glm::vec3(transform[2]))));
+	float distance = glm::max(glm::length(center - viewPos) - radius, 1e-3f);
+	float screenPixels = 3.14159265f * 2.0f * radius * projectionScale / distance;
+
+	TextureCache::instance().requestDetail(m_diffuseTexture, screenPixels);
+	TextureCache::instance().requestDetail(m_specularTexture, screenPixels);
+	TextureCache::instance().requestDetail(m_normalTexture, screenPixels);
+}
+
 void Sphere::initRenderData()
 {
 	glGenVertexArrays(1, &m_VAO);
@@ -78,7 +118,7 @@ void Sphere::initRenderData()
 			v.normal = glm::vec3(xPos, yPos, zPos);
 			v.texCoord = glm::vec2(xSegment * 5, ySegment * 5);
 			v.tangent = glm::normalize(glm::vec3(-zPos, 0, -xPos));
-			v.bitangent = glm::normalize(maths::cross(v.normal, v.tangent));
+			v.bitangent = glm::normalize(maths::cross(v.tangent, v.normal));
 			m_Vertices.push_back(v);
 		}
 	}
@@ -100,68 +140,59 @@ void Sphere::initRenderData()
 		oddRow = !oddRow;
 	}
 
+	// Draw as a cache optimised triangle list rather than a strip
+	m_indices = meshOptimizer::stripToList(m_indices);
+	std::vector<glm::vec3> positions(m_Vertices.size());
+	for (unsigned int i = 0; i < m_Vertices.size(); i++) {
+		positions[i] = m_Vertices[i].position;
+	}
+	std::vector<unsigned int> remap = meshOptimizer::optimize(m_indices, positions, "sphere");
+	meshOptimizer::remapVertices(m_Vertices, remap);
+
+	// Every index fits in 16 bits
+	std::vector<unsigned short> shortIndices(m_indices.begin(), m_indices.end());
+
+	// Quantise the vertices against the sphere bounds
+	glm::vec3 boundsMin = m_Vertices[0].position, boundsMax = m_Vertices[0].position;
+	for (unsigned int i = 1; i < m_Vertices.size(); i++) {
+		boundsMin = glm::min(boundsMin, m_Vertices[i].position);
+		boundsMax = glm::max(boundsMax, m_Vertices[i].position);
+	}
+	m_positionOffset = vertexFormat::getPositionOffset(boundsMin, boundsMax);
+	m_positionScale = vertexFormat::getPositionScale(boundsMin, boundsMax);
+
+	std::vector<PackedTangentVertex> packed(m_Vertices.size());
+	for (unsigned int i = 0; i < m_Vertices.size(); i++) {
+		const Vertex& v = m_Vertices[i];
+		vertexFormat::packTangentVertex(v.position, v.texCoord, v.normal, v.tangent, v.bitangent,
+			m_positionOffset, m_positionScale, packed[i]);
+	}
+	printf("Packed %u sphere vertices into %u bytes each (%u unpacked)\n",
+		(unsigned int)packed.size(), (unsigned int)sizeof(PackedTangentVertex), (unsigned int)sizeof(Vertex));
+
 	glBindVertexArray(m_VAO);
 
 	//㻺
 	glBindBuffer(GL_ARRAY_BUFFER, m_VBO);
-	glBufferData(GL_ARRAY_BUFFER, m_Vertices.size() * sizeof(Vertex), &m_Vertices[0], GL_STATIC_DRAW);
+	glBufferData(GL_ARRAY_BUFFER, packed.size() * sizeof(PackedTangentVertex), &packed[0], GL_STATIC_DRAW);
 
 	//
 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_EBO);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, m_indices.size() * sizeof(unsigned int), &m_indices[0], GL_STATIC_DRAW);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, shortIndices.size() * sizeof(unsigned short), &shortIndices[0], GL_STATIC_DRAW);
 
 	//λ
 	glEnableVertexAttribArray(0);
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)0);
-	//
+	glVertexAttribPointer(0, 3, GL_SHORT, GL_TRUE, sizeof(PackedTangentVertex), (void*)offsetof(PackedTangentVertex, position));
+	//, λzʼ4ֽ, ɫʹ.zw
 	glEnableVertexAttribArray(1);
-	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, normal));
+	glVertexAttribPointer(1, 4, GL_BYTE, GL_TRUE, sizeof(PackedTangentVertex), (void*)(offsetof(PackedTangentVertex, position) + 2 * sizeof(short)));
 	//
 	glEnableVertexAttribArray(2);
-	glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, texCoord));
-	//
+	glVertexAttribPointer(2, 2, GL_HALF_FLOAT, GL_FALSE, sizeof(PackedTangentVertex), (void*)offsetof(PackedTangentVertex, uv));
+	//ߺ͸߷
 	glEnableVertexAttribArray(3);
-	glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, tangent));
-	//
-	glEnableVertexAttribArray(4);
-	glVertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, bitangent));
+	glVertexAttribPointer(3, 4, GL_BYTE, GL_TRUE, sizeof(PackedTangentVertex), (void*)offsetof(PackedTangentVertex, tangent));
 
 	glBindVertexArray(0);
 
 }
-
-unsigned int Sphere::loadTexture(const char* path)
-{
-	unsigned int textureID;
-	glGenTextures(1, &textureID);
-
-	int width, height, numComponents;
-	unsigned char* data = stbi_load(path, &width, &height, &numComponents, 0);
-	if (data)
-	{
-		GLenum format;
-		if (numComponents == 1)
-			format = GL_RED;
-		else if (numComponents == 3)
-			format = GL_RGB;
-		else if (numComponents == 4)
-			format = GL_RGBA;
-
-		glBindTexture(GL_TEXTURE_2D, textureID);
-		glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
-		glGenerateMipmap(GL_TEXTURE_2D);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-		stbi_image_free(data);
-	}
-	else
-	{
-		std::cout << "Texture " << path << " failed to load." << std::endl;
-		stbi_image_free(data);
-	}
-
-	return textureID;
-}
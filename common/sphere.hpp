@@ -1,6 +1,8 @@
 #pragma once
 #include "common.hpp"
 
+class AssetLoader;
+
 class Sphere
 {
 public:
@@ -11,13 +13,17 @@ public:
 	void draw(unsigned int shaderID);
 
 	void initTextures(const char* diffusePath, const char* specularPath, const char* normalPath);
+	// Decode the maps in the background, drawPhong can be used once isLoaded returns true
+	void initTextures(const char* diffusePath, const char* specularPath, const char* normalPath, AssetLoader& loader);
+	bool isLoaded() const { return m_pendingTextures == 0; }
 	void drawPhong(unsigned int shaderID);
 
+	// Ask the texture cache for the detail the maps need with the sphere drawn at transform
+	void requestTextureDetail(const glm::mat4& transform, const glm::vec3& viewPos, float projectionScale);
+
 private:
 	void initRenderData();
 
-	unsigned int loadTexture(const char* path);
-
 private:
 	glm::vec3 m_color;
 	unsigned int m_VBO, m_VAO, m_EBO;
@@ -27,4 +33,9 @@ private:
 	unsigned int m_diffuseTexture;
 	unsigned int m_specularTexture;
 	unsigned int m_normalTexture;
+	unsigned int m_pendingTextures;
+
+	// Dequantisation of the packed positions
+	glm::vec3 m_positionOffset;
+	glm::vec3 m_positionScale;
 };
@@ -1,16 +1,348 @@
 
 #include "terrain.hpp"
 #include "maths.hpp"
+#include "assetLoader.hpp"
+#include "textureCache.hpp"
+#include "contentHash.hpp"
+#include "threadPool.hpp"
+#include "timer.hpp"
+
+#include <algorithm>
+#include <cfloat>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <random>
+
+#if defined(__AVX2__)
+#define TERRAIN_GATHER
+#include <immintrin.h>
+#endif
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+namespace
+{
+	const char* HEIGHTMAP_PATH = "../assets/terrain/terrain0-16bbp-257x257.raw";
+	// Tiled generated heightmaps, by size and seed
+	const char* GENERATED_HEIGHTMAP_FORMAT = "../assets/terrain/generated-%ux%u-%u.cgheight";
+	// Layers of the terrain's texture array, in the order terrainFS.glsl is told
+	enum TerrainLayer
+	{
+		GRASS_LAYER = 0,
+		ROCK_LAYER,
+		SNOW_LAYER,
+		TERRAIN_LAYER_COUNT
+	};
+	const char* const TEXTURE_PATHS[TERRAIN_LAYER_COUNT] = {
+		"../assets/textures/grass.jpg",
+		"../assets/textures/rock.jpg",
+		"../assets/textures/snow.jpg"
+	};
+
+	// Times each texture repeats across the terrain, as in terrainFS.glsl
+	const float GRASS_REPEATS = 16.0f;
+
+	// Quads along each side of the patch every chunk draws, a leaf chunk has one per heightmap sample
+	const unsigned int PATCH_QUADS = 32;
+
+	// Cuts the patch's strips apart, past the last vertex a 16 bit index reaches
+	const unsigned short PATCH_RESTART_INDEX = 0xffff;
+
+	// Quads along each side of a height tile, so a tile holds 8x8 chunks of its level
+	const unsigned int TILE_QUADS = 256;
+
+	// CPU and GPU memory the resident height tiles may take
+	const size_t TILE_BUDGET_BYTES = 32 * 1024 * 1024;
+
+	// A leaf is drawn while the camera is within this many leaf widths of it, each level up doubles it
+	const float LOD_RANGE_SCALE = 2.0f;
+
+	// Fraction of a level's range after which its vertices start morphing towards the next level
+	const float MORPH_START = 0.66f;
+
+	// Texture unit the height tiles are bound to, the terrain maps use unit 0
+	const int HEIGHTMAP_UNIT = 1;
+
+	// Points per thread pool item of a batched ground query, a batch under two of these stays on the caller
+	const size_t QUERIES_PER_JOB = 4096;
+
+	// Points and runs of the query benchmark
+	const unsigned int BENCHMARK_QUERIES = 1 << 20;
+	const int BENCHMARK_RUNS = 3;
+
+	// Rays cast by benchmarkRays, and how many of them are checked by stepping along them
+	const unsigned int BENCHMARK_RAYS = 1 << 16;
+	const unsigned int BENCHMARK_STEPPED_RAYS = 4096;
+
+	// Dabs of each brush and size benchmarkEdits makes, within this many samples of the camera, where the
+	// tiles are resident as they would be under the cursor
+	const unsigned int BENCHMARK_DABS = 64;
+	const float BENCHMARK_DAB_RADII[] = { 8.0f, 32.0f, 128.0f };
+	const float BENCHMARK_DAB_SPREAD = 512.0f;
+
+	std::vector<std::string> getTexturePaths()
+	{
+		return std::vector<std::string>(TEXTURE_PATHS, TEXTURE_PATHS + TERRAIN_LAYER_COUNT);
+	}
+
+	inline unsigned int countTrailingZeros(unsigned int value)
+	{
+#if defined(_MSC_VER)
+		unsigned long index;
+		_BitScanForward(&index, value);
+		return (unsigned int)index;
+#else
+		return (unsigned int)__builtin_ctz(value);
+#endif
+	}
+
+#ifdef TERRAIN_GATHER
+	static_assert(HEIGHT_BLOCK_SIZE == 8, "gatherGround shifts by the block size");
+
+	// One tile level as gatherGround sees it, in every lane
+	struct GatherLevel
+	{
+		const int* tileSlots;
+		__m256i lastTileX;
+		__m256i lastTileZ;
+		__m256i tilesX;
+		__m128i tileShift;			// from a level 0 sample to a tile of the level
+		__m256 invStride;			// level 0 samples between the level's
+		__m256 invSpacing;			// one over the distance between the level's samples
+	};
+
+	// What gatherGround needs of the terrain and its paged levels
+	struct GroundGather
+	{
+		const int* samples;			// read two at a time, the low half is the one asked for
+		__m256 offsetX;				// half the terrain's width and depth
+		__m256 offsetZ;
+		__m256 invBlockScale;
+		__m256 heightScale;			// from a sample to a height
+		__m256i endX;				// first sample a quad cannot start on
+		__m256i endZ;
+		__m256i slotSamples;
+		__m256i blocksPerRow;
+		__m256i spread;				// spreadBlockBits of 0 to 7
+		unsigned int levelCount;
+		GatherLevel levels[MAX_HEIGHTMAP_LEVELS];
+	};
+
+	// False when the tiles are not a power of two in size. The sums are the ones getGroundAt does, so
+	// the lanes match it
+	bool setupGather(GroundGather& gather, const HeightmapPager& pager, const glm::uvec2& dimensions, float heightScale, float blockScale)
+	{
+		PagedLevel paged;
+		if (!pager.getLevel(0, paged) || (paged.tileSize & (paged.tileSize - 1)) != 0) {
+			return false;
+		}
+		unsigned int shift = 0;
+		while ((1u << shift) < paged.tileSize) {
+			shift++;
+		}
+		gather.samples = (const int*)paged.samples;
+		gather.offsetX = _mm256_set1_ps((dimensions.x - 1) * blockScale * 0.5f);
+		gather.offsetZ = _mm256_set1_ps((dimensions.y - 1) * blockScale * 0.5f);
+		gather.invBlockScale = _mm256_set1_ps(1.0f / blockScale);
+		gather.heightScale = _mm256_set1_ps(heightScale / 65535.0f);
+		gather.endX = _mm256_set1_epi32(dimensions.x - 1);
+		gather.endZ = _mm256_set1_epi32(dimensions.y - 1);
+		gather.slotSamples = _mm256_set1_epi32(paged.slotSamples);
+		gather.blocksPerRow = _mm256_set1_epi32(paged.blocksPerRow);
+		gather.spread = _mm256_setr_epi32(spreadBlockBits(0), spreadBlockBits(1), spreadBlockBits(2), spreadBlockBits(3),
+			spreadBlockBits(4), spreadBlockBits(5), spreadBlockBits(6), spreadBlockBits(7));
+		gather.levelCount = 0;
+		for (unsigned int level = 0; pager.getLevel(level, paged); level++) {
+			GatherLevel& target = gather.levels[level];
+			const unsigned int stride = 1u << level;
+			target.tileSlots = paged.tileSlots;
+			target.lastTileX = _mm256_set1_epi32(paged.tilesX - 1);
+			target.lastTileZ = _mm256_set1_epi32(paged.tilesZ - 1);
+			target.tilesX = _mm256_set1_epi32(paged.tilesX);
+			target.tileShift = _mm_cvtsi32_si128(shift + level);
+			target.invStride = _mm256_set1_ps(1.0f / stride);
+			target.invSpacing = _mm256_set1_ps(1.0f / (stride * blockScale));
+			gather.levelCount++;
+		}
+		return true;
+	}
+
+	// getTiledSampleIndex in every lane, offset by the lane's slot. The permutes only look at the low
+	// 3 bits, which are the coordinates within the block
+	inline __m256i getSampleIndex(const GroundGather& gather, __m256i slotBase, __m256i x, __m256i z)
+	{
+		const __m256i block = _mm256_add_epi32(_mm256_mullo_epi32(_mm256_srli_epi32(z, 3), gather.blocksPerRow), _mm256_srli_epi32(x, 3));
+		const __m256i inner = _mm256_or_si256(_mm256_permutevar8x32_epi32(gather.spread, x),
+			_mm256_slli_epi32(_mm256_permutevar8x32_epi32(gather.spread, z), 1));
+		return _mm256_add_epi32(slotBase, _mm256_add_epi32(_mm256_slli_epi32(block, 6), inner));
+	}
+
+	inline __m256 gatherHeight(const GroundGather& gather, __m256i index, __m256i valid)
+	{
+		const __m256i pair = _mm256_mask_i32gather_epi32(_mm256_setzero_si256(), gather.samples, index, valid, 2);
+		return _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_and_si256(pair, _mm256_set1_epi32(0xffff))), gather.heightScale);
+	}
+
+	// Ground under 8 points, each from the finest resident tile that holds it, as getGroundAt would.
+	// Returns a bit for each point no level has a tile for, which is left to getGroundAt
+	template <bool NORMALS>
+	unsigned int gatherGround(const GroundGather& gather, const float* x, const float* z, float* heights,
+		float* normalX, float* normalY, float* normalZ)
+	{
+		const __m256 one = _mm256_set1_ps(1.0f);
+		const __m256i oneInt = _mm256_set1_epi32(1);
+		const __m256i none = _mm256_set1_epi32(-1);
+		const __m256 indexX = _mm256_mul_ps(_mm256_add_ps(_mm256_loadu_ps(x), gather.offsetX), gather.invBlockScale);
+		const __m256 indexZ = _mm256_mul_ps(_mm256_add_ps(_mm256_loadu_ps(z), gather.offsetZ), gather.invBlockScale);
+		const __m256i u0 = _mm256_cvttps_epi32(_mm256_floor_ps(indexX));
+		const __m256i v0 = _mm256_cvttps_epi32(_mm256_floor_ps(indexZ));
+
+		// A whole quad on the map, NaN and huge values convert to INT_MIN and fail as well
+		__m256i pending = _mm256_and_si256(
+			_mm256_and_si256(_mm256_cmpgt_epi32(u0, none), _mm256_cmpgt_epi32(gather.endX, u0)),
+			_mm256_and_si256(_mm256_cmpgt_epi32(v0, none), _mm256_cmpgt_epi32(gather.endZ, v0)));
+
+		// Off the map until a level answers
+		__m256 height = _mm256_set1_ps(-FLT_MAX);
+		__m256 resultX = _mm256_setzero_ps();
+		__m256 resultY = one;
+		__m256 resultZ = _mm256_setzero_ps();
+		for (unsigned int level = 0; level < gather.levelCount && !_mm256_testz_si256(pending, pending); level++) {
+			const GatherLevel& paged = gather.levels[level];
+			const __m256i tileX = _mm256_min_epi32(_mm256_srl_epi32(u0, paged.tileShift), paged.lastTileX);
+			const __m256i tileZ = _mm256_min_epi32(_mm256_srl_epi32(v0, paged.tileShift), paged.lastTileZ);
+			const __m256i slot = _mm256_mask_i32gather_epi32(none, paged.tileSlots,
+				_mm256_add_epi32(_mm256_mullo_epi32(tileZ, paged.tilesX), tileX), pending, 4);
+			const __m256i found = _mm256_and_si256(pending, _mm256_cmpgt_epi32(slot, none));
+			if (_mm256_testz_si256(found, found)) {
+				continue;
+			}
+			pending = _mm256_andnot_si256(found, pending);
+
+			// Samples of the level around each point, past the sample its tile starts with
+			const __m256 tileU = _mm256_add_ps(_mm256_mul_ps(_mm256_sub_ps(indexX,
+				_mm256_cvtepi32_ps(_mm256_sll_epi32(tileX, paged.tileShift))), paged.invStride), one);
+			const __m256 tileV = _mm256_add_ps(_mm256_mul_ps(_mm256_sub_ps(indexZ,
+				_mm256_cvtepi32_ps(_mm256_sll_epi32(tileZ, paged.tileShift))), paged.invStride), one);
+			const __m256i i0 = _mm256_cvttps_epi32(tileU);
+			const __m256i j0 = _mm256_cvttps_epi32(tileV);
+			const __m256i i1 = _mm256_add_epi32(i0, oneInt);
+			const __m256i j1 = _mm256_add_epi32(j0, oneInt);
+			const __m256i slotBase = _mm256_mullo_epi32(slot, gather.slotSamples);
+			const __m256 h00 = gatherHeight(gather, getSampleIndex(gather, slotBase, i0, j0), found);
+			const __m256 h10 = gatherHeight(gather, getSampleIndex(gather, slotBase, i1, j0), found);
+			const __m256 h01 = gatherHeight(gather, getSampleIndex(gather, slotBase, i0, j1), found);
+			const __m256 h11 = gatherHeight(gather, getSampleIndex(gather, slotBase, i1, j1), found);
+			const __m256 percentU = _mm256_sub_ps(tileU, _mm256_cvtepi32_ps(i0));
+			const __m256 percentV = _mm256_sub_ps(tileV, _mm256_cvtepi32_ps(j0));
+
+			// Same split of the quad as the patch
+			const __m256 upper = _mm256_cmp_ps(percentU, percentV, _CMP_GT_OQ);
+			const __m256 dU = _mm256_blendv_ps(_mm256_sub_ps(h11, h01), _mm256_sub_ps(h10, h00), upper);
+			const __m256 dV = _mm256_blendv_ps(_mm256_sub_ps(h01, h00), _mm256_sub_ps(h11, h10), upper);
+			const __m256 take = _mm256_castsi256_ps(found);
+			height = _mm256_blendv_ps(height, _mm256_add_ps(_mm256_add_ps(h00, _mm256_mul_ps(dU, percentU)), _mm256_mul_ps(dV, percentV)), take);
+			if (NORMALS) {
+				const __m256 sign = _mm256_set1_ps(-0.0f);
+				const __m256 slopeU = _mm256_mul_ps(_mm256_xor_ps(dU, sign), paged.invSpacing);
+				const __m256 slopeV = _mm256_mul_ps(_mm256_xor_ps(dV, sign), paged.invSpacing);
+				const __m256 lengthSquared = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(slopeU, slopeU), one), _mm256_mul_ps(slopeV, slopeV));
+				const __m256 invLength = _mm256_div_ps(one, _mm256_sqrt_ps(lengthSquared));
+				resultX = _mm256_blendv_ps(resultX, _mm256_mul_ps(slopeU, invLength), take);
+				resultY = _mm256_blendv_ps(resultY, invLength, take);
+				resultZ = _mm256_blendv_ps(resultZ, _mm256_mul_ps(slopeV, invLength), take);
+			}
+		}
+
+		_mm256_storeu_ps(heights, height);
+		if (NORMALS) {
+			_mm256_storeu_ps(normalX, resultX);
+			_mm256_storeu_ps(normalY, resultY);
+			_mm256_storeu_ps(normalZ, resultZ);
+		}
+		return (unsigned int)_mm256_movemask_ps(_mm256_castsi256_ps(pending));
+	}
+#endif
+}
 
 Terrain::Terrain(float heightScale, float blockScale)
-	: m_heightScale(heightScale)
-	,m_blockScale(blockScale)
+	: m_levelCount(0)
+	, m_heightmapDimensions(0)
+	, m_heightScale(heightScale)
+	, m_blockScale(blockScale)
+	, m_lastViewSample(0.0f)
+	, m_viewSampled(false)
+	, m_VAO(0), m_EBO(0)
+	, m_instanceVBO(0)
+	, m_pendingUploads(0)
+{
+	m_textureArray = TextureCache::instance().acquireArray(getTexturePaths());
+
+	loadHeightmap(HEIGHTMAP_PATH, 16, 257, 257);
+}
+
+Terrain::Terrain(float heightScale, float blockScale, AssetLoader& loader)
+	: Terrain(heightScale, blockScale, HEIGHTMAP_PATH, 16, 257, 257, loader)
+{
+}
+
+Terrain::Terrain(float heightScale, float blockScale, const std::string& filename, unsigned char bitsPerPixel,
+	unsigned int width, unsigned int height, AssetLoader& loader)
+	: m_levelCount(0)
+	, m_heightmapDimensions(0)
+	, m_heightScale(heightScale)
+	, m_blockScale(blockScale)
+	, m_lastViewSample(0.0f)
+	, m_viewSampled(false)
+	, m_VAO(0), m_EBO(0)
+	, m_instanceVBO(0)
+	, m_textureArray(0)
+	, m_pendingUploads(2)
+{
+	loader.load(filename, [this, filename, bitsPerPixel, width, height]() {
+			return readHeightmap(filename, bitsPerPixel, width, height);
+		},
+		[this]() {
+			if (m_pager.isOpen()) {
+				generateVertexBuffers();
+			}
+			m_pendingUploads--;
+		});
+
+	TextureCache::instance().acquireArray(getTexturePaths(), TextureOptions(), loader, [this](unsigned int id) {
+		m_textureArray = id;
+		m_pendingUploads--;
+	});
+}
+
+Terrain::Terrain(float heightScale, float blockScale, const HeightmapGeneratorSettings& settings, AssetLoader& loader)
+	: m_levelCount(0)
+	, m_heightmapDimensions(0)
+	, m_heightScale(heightScale)
+	, m_blockScale(blockScale)
+	, m_lastViewSample(0.0f)
+	, m_viewSampled(false)
+	, m_VAO(0), m_EBO(0)
+	, m_instanceVBO(0)
+	, m_textureArray(0)
+	, m_pendingUploads(2)
 {
-	m_grassTexture = loadTexture("../assets/textures/grass.jpg");
-	m_rockTexture = loadTexture("../assets/textures/rock.jpg");
-	m_snowTexture = loadTexture("../assets/textures/snow.jpg");
+	loader.load("generated heightmap", [this, settings]() {
+			return readGeneratedHeightmap(settings);
+		},
+		[this]() {
+			if (m_pager.isOpen()) {
+				generateVertexBuffers();
+			}
+			m_pendingUploads--;
+		});
 
-	loadHeightmap("../assets/terrain/terrain0-16bbp-257x257.raw", 16, 257, 257);
+	TextureCache::instance().acquireArray(getTexturePaths(), TextureOptions(), loader, [this](unsigned int id) {
+		m_textureArray = id;
+		m_pendingUploads--;
+	});
 }
 
 Terrain::~Terrain()
@@ -20,77 +352,124 @@ Terrain::~Terrain()
 
 bool Terrain::loadHeightmap(const std::string& filename, unsigned char bitsPerPixel, unsigned int width, unsigned int height)
 {
-	std::ifstream ifs;
-	ifs.open(filename, std::ifstream::binary);
-	if (ifs.fail()) {
-		std::cout << "Failed to open file: " << filename << std::endl;
-		return false;
-	}
-
-	const unsigned int bytesPerPixel = bitsPerPixel / 8;
-	const unsigned int expectedFileSize = (bytesPerPixel * width * height);
-	std::streampos fileSize = getFileLength(ifs);
-	if (expectedFileSize != fileSize) {
-		std::cout << "File Size Error: " << std::endl;
+	if (!readHeightmap(filename, bitsPerPixel, width, height)) {
 		return false;
 	}
+	generateVertexBuffers();
+	return true;
+}
 
-	unsigned char* heightMap = new unsigned char[fileSize];
-	ifs.read((char*)heightMap, fileSize);
-	if (ifs.fail()) {
-		std::cout << "Error occurred when read height map file: " << filename << std::endl;
-		ifs.close();
-		delete[] heightMap;
+bool Terrain::generateHeightmap(const HeightmapGeneratorSettings& settings)
+{
+	if (!readGeneratedHeightmap(settings)) {
 		return false;
 	}
-	ifs.close();
-
-	unsigned int numVerts = width * height;
-	m_positions.resize(numVerts);
-	m_normals.resize(numVerts);
-	m_texCoords.resize(numVerts);
-
-	m_heightmapDimensions = glm::uvec2(width, height);
+	generateVertexBuffers();
+	return true;
+}
 
-	//絥λ
-	float terrainWidth = (width - 1) * m_blockScale;
-	float terrainHeight = (height - 1) * m_blockScale;
+bool Terrain::readHeightmap(const std::string& filename, unsigned char bitsPerPixel, unsigned int width, unsigned int height)
+{
+	const std::string extension(".cgheight");
+	const bool tiled = filename.size() >= extension.size()
+		&& filename.compare(filename.size() - extension.size(), extension.size(), extension) == 0;
+	const std::string cachePath = tiled ? filename : heightmapFile::getCachePath(filename.c_str());
 
-	float halfTerrainWidth = terrainWidth * 0.5f;
-	float halfTerrainHeight = terrainHeight * 0.5f;
+	// A raw heightmap is tiled again when it has changed since, or was tiled for another layout
+	if (!tiled) {
+		unsigned long long sourceSize = 0, sourceHash = 0;
+		if (!hashFile(filename.c_str(), sourceSize, sourceHash)) {
+			std::cout << "Failed to open file: " << filename << std::endl;
+			return false;
+		}
+		bool current = m_pager.open(cachePath);
+		if (current) {
+			const TiledHeightmap& heightmap = m_pager.getHeightmap();
+			current = heightmap.sourceSize == sourceSize && heightmap.sourceHash == sourceHash
+				&& heightmap.width == width && heightmap.height == height
+				&& heightmap.tileSize == TILE_QUADS && heightmap.patchSize == PATCH_QUADS;
+			if (!current) {
+				m_pager.close();
+			}
+		}
+		if (!current && !heightmapFile::convert(filename, bitsPerPixel / 8, width, height, TILE_QUADS, PATCH_QUADS, cachePath)) {
+			std::cout << "Failed to tile height map file: " << filename << std::endl;
+			return false;
+		}
+	}
+	return openHeightmap(cachePath);
+}
 
-	for (unsigned int j = 0; j < height; j++) {
-		for (unsigned int i = 0; i < width; i++) {
-			unsigned int index = (j * width) + i;
-			assert(index * bytesPerPixel < fileSize);
-			float heightValue = getHeightValue(&heightMap[index * bytesPerPixel], bytesPerPixel);
+bool Terrain::readGeneratedHeightmap(const HeightmapGeneratorSettings& settings)
+{
+	char cachePath[256];
+	snprintf(cachePath, sizeof(cachePath), GENERATED_HEIGHTMAP_FORMAT, settings.width, settings.height, settings.seed);
 
-			float S = (i / (float)(width - 1));
-			float T = (j / (float)(height - 1));
+	// Generated again when the settings have changed since, or it was tiled for another layout
+	const unsigned long long sourceHash = heightmapGenerator::getSettingsHash(settings);
+	bool current = m_pager.open(cachePath);
+	if (current) {
+		const TiledHeightmap& heightmap = m_pager.getHeightmap();
+		current = heightmap.sourceHash == sourceHash
+			&& heightmap.sourceSize == (unsigned long long)settings.width * settings.height * sizeof(uint16_t)
+			&& heightmap.width == settings.width && heightmap.height == settings.height
+			&& heightmap.tileSize == TILE_QUADS && heightmap.patchSize == PATCH_QUADS;
+		if (!current) {
+			m_pager.close();
+		}
+	}
+	if (!current) {
+		Timer timer;
+		std::vector<uint16_t> samples;
+		heightmapGenerator::generate(settings, samples);
+		const double generateMs = timer.elapsedMs();
+		if (!heightmapFile::convertSamples(&samples[0], settings.width, settings.height, sourceHash,
+			TILE_QUADS, PATCH_QUADS, cachePath)) {
+			std::cout << "Failed to tile generated height map: " << cachePath << std::endl;
+			return false;
+		}
+		printf("Generated a %ux%u heightmap in %.1f ms, tiled in %.1f ms\n", settings.width, settings.height,
+			generateMs, timer.elapsedMs() - generateMs);
+	}
+	return openHeightmap(cachePath);
+}
 
-			float X = (S * terrainWidth) - halfTerrainWidth;
-			float Y = heightValue * m_heightScale;
-			float Z = (T * terrainHeight) - halfTerrainHeight;
+bool Terrain::openHeightmap(const std::string& cachePath)
+{
+	if (!m_pager.isOpen() && !m_pager.open(cachePath)) {
+		std::cout << "Error occurred when read height map file: " << cachePath << std::endl;
+		return false;
+	}
 
-			m_normals[index] = glm::vec3(0.0f);
-			m_positions[index] = glm::vec3(X, Y, Z);
-			m_texCoords[index] = glm::vec2(S, T);
-		}
+	const TiledHeightmap& heightmap = m_pager.getHeightmap();
+	if (heightmap.patchSize != PATCH_QUADS) {
+		std::cout << "Height map tiled for another patch size: " << cachePath << std::endl;
+		m_pager.close();
+		return false;
 	}
+	m_heightmapDimensions = glm::uvec2(heightmap.width, heightmap.height);
+	m_levelCount = heightmap.boundsLevels;
+	m_pyramid.build(heightmap);
 
 	std::cout << "Terrain loaded!" << std::endl;
-	delete[] heightMap;
 
 	generateIndexBuffer();
-	generateNormals();
-	generateVertexBuffers();
+	generateLodRanges();
 
 	return true;
 }
 
-float Terrain::getHeightAt(const glm::vec3& position)
+float Terrain::getHeightAt(const glm::vec3& position) const
+{
+	return getGroundAt(position.x, position.z, NULL);
+}
+
+float Terrain::getGroundAt(float x, float z, glm::vec3* normal) const
 {
 	float height = -FLT_MAX;
+	if (normal) {
+		*normal = glm::vec3(0.0f, 1.0f, 0.0f);
+	}
 	if (m_heightmapDimensions.x < 2 || m_heightmapDimensions.y < 2) {
 		return height;
 	}
@@ -100,7 +479,7 @@ float Terrain::getHeightAt(const glm::vec3& position)
 	float halfWidth = terrainWidth * 0.5f;
 	float halfHeight = terrainHeight * 0.5f;
 
-	glm::vec3 terrainPos = position;
+	glm::vec3 terrainPos(x, 0.0f, z);
 	glm::vec3 invBlockScale(1.0f / m_blockScale, 0.0f, 1.0f / m_blockScale);
 
 	glm::vec3 offset(halfWidth, 0.0f, halfHeight);
@@ -112,195 +491,758 @@ float Terrain::getHeightAt(const glm::vec3& position)
 	int v0 = (int)floorf(vertexIndices.z);
 	int v1 = v0 + 1;
 
-	if (u0 >= 0 && u1 < (int)m_heightmapDimensions.x && v0 >= 0 && v1 < (int)m_heightmapDimensions.y) {
-		glm::vec3 p00 = m_positions[(v0 * m_heightmapDimensions.x) + u0];
-		glm::vec3 p10 = m_positions[(v0 * m_heightmapDimensions.x) + u1];
-		glm::vec3 p01 = m_positions[(v1 * m_heightmapDimensions.x) + u0];
-		glm::vec3 p11 = m_positions[(v1 * m_heightmapDimensions.x) + u1];
+	PagedTile tile;
+	if (u0 >= 0 && u1 < (int)m_heightmapDimensions.x && v0 >= 0 && v1 < (int)m_heightmapDimensions.y
+		&& m_pager.findTile(0, u0, v0, tile)) {
+		// Samples of the tile's level around the position, past the sample the tile starts with
+		float tileU = (vertexIndices.x - tile.originX) / tile.stride + 1.0f;
+		float tileV = (vertexIndices.z - tile.originZ) / tile.stride + 1.0f;
+		unsigned int i0 = (unsigned int)tileU;
+		unsigned int j0 = (unsigned int)tileV;
+		const float scale = m_heightScale / 65535.0f;
+		float h00 = tile.getSample(i0, j0) * scale;
+		float h10 = tile.getSample(i0 + 1, j0) * scale;
+		float h01 = tile.getSample(i0, j0 + 1) * scale;
+		float h11 = tile.getSample(i0 + 1, j0 + 1) * scale;
 
-		float percentU = vertexIndices.x - u0;
-		float percentV = vertexIndices.z - v0;
+		float percentU = tileU - i0;
+		float percentV = tileV - j0;
 
-		glm::vec3 dU, dV;
+		// Same split of the quad into two triangles as the patch
+		float dU, dV;
 		if (percentU > percentV) {
-			dU = p10 - p00;
-			dV = p11 - p10;
+			dU = h10 - h00;
+			dV = h11 - h10;
 		}
 		else {
-			dU = p11 - p01;
-			dV = p01 - p00;
+			dU = h11 - h01;
+			dV = h01 - h00;
 		}
 
-		glm::vec3 heightPos = p00 + (dU * percentU) + (dV * percentV);
-		height = heightPos.y;
+		height = h00 + (dU * percentU) + (dV * percentV);
+		if (normal) {
+			// Slopes of the triangle, over the world distance between the tile's samples
+			float invSpacing = 1.0f / (tile.stride * m_blockScale);
+			*normal = glm::normalize(glm::vec3(-dU * invSpacing, 1.0f, -dV * invSpacing));
+		}
 	}
 
 	return height;
 
 }
 
-void Terrain::draw(unsigned int& shaderID)
+void Terrain::getHeightsAt(size_t count, const float* x, const float* z, float* heights,
+	float* normalX, float* normalY, float* normalZ) const
+{
+	if (count < QUERIES_PER_JOB * 2) {
+		getHeightsOnThread(count, x, z, heights, normalX, normalY, normalZ);
+		return;
+	}
+	const unsigned int jobs = (unsigned int)((count + QUERIES_PER_JOB - 1) / QUERIES_PER_JOB);
+	ThreadPool::instance().parallelFor(jobs, [&](unsigned int job) {
+		const size_t first = (size_t)job * QUERIES_PER_JOB;
+		const bool normals = normalX != NULL;
+		getHeightsOnThread(std::min<size_t>(QUERIES_PER_JOB, count - first), x + first, z + first, heights + first,
+			normals ? normalX + first : NULL, normals ? normalY + first : NULL, normals ? normalZ + first : NULL);
+	});
+}
+
+void Terrain::getHeightsOnThread(size_t count, const float* x, const float* z, float* heights,
+	float* normalX, float* normalY, float* normalZ) const
+{
+	size_t i = 0;
+#ifdef TERRAIN_GATHER
+	// Eight points at a time, the few that no resident tile holds go one by one below
+	GroundGather gather;
+	if (m_heightmapDimensions.x >= 2 && m_heightmapDimensions.y >= 2
+		&& setupGather(gather, m_pager, m_heightmapDimensions, m_heightScale, m_blockScale)) {
+		for (; i + 8 <= count; i += 8) {
+			unsigned int missed = normalX ? gatherGround<true>(gather, x + i, z + i, heights + i, normalX + i, normalY + i, normalZ + i)
+				: gatherGround<false>(gather, x + i, z + i, heights + i, NULL, NULL, NULL);
+			while (missed) {
+				const unsigned int lane = countTrailingZeros(missed);
+				missed &= missed - 1;
+				glm::vec3 normal;
+				heights[i + lane] = getGroundAt(x[i + lane], z[i + lane], &normal);
+				if (normalX) {
+					normalX[i + lane] = normal.x;
+					normalY[i + lane] = normal.y;
+					normalZ[i + lane] = normal.z;
+				}
+			}
+		}
+	}
+#endif
+	for (; i < count; i++) {
+		glm::vec3 normal;
+		heights[i] = getGroundAt(x[i], z[i], normalX ? &normal : NULL);
+		if (normalX) {
+			normalX[i] = normal.x;
+			normalY[i] = normal.y;
+			normalZ[i] = normal.z;
+		}
+	}
+}
+
+void Terrain::draw(unsigned int& shaderID, const glm::mat4& transform, const CullView& view, TerrainStats& stats)
 {
+	if (m_levelCount == 0) {
+		return;
+	}
+
+	// Select in terrain space. Planes go across as p * M, which leaves them unnormalised under scale
+	const glm::mat4 transposed = glm::transpose(transform);
+	glm::vec4 planes[6];
+	for (int i = 0; i < 6; i++) {
+		planes[i] = transposed * view.frustumPlanes[i];
+	}
+	const glm::vec3 localViewPos = glm::vec3(glm::inverse(transform) * glm::vec4(view.viewPos, 1.0f));
+
+	stats.levelCount = std::max(stats.levelCount, m_levelCount);
+	m_selection.clear();
+	selectNode(m_levelCount - 1, 0, 0, planes, localViewPos, stats);
+	if (m_selection.empty()) {
+		return;
+	}
+
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, m_textureArray);
+	glActiveTexture(GL_TEXTURE0 + HEIGHTMAP_UNIT);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, m_pager.getTextureArray());
 	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(GL_TEXTURE_2D, m_grassTexture);
-	glActiveTexture(GL_TEXTURE1);
-	glBindTexture(GL_TEXTURE_2D, m_rockTexture);
-	glActiveTexture(GL_TEXTURE2);
-	glBindTexture(GL_TEXTURE_2D, m_snowTexture);
+	glUniform1i(glGetUniformLocation(shaderID, "terrainMaps"), 0);
+	glUniform1i(glGetUniformLocation(shaderID, "grassLayer"), GRASS_LAYER);
+	glUniform1i(glGetUniformLocation(shaderID, "rockLayer"), ROCK_LAYER);
+	glUniform1i(glGetUniformLocation(shaderID, "snowLayer"), SNOW_LAYER);
 	glUniform1f(glGetUniformLocation(shaderID, "heightThreshold"), m_heightScale);
+	glUniform1i(glGetUniformLocation(shaderID, "heightTiles"), HEIGHTMAP_UNIT);
+	glUniform1f(glGetUniformLocation(shaderID, "tileWidth"), (float)heightmapFile::getTileWidth(TILE_QUADS));
+	glUniform1i(glGetUniformLocation(shaderID, "patchWidth"), PATCH_QUADS + 1);
+	glUniform2f(glGetUniformLocation(shaderID, "heightmapSize"), (float)m_heightmapDimensions.x, (float)m_heightmapDimensions.y);
+	glUniform1f(glGetUniformLocation(shaderID, "heightScale"), m_heightScale);
+	glUniform1f(glGetUniformLocation(shaderID, "blockScale"), m_blockScale);
+	glUniform3f(glGetUniformLocation(shaderID, "localViewPos"), localViewPos.x, localViewPos.y, localViewPos.z);
+
+	m_instances.clear();
+	for (size_t i = 0; i < m_selection.size(); i++) {
+		const SelectedChunk& chunk = m_selection[i];
+
+		// A chunk fits in one tile of its own level, or of any coarser one standing in for it
+		PagedTile tile;
+		if (!m_pager.findTile(chunk.level, chunk.x, chunk.z, tile)) {
+			continue;
+		}
+
+		ChunkInstance instance;
+		instance.node = glm::vec3((float)chunk.x, (float)chunk.z, (float)chunk.size / PATCH_QUADS);
+
+		// The top level has nothing coarser to morph to
+		instance.morph = glm::vec2(0.0f);
+		if (chunk.level + 1 < m_levelCount) {
+			float previous = chunk.level > 0 ? m_lodRanges[chunk.level - 1] : 0.0f;
+			float end = m_lodRanges[chunk.level];
+			float morphStart = previous + (end - previous) * MORPH_START;
+			instance.morph = glm::vec2(morphStart, 1.0f / (end - morphStart));
+		}
+		instance.tile = glm::vec4((float)tile.originX, (float)tile.originZ, (float)tile.stride, (float)tile.layer);
+		m_instances.push_back(instance);
+
+		stats.chunksDrawn++;
+		stats.chunksPerLevel[chunk.level]++;
+		stats.trianglesDrawn += PATCH_QUADS * PATCH_QUADS * 2;
+	}
+	stats.meshBytes = (unsigned int)(m_indexs.size() * sizeof(unsigned short));
+	stats.instanceBytes += (unsigned int)(m_instances.size() * sizeof(ChunkInstance));
+	if (m_instances.empty()) {
+		return;
+	}
+
+	// Orphan last frame's instances rather than wait for the draw that reads them
+	glBindBuffer(GL_ARRAY_BUFFER, m_instanceVBO);
+	glBufferData(GL_ARRAY_BUFFER, m_instances.size() * sizeof(ChunkInstance), &m_instances[0], GL_STREAM_DRAW);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
 
 	glBindVertexArray(m_VAO);
-	glDrawElements(GL_TRIANGLES, m_indexs.size(), GL_UNSIGNED_INT, 0);
+	glEnable(GL_PRIMITIVE_RESTART);
+	glPrimitiveRestartIndex(PATCH_RESTART_INDEX);
+	glDrawElementsInstanced(GL_TRIANGLE_STRIP, (GLsizei)m_indexs.size(), GL_UNSIGNED_SHORT, 0, (GLsizei)m_instances.size());
+	glDisable(GL_PRIMITIVE_RESTART);
 	glBindVertexArray(0);
 }
 
-void Terrain::generateIndexBuffer()
+bool Terrain::selectNode(unsigned int level, unsigned int nodeX, unsigned int nodeZ, const glm::vec4 planes[6],
+	const glm::vec3& localViewPos, TerrainStats& stats)
 {
-	if (m_heightmapDimensions.x < 2 || m_heightmapDimensions.y < 2) {
-		return;
+	glm::vec3 boxMin, boxMax;
+	if (!getNodeBox(level, nodeX, nodeZ, boxMin, boxMax)) {
+		return true;
+	}
+	stats.nodesTested++;
+	if (!maths::boxInFrustum(planes, boxMin, boxMax)) {
+		stats.chunksCulled++;
+		return true;
+	}
+
+	// The top level is always in reach, it covers whatever the levels below leave
+	if (level + 1 < m_levelCount && !maths::boxInSphere(boxMin, boxMax, localViewPos, m_lodRanges[level])) {
+		return false;
 	}
 
-	const unsigned int terrainWidth = m_heightmapDimensions.x;
-	const unsigned int terrainHeight = m_heightmapDimensions.y;
-
-	const unsigned int numTriangles = (terrainWidth - 1) * (terrainHeight - 1) * 2;
-	m_indexs.resize(numTriangles * 3);
-
-	unsigned int index = 0;
-	for (unsigned int j = 0; j < (terrainHeight - 1); j++) {
-		for (unsigned int i = 0; i < (terrainWidth - 1); i++) {
-			int vertexIndex = (j * terrainWidth) + i;
-			//TO
-			m_indexs[index++] = vertexIndex;
-			m_indexs[index++] = vertexIndex + terrainWidth + 1;
-			m_indexs[index++] = vertexIndex + 1;
-			//T1
-			m_indexs[index++] = vertexIndex;
-			m_indexs[index++] = vertexIndex + terrainWidth;
-			m_indexs[index++] = vertexIndex + terrainWidth + 1;
+	const unsigned int size = PATCH_QUADS << level;
+	if (level == 0 || !maths::boxInSphere(boxMin, boxMax, localViewPos, m_lodRanges[level - 1])) {
+		SelectedChunk chunk = { nodeX * size, nodeZ * size, size, level };
+		m_selection.push_back(chunk);
+		return true;
+	}
+
+	// A child out of reach of the finer level is still drawn at its own size, but every vertex is
+	// past the end of that level's morph range, so it ends up on this level's grid
+	const unsigned int childSize = size / 2;
+	for (unsigned int i = 0; i < 4; i++) {
+		unsigned int childX = nodeX * 2 + (i & 1);
+		unsigned int childZ = nodeZ * 2 + (i >> 1);
+		if (!selectNode(level - 1, childX, childZ, planes, localViewPos, stats)) {
+			SelectedChunk chunk = { childX * childSize, childZ * childSize, childSize, level - 1 };
+			m_selection.push_back(chunk);
 		}
 	}
+	return true;
+}
+
+bool Terrain::getNodeBox(unsigned int level, unsigned int nodeX, unsigned int nodeZ, glm::vec3& boxMin, glm::vec3& boxMax) const
+{
+	const TiledHeightmap& heightmap = m_pager.getHeightmap();
+	const uint16_t* bounds = heightmap.bounds[level] + ((size_t)nodeZ * heightmap.boundsNodes[level] + nodeX) * 2;
+	if (bounds[0] > bounds[1]) {
+		return false;
+	}
+
+	const unsigned int size = PATCH_QUADS << level;
+	const float scale = m_heightScale / 65535.0f;
+	float halfWidth = (m_heightmapDimensions.x - 1) * m_blockScale * 0.5f;
+	float halfHeight = (m_heightmapDimensions.y - 1) * m_blockScale * 0.5f;
+	unsigned int x1 = std::min(nodeX * size + size, m_heightmapDimensions.x - 1);
+	unsigned int z1 = std::min(nodeZ * size + size, m_heightmapDimensions.y - 1);
+	boxMin = glm::vec3(nodeX * size * m_blockScale - halfWidth, bounds[0] * scale, nodeZ * size * m_blockScale - halfHeight);
+	boxMax = glm::vec3(x1 * m_blockScale - halfWidth, bounds[1] * scale, z1 * m_blockScale - halfHeight);
+	return true;
+}
+
+void Terrain::deleteBuffers()
+{
+	glDeleteBuffers(1, &m_EBO);
+	glDeleteBuffers(1, &m_instanceVBO);
+	glDeleteVertexArrays(1, &m_VAO);
+	m_VAO = m_EBO = m_instanceVBO = 0;
+	m_pyramid.clear();
+	m_pager.close();
+	TextureCache::instance().release(m_textureArray);
+	m_textureArray = 0;
 }
 
-void Terrain::generateNormals()
+void Terrain::requestTextureDetail(const glm::vec3& viewPos, float projectionScale)
 {
-	for (unsigned int i = 0; i < m_indexs.size(); i += 3) {
-		glm::vec3 v0 = m_positions[m_indexs[i + 0]];
-		glm::vec3 v1 = m_positions[m_indexs[i + 1]];
-		glm::vec3 v2 = m_positions[m_indexs[i + 2]];
+	if (m_heightmapDimensions.x < 2 || m_heightmapDimensions.y < 2) {
+		return;
+	}
 
-		glm::vec3 normal = glm::normalize(maths::cross(v1 - v0, v2 - v0));
+	// Nearest ground is taken as the point below the camera, clamped onto the terrain when flying off it
+	float halfWidth = (m_heightmapDimensions.x - 1) * m_blockScale * 0.5f;
+	float halfHeight = (m_heightmapDimensions.y - 1) * m_blockScale * 0.5f;
+	glm::vec3 ground(glm::clamp(viewPos.x, -halfWidth + m_blockScale, halfWidth - m_blockScale), 0.0f,
+		glm::clamp(viewPos.z, -halfHeight + m_blockScale, halfHeight - m_blockScale));
+	ground.y = getHeightAt(ground);
+	float distance = glm::max(glm::length(viewPos - ground), 1e-3f);
 
-		m_normals[m_indexs[i + 0]] += normal;
-		m_normals[m_indexs[i + 1]] += normal;
-		m_normals[m_indexs[i + 2]] += normal;
+	// Screen size of one repeat at that distance. The layers share their levels and grass repeats the
+	// least, so it needs the finest level of the three
+	float pixelsPerUnit = projectionScale / distance;
+	float terrainWidth = halfWidth * 2.0f;
+	TextureCache::instance().requestDetail(m_textureArray, terrainWidth / GRASS_REPEATS * pixelsPerUnit);
+}
+
+void Terrain::updatePaging(const glm::vec3& viewPos, float deltaTime, double budgetMs)
+{
+	if (!m_pager.isOpen()) {
+		return;
 	}
 
-	const glm::vec3 up(0.0f, 1.0f, 0.0f);
-	for (unsigned int i = 0; i < m_normals.size(); i++) {
-		m_normals[i] = glm::normalize(m_normals[i]);
+	float halfWidth = (m_heightmapDimensions.x - 1) * m_blockScale * 0.5f;
+	float halfHeight = (m_heightmapDimensions.y - 1) * m_blockScale * 0.5f;
+	glm::vec2 viewSample((viewPos.x + halfWidth) / m_blockScale, (viewPos.z + halfHeight) / m_blockScale);
+	glm::vec2 velocity(0.0f);
+	if (m_viewSampled && deltaTime > 0.0f) {
+		velocity = (viewSample - m_lastViewSample) / deltaTime;
 	}
+	m_lastViewSample = viewSample;
+	m_viewSampled = true;
+
+	// A tile level is drawn by the chunks of the same level, out to that level's range
+	std::vector<float> radii(m_lodRanges.size());
+	for (size_t i = 0; i < radii.size(); i++) {
+		radii[i] = m_lodRanges[i] / m_blockScale;
+	}
+	m_pager.update(viewSample, velocity, radii, budgetMs);
 }
 
-void Terrain::generateVertexBuffers()
+void Terrain::benchmarkQueries() const
 {
-	size_t posSize = m_positions.size() * sizeof(glm::vec3);
-	size_t normalSize = m_normals.size() * sizeof(glm::vec3);
-	size_t uvSize = m_texCoords.size() * sizeof(glm::vec2);
+	if (m_heightmapDimensions.x < 2 || m_heightmapDimensions.y < 2) {
+		return;
+	}
 
-	glGenVertexArrays(1, &m_VAO);
-	glGenBuffers(1, &m_VBO);
-	glGenBuffers(1, &m_EBO);
+	// Points spread evenly over the map, as a crowd of agents anywhere on it would be
+	const float halfWidth = (m_heightmapDimensions.x - 1) * m_blockScale * 0.5f;
+	const float halfHeight = (m_heightmapDimensions.y - 1) * m_blockScale * 0.5f;
+	std::mt19937 generator(7);
+	std::uniform_real_distribution<float> alongX(-halfWidth, halfWidth);
+	std::uniform_real_distribution<float> alongZ(-halfHeight, halfHeight);
+	std::vector<float> x(BENCHMARK_QUERIES), z(BENCHMARK_QUERIES);
+	for (unsigned int i = 0; i < BENCHMARK_QUERIES; i++) {
+		x[i] = alongX(generator);
+		z[i] = alongZ(generator);
+	}
 
-	glBindVertexArray(m_VAO);
-	glBindBuffer(GL_ARRAY_BUFFER, m_VBO);
-	glBufferData(GL_ARRAY_BUFFER, posSize + normalSize + uvSize, 0, GL_STATIC_DRAW);
-	glBufferSubData(GL_ARRAY_BUFFER, 0, posSize, &m_positions[0]);
-	glBufferSubData(GL_ARRAY_BUFFER, posSize, normalSize, &m_normals[0]);
-	glBufferSubData(GL_ARRAY_BUFFER, posSize + normalSize, uvSize, &m_texCoords[0]);
+	std::vector<float> expected(BENCHMARK_QUERIES), expectedNormals(BENCHMARK_QUERIES * 3);
+	std::vector<float> heights(BENCHMARK_QUERIES), normals(BENCHMARK_QUERIES * 3);
+	float* normalX = &normals[0];
+	float* normalY = normalX + BENCHMARK_QUERIES;
+	float* normalZ = normalY + BENCHMARK_QUERIES;
+	const struct
+	{
+		const char* name;
+		bool withNormals;
+		int method;		// getHeightAt one by one, a batch on this thread, a batch across the pool
+	} runs[] = {
+		{ "getHeightAt", false, 0 },
+		{ "one by one with normals", true, 0 },
+		{ "batch on one thread", false, 1 },
+		{ "with normals", true, 1 },
+		{ "batch across the pool", false, 2 },
+		{ "with normals", true, 2 },
+	};
 
-	glEnableVertexAttribArray(0);
-	glEnableVertexAttribArray(1);
-	glEnableVertexAttribArray(2);
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), 0);
-	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), (void*)posSize);
-	glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(glm::vec2), (void*)(posSize + normalSize));
+#ifdef TERRAIN_GATHER
+	const char* path = "AVX2 gathers";
+#else
+	const char* path = "no gathers, build with ENABLE_AVX2 for them";
+#endif
+	printf("Ground queries at %u points over the %ux%u map, best of %d runs, %s:\n", BENCHMARK_QUERIES,
+		m_heightmapDimensions.x, m_heightmapDimensions.y, BENCHMARK_RUNS, path);
+	double scalarRates[2] = { 0.0, 0.0 };
+	float heightError = 0.0f, normalError = 0.0f;
+	for (size_t r = 0; r < sizeof(runs) / sizeof(runs[0]); r++) {
+		double bestMs = DBL_MAX;
+		for (int run = 0; run < BENCHMARK_RUNS; run++) {
+			Timer timer;
+			if (runs[r].method == 0 && !runs[r].withNormals) {
+				for (unsigned int i = 0; i < BENCHMARK_QUERIES; i++) {
+					heights[i] = getHeightAt(glm::vec3(x[i], 0.0f, z[i]));
+				}
+			}
+			else if (runs[r].method == 0) {
+				for (unsigned int i = 0; i < BENCHMARK_QUERIES; i++) {
+					glm::vec3 normal;
+					heights[i] = getGroundAt(x[i], z[i], &normal);
+					normalX[i] = normal.x;
+					normalY[i] = normal.y;
+					normalZ[i] = normal.z;
+				}
+			}
+			else {
+				float* nx = runs[r].withNormals ? normalX : NULL;
+				float* ny = runs[r].withNormals ? normalY : NULL;
+				float* nz = runs[r].withNormals ? normalZ : NULL;
+				if (runs[r].method == 1) {
+					getHeightsOnThread(BENCHMARK_QUERIES, &x[0], &z[0], &heights[0], nx, ny, nz);
+				}
+				else {
+					getHeightsAt(BENCHMARK_QUERIES, &x[0], &z[0], &heights[0], nx, ny, nz);
+				}
+			}
+			bestMs = std::min(bestMs, timer.elapsedMs());
+		}
 
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_EBO);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, m_indexs.size() * sizeof(unsigned int), &m_indexs[0], GL_STATIC_DRAW);
+		// The one by one runs are what the batches have to match
+		if (runs[r].method == 0) {
+			expected.swap(heights);
+			if (runs[r].withNormals) {
+				expectedNormals.swap(normals);
+				normalX = &normals[0];
+				normalY = normalX + BENCHMARK_QUERIES;
+				normalZ = normalY + BENCHMARK_QUERIES;
+			}
+		}
+		else {
+			for (unsigned int i = 0; i < BENCHMARK_QUERIES; i++) {
+				heightError = std::max(heightError, fabsf(heights[i] - expected[i]));
+			}
+			for (unsigned int i = 0; runs[r].withNormals && i < BENCHMARK_QUERIES * 3; i++) {
+				normalError = std::max(normalError, fabsf(normals[i] - expectedNormals[i]));
+			}
+		}
 
-	glBindVertexArray(0);
+		const double rate = BENCHMARK_QUERIES / (bestMs * 1000.0);
+		double& scalarRate = scalarRates[runs[r].withNormals ? 1 : 0];
+		if (runs[r].method == 0) {
+			scalarRate = rate;
+		}
+		printf("  %-26s %8.2f ms %8.1f M queries/s %6.1fx\n", runs[r].name, bestMs, rate, rate / scalarRate);
+	}
+	printf("  Largest difference from one by one: %g in height, %g in normals\n", heightError, normalError);
 }
 
-std::streampos Terrain::getFileLength(std::ifstream& file)
+void Terrain::getSampleSpace(glm::vec3& offset, glm::vec3& scale) const
 {
-	std::streampos pos = file.tellg();
-	file.seekg(0, std::ios::end);
-	std::streampos length = file.tellg();
-	file.seekg(pos);
+	offset = glm::vec3((m_heightmapDimensions.x - 1) * m_blockScale * 0.5f, 0.0f, (m_heightmapDimensions.y - 1) * m_blockScale * 0.5f);
+	scale = glm::vec3(1.0f / m_blockScale, 65535.0f / m_heightScale, 1.0f / m_blockScale);
+}
 
-	return length;
+bool Terrain::raycast(const glm::vec3& origin, const glm::vec3& direction, float maxDistance, float& distance) const
+{
+	if (!m_pyramid.isBuilt()) {
+		return false;
+	}
+	glm::vec3 offset, scale;
+	getSampleSpace(offset, scale);
+	return m_pyramid.raycast(m_pager, (origin + offset) * scale, direction * scale, maxDistance, distance);
 }
 
-float Terrain::getHeightValue(const unsigned char* data, unsigned char numBytes)
+unsigned int Terrain::raycastPacket(const glm::vec3 origins[8], const glm::vec3 directions[8], float maxDistance,
+	float distances[8]) const
 {
-	switch (numBytes)
-	{
-	case 1:
-	{
-		return (unsigned char)(data[0]) / (float)0xff;
+	if (!m_pyramid.isBuilt()) {
+		return 0;
 	}
-	break;
-	case 2:
-	{
-		return (unsigned short)(data[1] << 8 | data[0]) / (float)0xffff;
+	glm::vec3 offset, scale;
+	getSampleSpace(offset, scale);
+	HeightRayPacket rays;
+	for (unsigned int i = 0; i < 8; i++) {
+		const glm::vec3 origin = (origins[i] + offset) * scale;
+		const glm::vec3 direction = directions[i] * scale;
+		rays.originX[i] = origin.x;
+		rays.originY[i] = origin.y;
+		rays.originZ[i] = origin.z;
+		rays.directionX[i] = direction.x;
+		rays.directionY[i] = direction.y;
+		rays.directionZ[i] = direction.z;
+		rays.maxT[i] = maxDistance;
 	}
-	break;
-	case 4:
-	{
-		return (unsigned int)(data[3] << 24 | data[2] << 16 | data[1] << 8 | data[0]) / (float)0xffffffff;
+	return m_pyramid.raycastPacket(m_pager, rays, distances);
+}
+
+void Terrain::benchmarkRays() const
+{
+	if (!m_pyramid.isBuilt()) {
+		printf("No height pyramid to cast rays against\n");
+		return;
+	}
+
+	// Rays from above the ground anywhere on the map, looking down at 5 to 60 degrees in any direction,
+	// as clicks on the terrain from a camera flying over it would be
+	const float halfWidth = (m_heightmapDimensions.x - 1) * m_blockScale * 0.5f;
+	const float halfHeight = (m_heightmapDimensions.y - 1) * m_blockScale * 0.5f;
+	const float maxDistance = 2.0f * (halfWidth + halfHeight) + m_heightScale;
+	std::mt19937 generator(11);
+	std::uniform_real_distribution<float> alongX(-halfWidth, halfWidth);
+	std::uniform_real_distribution<float> alongZ(-halfHeight, halfHeight);
+	std::uniform_real_distribution<float> above(0.05f * m_heightScale, 0.5f * m_heightScale);
+	std::uniform_real_distribution<float> yaw(0.0f, glm::radians(360.0f));
+	std::uniform_real_distribution<float> pitch(glm::radians(5.0f), glm::radians(60.0f));
+	std::vector<glm::vec3> origins(BENCHMARK_RAYS), directions(BENCHMARK_RAYS);
+	for (unsigned int i = 0; i < BENCHMARK_RAYS; i++) {
+		origins[i] = glm::vec3(alongX(generator), 0.0f, alongZ(generator));
+		origins[i].y = std::max(getHeightAt(origins[i]), 0.0f) + above(generator);
+		const float angle = yaw(generator);
+		const float down = pitch(generator);
+		directions[i] = glm::vec3(cosf(down) * cosf(angle), -sinf(down), cosf(down) * sinf(angle));
+	}
+
+	std::vector<float> single(BENCHMARK_RAYS), packet(BENCHMARK_RAYS), stepped(BENCHMARK_STEPPED_RAYS);
+	std::vector<bool> singleHits(BENCHMARK_RAYS), packetHits(BENCHMARK_RAYS), steppedHits(BENCHMARK_STEPPED_RAYS);
+	double bestMs[3] = { DBL_MAX, DBL_MAX, DBL_MAX };
+	for (int run = 0; run < BENCHMARK_RUNS; run++) {
+		Timer timer;
+		for (unsigned int i = 0; i < BENCHMARK_RAYS; i++) {
+			singleHits[i] = raycast(origins[i], directions[i], maxDistance, single[i]);
+		}
+		bestMs[0] = std::min(bestMs[0], timer.elapsedMs());
+
+		timer.reset();
+		for (unsigned int i = 0; i < BENCHMARK_RAYS; i += 8) {
+			const unsigned int hits = raycastPacket(&origins[i], &directions[i], maxDistance, &packet[i]);
+			for (unsigned int lane = 0; lane < 8; lane++) {
+				packetHits[i + lane] = (hits & (1u << lane)) != 0;
+			}
+		}
+		bestMs[1] = std::min(bestMs[1], timer.elapsedMs());
+
+		// Stepping a quarter of a sample at a time until the ray is below the ground, then bisecting
+		timer.reset();
+		const float step = m_blockScale * 0.25f;
+		for (unsigned int i = 0; i < BENCHMARK_STEPPED_RAYS; i++) {
+			steppedHits[i] = false;
+			float previous = 0.0f;
+			for (float distance = 0.0f; distance <= maxDistance; distance += step) {
+				const glm::vec3 position = origins[i] + directions[i] * distance;
+				if (getHeightAt(position) >= position.y) {
+					float low = previous, high = distance;
+					for (int j = 0; j < 24; j++) {
+						const float middle = (low + high) * 0.5f;
+						const glm::vec3 point = origins[i] + directions[i] * middle;
+						if (getHeightAt(point) >= point.y) {
+							high = middle;
+						}
+						else {
+							low = middle;
+						}
+					}
+					stepped[i] = high;
+					steppedHits[i] = true;
+					break;
+				}
+				previous = distance;
+			}
+		}
+		bestMs[2] = std::min(bestMs[2], timer.elapsedMs());
 	}
-	break;
-	default:
-		assert(false);
-		break;
+
+	// Agreeing is hitting or missing alike, and hitting within a hundredth of a sample
+	const float tolerance = m_blockScale * 0.01f;
+	unsigned int hitCount = 0, packetAgree = 0, steppedAgree = 0;
+	for (unsigned int i = 0; i < BENCHMARK_RAYS; i++) {
+		hitCount += singleHits[i] ? 1 : 0;
+		if (singleHits[i] == packetHits[i] && (!singleHits[i] || fabsf(single[i] - packet[i]) <= tolerance)) {
+			packetAgree++;
+		}
+		if (i < BENCHMARK_STEPPED_RAYS && singleHits[i] == steppedHits[i] && (!singleHits[i] || fabsf(single[i] - stepped[i]) <= tolerance)) {
+			steppedAgree++;
+		}
 	}
 
-	return 0.0;
+#ifdef TERRAIN_GATHER
+	const char* path = "AVX2 packets";
+#else
+	const char* path = "packets one ray at a time, build with ENABLE_AVX2 for AVX2";
+#endif
+	printf("Rays over the %ux%u map, %u of %u hit, best of %d runs, %s:\n", m_heightmapDimensions.x, m_heightmapDimensions.y,
+		hitCount, BENCHMARK_RAYS, BENCHMARK_RUNS, path);
+	const unsigned int counts[3] = { BENCHMARK_RAYS, BENCHMARK_RAYS, BENCHMARK_STEPPED_RAYS };
+	const char* names[3] = { "single rays", "packets of 8", "stepping with getHeightAt" };
+	const double steppedRate = counts[2] / (bestMs[2] * 1000.0);
+	for (int i = 0; i < 3; i++) {
+		const double rate = counts[i] / (bestMs[i] * 1000.0);
+		printf("  %-26s %8.2f ms %8.3f M rays/s %7.1fx\n", names[i], bestMs[i], rate, rate / steppedRate);
+	}
+	printf("  Packets agree with single rays on %u of %u, stepping on %u of %u\n", packetAgree, BENCHMARK_RAYS,
+		steppedAgree, BENCHMARK_STEPPED_RAYS);
+	printf("  Pyramid: %.1f KB\n", m_pyramid.getMemoryBytes() / 1024.0);
 }
 
-unsigned int Terrain::loadTexture(const char* path)
+bool Terrain::applyBrush(const TerrainBrush& brush)
 {
-	unsigned int textureID;
-	glGenTextures(1, &textureID);
+	if (!m_pager.isOpen() || brush.radius <= 0.0f) {
+		return false;
+	}
 
-	int width, height, numComponents;
-	unsigned char* data = stbi_load(path, &width, &height, &numComponents, 0);
-	if (data)
-	{
-		GLenum format;
-		if (numComponents == 1)
-			format = GL_RED;
-		else if (numComponents == 3)
-			format = GL_RGB;
-		else if (numComponents == 4)
-			format = GL_RGBA;
-
-		glBindTexture(GL_TEXTURE_2D, textureID);
-		glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
-		glGenerateMipmap(GL_TEXTURE_2D);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-		stbi_image_free(data);
-	}
-	else
+	// The samples under the brush, and one more all round for smoothing
+	glm::vec3 offset, scale;
+	getSampleSpace(offset, scale);
+	const glm::vec3 center = (brush.center + offset) * scale;
+	const float radius = brush.radius * scale.x;
+	const int width = (int)m_heightmapDimensions.x;
+	const int height = (int)m_heightmapDimensions.y;
+	const int x0 = std::max((int)ceilf(center.x - radius), 0);
+	const int z0 = std::max((int)ceilf(center.z - radius), 0);
+	const int x1 = std::min((int)floorf(center.x + radius), width - 1);
+	const int z1 = std::min((int)floorf(center.z + radius), height - 1);
+	if (x0 > x1 || z0 > z1) {
+		return false;
+	}
+	const int readX0 = std::max(x0 - 1, 0);
+	const int readZ0 = std::max(z0 - 1, 0);
+	const int readX1 = std::min(x1 + 1, width - 1);
+	const int readZ1 = std::min(z1 + 1, height - 1);
+	const int readWidth = readX1 - readX0 + 1;
+	std::vector<uint16_t> before((size_t)readWidth * (readZ1 - readZ0 + 1));
+	m_pager.readSamples(readX0, readZ0, readX1, readZ1, &before[0]);
+
+	const int editWidth = x1 - x0 + 1;
+	std::vector<uint16_t> after((size_t)editWidth * (z1 - z0 + 1));
+	const float step = brush.strength * scale.y;
+	const float level = brush.center.y * scale.y;
+	for (int z = z0; z <= z1; z++) {
+		const uint16_t* row = &before[(size_t)(z - readZ0) * readWidth];
+		for (int x = x0; x <= x1; x++) {
+			const float current = row[x - readX0];
+			const float dx = (x - center.x) / radius;
+			const float dz = (z - center.z) / radius;
+			const float falloff = std::max(1.0f - (dx * dx + dz * dz), 0.0f);
+			const float weight = falloff * falloff;
+			float value = current;
+			switch (brush.mode) {
+			case BRUSH_RAISE:
+				value = current + step * weight;
+				break;
+			case BRUSH_LOWER:
+				value = current - step * weight;
+				break;
+			case BRUSH_SMOOTH: {
+				// Neighbours past the map's edge repeat it
+				float sum = 0.0f;
+				for (int j = -1; j <= 1; j++) {
+					const uint16_t* neighbours = &before[(size_t)(std::min(std::max(z + j, readZ0), readZ1) - readZ0) * readWidth];
+					for (int i = -1; i <= 1; i++) {
+						sum += neighbours[std::min(std::max(x + i, readX0), readX1) - readX0];
+					}
+				}
+				value = current + (sum / 9.0f - current) * std::min(brush.strength * weight, 1.0f);
+				break;
+			}
+			case BRUSH_FLATTEN:
+				value = current + (level - current) * std::min(brush.strength * weight, 1.0f);
+				break;
+			default:
+				break;
+			}
+			after[(size_t)(z - z0) * editWidth + (x - x0)] = (uint16_t)std::min(std::max(value + 0.5f, 0.0f), 65535.0f);
+		}
+	}
+
+	m_pager.editSamples(x0, z0, x1, z1, &after[0]);
+	m_pyramid.update(m_pager, x0, z0, x1, z1);
+	return true;
+}
+
+void Terrain::benchmarkEdits()
+{
+	if (!m_pager.isOpen()) {
+		printf("No heightmap to edit\n");
+		return;
+	}
+
+	const float halfWidth = (m_heightmapDimensions.x - 1) * m_blockScale * 0.5f;
+	const float halfHeight = (m_heightmapDimensions.y - 1) * m_blockScale * 0.5f;
+	const glm::vec2 around = m_viewSampled ? m_lastViewSample
+		: glm::vec2((m_heightmapDimensions.x - 1) * 0.5f, (m_heightmapDimensions.y - 1) * 0.5f);
+	std::mt19937 generator(5);
+	std::uniform_real_distribution<float> spread(-BENCHMARK_DAB_SPREAD, BENCHMARK_DAB_SPREAD);
+	const char* names[TERRAIN_BRUSH_MODES] = { "raise", "lower", "smooth", "flatten" };
+	const HeightmapPagerStats start = m_pager.getStats();
+
+	// Each dab's rectangle as it was, to be put back last to first
+	struct Undo
 	{
-		std::cout << "Texture " << path << " failed to load." << std::endl;
-		stbi_image_free(data);
+		unsigned int x0, z0, x1, z1;
+		std::vector<uint16_t> samples;
+	};
+	std::vector<Undo> undo;
+
+	printf("Brush dabs on the %ux%u map, %u of each within %.0f samples of the camera:\n", m_heightmapDimensions.x,
+		m_heightmapDimensions.y, BENCHMARK_DABS, BENCHMARK_DAB_SPREAD);
+	for (size_t size = 0; size < sizeof(BENCHMARK_DAB_RADII) / sizeof(BENCHMARK_DAB_RADII[0]); size++) {
+		const float radius = BENCHMARK_DAB_RADII[size];
+		for (int mode = 0; mode < TERRAIN_BRUSH_MODES; mode++) {
+			double totalMs = 0.0, worstMs = 0.0;
+			for (unsigned int i = 0; i < BENCHMARK_DABS; i++) {
+				const float sampleX = std::min(std::max(around.x + spread(generator), 0.0f), (float)(m_heightmapDimensions.x - 1));
+				const float sampleZ = std::min(std::max(around.y + spread(generator), 0.0f), (float)(m_heightmapDimensions.y - 1));
+				TerrainBrush brush;
+				brush.mode = (TerrainBrushMode)mode;
+				brush.center = glm::vec3(sampleX * m_blockScale - halfWidth, 0.0f, sampleZ * m_blockScale - halfHeight);
+				brush.center.y = getHeightAt(brush.center);
+				brush.radius = radius * m_blockScale;
+				brush.strength = mode == BRUSH_RAISE || mode == BRUSH_LOWER ? m_heightScale * 0.01f : 0.5f;
+
+				// A sample wider than the brush, whatever rounding it sees
+				Undo dab;
+				dab.x0 = (unsigned int)std::max((int)floorf(sampleX - radius), 0);
+				dab.z0 = (unsigned int)std::max((int)floorf(sampleZ - radius), 0);
+				dab.x1 = std::min((unsigned int)ceilf(sampleX + radius), m_heightmapDimensions.x - 1);
+				dab.z1 = std::min((unsigned int)ceilf(sampleZ + radius), m_heightmapDimensions.y - 1);
+				dab.samples.resize((size_t)(dab.x1 - dab.x0 + 1) * (dab.z1 - dab.z0 + 1));
+				m_pager.readSamples(dab.x0, dab.z0, dab.x1, dab.z1, &dab.samples[0]);
+				undo.push_back(dab);
+
+				Timer timer;
+				applyBrush(brush);
+				const double ms = timer.elapsedMs();
+				totalMs += ms;
+				worstMs = std::max(worstMs, ms);
+			}
+			printf("  %-8s radius %4.0f %8.3f ms average %8.3f ms worst\n", names[mode], radius, totalMs / BENCHMARK_DABS, worstMs);
+		}
+	}
+	const HeightmapPagerStats end = m_pager.getStats();
+	printf("  Tiles edited: %u, %.1f MB of edited copies\n", end.editedTiles - start.editedTiles,
+		(end.bytesEdited - start.bytesEdited) / (1024.0 * 1024.0));
+
+	for (size_t i = undo.size(); i-- > 0;) {
+		m_pager.editSamples(undo[i].x0, undo[i].z0, undo[i].x1, undo[i].z1, &undo[i].samples[0]);
+		m_pyramid.update(m_pager, undo[i].x0, undo[i].z0, undo[i].x1, undo[i].z1);
+	}
+}
+
+void Terrain::resetStats(TerrainStats& stats)
+{
+	memset(&stats, 0, sizeof(stats));
+}
+
+void Terrain::generateIndexBuffer()
+{
+	// Vertices are numbered row by row, and terrainVS.glsl turns the number back into the grid position
+	const unsigned int patchWidth = PATCH_QUADS + 1;
+	m_indexs.clear();
+	m_indexs.reserve(PATCH_QUADS * (patchWidth * 2 + 1));
+
+	// Down each column of quads, the right vertex of each row before the left. That cuts every quad along
+	// the diagonal from its first corner, the split getHeightAt assumes, and winds the triangles as before
+	for (unsigned int i = 0; i < PATCH_QUADS; i++) {
+		if (i > 0) {
+			m_indexs.push_back(PATCH_RESTART_INDEX);
+		}
+		for (unsigned int j = 0; j < patchWidth; j++) {
+			m_indexs.push_back((unsigned short)(j * patchWidth + i + 1));
+			m_indexs.push_back((unsigned short)(j * patchWidth + i));
+		}
+	}
+}
+
+void Terrain::generateLodRanges()
+{
+	m_lodRanges.resize(m_levelCount);
+	float range = PATCH_QUADS * m_blockScale * LOD_RANGE_SCALE;
+	for (unsigned int level = 0; level < m_levelCount; level++) {
+		m_lodRanges[level] = range;
+		range *= 2.0f;
 	}
+}
+
+void Terrain::generateVertexBuffers()
+{
+	if (!m_pager.createSlots(TILE_BUDGET_BYTES)) {
+		return;
+	}
+
+	glGenVertexArrays(1, &m_VAO);
+	glGenBuffers(1, &m_EBO);
+	glGenBuffers(1, &m_instanceVBO);
+
+	// The patch has no vertex buffer, chunk attributes step once per instance
+	glBindVertexArray(m_VAO);
+	glBindBuffer(GL_ARRAY_BUFFER, m_instanceVBO);
+	glEnableVertexAttribArray(1);
+	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(ChunkInstance), (void*)offsetof(ChunkInstance, node));
+	glVertexAttribDivisor(1, 1);
+	glEnableVertexAttribArray(2);
+	glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(ChunkInstance), (void*)offsetof(ChunkInstance, morph));
+	glVertexAttribDivisor(2, 1);
+	glEnableVertexAttribArray(3);
+	glVertexAttribPointer(3, 4, GL_FLOAT, GL_FALSE, sizeof(ChunkInstance), (void*)offsetof(ChunkInstance, tile));
+	glVertexAttribDivisor(3, 1);
+
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_EBO);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, m_indexs.size() * sizeof(unsigned short), &m_indexs[0], GL_STATIC_DRAW);
 
-	return textureID;
+	glBindVertexArray(0);
 }
@@ -1,41 +1,196 @@
 #pragma once
 #include "common.hpp"
+#include "heightPyramid.hpp"
+#include "heightmapGenerator.hpp"
+#include "heightmapPager.hpp"
+#include "meshlets.hpp"
 
+class AssetLoader;
+
+const unsigned int MAX_TERRAIN_LEVELS = 16;
+
+// Per frame totals of the quadtree selection
+struct TerrainStats
+{
+	unsigned int nodesTested;
+	unsigned int chunksCulled;		// outside the view, with everything below them
+	unsigned int chunksDrawn;
+	unsigned int trianglesDrawn;
+	unsigned int levelCount;
+	unsigned int chunksPerLevel[MAX_TERRAIN_LEVELS];	// drawn at each level, 0 is the finest
+	unsigned int meshBytes;			// of the patch in GPU memory, which every chunk draws
+	unsigned int instanceBytes;		// uploaded for the chunks drawn
+};
+
+enum TerrainBrushMode
+{
+	BRUSH_RAISE = 0,
+	BRUSH_LOWER,
+	BRUSH_SMOOTH,			// towards the average of each sample's neighbours
+	BRUSH_FLATTEN,			// towards the height of the brush's center
+	TERRAIN_BRUSH_MODES
+};
+
+// One dab of a brush, in terrain space. Raising and lowering move the ground strength units up or down at
+// the center, smoothing and flattening move it that fraction of the way there, all falling off to nothing
+// at radius
+struct TerrainBrush
+{
+	TerrainBrushMode mode;
+	glm::vec3 center;
+	float radius;
+	float strength;
+};
+
+// Heightfield drawn as a CDLOD quadtree. Every chunk is an instance of the same grid patch, scaled
+// over its square of the heightmap, and terrainVS.glsl reads the heights from a texture. The patch is
+// nothing but 16 bit indices, strips cut by primitive restart, whose values give the grid position. Chunks further
+// away cover more of the map with the same patch, and vertices near the end of a level's range
+// morph onto the grid of the next level so neighbouring levels meet without cracks.
+// The heights are paged in tiles from a .cgheight file, so only the tiles around the camera are in
+// memory and a chunk whose tiles have not arrived yet draws from a coarser level
 class Terrain
 {
 public:
 	Terrain(float heightScale, float blockScale);
+	// Load the heightmap and textures in the background, the terrain can be drawn once isLoaded returns true
+	Terrain(float heightScale, float blockScale, AssetLoader& loader);
+	// As above with another heightmap of any size, either a .raw file, tiled into a .cgheight next to
+	// it on first use, or a .cgheight, which needs no size
+	Terrain(float heightScale, float blockScale, const std::string& filename, unsigned char bitsPerPixel,
+		unsigned int width, unsigned int height, AssetLoader& loader);
+	// As above with a heightmap generated from settings, tiled into a .cgheight that is used again for
+	// as long as the settings stay the same
+	Terrain(float heightScale, float blockScale, const HeightmapGeneratorSettings& settings, AssetLoader& loader);
 	~Terrain();
 
 	bool loadHeightmap(const std::string& filename, unsigned char bitsPerPixel, unsigned int width, unsigned int height);
+	bool generateHeightmap(const HeightmapGeneratorSettings& settings);
+
+	bool isLoaded() const { return m_pendingUploads == 0 && m_VAO != 0; }
 	
-	float getHeightAt(const glm::vec3& position);
+	float getHeightAt(const glm::vec3& position) const;
+
+	// Heights at count points, given as separate arrays of x and z, each the same as getHeightAt, and
+	// the ground's normals as well unless normalX is NULL. Points on resident tiles of the finest level
+	// are done 8 at a time with AVX2 gathers when the build enables it, and large batches are split
+	// across the thread pool
+	void getHeightsAt(size_t count, const float* x, const float* z, float* heights,
+		float* normalX = NULL, float* normalY = NULL, float* normalZ = NULL) const;
 	
-	void draw(unsigned int& shaderID);
+	// Select the chunks for this view, cull those outside it and draw the rest in one instanced call
+	void draw(unsigned int& shaderID, const glm::mat4& transform, const CullView& view, TerrainStats& stats);
+
+	// Delete the GL buffers and release the textures, while the context is still current
+	void deleteBuffers();
+
+	// Ask the texture cache for the detail the ground nearest the camera needs
+	void requestTextureDetail(const glm::vec3& viewPos, float projectionScale);
+
+	// Page in the height tiles around the camera and ahead of it, once per frame
+	void updatePaging(const glm::vec3& viewPos, float deltaTime, double budgetMs);
+
+	HeightmapPagerStats getPagingStats() const { return m_pager.getStats(); }
+
+	static void resetStats(TerrainStats& stats);
+
+	// Time getHeightAt against getHeightsAt over points spread across the map
+	void benchmarkQueries() const;
+
+	// First point along origin + direction * distance, up to maxDistance, where the ray meets the ground
+	// getHeightAt reports. The ray skips the empty space above the ground a cell of a max height pyramid
+	// at a time, and only tests the triangles of the cells it passes below the top of
+	bool raycast(const glm::vec3& origin, const glm::vec3& direction, float maxDistance, float& distance) const;
+	// raycast for eight rays at once, 8 wide with AVX2 when the build enables it. Returns a bit for each
+	// ray that hit, with its distance in distances
+	unsigned int raycastPacket(const glm::vec3 origins[8], const glm::vec3 directions[8], float maxDistance,
+		float distances[8]) const;
+
+	// Time single and packet rays against stepping along them with getHeightAt
+	void benchmarkRays() const;
+
+	// Render thread: change the heights under the brush. Only the samples under it are read and written,
+	// the tiles holding them are patched in place and the changed texels uploaded, and the quadtree bounds
+	// and height pyramid are taken again over the same rectangle. Normals need nothing, terrainVS.glsl and
+	// getHeightAt take them from the neighbouring heights. False when the brush misses the map
+	bool applyBrush(const TerrainBrush& brush);
+
+	// Time dabs of each brush at a few sizes across the map, then put the heights back as they were
+	void benchmarkEdits();
 
 private:
+	// Chunk picked for drawing and the level whose morph range it uses
+	struct SelectedChunk
+	{
+		unsigned int x, z;			// first heightmap sample it covers
+		unsigned int size;			// in samples
+		unsigned int level;
+	};
+
+	// Per instance attributes of a drawn chunk, as terrainVS.glsl reads them
+	struct ChunkInstance
+	{
+		glm::vec3 node;				// first sample, samples between grid lines
+		glm::vec2 morph;			// distance the morph starts at, one over the distance it takes
+		glm::vec4 tile;				// first sample of the height tile, samples between its texels, layer
+	};
+
+	// Map the tiled heights, tiling a raw heightmap first if its .cgheight is missing or stale.
+	// Touches no GL
+	bool readHeightmap(const std::string& filename, unsigned char bitsPerPixel, unsigned int width, unsigned int height);
+	// As above, generating the heights when their .cgheight is missing or was generated from other settings
+	bool readGeneratedHeightmap(const HeightmapGeneratorSettings& settings);
+	// Map the .cgheight and build what the terrain keeps over it. Touches no GL
+	bool openHeightmap(const std::string& cachePath);
+
+	// Height and, when normal is not NULL, normal of the ground at (x, z), -FLT_MAX and up off the map
+	float getGroundAt(float x, float z, glm::vec3* normal) const;
+	// Terrain space to the height pyramid's, (position + offset) * scale, which leaves distances along a ray as they are
+	void getSampleSpace(glm::vec3& offset, glm::vec3& scale) const;
+	// getHeightsAt without the thread pool
+	void getHeightsOnThread(size_t count, const float* x, const float* z, float* heights,
+		float* normalX, float* normalY, float* normalZ) const;
+
 	void generateIndexBuffer();
-	void generateNormals();
+	void generateLodRanges();
 	void generateVertexBuffers();
 
-	std::streampos getFileLength(std::ifstream& file);
-	float getHeightValue(const unsigned char* data, unsigned char numBytes);
-
-	unsigned int loadTexture(const char* path);
+	// Walk the tree from a node, false when the node is out of reach of its level and its parent
+	// has to draw the area instead
+	bool selectNode(unsigned int level, unsigned int nodeX, unsigned int nodeZ, const glm::vec4 planes[6],
+		const glm::vec3& localViewPos, TerrainStats& stats);
+	// False for nodes past the edge of a map that is not a power of two in size, which have nothing to draw
+	bool getNodeBox(unsigned int level, unsigned int nodeX, unsigned int nodeZ, glm::vec3& boxMin, glm::vec3& boxMax) const;
 
 private:
-	std::vector<glm::vec3> m_positions;
-	std::vector<glm::vec3> m_normals;
-	std::vector<glm::vec2> m_texCoords;
-	std::vector<unsigned int> m_indexs;
+	HeightmapPager m_pager;
+	HeightPyramid m_pyramid;
+	unsigned int m_levelCount;
+
+	// Distance to the camera within which each level is drawn, in terrain space
+	std::vector<float> m_lodRanges;
+
+	// One patch of the grid every chunk draws, a strip down each column of quads
+	std::vector<unsigned short> m_indexs;
+
+	std::vector<SelectedChunk> m_selection;
+	std::vector<ChunkInstance> m_instances;
 
 	glm::uvec2 m_heightmapDimensions;
 	float m_heightScale;
 	float m_blockScale;
 
-	unsigned int m_VAO, m_VBO, m_EBO;
+	// Where updatePaging last saw the camera, in samples
+	glm::vec2 m_lastViewSample;
+	bool m_viewSampled;
+
+	unsigned int m_VAO, m_EBO;
+	unsigned int m_instanceVBO;
 
-	unsigned int m_grassTexture;
-	unsigned int m_rockTexture;
-	unsigned int m_snowTexture;
+	// Grass, rock and snow as layers of one array
+	unsigned int m_textureArray;
+
+	// Loader uploads that have not run yet
+	unsigned int m_pendingUploads;
 };
+
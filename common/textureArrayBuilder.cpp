@@ -0,0 +1,50 @@
+#include "textureArrayBuilder.hpp"
+
+#include <algorithm>
+
+int TextureArrayBuilder::addLayer(const std::string& path)
+{
+	int layer = getLayer(path);
+	if (layer >= 0) {
+		return layer;
+	}
+	m_paths.push_back(path);
+	return (int)m_paths.size() - 1;
+}
+
+int TextureArrayBuilder::getLayer(const std::string& path) const
+{
+	std::vector<std::string>::const_iterator it = std::find(m_paths.begin(), m_paths.end(), path);
+	return it == m_paths.end() ? -1 : (int)(it - m_paths.begin());
+}
+
+void TextureArrayBuilder::addUser(TextureCache::ReadyCallback onReady)
+{
+	m_users.push_back(onReady);
+}
+
+void TextureArrayBuilder::build(const TextureOptions& options)
+{
+	if (m_paths.empty()) {
+		return;
+	}
+
+	// One acquire per user, so each holds a reference of its own
+	for (size_t i = 0; i < m_users.size(); i++) {
+		m_users[i](TextureCache::instance().acquireArray(m_paths, options));
+	}
+	m_users.clear();
+}
+
+void TextureArrayBuilder::build(const TextureOptions& options, AssetLoader& loader)
+{
+	if (m_paths.empty()) {
+		return;
+	}
+
+	// Only the first acquire loads, the others wait on the same entry
+	for (size_t i = 0; i < m_users.size(); i++) {
+		TextureCache::instance().acquireArray(m_paths, options, loader, m_users[i]);
+	}
+	m_users.clear();
+}
@@ -0,0 +1,34 @@
+#pragma once
+#include <string>
+#include <vector>
+
+#include "textureCache.hpp"
+
+class AssetLoader;
+
+// Gathers the maps of objects drawn with the same shader into one texture array, so their draws bind a
+// single texture and pick each map by its layer. Draws that differ only in their maps can then be batched.
+// Every layer is built with the same options, so colour and data maps belong in separate arrays
+class TextureArrayBuilder
+{
+public:
+	// Layer the texture will be in, a path added again shares its layer
+	int addLayer(const std::string& path);
+
+	// Layer of path, -1 when it was never added
+	int getLayer(const std::string& path) const;
+
+	unsigned int getLayerCount() const { return (unsigned int)m_paths.size(); }
+
+	// Hand the array to onReady once it is built, with a reference onReady's owner releases
+	void addUser(TextureCache::ReadyCallback onReady);
+
+	// Build the array from every layer added so far, straight away or in the background, and pass it to
+	// the users waiting for it
+	void build(const TextureOptions& options = TextureOptions());
+	void build(const TextureOptions& options, AssetLoader& loader);
+
+private:
+	std::vector<std::string> m_paths;
+	std::vector<TextureCache::ReadyCallback> m_users;
+};
@@ -0,0 +1,1193 @@
+#include "textureCache.hpp"
+#include "assetLoader.hpp"
+#include "contentHash.hpp"
+#include "threadPool.hpp"
+#include "uploadRing.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+#include <memory>
+
+namespace
+{
+	// Streamed textures load the levels up to this size straight away, so they can be drawn at once
+	const unsigned int STREAMING_TAIL_SIZE = 64;
+
+	// Default residency budget, far above what the bundled assets need
+	const unsigned long long DEFAULT_RESIDENCY_BUDGET = 256ull * 1024 * 1024;
+
+	// Lexically normalised path so "a/./b.png", "a\\b.png" and "c/../a/b.png" share one entry
+	std::string canonicalPath(const std::string& path)
+	{
+		std::vector<std::string> parts;
+		std::string part;
+		for (size_t i = 0; i <= path.size(); i++) {
+			char c = i < path.size() ? path[i] : '/';
+			if (c != '/' && c != '\\') {
+				part += c;
+				continue;
+			}
+			if (part == "..") {
+				if (!parts.empty() && parts.back() != "..") {
+					parts.pop_back();
+				}
+				else {
+					parts.push_back(part);
+				}
+			}
+			else if (!part.empty() && part != ".") {
+				parts.push_back(part);
+			}
+			part.clear();
+		}
+
+		std::string result = (!path.empty() && (path[0] == '/' || path[0] == '\\')) ? "/" : "";
+		for (size_t i = 0; i < parts.size(); i++) {
+			result += (i > 0 ? "/" : "") + parts[i];
+		}
+		return result;
+	}
+
+	std::string makeOptionsKey(const TextureOptions& options)
+	{
+		char suffix[96];
+		snprintf(suffix, sizeof(suffix), "|flip%d|wrap%d|mip%d|bc%d|filter%d|srgb%d|stream%d", options.flipVertically ? 1 : 0,
+			(int)options.wrap, options.mipmaps ? 1 : 0, (int)options.compression, (int)options.mipFilter, options.srgb ? 1 : 0,
+			options.streamed ? 1 : 0);
+		return suffix;
+	}
+
+	std::string makeKey(const std::string& path, const TextureOptions& options)
+	{
+		return canonicalPath(path) + makeOptionsKey(options);
+	}
+
+	std::string makeArrayKey(const std::vector<std::string>& layers, const TextureOptions& options)
+	{
+		std::string key = "array";
+		for (size_t i = 0; i < layers.size(); i++) {
+			key += "|" + canonicalPath(layers[i]);
+		}
+		return key + makeOptionsKey(options);
+	}
+
+	std::string makeCubeKey(const std::vector<std::string>& faces)
+	{
+		std::string key = "cube";
+		for (size_t i = 0; i < faces.size(); i++) {
+			key += "|" + canonicalPath(faces[i]);
+		}
+		return key;
+	}
+
+	TextureOptions cubeMapOptions()
+	{
+		TextureOptions options;
+		options.wrap = GL_CLAMP_TO_EDGE;
+		options.mipmaps = false;
+		options.compression = TEXTURE_UNCOMPRESSED;
+		options.streamed = false;
+		return options;
+	}
+
+	// Normal maps are never gamma encoded
+	TextureBuildSettings getBuildSettings(const TextureOptions& options)
+	{
+		TextureBuildSettings settings;
+		settings.compression = options.compression;
+		settings.mipFilter = options.mipFilter;
+		settings.srgb = options.srgb && options.compression != TEXTURE_COMPRESS_NORMAL;
+		return settings;
+	}
+
+	// Read from the GLEW flags set at start up, so workers can ask too
+	bool isFormatSupported(BcFormat format)
+	{
+		switch (format) {
+		case BC1:
+		case BC3:
+			return GLEW_EXT_texture_compression_s3tc != 0;
+		case BC4:
+		case BC5:
+			return GLEW_VERSION_3_0 || GLEW_ARB_texture_compression_rgtc;
+		case BC7:
+			return GLEW_VERSION_4_2 || GLEW_ARB_texture_compression_bptc;
+		default:
+			return false;
+		}
+	}
+
+	GLenum getCompressedFormat(BcFormat format)
+	{
+		switch (format) {
+		case BC1: return GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+		case BC3: return GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+		case BC4: return GL_COMPRESSED_RED_RGTC1;
+		case BC5: return GL_COMPRESSED_RG_RGTC2;
+		default: return GL_COMPRESSED_RGBA_BPTC_UNORM;
+		}
+	}
+
+	// Block format every layer of an array can be stored in, the layers' own one when they agree. Colour
+	// layers widen to the format of the richest of them, anything else mixed stays uncompressed
+	BcFormat getArrayFormat(const std::vector<BcFormat>& formats)
+	{
+		bool same = true, bc7 = false, bc3 = false, other = false;
+		for (size_t i = 0; i < formats.size(); i++) {
+			same = same && formats[i] == formats[0];
+			bc7 = bc7 || formats[i] == BC7;
+			bc3 = bc3 || formats[i] == BC3;
+			other = other || formats[i] == BC_NONE || formats[i] == BC5;
+		}
+		if (same) {
+			return formats[0];
+		}
+		if (other) {
+			return BC_NONE;
+		}
+		return bc7 ? BC7 : bc3 ? BC3 : BC1;
+	}
+
+	unsigned long long textureBytes(int width, int height, int components, bool mipmaps)
+	{
+		unsigned long long bytes = 0;
+		while (true) {
+			bytes += (unsigned long long)width * height * components;
+			if (!mipmaps || (width == 1 && height == 1)) {
+				return bytes;
+			}
+			width = width > 1 ? width / 2 : 1;
+			height = height > 1 ? height / 2 : 1;
+		}
+	}
+
+	// One level of every layer as stored on the GPU, uncompressed levels take the source image's component count
+	unsigned long long levelBytes(const CachedTexture& texture, unsigned int layers, unsigned int level)
+	{
+		const TextureLevel& data = texture.levels[level];
+		return layers * (texture.format == BC_NONE ? (unsigned long long)data.width * data.height * texture.sourceComponents
+			: data.size);
+	}
+
+	unsigned long long uncompressedLevelBytes(const CachedTexture& texture, unsigned int layers, unsigned int level)
+	{
+		const TextureLevel& data = texture.levels[level];
+		return (unsigned long long)layers * data.width * data.height * texture.sourceComponents;
+	}
+
+	// Levels a texture uploads, and the first of them that is loaded straight away. Streamed textures
+	// start at the first level within the tail size
+	unsigned int getLevelCount(const CachedTexture& texture, const TextureOptions& options)
+	{
+		return options.mipmaps ? texture.levelCount : std::min(texture.levelCount, 1u);
+	}
+
+	unsigned int getFirstLevel(const CachedTexture& texture, const TextureOptions& options)
+	{
+		const unsigned int levels = getLevelCount(texture, options);
+		unsigned int first = 0;
+		while (options.streamed && first + 1 < levels
+			&& std::max(texture.levels[first].width, texture.levels[first].height) > STREAMING_TAIL_SIZE) {
+			first++;
+		}
+		return first;
+	}
+
+	// Pixels is client memory, or an offset into the bound unpack buffer. An array level holds every
+	// layer back to back
+	void defineLevel(GLenum target, const CachedTexture& texture, unsigned int layers, unsigned int level, const void* pixels)
+	{
+		const TextureLevel& source = texture.levels[level];
+		const GLenum internalFormat = texture.format == BC_NONE ? image::getFormat(texture.sourceComponents)
+			: getCompressedFormat(texture.format);
+		if (target == GL_TEXTURE_2D_ARRAY && texture.format == BC_NONE) {
+			glTexImage3D(target, level, internalFormat, source.width, source.height, layers, 0, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+		}
+		else if (target == GL_TEXTURE_2D_ARRAY) {
+			glCompressedTexImage3D(target, level, internalFormat, source.width, source.height, layers, 0,
+				source.size * layers, pixels);
+		}
+		else if (texture.format == BC_NONE) {
+			glTexImage2D(target, level, internalFormat, source.width, source.height, 0, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+		}
+		else {
+			glCompressedTexImage2D(target, level, internalFormat, source.width, source.height, 0, source.size, pixels);
+		}
+	}
+
+	// Shrink a level to 0x0 so the driver can free it
+	void clearLevel(GLenum target, const CachedTexture& texture, unsigned int level)
+	{
+		const GLenum internalFormat = texture.format == BC_NONE ? image::getFormat(texture.sourceComponents)
+			: getCompressedFormat(texture.format);
+		if (target == GL_TEXTURE_2D_ARRAY && texture.format == BC_NONE) {
+			glTexImage3D(target, level, internalFormat, 0, 0, 0, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+		}
+		else if (target == GL_TEXTURE_2D_ARRAY) {
+			glCompressedTexImage3D(target, level, internalFormat, 0, 0, 0, 0, 0, NULL);
+		}
+		else if (texture.format == BC_NONE) {
+			glTexImage2D(target, level, internalFormat, 0, 0, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+		}
+		else {
+			glCompressedTexImage2D(target, level, internalFormat, 0, 0, 0, 0, NULL);
+		}
+	}
+}
+
+struct TextureCache::DecodedPart
+{
+	Image image;						// a cube map face
+	CachedTexture texture;				// or every level of a 2D texture or array
+	unsigned int layers;				// of an array, each level holds them back to back, else 1
+	MappedFile file;					// .cgtex the levels point into
+	std::vector<unsigned char> built;	// or the levels built on this load
+	unsigned long long sourceSize;		// of the image file, when it could be read
+	unsigned long long sourceHash;
+	bool hashed;
+	double buildMs;						// 0 when the levels came from the file
+	double startMs;						// milliseconds on m_clock
+	double endMs;
+	UploadSlice staging;				// the face or the first levels, copied into the upload ring
+	size_t stagedOffsets[MAX_TEXTURE_LEVELS];
+
+	DecodedPart()
+		: image()
+		, texture()
+		, layers(1)
+		, sourceSize(0)
+		, sourceHash(0)
+		, hashed(false)
+		, buildMs(0.0)
+		, startMs(0.0)
+		, endMs(0.0)
+	{
+	}
+
+	~DecodedPart()
+	{
+		if (staging.data) {
+			UploadRing::instance().cancel(staging);
+		}
+	}
+};
+
+struct TextureCache::StagedLevel
+{
+	unsigned int level;
+	UploadSlice slice;
+	std::atomic<bool> ready;
+
+	StagedLevel()
+		: level(0)
+		, ready(false)
+	{
+	}
+
+	// The copy job holds a reference too, so the slice is only given back once it is done writing
+	~StagedLevel()
+	{
+		if (slice.data) {
+			UploadRing::instance().cancel(slice);
+		}
+	}
+};
+
+TextureOptions getMapOptions(const std::string& type)
+{
+	TextureOptions options;
+	if (type == "normal") {
+		options.compression = TEXTURE_COMPRESS_NORMAL;
+		options.srgb = false;
+	}
+	else if (type == "specular") {
+		options.srgb = false;
+	}
+	return options;
+}
+
+TextureCache::TextureCache()
+{
+	m_stats.hits = 0;
+	m_stats.misses = 0;
+	m_stats.textures = 0;
+	m_stats.bytesResident = 0;
+	m_stats.bytesUncompressed = 0;
+	m_stats.decodeMs = 0.0;
+	m_stats.decodeWallMs = 0.0;
+	m_stats.residencyBudget = DEFAULT_RESIDENCY_BUDGET;
+	m_stats.pendingLevels = 0;
+	m_stats.levelsStreamedIn = 0;
+	m_stats.levelsEvicted = 0;
+	m_stats.bytesStreamedIn = 0;
+	m_stats.bytesEvicted = 0;
+	m_firstDecodeMs = std::numeric_limits<double>::max();
+	m_lastDecodeMs = 0.0;
+	m_frame = 1;
+}
+
+TextureCache& TextureCache::instance()
+{
+	static TextureCache cache;
+	return cache;
+}
+
+unsigned int TextureCache::acquire(const std::string& path, const TextureOptions& options)
+{
+	std::string key = makeKey(path, options);
+	Entry* entry = findEntry(key);
+	if (!entry) {
+		entry = createEntry(key, GL_TEXTURE_2D, options, std::vector<std::string>(1, path));
+	}
+	loadNow(entry);
+	return entry->textureID;
+}
+
+void TextureCache::acquire(const std::string& path, const TextureOptions& options, AssetLoader& loader, ReadyCallback onReady)
+{
+	std::string key = makeKey(path, options);
+	Entry* entry = findEntry(key);
+	if (entry) {
+		if (entry->pendingParts == 0) {
+			onReady(entry->textureID);
+		}
+		else {
+			entry->waiters.push_back(onReady);
+		}
+		return;
+	}
+
+	entry = createEntry(key, GL_TEXTURE_2D, options, std::vector<std::string>(1, path));
+	entry->waiters.push_back(onReady);
+	loadAsync(entry, loader);
+}
+
+unsigned int TextureCache::acquireCubeMap(const char* const faces[6])
+{
+	std::vector<std::string> paths(faces, faces + 6);
+	std::string key = makeCubeKey(paths);
+	Entry* entry = findEntry(key);
+	if (!entry) {
+		entry = createEntry(key, GL_TEXTURE_CUBE_MAP, cubeMapOptions(), paths);
+	}
+	loadNow(entry);
+	return entry->textureID;
+}
+
+void TextureCache::acquireCubeMap(const char* const faces[6], AssetLoader& loader, ReadyCallback onReady)
+{
+	std::vector<std::string> paths(faces, faces + 6);
+	std::string key = makeCubeKey(paths);
+	Entry* entry = findEntry(key);
+	if (entry) {
+		if (entry->pendingParts == 0) {
+			onReady(entry->textureID);
+		}
+		else {
+			entry->waiters.push_back(onReady);
+		}
+		return;
+	}
+
+	entry = createEntry(key, GL_TEXTURE_CUBE_MAP, cubeMapOptions(), paths);
+	entry->waiters.push_back(onReady);
+	loadAsync(entry, loader);
+}
+
+unsigned int TextureCache::acquireArray(const std::vector<std::string>& paths, const TextureOptions& options)
+{
+	std::string key = makeArrayKey(paths, options);
+	Entry* entry = findEntry(key);
+	if (!entry) {
+		entry = createEntry(key, GL_TEXTURE_2D_ARRAY, options, paths);
+	}
+	loadNow(entry);
+	return entry->textureID;
+}
+
+void TextureCache::acquireArray(const std::vector<std::string>& paths, const TextureOptions& options, AssetLoader& loader,
+	ReadyCallback onReady)
+{
+	std::string key = makeArrayKey(paths, options);
+	Entry* entry = findEntry(key);
+	if (entry) {
+		if (entry->pendingParts == 0) {
+			onReady(entry->textureID);
+		}
+		else {
+			entry->waiters.push_back(onReady);
+		}
+		return;
+	}
+
+	entry = createEntry(key, GL_TEXTURE_2D_ARRAY, options, paths);
+	entry->waiters.push_back(onReady);
+	loadAsync(entry, loader);
+}
+
+void TextureCache::release(unsigned int textureID)
+{
+	std::map<unsigned int, Entry*>::iterator it = m_textures.find(textureID);
+	if (it == m_textures.end()) {
+		return;
+	}
+
+	Entry* entry = it->second;
+	if (entry->refs > 0) {
+		entry->refs--;
+	}
+	if (entry->refs == 0 && entry->jobsInFlight == 0) {
+		destroyEntry(entry);
+	}
+}
+
+void TextureCache::requestDetail(unsigned int textureID, float screenPixels)
+{
+	std::map<unsigned int, Entry*>::iterator it = m_textures.find(textureID);
+	if (it == m_textures.end() || !it->second->source) {
+		return;
+	}
+
+	// About one texel per pixel: skip a level for every halving of the screen size against the top level
+	Entry* entry = it->second;
+	const CachedTexture& texture = entry->source->texture;
+	const float ratio = std::max(texture.width, texture.height) / std::max(screenPixels, 1.0f);
+	unsigned int level = ratio > 1.0f ? (unsigned int)std::floor(std::log2(ratio)) : 0;
+	level = std::min(level, entry->tailLevel);
+	if (entry->lastRequestFrame != m_frame) {
+		entry->lastRequestFrame = m_frame;
+		entry->wantedLevel = level;
+	}
+	else {
+		entry->wantedLevel = std::min(entry->wantedLevel, level);
+	}
+}
+
+void TextureCache::updateStreaming(double budgetMs)
+{
+	Timer timer;
+
+	// A budget lowered since the last frame may take levels from textures in use
+	makeRoom(0, true);
+
+	// Detail that is no longer needed goes at once, apart from one spare level so an object sitting on
+	// a level boundary does not upload and evict the same level frame after frame
+	std::vector<Entry*> wanting;
+	m_stats.pendingLevels = 0;
+	for (std::map<unsigned int, Entry*>::iterator it = m_textures.begin(); it != m_textures.end(); ++it) {
+		Entry* entry = it->second;
+		if (!entry->source) {
+			continue;
+		}
+
+		// A staged level nobody asks for any more would hold up the ring
+		if (entry->lastRequestFrame != m_frame) {
+			entry->staged.reset();
+			continue;
+		}
+		while (entry->residentLevel + 1 < entry->wantedLevel) {
+			evictLevel(entry);
+		}
+		if (entry->wantedLevel < entry->residentLevel) {
+			wanting.push_back(entry);
+			m_stats.pendingLevels += entry->residentLevel - entry->wantedLevel;
+		}
+	}
+
+	// One level per texture per pass so everything in view sharpens together. Levels are copied into the
+	// upload ring by a worker first and uploaded on a later frame, once the copy is done
+	unsigned int uploads = 0;
+	bool progress = true;
+	while (progress) {
+		progress = false;
+		for (size_t i = 0; i < wanting.size(); i++) {
+			Entry* entry = wanting[i];
+			if (entry->residentLevel <= entry->wantedLevel) {
+				continue;
+			}
+			if (uploads > 0 && timer.elapsedMs() >= budgetMs) {
+				progress = false;
+				break;
+			}
+			if (entry->staged && !entry->staged->ready.load()) {
+				continue;
+			}
+			if (!makeRoom(levelBytes(entry->source->texture, entry->source->layers, entry->residentLevel - 1), false)) {
+				continue;
+			}
+			if (!entry->staged && stageLevel(entry)) {
+				continue;
+			}
+			streamInLevel(entry);
+			m_stats.pendingLevels--;
+			uploads++;
+			progress = true;
+		}
+	}
+	m_frame++;
+}
+
+void TextureCache::setResidencyBudget(unsigned long long bytes)
+{
+	m_stats.residencyBudget = bytes;
+}
+
+void TextureCache::printStats() const
+{
+	printf("Texture cache: %u textures, %.1f MB resident (%.1f MB saved by compression), %u hits, %u misses, %.1f ms of decoding in %.1f ms (%.1fx)\n",
+		m_stats.textures, m_stats.bytesResident / (1024.0 * 1024.0), (m_stats.bytesUncompressed - m_stats.bytesResident) / (1024.0 * 1024.0),
+		m_stats.hits, m_stats.misses, m_stats.decodeMs, m_stats.decodeWallMs,
+		m_stats.decodeWallMs > 0.0 ? m_stats.decodeMs / m_stats.decodeWallMs : 1.0);
+}
+
+void TextureCache::printStreamingStats() const
+{
+	printf("Texture streaming: %.1f MB resident of a %.1f MB budget, %u levels pending, %u levels (%.1f MB) streamed in, %u levels (%.1f MB) evicted\n",
+		m_stats.bytesResident / (1024.0 * 1024.0), m_stats.residencyBudget / (1024.0 * 1024.0), m_stats.pendingLevels,
+		m_stats.levelsStreamedIn, m_stats.bytesStreamedIn / (1024.0 * 1024.0),
+		m_stats.levelsEvicted, m_stats.bytesEvicted / (1024.0 * 1024.0));
+}
+
+void TextureCache::benchmarkDecode() const
+{
+	std::vector<const std::string*> paths;
+	for (std::map<std::string, Entry*>::const_iterator it = m_entries.begin(); it != m_entries.end(); ++it) {
+		for (size_t i = 0; i < it->second->paths.size(); i++) {
+			paths.push_back(&it->second->paths[i]);
+		}
+	}
+	if (paths.empty()) {
+		return;
+	}
+
+	// Every image is freed straight away so both runs see the same allocator state
+	Timer serialTimer;
+	for (size_t i = 0; i < paths.size(); i++) {
+		Image decoded;
+		image::decode(paths[i]->c_str(), decoded);
+		image::release(decoded);
+	}
+	double serialMs = serialTimer.elapsedMs();
+
+	Timer parallelTimer;
+	ThreadPool::instance().parallelFor((unsigned int)paths.size(), [&paths](unsigned int i) {
+		Image decoded;
+		image::decode(paths[i]->c_str(), decoded);
+		image::release(decoded);
+	});
+	double parallelMs = parallelTimer.elapsedMs();
+
+	printf("Decoding %u images: %.1f ms serial, %.1f ms on %u threads (%.1fx)\n", (unsigned int)paths.size(),
+		serialMs, parallelMs, ThreadPool::instance().getThreadCount() + 1, parallelMs > 0.0 ? serialMs / parallelMs : 1.0);
+}
+
+void TextureCache::benchmarkMipmaps() const
+{
+	// Decoding is not timed, every run starts from the same RGBA8 images
+	std::vector<std::vector<unsigned char> > images;
+	std::vector<int> widths, heights;
+	unsigned long long pixelCount = 0;
+	for (std::map<std::string, Entry*>::const_iterator it = m_entries.begin(); it != m_entries.end(); ++it) {
+		const Entry* entry = it->second;
+		Image decoded;
+		if (entry->target != GL_TEXTURE_2D || !image::decode(entry->paths[0].c_str(), decoded, entry->options.flipVertically)) {
+			continue;
+		}
+		images.push_back(std::vector<unsigned char>());
+		image::toRgba(decoded, images.back());
+		widths.push_back(decoded.width);
+		heights.push_back(decoded.height);
+		pixelCount += (unsigned long long)decoded.width * decoded.height;
+		image::release(decoded);
+	}
+	if (images.empty()) {
+		return;
+	}
+
+	printf("Mip chains for %u textures, %.1f Mpixels at the top level:\n", (unsigned int)images.size(), pixelCount / 1.0e6);
+	const struct
+	{
+		MipFilter filter;
+		bool srgb;
+	} runs[] = { { MIP_FILTER_BOX, false }, { MIP_FILTER_BOX, true }, { MIP_FILTER_KAISER, false }, { MIP_FILTER_KAISER, true } };
+	MipLevels levels;
+
+	// Untimed pass so page faults and table setup are not charged to the first filter
+	mipChain::build(images[0].data(), widths[0], heights[0], MIP_FILTER_BOX, true, levels);
+	for (size_t r = 0; r < sizeof(runs) / sizeof(runs[0]); r++) {
+		Timer timer;
+		for (size_t i = 0; i < images.size(); i++) {
+			mipChain::build(images[i].data(), widths[i], heights[i], runs[r].filter, runs[r].srgb, levels);
+		}
+		double ms = timer.elapsedMs();
+		printf("  CPU %s%s: %.1f ms, %.0f Mpixels/s on %u threads\n", runs[r].srgb ? "gamma correct " : "",
+			mipChain::getFilterName(runs[r].filter), ms, pixelCount / 1.0e3 / std::max(ms, 0.001),
+			ThreadPool::instance().getThreadCount() + 1);
+	}
+
+	// The driver path is timed from an uploaded top level to the finished chain
+	double driverMs = 0.0;
+	for (size_t i = 0; i < images.size(); i++) {
+		GLuint texture;
+		glGenTextures(1, &texture);
+		glBindTexture(GL_TEXTURE_2D, texture);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, widths[i], heights[i], 0, GL_RGBA, GL_UNSIGNED_BYTE, images[i].data());
+		glFinish();
+		Timer timer;
+		glGenerateMipmap(GL_TEXTURE_2D);
+		glFinish();
+		driverMs += timer.elapsedMs();
+		glBindTexture(GL_TEXTURE_2D, 0);
+		glDeleteTextures(1, &texture);
+	}
+	printf("  glGenerateMipmap: %.1f ms, %.0f Mpixels/s\n", driverMs, pixelCount / 1.0e3 / std::max(driverMs, 0.001));
+}
+
+TextureCache::Entry* TextureCache::findEntry(const std::string& key)
+{
+	std::map<std::string, Entry*>::iterator it = m_entries.find(key);
+	if (it == m_entries.end()) {
+		m_stats.misses++;
+		return NULL;
+	}
+	m_stats.hits++;
+	it->second->refs++;
+	return it->second;
+}
+
+TextureCache::Entry* TextureCache::createEntry(const std::string& key, GLenum target, const TextureOptions& options,
+	const std::vector<std::string>& paths)
+{
+	// The layers of an array have to agree on a size and format before any of them is uploaded, so the
+	// array is decoded as a single part
+	const unsigned int parts = target == GL_TEXTURE_2D_ARRAY ? 1 : (unsigned int)paths.size();
+	Entry* entry = new Entry();
+	entry->target = target;
+	entry->options = options;
+	entry->paths = paths;
+	entry->uploaded.assign(parts, false);
+	entry->refs = 1;
+	entry->pendingParts = parts;
+	entry->jobsInFlight = 0;
+	entry->bytes = 0;
+	entry->uncompressedBytes = 0;
+	entry->residentLevel = 0;
+	entry->tailLevel = 0;
+	entry->wantedLevel = 0;
+	entry->lastRequestFrame = 0;
+	entry->position = m_entries.insert(std::make_pair(key, entry)).first;
+
+	// Sampler state is set up front so the parts can arrive in any order
+	glGenTextures(1, &entry->textureID);
+	glBindTexture(target, entry->textureID);
+	glTexParameteri(target, GL_TEXTURE_WRAP_S, options.wrap);
+	glTexParameteri(target, GL_TEXTURE_WRAP_T, options.wrap);
+	if (target == GL_TEXTURE_CUBE_MAP) {
+		glTexParameteri(target, GL_TEXTURE_WRAP_R, options.wrap);
+	}
+	glTexParameteri(target, GL_TEXTURE_MIN_FILTER, options.mipmaps ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+	glTexParameteri(target, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glBindTexture(target, 0);
+
+	m_textures[entry->textureID] = entry;
+	m_stats.textures++;
+	return entry;
+}
+
+void TextureCache::loadNow(Entry* entry)
+{
+	std::vector<unsigned int> missing;
+	for (unsigned int i = 0; i < entry->uploaded.size(); i++) {
+		if (!entry->uploaded[i]) {
+			missing.push_back(i);
+		}
+	}
+
+	// Decode the parts across the thread pool, the six faces of a cube map at once, then upload in order
+	std::vector<std::shared_ptr<DecodedPart> > decoded(missing.size());
+	std::vector<unsigned char> loaded(missing.size());
+	ThreadPool::instance().parallelFor((unsigned int)missing.size(), [&](unsigned int i) {
+		decoded[i] = std::make_shared<DecodedPart>();
+		if (entry->target == GL_TEXTURE_2D_ARRAY) {
+			loaded[i] = decodeArray(entry->paths, entry->options, m_clock, *decoded[i]);
+		}
+		else {
+			loaded[i] = decodePart(entry->paths[missing[i]], entry->target, entry->options, m_clock, *decoded[i]);
+		}
+		stagePart(entry->options, *decoded[i]);
+	});
+
+	for (size_t i = 0; i < missing.size(); i++) {
+		if (!loaded[i]) {
+			printf("Texture %s failed to load.\n", entry->paths[missing[i]].c_str());
+		}
+		uploadPart(entry, missing[i], decoded[i]);
+		image::release(decoded[i]->image);
+	}
+}
+
+void TextureCache::loadAsync(Entry* entry, AssetLoader& loader)
+{
+	for (unsigned int i = 0; i < entry->uploaded.size(); i++) {
+		std::shared_ptr<DecodedPart> decoded = std::make_shared<DecodedPart>();
+		GLenum target = entry->target;
+		std::vector<std::string> paths = target == GL_TEXTURE_2D_ARRAY ? entry->paths
+			: std::vector<std::string>(1, entry->paths[i]);
+		TextureOptions options = entry->options;
+		entry->jobsInFlight++;
+		const Timer* clock = &m_clock;
+		loader.load(paths[0], [decoded, paths, target, options, clock]() {
+				bool ok = target == GL_TEXTURE_2D_ARRAY ? decodeArray(paths, options, *clock, *decoded)
+					: decodePart(paths[0], target, options, *clock, *decoded);
+				stagePart(options, *decoded);
+				return ok;
+			},
+			[this, entry, decoded, i]() {
+				entry->jobsInFlight--;
+				if (!entry->uploaded[i]) {
+					uploadPart(entry, i, decoded);
+				}
+				image::release(decoded->image);
+
+				// Every holder may have released it while the job was running
+				if (entry->refs == 0 && entry->jobsInFlight == 0) {
+					destroyEntry(entry);
+				}
+			});
+	}
+}
+
+bool TextureCache::decodePart(const std::string& path, GLenum target, const TextureOptions& options, const Timer& clock,
+	DecodedPart& decoded)
+{
+	decoded.startMs = clock.elapsedMs();
+	if (target != GL_TEXTURE_2D) {
+		bool ok = image::decode(path.c_str(), decoded.image, options.flipVertically);
+		decoded.endMs = clock.elapsedMs();
+		return ok;
+	}
+
+	const TextureBuildSettings settings = getBuildSettings(options);
+
+	// A cache file built from this exact source skips decoding altogether
+	unsigned long long sourceSize = 0, sourceHash = 0;
+	bool hashed = hashFile(path.c_str(), sourceSize, sourceHash);
+	decoded.sourceSize = sourceSize;
+	decoded.sourceHash = sourceHash;
+	decoded.hashed = hashed;
+	std::string cachePath = textureFile::getCachePath(path.c_str(), options.flipVertically);
+	if (hashed && textureFile::open(cachePath, sourceSize, sourceHash, settings, decoded.file, decoded.texture)
+		&& (decoded.texture.format == BC_NONE || isFormatSupported(decoded.texture.format))) {
+		decoded.endMs = clock.elapsedMs();
+		return true;
+	}
+	decoded.file.close();
+	decoded.texture = CachedTexture();
+
+	if (!image::decode(path.c_str(), decoded.image, options.flipVertically)) {
+		decoded.endMs = clock.elapsedMs();
+		return false;
+	}
+
+	// Levels left uncompressed because the driver lacks the format are not written, so the file
+	// never stops a driver that has it from getting the compressed version
+	BcFormat format = textureFile::chooseFormat(decoded.image, options.compression, isFormatSupported(BC7));
+	bool cacheable = hashed;
+	if (format != BC_NONE && !isFormatSupported(format)) {
+		format = BC_NONE;
+		cacheable = false;
+	}
+
+	Timer buildTimer;
+	textureFile::build(decoded.image, format, settings, decoded.built, decoded.texture);
+	decoded.buildMs = buildTimer.elapsedMs();
+	image::release(decoded.image);
+	if (cacheable && !textureFile::write(cachePath, sourceSize, sourceHash, settings, decoded.texture)) {
+		printf("Failed to write texture cache %s\n", cachePath.c_str());
+	}
+	else if (cacheable && options.streamed) {
+		// A streamed texture keeps its levels for as long as it lives, so read them from the file instead
+		CachedTexture mapped;
+		if (textureFile::open(cachePath, sourceSize, sourceHash, settings, decoded.file, mapped)) {
+			decoded.texture = mapped;
+			std::vector<unsigned char>().swap(decoded.built);
+		}
+	}
+	decoded.endMs = clock.elapsedMs();
+	return true;
+}
+
+bool TextureCache::decodeArray(const std::vector<std::string>& paths, const TextureOptions& options, const Timer& clock,
+	DecodedPart& decoded)
+{
+	decoded.startMs = clock.elapsedMs();
+
+	// Each layer loads through its own .cgtex first. Layers are only held until they are copied into the
+	// array, so they are never kept mapped for streaming
+	TextureOptions layerOptions = options;
+	layerOptions.streamed = false;
+	const unsigned int count = (unsigned int)paths.size();
+	std::vector<std::shared_ptr<DecodedPart> > layers(count);
+	std::vector<unsigned char> loaded(count);
+	ThreadPool::instance().parallelFor(count, [&](unsigned int i) {
+		layers[i] = std::make_shared<DecodedPart>();
+		loaded[i] = decodePart(paths[i], GL_TEXTURE_2D, layerOptions, clock, *layers[i]) && layers[i]->texture.levelCount > 0;
+	});
+
+	unsigned int width = 0, height = 0, components = 0;
+	std::vector<BcFormat> formats;
+	for (unsigned int i = 0; i < count; i++) {
+		if (!loaded[i]) {
+			printf("Texture %s failed to load.\n", paths[i].c_str());
+			continue;
+		}
+		const CachedTexture& texture = layers[i]->texture;
+		width = std::max(width, texture.width);
+		height = std::max(height, texture.height);
+		components = std::max(components, texture.sourceComponents);
+		formats.push_back(texture.format);
+	}
+	if (formats.empty()) {
+		decoded.endMs = clock.elapsedMs();
+		return false;
+	}
+	const BcFormat format = getArrayFormat(formats);
+
+	// A layer already in the array's format with a level of its size starts from that level, the rest
+	// are converted. Single channel layers are widened to grey when they join colour ones
+	const unsigned int levelCount = std::min(mipChain::getLevelCount(width, height), MAX_TEXTURE_LEVELS);
+	int reference = -1;
+	for (unsigned int i = 0; i < count; i++) {
+		if (!loaded[i]) {
+			continue;
+		}
+		CachedTexture& texture = layers[i]->texture;
+		unsigned int first = 0;
+		while (first < texture.levelCount && (texture.levels[first].width != width || texture.levels[first].height != height)) {
+			first++;
+		}
+		if (texture.format == format && first < texture.levelCount
+			&& (texture.sourceComponents == 1) == (components == 1)) {
+			for (unsigned int level = first; level < texture.levelCount; level++) {
+				texture.levels[level - first] = texture.levels[level];
+			}
+			texture.levelCount -= first;
+			texture.width = width;
+			texture.height = height;
+		}
+		else {
+			loaded[i] = conformLayer(paths[i], layerOptions, width, height, format, *layers[i]);
+		}
+		loaded[i] = loaded[i] && texture.levelCount == levelCount;
+		decoded.buildMs += layers[i]->buildMs;
+		if (loaded[i] && reference < 0) {
+			reference = i;
+		}
+	}
+	if (reference < 0) {
+		decoded.endMs = clock.elapsedMs();
+		return false;
+	}
+
+	// Every level holds all the layers back to back. A layer that failed stays zero, black in every format
+	CachedTexture& texture = decoded.texture;
+	texture = layers[reference]->texture;
+	texture.sourceComponents = components;
+	size_t offsets[MAX_TEXTURE_LEVELS];
+	size_t total = 0;
+	for (unsigned int level = 0; level < levelCount; level++) {
+		offsets[level] = total;
+		total += ((size_t)texture.levels[level].size * count + 15) & ~(size_t)15;
+	}
+	decoded.layers = count;
+	decoded.built.assign(total, 0);
+	for (unsigned int level = 0; level < levelCount; level++) {
+		const size_t size = texture.levels[level].size;
+		texture.levels[level].data = &decoded.built[offsets[level]];
+		for (unsigned int i = 0; i < count; i++) {
+			if (loaded[i]) {
+				memcpy(&decoded.built[offsets[level] + i * size], layers[i]->texture.levels[level].data, size);
+				texture.psnr = std::min(texture.psnr, layers[i]->texture.psnr);
+			}
+		}
+	}
+	decoded.endMs = clock.elapsedMs();
+	return true;
+}
+
+bool TextureCache::conformLayer(const std::string& path, const TextureOptions& options, unsigned int width,
+	unsigned int height, BcFormat format, DecodedPart& layer)
+{
+	layer.file.close();
+	layer.texture = CachedTexture();
+	std::vector<unsigned char>().swap(layer.built);
+
+	const TextureBuildSettings settings = getBuildSettings(options);
+	std::string cachePath = textureFile::getLayerCachePath(path.c_str(), options.flipVertically, width, height);
+	if (layer.hashed && textureFile::open(cachePath, layer.sourceSize, layer.sourceHash, settings, layer.file, layer.texture)
+		&& layer.texture.format == format && layer.texture.width == width && layer.texture.height == height) {
+		return true;
+	}
+	layer.file.close();
+	layer.texture = CachedTexture();
+
+	Image source;
+	if (!image::decode(path.c_str(), source, options.flipVertically)) {
+		return false;
+	}
+	Timer buildTimer;
+	std::vector<unsigned char> rgba, resized;
+	image::toRgba(source, rgba);
+	if (source.components == 1 && format != BC4) {
+		for (size_t i = 0; i < rgba.size(); i += 4) {
+			rgba[i + 1] = rgba[i + 2] = rgba[i];
+		}
+	}
+	mipChain::resample(rgba.data(), source.width, source.height, width, height, settings.srgb, resized);
+	Image scaled = { (int)width, (int)height, 4, resized.data() };
+	textureFile::build(scaled, format, settings, layer.built, layer.texture);
+	layer.texture.sourceComponents = source.components;
+	layer.buildMs = buildTimer.elapsedMs();
+	image::release(source);
+
+	if (layer.hashed && !textureFile::write(cachePath, layer.sourceSize, layer.sourceHash, settings, layer.texture)) {
+		printf("Failed to write texture cache %s\n", cachePath.c_str());
+	}
+	return true;
+}
+
+void TextureCache::stagePart(const TextureOptions& options, DecodedPart& decoded)
+{
+	UploadRing& ring = UploadRing::instance();
+	if (decoded.image.pixels) {
+		ring.stage(decoded.image.pixels, (size_t)decoded.image.width * decoded.image.height * 3, decoded.staging);
+		return;
+	}
+
+	const CachedTexture& texture = decoded.texture;
+	const unsigned int levels = getLevelCount(texture, options);
+	const unsigned int first = getFirstLevel(texture, options);
+	size_t total = 0;
+	for (unsigned int i = first; i < levels; i++) {
+		decoded.stagedOffsets[i] = total;
+		total += ((size_t)texture.levels[i].size * decoded.layers + 15) & ~(size_t)15;
+	}
+	if (total == 0 || !ring.allocate(total, decoded.staging)) {
+		return;
+	}
+	for (unsigned int i = first; i < levels; i++) {
+		memcpy(decoded.staging.data + decoded.stagedOffsets[i], texture.levels[i].data,
+			(size_t)texture.levels[i].size * decoded.layers);
+	}
+}
+
+void TextureCache::uploadPart(Entry* entry, unsigned int part, const std::shared_ptr<DecodedPart>& decoded)
+{
+	// Decodes overlap on the workers, so the wall clock span is tracked next to the summed time
+	m_firstDecodeMs = std::min(m_firstDecodeMs, decoded->startMs);
+	m_lastDecodeMs = std::max(m_lastDecodeMs, decoded->endMs);
+	m_stats.decodeMs += decoded->endMs - decoded->startMs;
+	m_stats.decodeWallMs = m_lastDecodeMs - m_firstDecodeMs;
+
+	unsigned long long bytes = 0, uncompressedBytes = 0;
+	const CachedTexture& texture = decoded->texture;
+	if (texture.levelCount > 0) {
+		// Streamed textures start from the first level within the tail size and keep the part for the rest
+		const unsigned int levels = getLevelCount(texture, entry->options);
+		const unsigned int first = getFirstLevel(texture, entry->options);
+		if (first > 0) {
+			entry->source = decoded;
+			entry->residentLevel = first;
+			entry->tailLevel = first;
+		}
+
+		// Every level comes from the worker, so the driver never has to generate mipmaps
+		unsigned long long chainBytes = 0, chainUncompressedBytes = 0;
+		const bool staged = decoded->staging.data != NULL;
+		UploadRing& ring = UploadRing::instance();
+		if (staged) {
+			ring.bindUnpack();
+		}
+		const unsigned int layers = decoded->layers;
+		glBindTexture(entry->target, entry->textureID);
+		for (unsigned int i = 0; i < levels; i++) {
+			chainBytes += levelBytes(texture, layers, i);
+			chainUncompressedBytes += uncompressedLevelBytes(texture, layers, i);
+			if (i >= first) {
+				defineLevel(entry->target, texture, layers, i,
+					staged ? UploadRing::getUnpackOffset(decoded->staging, decoded->stagedOffsets[i]) : texture.levels[i].data);
+				bytes += levelBytes(texture, layers, i);
+				uncompressedBytes += uncompressedLevelBytes(texture, layers, i);
+			}
+		}
+		glTexParameteri(entry->target, GL_TEXTURE_BASE_LEVEL, first);
+		glTexParameteri(entry->target, GL_TEXTURE_MAX_LEVEL, levels - 1);
+		glBindTexture(entry->target, 0);
+		if (staged) {
+			ring.unbindUnpack();
+			ring.submit(decoded->staging);
+		}
+
+		if (texture.format != BC_NONE) {
+			char name[32] = "";
+			if (layers > 1) {
+				snprintf(name, sizeof(name), " and %u more layers", layers - 1);
+			}
+			printf("Texture %s%s: %s %ux%u, %u levels, %.2f MB instead of %.2f MB, PSNR %.1f dB",
+				entry->paths[part].c_str(), name, bc::getName(texture.format), texture.width, texture.height, levels,
+				chainBytes / (1024.0 * 1024.0), chainUncompressedBytes / (1024.0 * 1024.0), texture.psnr);
+			if (decoded->buildMs > 0.0) {
+				printf(", built in %.1f ms", decoded->buildMs);
+			}
+			if (first > 0) {
+				printf(", streaming from %ux%u", texture.levels[first].width, texture.levels[first].height);
+			}
+			printf("\n");
+		}
+	}
+	else if (decoded->image.pixels) {
+		const Image& face = decoded->image;
+		const bool staged = decoded->staging.data != NULL;
+		UploadRing& ring = UploadRing::instance();
+		if (staged) {
+			ring.bindUnpack();
+		}
+		glBindTexture(GL_TEXTURE_CUBE_MAP, entry->textureID);
+		glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + part, 0, GL_RGB, face.width, face.height, 0, GL_RGB, GL_UNSIGNED_BYTE,
+			staged ? UploadRing::getUnpackOffset(decoded->staging, 0) : face.pixels);
+		glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+		if (staged) {
+			ring.unbindUnpack();
+			ring.submit(decoded->staging);
+		}
+
+		bytes = textureBytes(face.width, face.height, 3, false);
+		uncompressedBytes = bytes;
+	}
+	entry->bytes += bytes;
+	entry->uncompressedBytes += uncompressedBytes;
+	m_stats.bytesResident += bytes;
+	m_stats.bytesUncompressed += uncompressedBytes;
+
+	entry->uploaded[part] = true;
+	entry->pendingParts--;
+	if (entry->pendingParts == 0) {
+		std::vector<ReadyCallback> waiters;
+		waiters.swap(entry->waiters);
+		for (size_t i = 0; i < waiters.size(); i++) {
+			waiters[i](entry->textureID);
+		}
+	}
+}
+
+void TextureCache::destroyEntry(Entry* entry)
+{
+	glDeleteTextures(1, &entry->textureID);
+	m_stats.bytesResident -= entry->bytes;
+	m_stats.bytesUncompressed -= entry->uncompressedBytes;
+	m_stats.textures--;
+	m_textures.erase(entry->textureID);
+	m_entries.erase(entry->position);
+	delete entry;
+}
+
+bool TextureCache::stageLevel(Entry* entry)
+{
+	std::shared_ptr<StagedLevel> staged = std::make_shared<StagedLevel>();
+	staged->level = entry->residentLevel - 1;
+	const size_t size = (size_t)entry->source->texture.levels[staged->level].size * entry->source->layers;
+	if (!UploadRing::instance().allocate(size, staged->slice)) {
+		return false;
+	}
+
+	// The copy also takes the page faults of reading the level from the mapped file off this thread
+	std::shared_ptr<DecodedPart> source = entry->source;
+	entry->staged = staged;
+	ThreadPool::instance().enqueue([staged, source, size]() {
+		memcpy(staged->slice.data, source->texture.levels[staged->level].data, size);
+		staged->ready = true;
+	});
+	return true;
+}
+
+void TextureCache::streamInLevel(Entry* entry)
+{
+	const CachedTexture& texture = entry->source->texture;
+	const unsigned int layers = entry->source->layers;
+	const unsigned int level = entry->residentLevel - 1;
+	UploadRing& ring = UploadRing::instance();
+	const bool staged = entry->staged && entry->staged->level == level && entry->staged->ready.load();
+	glBindTexture(entry->target, entry->textureID);
+	if (staged) {
+		ring.bindUnpack();
+		defineLevel(entry->target, texture, layers, level, UploadRing::getUnpackOffset(entry->staged->slice, 0));
+		ring.unbindUnpack();
+		ring.submit(entry->staged->slice);
+	}
+	else {
+		defineLevel(entry->target, texture, layers, level, texture.levels[level].data);
+	}
+	glTexParameteri(entry->target, GL_TEXTURE_BASE_LEVEL, level);
+	glBindTexture(entry->target, 0);
+	entry->residentLevel = level;
+	entry->staged.reset();
+
+	const unsigned long long bytes = levelBytes(texture, layers, level);
+	const unsigned long long uncompressedBytes = uncompressedLevelBytes(texture, layers, level);
+	entry->bytes += bytes;
+	entry->uncompressedBytes += uncompressedBytes;
+	m_stats.bytesResident += bytes;
+	m_stats.bytesUncompressed += uncompressedBytes;
+	m_stats.levelsStreamedIn++;
+	m_stats.bytesStreamedIn += bytes;
+}
+
+void TextureCache::evictLevel(Entry* entry)
+{
+	const CachedTexture& texture = entry->source->texture;
+	const unsigned int layers = entry->source->layers;
+	const unsigned int level = entry->residentLevel;
+	glBindTexture(entry->target, entry->textureID);
+	glTexParameteri(entry->target, GL_TEXTURE_BASE_LEVEL, level + 1);
+	clearLevel(entry->target, texture, level);
+	glBindTexture(entry->target, 0);
+	entry->residentLevel = level + 1;
+	entry->staged.reset();
+
+	const unsigned long long bytes = levelBytes(texture, layers, level);
+	const unsigned long long uncompressedBytes = uncompressedLevelBytes(texture, layers, level);
+	entry->bytes -= bytes;
+	entry->uncompressedBytes -= uncompressedBytes;
+	m_stats.bytesResident -= bytes;
+	m_stats.bytesUncompressed -= uncompressedBytes;
+	m_stats.levelsEvicted++;
+	m_stats.bytesEvicted += bytes;
+}
+
+bool TextureCache::makeRoom(unsigned long long bytes, bool allowCurrent)
+{
+	while (m_stats.bytesResident + bytes > m_stats.residencyBudget) {
+		// Least recently requested first, and of those the one with the finest level frees the most
+		Entry* victim = NULL;
+		for (std::map<unsigned int, Entry*>::iterator it = m_textures.begin(); it != m_textures.end(); ++it) {
+			Entry* entry = it->second;
+			if (!entry->source || entry->residentLevel >= entry->tailLevel
+				|| (!allowCurrent && entry->lastRequestFrame == m_frame)) {
+				continue;
+			}
+			if (!victim || entry->lastRequestFrame < victim->lastRequestFrame
+				|| (entry->lastRequestFrame == victim->lastRequestFrame && entry->residentLevel < victim->residentLevel)) {
+				victim = entry;
+			}
+		}
+		if (!victim) {
+			return false;
+		}
+		evictLevel(victim);
+	}
+	return true;
+}
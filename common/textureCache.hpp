@@ -0,0 +1,205 @@
+#pragma once
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <GL/glew.h>
+
+#include "image.hpp"
+#include "textureFile.hpp"
+#include "timer.hpp"
+
+class AssetLoader;
+
+// Upload and sampler choices, the same file loaded with different options is a different texture
+struct TextureOptions
+{
+	bool flipVertically;
+	GLint wrap;
+	bool mipmaps;
+	TextureCompression compression;		// used when the driver supports the chosen block format
+	MipFilter mipFilter;
+	bool srgb;							// colour data, mips are filtered in linear light
+	bool streamed;						// start at the low resolution tail, finer levels arrive as requestDetail asks
+
+	TextureOptions()
+		: flipVertically(false)
+		, wrap(GL_REPEAT)
+		, mipmaps(true)
+		, compression(TEXTURE_COMPRESS_COLOR)
+		, mipFilter(MIP_FILTER_KAISER)
+		, srgb(true)
+		, streamed(true)
+	{
+	}
+};
+
+// Options for a material map by its type, as models and shaders name them. Diffuse maps are colour, while
+// specular and normal maps hold data and have their mips filtered as stored, normal maps as x and y only
+TextureOptions getMapOptions(const std::string& type);
+
+struct TextureCacheStats
+{
+	unsigned int hits;
+	unsigned int misses;
+	unsigned int textures;				// currently resident
+	unsigned long long bytesResident;	// every mip level as stored on the GPU
+	unsigned long long bytesUncompressed;	// the same textures without block compression
+	double decodeMs;					// summed over all decodes, the time a single thread would need
+	double decodeWallMs;				// from the first decode starting to the last one finishing
+
+	// Streaming
+	unsigned long long residencyBudget;	// bytesResident is kept under this by evicting streamed levels
+	unsigned int pendingLevels;			// levels asked for last frame that are not resident yet
+	unsigned int levelsStreamedIn;
+	unsigned int levelsEvicted;			// against levelsStreamedIn this shows how much the budget churns
+	unsigned long long bytesStreamedIn;
+	unsigned long long bytesEvicted;
+};
+
+// Shares GL textures between everything that loads the same file with the same options. Textures are
+// reference counted: every acquire is matched by a release and the last release deletes the texture.
+// Only called from the render thread, the loader overloads still decode on the workers
+class TextureCache
+{
+public:
+	typedef std::function<void(unsigned int)> ReadyCallback;
+
+	static TextureCache& instance();
+
+	// Load a 2D texture, a file that fails to decode gets an empty texture. 2D textures are read with all
+	// their levels from the .cgtex next to the file, which is built on a worker and written on the first load
+	unsigned int acquire(const std::string& path, const TextureOptions& options = TextureOptions());
+
+	// Decode in the background, onReady receives the texture once it is uploaded, straight away on a hit
+	void acquire(const std::string& path, const TextureOptions& options, AssetLoader& loader, ReadyCallback onReady);
+
+	// Cube map from six faces in GL_TEXTURE_CUBE_MAP_POSITIVE_X + i order, clamped, uncompressed and without mipmaps
+	unsigned int acquireCubeMap(const char* const faces[6]);
+	void acquireCubeMap(const char* const faces[6], AssetLoader& loader, ReadyCallback onReady);
+
+	// Texture array with one layer per path in order, for a sampler2DArray. Layers are resampled to the
+	// largest of them and converted to one block format, so any textures drawn together can share one
+	// binding. A layer that fails to load is left black. Streams like a 2D texture, a level at a time
+	unsigned int acquireArray(const std::vector<std::string>& paths, const TextureOptions& options = TextureOptions());
+	void acquireArray(const std::vector<std::string>& paths, const TextureOptions& options, AssetLoader& loader,
+		ReadyCallback onReady);
+
+	void release(unsigned int textureID);
+
+	// Ask for enough detail this frame to draw the texture with one repeat of it covering screenPixels
+	// across. Called for every object using a streamed texture, the finest request of the frame wins
+	void requestDetail(unsigned int textureID, float screenPixels);
+
+	// Once per frame after drawing: drop levels finer than the frame asked for, then upload the missing
+	// ones, at least one and then as many as fit in budgetMs. Levels of the textures used least recently
+	// are evicted to stay within the residency budget
+	void updateStreaming(double budgetMs);
+
+	// Bytes every texture may take on the GPU, streamed textures never drop below their tails
+	void setResidencyBudget(unsigned long long bytes);
+
+	const TextureCacheStats& getStats() const { return m_stats; }
+	void printStats() const;
+	void printStreamingStats() const;
+
+	// Decode every cached file one after another, then across the thread pool, and print both times
+	void benchmarkDecode() const;
+
+	// Build the mip chain of every loaded 2D texture with each CPU filter and with glGenerateMipmap,
+	// and print the throughput of each
+	void benchmarkMipmaps() const;
+
+private:
+	TextureCache();
+	TextureCache(const TextureCache&);
+	TextureCache& operator=(const TextureCache&);
+
+	// Everything a decode job hands to its upload, and a streamed level being copied into the upload
+	// ring, defined in the .cpp
+	struct DecodedPart;
+	struct StagedLevel;
+
+	struct Entry
+	{
+		unsigned int textureID;
+		GLenum target;
+		TextureOptions options;
+		std::vector<std::string> paths;		// one per part, six for a cube map, or the layers of an array
+		std::vector<bool> uploaded;
+		unsigned int refs;
+		unsigned int pendingParts;			// parts not uploaded yet
+		unsigned int jobsInFlight;			// loader jobs that still hold the entry
+		unsigned long long bytes;
+		unsigned long long uncompressedBytes;
+		std::vector<ReadyCallback> waiters;
+		std::map<std::string, Entry*>::iterator position;
+
+		// Streaming, levels residentLevel to the last one are on the GPU
+		std::shared_ptr<DecodedPart> source;	// every level, held while the texture streams
+		std::shared_ptr<StagedLevel> staged;	// the next finer level, while a worker stages it
+		unsigned int residentLevel;
+		unsigned int tailLevel;				// first level uploaded on load, never evicted
+		unsigned int wantedLevel;			// finest level requested in lastRequestFrame
+		unsigned int lastRequestFrame;
+	};
+
+	// Existing entry for key with one more reference, or NULL after counting a miss
+	Entry* findEntry(const std::string& key);
+	Entry* createEntry(const std::string& key, GLenum target, const TextureOptions& options,
+		const std::vector<std::string>& paths);
+
+	// Decode and upload every part that is still missing on the calling thread
+	void loadNow(Entry* entry);
+
+	// Queue one loader job per part
+	void loadAsync(Entry* entry, AssetLoader& loader);
+
+	// Read, decode and if needed compress one part, safe on worker threads
+	static bool decodePart(const std::string& path, GLenum target, const TextureOptions& options, const Timer& clock,
+		DecodedPart& decoded);
+
+	// Decode every layer of an array as a 2D texture, bring them to one size and format and lay each level
+	// out with its layers back to back, as glTexImage3D reads them. An array is a single part
+	static bool decodeArray(const std::vector<std::string>& paths, const TextureOptions& options, const Timer& clock,
+		DecodedPart& decoded);
+
+	// Replace a decoded layer by a copy width x height in format, from its .cgtex for the array or else
+	// resampled from the source image and written to that file
+	static bool conformLayer(const std::string& path, const TextureOptions& options, unsigned int width,
+		unsigned int height, BcFormat format, DecodedPart& layer);
+
+	// Copy what uploadPart will upload into the upload ring, on the worker that decoded it
+	static void stagePart(const TextureOptions& options, DecodedPart& decoded);
+
+	// Upload one decoded part into the entry's texture, part is the cube face
+	void uploadPart(Entry* entry, unsigned int part, const std::shared_ptr<DecodedPart>& decoded);
+	void destroyEntry(Entry* entry);
+
+	// Start copying the next finer level of a streamed texture into the upload ring on a worker, false
+	// when the ring has no room and the level should be uploaded straight away
+	bool stageLevel(Entry* entry);
+
+	// Upload the next finer level of a streamed texture, or drop its finest resident one
+	void streamInLevel(Entry* entry);
+	void evictLevel(Entry* entry);
+
+	// Evict least recently requested levels until bytes more fit in the budget. Textures requested this
+	// frame are only touched when allowCurrent is set
+	bool makeRoom(unsigned long long bytes, bool allowCurrent);
+
+private:
+	std::map<std::string, Entry*> m_entries;
+	std::map<unsigned int, Entry*> m_textures;
+	TextureCacheStats m_stats;
+
+	// Shared time base for decodes on any thread
+	Timer m_clock;
+	double m_firstDecodeMs;
+	double m_lastDecodeMs;
+
+	// Frames seen by updateStreaming, for the least recently used order
+	unsigned int m_frame;
+};
@@ -0,0 +1,259 @@
+#include "textureFile.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+namespace
+{
+	const char TEXTURE_FILE_MAGIC[4] = { 'C', 'G', 'T', 'X' };
+
+	// Bump whenever the layout below or the encoder that produced it changes
+	const uint32_t TEXTURE_FILE_VERSION = 2;
+
+	// File layout: header, then every level largest first, each 16 byte aligned
+	struct TextureFileHeader
+	{
+		char magic[4];
+		uint32_t version;
+		uint64_t sourceSize;
+		uint64_t sourceHash;
+		uint32_t compression;
+		uint32_t mipFilter;
+		uint32_t srgb;
+		uint32_t format;
+		uint32_t width;
+		uint32_t height;
+		uint32_t sourceComponents;
+		float psnr;
+		uint32_t levelCount;
+		uint32_t levelWidth[MAX_TEXTURE_LEVELS];
+		uint32_t levelHeight[MAX_TEXTURE_LEVELS];
+		uint64_t levelOffset[MAX_TEXTURE_LEVELS];
+		uint32_t levelSize[MAX_TEXTURE_LEVELS];
+	};
+
+	inline uint64_t alignUp(uint64_t value)
+	{
+		return (value + 15) & ~(uint64_t)15;
+	}
+
+	size_t getLevelSize(BcFormat format, int width, int height)
+	{
+		return format == BC_NONE ? (size_t)width * height * 4 : bc::getImageSize(format, width, height);
+	}
+
+	int psnrChannels(BcFormat format, int sourceComponents)
+	{
+		switch (format) {
+		case BC4: return 1;
+		case BC5: return 2;
+		case BC1: return 3;
+		case BC3: return 4;
+		default: return (sourceComponents == 2 || sourceComponents == 4) ? 4 : 3;
+		}
+	}
+}
+
+namespace textureFile
+{
+	std::string getCachePath(const char* sourcePath, bool flipped)
+	{
+		std::string path(sourcePath);
+		size_t dot = path.find_last_of('.');
+		size_t slash = path.find_last_of("/\\");
+		if (dot != std::string::npos && (slash == std::string::npos || dot > slash)) {
+			path.erase(dot);
+		}
+		return path + (flipped ? ".flipped.cgtex" : ".cgtex");
+	}
+
+	std::string getLayerCachePath(const char* sourcePath, bool flipped, unsigned int width, unsigned int height)
+	{
+		std::string path = getCachePath(sourcePath, flipped);
+		char size[32];
+		snprintf(size, sizeof(size), ".%ux%u", width, height);
+		return path.insert(path.size() - strlen(".cgtex"), size);
+	}
+
+	BcFormat chooseFormat(const Image& image, TextureCompression compression, bool allowBc7)
+	{
+		if (compression == TEXTURE_UNCOMPRESSED || !image.pixels) {
+			return BC_NONE;
+		}
+		if (compression == TEXTURE_COMPRESS_NORMAL) {
+			return BC5;
+		}
+		if (image.components == 1) {
+			return BC4;
+		}
+		if (allowBc7) {
+			return BC7;
+		}
+
+		bool hasAlpha = false;
+		if (image.components == 2 || image.components == 4) {
+			const size_t pixelCount = (size_t)image.width * image.height;
+			for (size_t i = 0; i < pixelCount && !hasAlpha; i++) {
+				hasAlpha = image.pixels[i * image.components + image.components - 1] != 255;
+			}
+		}
+		return hasAlpha ? BC3 : BC1;
+	}
+
+	void build(const Image& image, BcFormat format, const TextureBuildSettings& settings,
+		std::vector<unsigned char>& storage, CachedTexture& texture)
+	{
+		texture = CachedTexture();
+		texture.format = format;
+		texture.width = image.width;
+		texture.height = image.height;
+		texture.sourceComponents = image.components;
+		texture.psnr = 100.0f;
+
+		std::vector<unsigned char> rgba;
+		image::toRgba(image, rgba);
+		MipLevels chain;
+		mipChain::build(rgba.data(), image.width, image.height, settings.mipFilter, settings.srgb, chain);
+		texture.levelCount = std::min(chain.getLevelCount(), MAX_TEXTURE_LEVELS);
+
+		// Lay the levels out first so storage is only allocated once
+		size_t offsets[MAX_TEXTURE_LEVELS];
+		size_t total = 0;
+		for (unsigned int i = 0; i < texture.levelCount; i++) {
+			TextureLevel& level = texture.levels[i];
+			level.width = chain.widths[i];
+			level.height = chain.heights[i];
+			level.size = (unsigned int)getLevelSize(format, level.width, level.height);
+			offsets[i] = total;
+			total += alignUp(level.size);
+		}
+		storage.assign(total, 0);
+
+		for (unsigned int i = 0; i < texture.levelCount; i++) {
+			TextureLevel& level = texture.levels[i];
+			level.data = &storage[offsets[i]];
+			const unsigned char* pixels = &chain.pixels[chain.offsets[i]];
+			if (format == BC_NONE) {
+				memcpy(&storage[offsets[i]], pixels, level.size);
+				continue;
+			}
+			bc::encode(format, pixels, level.width, level.height, &storage[offsets[i]]);
+
+			if (i == 0) {
+				std::vector<unsigned char> decoded(rgba.size());
+				bc::decode(format, level.data, level.width, level.height, decoded.data());
+				texture.psnr = (float)bc::computePsnr(pixels, decoded.data(), level.width, level.height,
+					psnrChannels(format, image.components));
+			}
+		}
+	}
+
+	bool open(const std::string& cachePath, unsigned long long sourceSize, unsigned long long sourceHash,
+		const TextureBuildSettings& settings, MappedFile& file, CachedTexture& texture)
+	{
+		if (!file.open(cachePath.c_str())) {
+			return false;
+		}
+
+		if (file.size() < sizeof(TextureFileHeader)) {
+			file.close();
+			return false;
+		}
+
+		TextureFileHeader header;
+		memcpy(&header, file.data(), sizeof(header));
+
+		bool valid = memcmp(header.magic, TEXTURE_FILE_MAGIC, sizeof(header.magic)) == 0
+			&& header.version == TEXTURE_FILE_VERSION
+			&& header.sourceSize == sourceSize
+			&& header.sourceHash == sourceHash
+			&& header.compression == (uint32_t)settings.compression
+			&& header.mipFilter == (uint32_t)settings.mipFilter
+			&& header.srgb == (settings.srgb ? 1u : 0u)
+			&& header.format < BC_FORMAT_COUNT
+			&& header.levelCount >= 1 && header.levelCount <= MAX_TEXTURE_LEVELS
+			&& header.levelWidth[0] == header.width && header.levelHeight[0] == header.height;
+		for (uint32_t i = 0; valid && i < header.levelCount; i++) {
+			valid = header.levelOffset[i] >= sizeof(header)
+				&& header.levelSize[i] == getLevelSize((BcFormat)header.format, header.levelWidth[i], header.levelHeight[i])
+				&& header.levelOffset[i] + header.levelSize[i] <= file.size();
+		}
+		if (!valid) {
+			file.close();
+			return false;
+		}
+
+		texture.format = (BcFormat)header.format;
+		texture.width = header.width;
+		texture.height = header.height;
+		texture.sourceComponents = header.sourceComponents;
+		texture.psnr = header.psnr;
+		texture.levelCount = header.levelCount;
+		for (uint32_t i = 0; i < header.levelCount; i++) {
+			texture.levels[i].width = header.levelWidth[i];
+			texture.levels[i].height = header.levelHeight[i];
+			texture.levels[i].data = file.data() + header.levelOffset[i];
+			texture.levels[i].size = header.levelSize[i];
+		}
+		return true;
+	}
+
+	bool write(const std::string& cachePath, unsigned long long sourceSize, unsigned long long sourceHash,
+		const TextureBuildSettings& settings, const CachedTexture& texture)
+	{
+		TextureFileHeader header;
+		memset(&header, 0, sizeof(header));
+		memcpy(header.magic, TEXTURE_FILE_MAGIC, sizeof(header.magic));
+		header.version = TEXTURE_FILE_VERSION;
+		header.sourceSize = sourceSize;
+		header.sourceHash = sourceHash;
+		header.compression = settings.compression;
+		header.mipFilter = settings.mipFilter;
+		header.srgb = settings.srgb ? 1 : 0;
+		header.format = texture.format;
+		header.width = texture.width;
+		header.height = texture.height;
+		header.sourceComponents = texture.sourceComponents;
+		header.psnr = texture.psnr;
+		header.levelCount = texture.levelCount;
+		uint64_t offset = alignUp(sizeof(header));
+		for (unsigned int i = 0; i < texture.levelCount; i++) {
+			header.levelWidth[i] = texture.levels[i].width;
+			header.levelHeight[i] = texture.levels[i].height;
+			header.levelOffset[i] = offset;
+			header.levelSize[i] = texture.levels[i].size;
+			offset = alignUp(offset + texture.levels[i].size);
+		}
+
+		// Write to a temporary file first so a crash never leaves a truncated cache behind
+		std::string tempPath = cachePath + ".tmp";
+		FILE* file = fopen(tempPath.c_str(), "wb");
+		if (!file) {
+			return false;
+		}
+
+		static const unsigned char padding[16] = { 0 };
+		uint64_t written = sizeof(header);
+		bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+		for (unsigned int i = 0; ok && i < texture.levelCount; i++) {
+			ok = fwrite(padding, 1, header.levelOffset[i] - written, file) == header.levelOffset[i] - written
+				&& fwrite(texture.levels[i].data, texture.levels[i].size, 1, file) == 1;
+			written = header.levelOffset[i] + texture.levels[i].size;
+		}
+		ok = (fclose(file) == 0) && ok;
+
+		if (!ok) {
+			remove(tempPath.c_str());
+			return false;
+		}
+
+		remove(cachePath.c_str());
+		if (rename(tempPath.c_str(), cachePath.c_str()) != 0) {
+			remove(tempPath.c_str());
+			return false;
+		}
+		return true;
+	}
+}
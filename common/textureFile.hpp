@@ -0,0 +1,72 @@
+#pragma once
+#include <string>
+#include <vector>
+
+#include "bcEncoder.hpp"
+#include "image.hpp"
+#include "mappedFile.hpp"
+#include "mipChain.hpp"
+
+const unsigned int MAX_TEXTURE_LEVELS = 16;
+
+// How a texture may be compressed, normal maps keep only x and y so both get a full BC4 block
+enum TextureCompression
+{
+	TEXTURE_UNCOMPRESSED = 0,
+	TEXTURE_COMPRESS_COLOR,
+	TEXTURE_COMPRESS_NORMAL
+};
+
+// How the levels in a cache file were made, a file built with other settings is rebuilt
+struct TextureBuildSettings
+{
+	TextureCompression compression;
+	MipFilter mipFilter;
+	bool srgb;				// colour channels are sRGB encoded, so the mips are filtered in linear light
+};
+
+struct TextureLevel
+{
+	unsigned int width;
+	unsigned int height;
+	const unsigned char* data;
+	unsigned int size;
+};
+
+// Texture with its whole mip chain, either freshly built or pointing into a mapped .cgtex. BC_NONE
+// levels are plain RGBA8
+struct CachedTexture
+{
+	BcFormat format;
+	unsigned int width;
+	unsigned int height;
+	unsigned int sourceComponents;	// of the decoded image, what an uncompressed upload would have used
+	float psnr;						// top level against the source image, in dB
+	unsigned int levelCount;
+	TextureLevel levels[MAX_TEXTURE_LEVELS];	// largest first, down to 1x1
+};
+
+// Compressed copy of a texture stored next to the source image, e.g. rock.jpg -> rock.cgtex
+namespace textureFile
+{
+	std::string getCachePath(const char* sourcePath, bool flipped);
+
+	// Copy resampled to fit a texture array, e.g. snow.jpg -> snow.512x512.cgtex
+	std::string getLayerCachePath(const char* sourcePath, bool flipped, unsigned int width, unsigned int height);
+
+	// BC4 for one channel and BC5 for normal maps, otherwise BC7 when allowed, else BC1, or BC3 when
+	// the image uses its alpha channel. BC_NONE when the image should stay uncompressed
+	BcFormat chooseFormat(const Image& image, TextureCompression compression, bool allowBc7);
+
+	// Filter the image down to 1x1 and encode every level into storage, which texture points into
+	void build(const Image& image, BcFormat format, const TextureBuildSettings& settings,
+		std::vector<unsigned char>& storage, CachedTexture& texture);
+
+	// Map a cache file and point texture at its levels, fails if it is missing, corrupt, from another
+	// format version, built from a different source file or with different settings
+	bool open(const std::string& cachePath, unsigned long long sourceSize, unsigned long long sourceHash,
+		const TextureBuildSettings& settings, MappedFile& file, CachedTexture& texture);
+
+	bool write(const std::string& cachePath, unsigned long long sourceSize, unsigned long long sourceHash,
+		const TextureBuildSettings& settings, const CachedTexture& texture);
+}
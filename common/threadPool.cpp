@@ -0,0 +1,106 @@
+#include "threadPool.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+
+ThreadPool::ThreadPool(unsigned int numThreads)
+	: m_stopping(false)
+{
+	numThreads = std::max(numThreads, 1u);
+	for (unsigned int i = 0; i < numThreads; i++) {
+		m_workers.push_back(std::thread(&ThreadPool::workerLoop, this));
+	}
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_stopping = true;
+	}
+	m_condition.notify_all();
+
+	for (unsigned int i = 0; i < m_workers.size(); i++) {
+		m_workers[i].join();
+	}
+}
+
+ThreadPool& ThreadPool::instance()
+{
+	// Leave one core for the render thread
+	static ThreadPool pool(std::max(std::thread::hardware_concurrency(), 2u) - 1);
+	return pool;
+}
+
+void ThreadPool::enqueue(std::function<void()> job)
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_jobs.push_back(std::move(job));
+	}
+	m_condition.notify_one();
+}
+
+void ThreadPool::parallelFor(unsigned int count, const std::function<void(unsigned int)>& body)
+{
+	if (count == 0) {
+		return;
+	}
+	if (count == 1) {
+		body(0);
+		return;
+	}
+
+	struct Batch
+	{
+		std::atomic<unsigned int> next;
+		std::atomic<unsigned int> done;
+		std::mutex mutex;
+		std::condition_variable finished;
+	};
+	std::shared_ptr<Batch> batch = std::make_shared<Batch>();
+	batch->next = 0;
+	batch->done = 0;
+
+	// Workers that start after every item has been claimed return without touching body
+	const std::function<void(unsigned int)>* bodyPtr = &body;
+	std::function<void()> run = [batch, count, bodyPtr]() {
+		unsigned int i;
+		while ((i = batch->next++) < count) {
+			(*bodyPtr)(i);
+			if (++batch->done == count) {
+				std::lock_guard<std::mutex> lock(batch->mutex);
+				batch->finished.notify_all();
+			}
+		}
+	};
+
+	unsigned int helpers = std::min(count - 1, getThreadCount());
+	for (unsigned int i = 0; i < helpers; i++) {
+		enqueue(run);
+	}
+
+	// The calling thread takes items as well, so nested calls from a worker cannot deadlock
+	run();
+
+	std::unique_lock<std::mutex> lock(batch->mutex);
+	batch->finished.wait(lock, [&batch, count]() { return batch->done == count; });
+}
+
+void ThreadPool::workerLoop()
+{
+	while (true) {
+		std::function<void()> job;
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_condition.wait(lock, [this]() { return m_stopping || !m_jobs.empty(); });
+			if (m_stopping && m_jobs.empty()) {
+				return;
+			}
+			job = std::move(m_jobs.front());
+			m_jobs.pop_front();
+		}
+		job();
+	}
+}
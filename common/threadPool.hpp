@@ -0,0 +1,39 @@
+#pragma once
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads shared by the loaders
+class ThreadPool
+{
+public:
+	explicit ThreadPool(unsigned int numThreads);
+	~ThreadPool();
+
+	// Process wide pool sized to the machine, created on first use
+	static ThreadPool& instance();
+
+	// Run a job on a worker thread
+	void enqueue(std::function<void()> job);
+
+	// Run body(0) ... body(count - 1) across the workers and the calling thread, returns once all are done
+	void parallelFor(unsigned int count, const std::function<void(unsigned int)>& body);
+
+	unsigned int getThreadCount() const { return (unsigned int)m_workers.size(); }
+
+private:
+	ThreadPool(const ThreadPool&);
+	ThreadPool& operator=(const ThreadPool&);
+
+	void workerLoop();
+
+private:
+	std::vector<std::thread> m_workers;
+	std::deque<std::function<void()> > m_jobs;
+	std::mutex m_mutex;
+	std::condition_variable m_condition;
+	bool m_stopping;
+};
@@ -0,0 +1,30 @@
+#pragma once
+#include <chrono>
+
+// Wall clock stopwatch used for the load time and throughput reports
+class Timer
+{
+public:
+	Timer()
+		: m_start(std::chrono::high_resolution_clock::now())
+	{
+	}
+
+	void reset()
+	{
+		m_start = std::chrono::high_resolution_clock::now();
+	}
+
+	double elapsedSeconds() const
+	{
+		return std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - m_start).count();
+	}
+
+	double elapsedMs() const
+	{
+		return elapsedSeconds() * 1000.0;
+	}
+
+private:
+	std::chrono::high_resolution_clock::time_point m_start;
+};
@@ -0,0 +1,250 @@
+#include "uploadRing.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+namespace
+{
+	// Slice starts, enough for any pixel or vertex data the GL calls read
+	const size_t SLICE_ALIGNMENT = 256;
+
+	// How long shutdown waits for the GPU before deleting the buffer anyway
+	const GLuint64 SHUTDOWN_TIMEOUT_NS = 1000000000ull;
+
+	inline size_t alignUp(size_t value)
+	{
+		return (value + SLICE_ALIGNMENT - 1) & ~(SLICE_ALIGNMENT - 1);
+	}
+}
+
+UploadRing::UploadRing()
+	: m_buffer(0)
+	, m_data(NULL)
+	, m_capacity(0)
+	, m_head(0)
+	, m_used(0)
+	, m_nextId(1)
+	, m_nextSerial(1)
+	, m_passedSerial(0)
+	, m_unfenced(false)
+	, m_enabled(true)
+{
+	memset(&m_stats, 0, sizeof(m_stats));
+}
+
+UploadRing::~UploadRing()
+{
+}
+
+UploadRing& UploadRing::instance()
+{
+	static UploadRing ring;
+	return ring;
+}
+
+bool UploadRing::init(size_t bytes)
+{
+	if (m_data || !GLEW_ARB_buffer_storage) {
+		return m_data != NULL;
+	}
+
+	// Coherent, so worker writes need no flush before the GL call that reads them
+	const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+	glGenBuffers(1, &m_buffer);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, m_buffer);
+	glBufferStorage(GL_PIXEL_UNPACK_BUFFER, bytes, NULL, flags);
+	m_data = (unsigned char*)glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, bytes, flags);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	if (!m_data) {
+		glDeleteBuffers(1, &m_buffer);
+		m_buffer = 0;
+		return false;
+	}
+
+	m_capacity = bytes;
+	m_stats.capacity = bytes;
+	return true;
+}
+
+void UploadRing::shutdown()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	for (size_t i = 0; i < m_fences.size(); i++) {
+		glClientWaitSync(m_fences[i].sync, GL_SYNC_FLUSH_COMMANDS_BIT, SHUTDOWN_TIMEOUT_NS);
+		glDeleteSync(m_fences[i].sync);
+	}
+	m_fences.clear();
+	m_records.clear();
+
+	if (m_buffer) {
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, m_buffer);
+		glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		glDeleteBuffers(1, &m_buffer);
+	}
+	m_buffer = 0;
+	m_data = NULL;
+	m_capacity = 0;
+	m_head = 0;
+	m_used = 0;
+}
+
+bool UploadRing::allocate(size_t size, UploadSlice& slice)
+{
+	slice = UploadSlice();
+	std::lock_guard<std::mutex> lock(m_mutex);
+	const size_t aligned = alignUp(std::max(size, (size_t)1));
+	if (!m_data || !m_enabled.load() || aligned > m_capacity) {
+		m_stats.fallbacks++;
+		return false;
+	}
+
+	// A slice never wraps, the end of the ring is skipped instead and counted with the slice
+	size_t start = m_head;
+	size_t skipped = 0;
+	if (start + aligned > m_capacity) {
+		skipped = m_capacity - start;
+		start = 0;
+	}
+	if (m_used + skipped + aligned > m_capacity) {
+		m_stats.fallbacks++;
+		return false;
+	}
+
+	Record record;
+	record.id = m_nextId++;
+	record.span = skipped + aligned;
+	record.state = SLICE_RESERVED;
+	record.serial = 0;
+	m_records.push_back(record);
+	m_head = start + aligned;
+	m_used += record.span;
+
+	slice.id = record.id;
+	slice.offset = start;
+	slice.size = size;
+	slice.data = m_data + start;
+
+	m_stats.bytesInUse = m_used;
+	m_stats.peakBytesInUse = std::max(m_stats.peakBytesInUse, m_used);
+	m_stats.bytesStaged += size;
+	m_stats.slicesStaged++;
+	return true;
+}
+
+bool UploadRing::stage(const void* data, size_t size, UploadSlice& slice)
+{
+	if (!data || size == 0 || !allocate(size, slice)) {
+		return false;
+	}
+	memcpy(slice.data, data, size);
+	return true;
+}
+
+void UploadRing::bufferData(GLenum target, const void* data, size_t size, UploadSlice& slice)
+{
+	if (!slice.data) {
+		glBufferData(target, size, data, GL_STATIC_DRAW);
+		return;
+	}
+
+	// A copy between buffers stays on the GPU, glBufferSubData can only read client memory
+	glBufferData(target, size, NULL, GL_STATIC_DRAW);
+	glBindBuffer(GL_COPY_READ_BUFFER, m_buffer);
+	glCopyBufferSubData(GL_COPY_READ_BUFFER, target, slice.offset, 0, size);
+	glBindBuffer(GL_COPY_READ_BUFFER, 0);
+	submit(slice);
+}
+
+void UploadRing::bindUnpack() const
+{
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, m_buffer);
+}
+
+void UploadRing::unbindUnpack() const
+{
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+}
+
+void UploadRing::submit(UploadSlice& slice)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	Record* record = findRecord(slice.id);
+	if (record) {
+		record->state = SLICE_SUBMITTED;
+		record->serial = m_nextSerial;
+		m_unfenced = true;
+	}
+	slice = UploadSlice();
+}
+
+void UploadRing::cancel(UploadSlice& slice)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	Record* record = findRecord(slice.id);
+	if (record) {
+		record->state = SLICE_CANCELLED;
+	}
+	slice = UploadSlice();
+}
+
+void UploadRing::endFrame()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	if (m_unfenced) {
+		Fence fence;
+		fence.serial = m_nextSerial++;
+		fence.sync = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		m_fences.push_back(fence);
+		m_unfenced = false;
+	}
+
+	// Never waits, a fence that has not passed is looked at again next frame
+	while (!m_fences.empty()) {
+		GLenum result = glClientWaitSync(m_fences.front().sync, 0, 0);
+		if (result != GL_ALREADY_SIGNALED && result != GL_CONDITION_SATISFIED) {
+			break;
+		}
+		m_passedSerial = m_fences.front().serial;
+		glDeleteSync(m_fences.front().sync);
+		m_fences.pop_front();
+	}
+	reclaim();
+}
+
+UploadRingStats UploadRing::getStats() const
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_stats;
+}
+
+UploadRing::Record* UploadRing::findRecord(unsigned int id)
+{
+	// Recent slices are at the back
+	for (std::deque<Record>::reverse_iterator it = m_records.rbegin(); it != m_records.rend(); ++it) {
+		if (it->id == id) {
+			return &*it;
+		}
+	}
+	return NULL;
+}
+
+void UploadRing::reclaim()
+{
+	while (!m_records.empty()) {
+		const Record& record = m_records.front();
+		if (record.state == SLICE_RESERVED || (record.state == SLICE_SUBMITTED && record.serial > m_passedSerial)) {
+			break;
+		}
+		m_used -= record.span;
+		m_records.pop_front();
+	}
+
+	// Starting over at the front keeps large slices from being skipped past the end
+	if (m_records.empty()) {
+		m_head = 0;
+		m_used = 0;
+	}
+	m_stats.bytesInUse = m_used;
+}
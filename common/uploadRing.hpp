@@ -0,0 +1,142 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+
+#include <GL/glew.h>
+
+// Space reserved in the upload ring, data is NULL when nothing is reserved
+struct UploadSlice
+{
+	unsigned int id;
+	size_t offset;				// into the ring buffer, the source offset the GL calls take
+	size_t size;
+	unsigned char* data;		// mapped memory, any thread may write it until the slice is submitted
+
+	UploadSlice()
+		: id(0)
+		, offset(0)
+		, size(0)
+		, data(NULL)
+	{
+	}
+};
+
+struct UploadRingStats
+{
+	size_t capacity;
+	size_t bytesInUse;
+	size_t peakBytesInUse;
+	unsigned long long bytesStaged;
+	unsigned int slicesStaged;
+	unsigned int fallbacks;		// reservations refused because the ring was full or turned off
+};
+
+// Persistently mapped buffer used as a ring of staging memory. Workers copy decoded data straight into
+// it and the render thread points glTexImage2D and glCopyBufferSubData at the ring, so the driver reads
+// from GPU visible memory instead of copying client memory while the frame waits. One fence per frame
+// tells when the GPU has finished with a slice and its space can be reused
+class UploadRing
+{
+public:
+	static UploadRing& instance();
+
+	// Create the buffer on the render thread. Needs ARB_buffer_storage, without it every reservation
+	// fails and uploads go straight from client memory as before
+	bool init(size_t bytes);
+
+	// Wait for the GPU to finish with the ring and delete it
+	void shutdown();
+
+	bool isAvailable() const { return m_data != NULL; }
+
+	// Turned off, reservations fail so uploads can be timed without the ring. Slices already
+	// reserved still upload from it
+	void setEnabled(bool enabled) { m_enabled = enabled; }
+	bool isEnabled() const { return m_enabled.load(); }
+
+	// Any thread: reserve size bytes. Fails rather than waits when the ring is full, a worker must never
+	// wait on the render thread, so the caller keeps its data and uploads from client memory
+	bool allocate(size_t size, UploadSlice& slice);
+
+	// Any thread: reserve and copy in one go
+	bool stage(const void* data, size_t size, UploadSlice& slice);
+
+	// Render thread: allocate storage for the bound buffer and fill it from the slice when it was
+	// staged, else from data. The slice is submitted either way
+	void bufferData(GLenum target, const void* data, size_t size, UploadSlice& slice);
+
+	// Render thread: while the ring is bound for unpacking, glTexImage2D takes offsets into it
+	void bindUnpack() const;
+	void unbindUnpack() const;
+	static const void* getUnpackOffset(const UploadSlice& slice, size_t offset)
+	{
+		return (const unsigned char*)NULL + slice.offset + offset;
+	}
+
+	// Render thread: the GL calls reading the slice have been issued, its space comes back once the
+	// next fence has passed. Clears the slice
+	void submit(UploadSlice& slice);
+
+	// Any thread: give back a slice that will not be uploaded. Clears the slice
+	void cancel(UploadSlice& slice);
+
+	// Render thread, once per frame: fence the slices submitted since the last call and reclaim the
+	// space of those the GPU has finished reading
+	void endFrame();
+
+	UploadRingStats getStats() const;
+
+private:
+	UploadRing();
+	~UploadRing();
+	UploadRing(const UploadRing&);
+	UploadRing& operator=(const UploadRing&);
+
+	enum SliceState
+	{
+		SLICE_RESERVED,
+		SLICE_SUBMITTED,
+		SLICE_CANCELLED
+	};
+
+	// Every reservation in ring order, span includes the bytes skipped to wrap around
+	struct Record
+	{
+		unsigned int id;
+		size_t span;
+		SliceState state;
+		unsigned int serial;		// fence that covers a submitted slice
+	};
+
+	struct Fence
+	{
+		unsigned int serial;
+		GLsync sync;
+	};
+
+	Record* findRecord(unsigned int id);
+
+	// Pop the leading records that are cancelled or behind a passed fence, called with the lock held
+	void reclaim();
+
+private:
+	mutable std::mutex m_mutex;
+	std::deque<Record> m_records;
+	std::deque<Fence> m_fences;
+
+	GLuint m_buffer;
+	unsigned char* m_data;
+	size_t m_capacity;
+	size_t m_head;					// where the next reservation starts
+	size_t m_used;					// from the oldest record to m_head
+
+	unsigned int m_nextId;
+	unsigned int m_nextSerial;		// the fence endFrame creates next
+	unsigned int m_passedSerial;	// newest fence the GPU has passed
+	bool m_unfenced;				// slices submitted since the last fence
+
+	std::atomic<bool> m_enabled;
+	UploadRingStats m_stats;
+};
@@ -0,0 +1,148 @@
+#include "vertexFormat.hpp"
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+namespace
+{
+	inline float signNotZero(float value)
+	{
+		return value >= 0.0f ? 1.0f : -1.0f;
+	}
+
+	inline float unpackSnorm8(signed char value)
+	{
+		return glm::max(value / 127.0f, -1.0f);
+	}
+
+	// Same decode as octDecode in the vertex shaders
+	glm::vec3 octDecode(float x, float y)
+	{
+		glm::vec3 n(x, y, 1.0f - fabsf(x) - fabsf(y));
+		float t = glm::max(-n.z, 0.0f);
+		n.x += n.x >= 0.0f ? -t : t;
+		n.y += n.y >= 0.0f ? -t : t;
+		return glm::normalize(n);
+	}
+}
+
+namespace vertexFormat
+{
+	glm::vec3 getPositionOffset(const glm::vec3& boundsMin, const glm::vec3& boundsMax)
+	{
+		return (boundsMin + boundsMax) * 0.5f;
+	}
+
+	glm::vec3 getPositionScale(const glm::vec3& boundsMin, const glm::vec3& boundsMax)
+	{
+		glm::vec3 scale = (boundsMax - boundsMin) * 0.5f;
+		for (int i = 0; i < 3; i++) {
+			if (!(scale[i] > 0.0f)) {
+				scale[i] = 1.0f;
+			}
+		}
+		return scale;
+	}
+
+	void packPosition(const glm::vec3& position, const glm::vec3& offset, const glm::vec3& scale, short out[3])
+	{
+		glm::vec3 normalized = glm::clamp((position - offset) / scale, -1.0f, 1.0f);
+		for (int i = 0; i < 3; i++) {
+			out[i] = (short)lrintf(normalized[i] * 32767.0f);
+		}
+	}
+
+	void packOctahedral(const glm::vec3& direction, signed char out[2])
+	{
+		// Missing normals decode as +z
+		float length = fabsf(direction.x) + fabsf(direction.y) + fabsf(direction.z);
+		if (!(length > 0.0f)) {
+			out[0] = 0;
+			out[1] = 0;
+			return;
+		}
+
+		// Project onto the octahedron, then fold the lower half over the upper one
+		glm::vec3 n = direction / length;
+		glm::vec2 e(n.x, n.y);
+		if (n.z < 0.0f) {
+			e.x = (1.0f - fabsf(n.y)) * signNotZero(n.x);
+			e.y = (1.0f - fabsf(n.x)) * signNotZero(n.y);
+		}
+
+		float bestDot = -2.0f;
+		for (int i = 0; i < 4; i++) {
+			float x = (i & 1) ? ceilf(e.x * 127.0f) : floorf(e.x * 127.0f);
+			float y = (i & 2) ? ceilf(e.y * 127.0f) : floorf(e.y * 127.0f);
+			x = glm::clamp(x, -127.0f, 127.0f);
+			y = glm::clamp(y, -127.0f, 127.0f);
+			float d = glm::dot(octDecode(x / 127.0f, y / 127.0f), n);
+			if (d > bestDot) {
+				bestDot = d;
+				out[0] = (signed char)x;
+				out[1] = (signed char)y;
+			}
+		}
+	}
+
+	glm::vec3 unpackOctahedral(const signed char packed[2])
+	{
+		return octDecode(unpackSnorm8(packed[0]), unpackSnorm8(packed[1]));
+	}
+
+	unsigned short packHalf(float value)
+	{
+		uint32_t bits;
+		memcpy(&bits, &value, sizeof(bits));
+		uint32_t sign = (bits >> 16) & 0x8000;
+		uint32_t magnitude = bits & 0x7fffffff;
+
+		// Infinity and NaN
+		if (magnitude >= 0x7f800000) {
+			return (unsigned short)(sign | 0x7c00 | (magnitude > 0x7f800000 ? 0x200 : 0));
+		}
+
+		// Rounds to infinity, 65520 and above
+		if (magnitude >= 0x477ff000) {
+			return (unsigned short)(sign | 0x7c00);
+		}
+
+		// Below the smallest normal half, scale so the subnormal mantissa is the integer part
+		if (magnitude < 0x38800000) {
+			float absolute;
+			memcpy(&absolute, &magnitude, sizeof(absolute));
+			return (unsigned short)(sign | (uint32_t)lrintf(absolute * 16777216.0f));
+		}
+
+		// Rebias the exponent and round the mantissa to nearest even
+		uint32_t half = (magnitude - 0x38000000) >> 13;
+		uint32_t remainder = magnitude & 0x1fff;
+		if (remainder > 0x1000 || (remainder == 0x1000 && (half & 1))) {
+			half++;
+		}
+		return (unsigned short)(sign | half);
+	}
+
+	void packVertex(const glm::vec3& position, const glm::vec2& uv, const glm::vec3& normal,
+		const glm::vec3& offset, const glm::vec3& scale, PackedVertex& out)
+	{
+		packPosition(position, offset, scale, out.position);
+		packOctahedral(normal, out.normal);
+		out.uv[0] = packHalf(uv.x);
+		out.uv[1] = packHalf(uv.y);
+	}
+
+	void packTangentVertex(const glm::vec3& position, const glm::vec2& uv, const glm::vec3& normal,
+		const glm::vec3& tangent, const glm::vec3& bitangent,
+		const glm::vec3& offset, const glm::vec3& scale, PackedTangentVertex& out)
+	{
+		packPosition(position, offset, scale, out.position);
+		packOctahedral(normal, out.normal);
+		out.uv[0] = packHalf(uv.x);
+		out.uv[1] = packHalf(uv.y);
+		packOctahedral(tangent, out.tangent);
+		out.tangentSign = glm::dot(glm::cross(normal, tangent), bitangent) < 0.0f ? -127 : 127;
+		out.padding = 0;
+	}
+}
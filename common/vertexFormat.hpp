@@ -0,0 +1,52 @@
+#pragma once
+#include <glm/glm.hpp>
+
+// Quantised vertex layouts, decoded by the vertex shaders:
+// - positions are snorm16 relative to the mesh bounds, position = positionOffset + aPos * positionScale
+// - normals and tangents are snorm8 octahedral encodings
+// - uvs are half floats
+// The two octahedral normal bytes follow the three position shorts, so the normal attribute reads
+// the 4 byte slot starting at position z and uses .zw, which keeps every attribute 4 byte aligned
+
+// Model vertex, 12 bytes instead of 32
+struct PackedVertex
+{
+	short position[3];
+	signed char normal[2];
+	unsigned short uv[2];
+};
+
+// Normal mapped vertex, 16 bytes instead of the 56 byte Vertex,
+// the bitangent is rebuilt as cross(normal, tangent) * tangentSign
+struct PackedTangentVertex
+{
+	short position[3];
+	signed char normal[2];
+	unsigned short uv[2];
+	signed char tangent[2];
+	signed char tangentSign;
+	signed char padding;
+};
+
+namespace vertexFormat
+{
+	// Dequantisation uniforms for a mesh with the given bounds, flat axes get a scale of 1
+	glm::vec3 getPositionOffset(const glm::vec3& boundsMin, const glm::vec3& boundsMax);
+	glm::vec3 getPositionScale(const glm::vec3& boundsMin, const glm::vec3& boundsMax);
+
+	void packPosition(const glm::vec3& position, const glm::vec3& offset, const glm::vec3& scale, short out[3]);
+
+	// Picks the rounding of each component that gives the smallest angular error
+	void packOctahedral(const glm::vec3& direction, signed char out[2]);
+	glm::vec3 unpackOctahedral(const signed char packed[2]);
+
+	// IEEE 754 half float, rounded to nearest even
+	unsigned short packHalf(float value);
+
+	void packVertex(const glm::vec3& position, const glm::vec2& uv, const glm::vec3& normal,
+		const glm::vec3& offset, const glm::vec3& scale, PackedVertex& out);
+
+	void packTangentVertex(const glm::vec3& position, const glm::vec2& uv, const glm::vec3& normal,
+		const glm::vec3& tangent, const glm::vec3& bitangent,
+		const glm::vec3& offset, const glm::vec3& scale, PackedTangentVertex& out);
+}
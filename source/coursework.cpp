@@ -1,6 +1,7 @@
 #include <iostream>
 #include <cmath>
 #include <random>
+#include <algorithm>
 
 #include <common/common.hpp>
 #include <common/shader.hpp>
@@ -10,13 +11,38 @@
 #include <common/model.hpp>
 #include <common/light.hpp>
 #include <common/terrain.hpp>
+#include <common/heightmapFile.hpp>
+#include <common/heightmapGenerator.hpp>
 #include <common/skyBox.hpp>
 #include <common/sphere.hpp>
+#include <common/assetLoader.hpp>
+#include <common/textureCache.hpp>
+#include <common/textureArrayBuilder.hpp>
+#include <common/timer.hpp>
+#include <common/uploadRing.hpp>
+#include <common/frameTimeStats.hpp>
 
 const int windowWidth = 1024;
 const int windowHeight = 768;
 Camera g_Camera(windowWidth, windowHeight);
 
+// Time each frame may spend creating GL objects for assets that finished loading
+const double uploadBudgetMs = 4.0;
+
+// Time each frame may spend uploading finer texture levels, and the budget key's smallest step
+const double streamingBudgetMs = 2.0;
+const unsigned long long minTextureBudget = 4ull * 1024 * 1024;
+
+// Time each frame may spend uploading terrain height tiles that finished paging in
+const double terrainPagingBudgetMs = 1.0;
+
+// Side of a square generated heightmap to draw instead of the bundled one, 0 for the bundled one
+const unsigned int generatedTerrainSize = 0;
+const unsigned int generatedTerrainSeed = 1;
+
+// Staging memory workers copy decoded assets into for the render thread to upload from
+const size_t uploadRingBytes = 32 * 1024 * 1024;
+
 float g_deltaFrame = 0;
 float g_lastFrame = 0;
 
@@ -27,10 +53,29 @@ glm::mat4 g_rockTransform3;
 
 glm::mat4 g_manTransform;
 
+// Level of detail each model instance drew last frame
+unsigned int g_rockLods[4] = { 0, 0, 0, 0 };
+unsigned int g_manLod = 0;
+
+// Meshlet culling totals of the last frame
+ClusterCullStats g_clusterStats;
+
 glm::mat4 g_terrainTransform;
 
+// Terrain chunks selected and culled last frame
+TerrainStats g_terrainStats;
+HeightmapPagerStats g_terrainPaging = {};
+
 glm::mat4 g_phongSphereTransform;
 
+// Mid-session load test: another copy of the assets loads while the frame times are recorded
+bool g_loadTestRequested = false;
+bool g_loadTestRunning = false;
+FrameTimeStats g_loadTestFrames;
+Model* g_loadTestModel = NULL;
+Terrain* g_loadTestTerrain = NULL;
+std::vector<unsigned int> g_loadTestTextures;
+
 //  ɫ
 std::random_device rd;
 std::mt19937 gen(rd());
@@ -51,6 +96,8 @@ void mouseMove(GLFWwindow* window, double x, double y);
 void mouseClick(GLFWwindow* window, int button, int action, int mods);
 void keyClick(GLFWwindow* window, int key, int scancode, int action, int mods);
 void mouseScroll(GLFWwindow* window, double xOffset, double yOffset);
+void startLoadTest(AssetLoader& loader);
+void endLoadTest();
 
 void printHelp() {
 	std::cout << "\npress 'h' to print this message again.\n"
@@ -60,11 +107,30 @@ void printHelp() {
 		<< "press 'p' to pause or start point light moving.\n"
 		<< "press 'c' to change point light color to a random.\n"
 		<< "press 'm' to change the fly mode of the free camera.\n"
+		<< "press 'l' to cycle the forced model level of detail.\n"
+		<< "press 'i' to print how many meshlets were culled last frame.\n"
+		<< "press 'f' to check meshlet backface culling against concave and convex clusters.\n"
+		<< "press 'k' to print how many terrain chunks were drawn last frame and the height tiles in memory.\n"
+		<< "press 'b' to time serial and parallel decoding of the loaded textures.\n"
+		<< "press 'g' to time CPU mip generation against glGenerateMipmap.\n"
+		<< "press 'n' to time building, compressing and decoding tiled terrain heightmaps up to 8193x8193.\n"
+		<< "press 'j' to time batched terrain height and normal queries against getHeightAt.\n"
+		<< "press 'y' to time single and packet rays against the terrain's height pyramid.\n"
+		<< "click the terrain to print the point under the cursor.\n"
+		<< "press or hold 1/2/3/4 to raise, lower, smooth or flatten the terrain under the cursor.\n"
+		<< "press 'x' to time terrain brush edits.\n"
+		<< "press 'v' to time procedural heightmap generation and erosion per megasample.\n"
+		<< "press 't' to print the texture streaming counters.\n"
+		<< "press '[' or ']' to halve or double the texture memory budget.\n"
+		<< "press 'u' to load the assets again and report the frame time spikes while they load.\n"
+		<< "press 'o' to turn the upload ring off or on.\n"
 		<< "press ESC to quit.\n";
 }
 
 int main( void )
 {
+    Timer startupTimer;
+    
     // =========================================================================
     // Window creation - you shouldn't need to change this code
     // -------------------------------------------------------------------------
@@ -115,9 +181,21 @@ int main( void )
     glfwSetKeyCallback(window, keyClick);
     glfwSetScrollCallback(window, mouseScroll);
 
-    Model rock("../assets/models/rock/rock.obj");
-	rock.addTexture("../assets/models/rock/Rock-Texture-Surface.jpg", "diffuse");
-	rock.addTexture("../assets/textures/gray.jpg", "specular");
+    // Assets are decoded on worker threads and uploaded over the first frames, each is drawn once it is ready
+    if (UploadRing::instance().init(uploadRingBytes))
+        std::cout << "Upload ring: " << uploadRingBytes / (1024 * 1024) << " MB\n";
+    else
+        std::cout << "Upload ring unavailable without ARB_buffer_storage, uploads read client memory\n";
+    AssetLoader assetLoader;
+
+    // The rock and the cyborg keep their maps in texture arrays, so both draw with the same bindings.
+    // Specular maps are data rather than colour, so they get an array of their own with linear mips
+    TextureArrayBuilder modelMaps;
+    TextureArrayBuilder modelSpecularMaps;
+
+    Model rock("../assets/models/rock/rock.obj", assetLoader);
+	rock.addTexture("../assets/models/rock/Rock-Texture-Surface.jpg", "diffuse", modelMaps);
+	rock.addTexture("../assets/textures/gray.jpg", "specular", modelSpecularMaps);
     unsigned int modelShader = LoadShaders("vertexShader.glsl", "fragmentShader.glsl");
 	g_rockTransform0 = glm::translate(glm::mat4(), glm::vec3(0, 23, -5));
 	g_rockTransform1 = glm::translate(glm::mat4(), glm::vec3(0, 22, 5));
@@ -126,20 +204,27 @@ int main( void )
 
 	g_phongSphereTransform = glm::translate(glm::mat4(), glm::vec3(0, 25, 5));
 
-    Model man("../assets/models/cyborg/cyborg.obj");
-    man.addTexture("../assets/models/cyborg/cyborg_diffuse.png", "diffuse");
-    man.addTexture("../assets/models/cyborg/cyborg_specular.png", "specular");
+    Model man("../assets/models/cyborg/cyborg.obj", assetLoader);
+    man.addTexture("../assets/models/cyborg/cyborg_diffuse.png", "diffuse", modelMaps);
+    man.addTexture("../assets/models/cyborg/cyborg_specular.png", "specular", modelSpecularMaps);
+    modelMaps.build(getMapOptions("diffuse"), assetLoader);
+    modelSpecularMaps.build(getMapOptions("specular"), assetLoader);
     g_manTransform = glm::translate(glm::mat4(), glm::vec3(5, 22, 5));
 
-    Terrain terrain(30.0f, 2.0f);
+	HeightmapGeneratorSettings terrainSettings;
+	terrainSettings.width = generatedTerrainSize;
+	terrainSettings.height = generatedTerrainSize;
+	terrainSettings.seed = generatedTerrainSeed;
+	Terrain* terrainSource = generatedTerrainSize > 0 ? new Terrain(30.0f, 2.0f, terrainSettings, assetLoader)
+		: new Terrain(30.0f, 2.0f, assetLoader);
+	Terrain& terrain = *terrainSource;
     unsigned int terrainShader = LoadShaders("terrainVS.glsl", "terrainFS.glsl");
-	g_Camera.terrain = &terrain;
 
-	SkyBox skyBox;
+	SkyBox skyBox(assetLoader);
     unsigned int skyBoxShader = LoadShaders("skyBoxVS.glsl", "skyBoxFS.glsl");
 
 	Sphere sphere;
-	sphere.initTextures("../assets/textures/sphere_diffuse.png", "../assets/textures/sphere_specular.png", "../assets/textures/sphere_normal.png");
+	sphere.initTextures("../assets/textures/sphere_diffuse.png", "../assets/textures/sphere_specular.png", "../assets/textures/sphere_normal.png", assetLoader);
 	unsigned int phongShader = LoadShaders("phongVS.glsl", "phongFS.glsl");
 
     // Point Lights
@@ -154,6 +239,9 @@ int main( void )
 
 	printHelp();
 
+	bool firstFrameDrawn = false;
+	bool allAssetsLoaded = false;
+
     // Render loop
     while (!glfwWindowShouldClose(window))
     {
@@ -161,6 +249,27 @@ int main( void )
         g_deltaFrame = currentFrame - g_lastFrame;
 		g_lastFrame = currentFrame;
 		glfwPollEvents();
+		if (g_loadTestRunning)
+		{
+			g_loadTestFrames.addFrame(g_deltaFrame * 1000.0);
+		}
+
+		// Create the GL objects of assets that have finished decoding
+		if (g_loadTestRequested && !g_loadTestRunning)
+		{
+			startLoadTest(assetLoader);
+		}
+		g_loadTestRequested = false;
+		assetLoader.processUploads(uploadBudgetMs);
+		if (g_loadTestRunning && assetLoader.isFinished())
+		{
+			g_loadTestRunning = false;
+			g_loadTestFrames.print(UploadRing::instance().isEnabled() ? "Frames while loading, upload ring on" : "Frames while loading, upload ring off");
+		}
+		if (!g_Camera.terrain && terrain.isLoaded())
+		{
+			g_Camera.terrain = &terrain;
+		}
 
         // Get inputs
         keyboardInput(window);
@@ -204,18 +313,32 @@ int main( void )
 
 		glUniformMatrix4fv(glGetUniformLocation(modelShader, "view"), 1, GL_FALSE, (float*)glm::value_ptr(g_Camera.getViewTransform()));
 		glUniformMatrix4fv(glGetUniformLocation(modelShader, "projection"), 1, GL_FALSE, g_Camera.projTransform);
-        glUniformMatrix4fv(glGetUniformLocation(modelShader, "model"), 1, GL_FALSE, (float*)glm::value_ptr(g_rockTransform0));
-        rock.draw(modelShader);
-		glUniformMatrix4fv(glGetUniformLocation(modelShader, "model"), 1, GL_FALSE, (float*)glm::value_ptr(g_rockTransform1));
-        rock.draw(modelShader);
-		glUniformMatrix4fv(glGetUniformLocation(modelShader, "model"), 1, GL_FALSE, (float*)glm::value_ptr(g_rockTransform2));
-        rock.draw(modelShader);
-		glUniformMatrix4fv(glGetUniformLocation(modelShader, "model"), 1, GL_FALSE, (float*)glm::value_ptr(g_rockTransform3));
-        rock.draw(modelShader);
+		float projectionScale = g_Camera.getProjectionScale();
+		CullView cullView = meshlets::makeCullView(glm::make_mat4(g_Camera.projTransform) * g_Camera.getViewTransform(), g_Camera.position);
+		meshlets::resetStats(g_clusterStats);
+        if (rock.isLoaded())
+        {
+            glUniformMatrix4fv(glGetUniformLocation(modelShader, "model"), 1, GL_FALSE, (float*)glm::value_ptr(g_rockTransform0));
+            rock.drawCulled(modelShader, rock.selectLod(g_rockTransform0, g_Camera.position, projectionScale, g_rockLods[0]), g_rockTransform0, cullView, g_clusterStats);
+            glUniformMatrix4fv(glGetUniformLocation(modelShader, "model"), 1, GL_FALSE, (float*)glm::value_ptr(g_rockTransform1));
+            rock.drawCulled(modelShader, rock.selectLod(g_rockTransform1, g_Camera.position, projectionScale, g_rockLods[1]), g_rockTransform1, cullView, g_clusterStats);
+            glUniformMatrix4fv(glGetUniformLocation(modelShader, "model"), 1, GL_FALSE, (float*)glm::value_ptr(g_rockTransform2));
+            rock.drawCulled(modelShader, rock.selectLod(g_rockTransform2, g_Camera.position, projectionScale, g_rockLods[2]), g_rockTransform2, cullView, g_clusterStats);
+            glUniformMatrix4fv(glGetUniformLocation(modelShader, "model"), 1, GL_FALSE, (float*)glm::value_ptr(g_rockTransform3));
+            rock.drawCulled(modelShader, rock.selectLod(g_rockTransform3, g_Camera.position, projectionScale, g_rockLods[3]), g_rockTransform3, cullView, g_clusterStats);
+            rock.requestTextureDetail(g_rockTransform0, g_Camera.position, projectionScale);
+            rock.requestTextureDetail(g_rockTransform1, g_Camera.position, projectionScale);
+            rock.requestTextureDetail(g_rockTransform2, g_Camera.position, projectionScale);
+            rock.requestTextureDetail(g_rockTransform3, g_Camera.position, projectionScale);
+        }
 
         // Render man
-		glUniformMatrix4fv(glGetUniformLocation(modelShader, "model"), 1, GL_FALSE, (float*)glm::value_ptr(g_manTransform));
-        man.draw(modelShader);
+        if (man.isLoaded())
+        {
+            glUniformMatrix4fv(glGetUniformLocation(modelShader, "model"), 1, GL_FALSE, (float*)glm::value_ptr(g_manTransform));
+            man.drawCulled(modelShader, man.selectLod(g_manTransform, g_Camera.position, projectionScale, g_manLod), g_manTransform, cullView, g_clusterStats);
+            man.requestTextureDetail(g_manTransform, g_Camera.position, projectionScale);
+        }
 
         // Render terrain
 		glUseProgram(terrainShader);
@@ -237,7 +360,14 @@ int main( void )
 		glUniformMatrix4fv(glGetUniformLocation(terrainShader, "model"), 1, GL_FALSE, (float*)glm::value_ptr(g_terrainTransform));
 		glUniformMatrix4fv(glGetUniformLocation(terrainShader, "view"), 1, GL_FALSE, (float*)glm::value_ptr(g_Camera.getViewTransform()));
 		glUniformMatrix4fv(glGetUniformLocation(terrainShader, "projection"), 1, GL_FALSE, g_Camera.projTransform);
-		terrain.draw(terrainShader);
+		Terrain::resetStats(g_terrainStats);
+		if (terrain.isLoaded())
+		{
+			terrain.draw(terrainShader, g_terrainTransform, cullView, g_terrainStats);
+			terrain.requestTextureDetail(g_Camera.position, projectionScale);
+			terrain.updatePaging(g_Camera.position, g_deltaFrame, terrainPagingBudgetMs);
+			g_terrainPaging = terrain.getPagingStats();
+		}
 
 		// Render Sphere using phong lighting
 		glUseProgram(phongShader);
@@ -259,7 +389,11 @@ int main( void )
 		glUniformMatrix4fv(glGetUniformLocation(phongShader, "model"), 1, GL_FALSE, (float*)glm::value_ptr(g_phongSphereTransform));
 		glUniformMatrix4fv(glGetUniformLocation(phongShader, "view"), 1, GL_FALSE, (float*)glm::value_ptr(g_Camera.getViewTransform()));
 		glUniformMatrix4fv(glGetUniformLocation(phongShader, "projection"), 1, GL_FALSE, g_Camera.projTransform);
-		sphere.drawPhong(phongShader);
+		if (sphere.isLoaded())
+		{
+			sphere.drawPhong(phongShader);
+			sphere.requestTextureDetail(g_phongSphereTransform, g_Camera.position, projectionScale);
+		}
 
 		//Render lights
 		glUseProgram(lightShader);
@@ -277,13 +411,38 @@ int main( void )
 		glUniformMatrix4fv(glGetUniformLocation(skyBoxShader, "model"), 1, GL_FALSE, (float*)glm::value_ptr(skyboxTransform));
 		glUniformMatrix4fv(glGetUniformLocation(skyBoxShader, "view"), 1, GL_FALSE, (float*)glm::value_ptr(g_Camera.getViewTransform()));
 		glUniformMatrix4fv(glGetUniformLocation(skyBoxShader, "projection"), 1, GL_FALSE, g_Camera.projTransform);
-        skyBox.draw(skyBoxShader);
+		if (skyBox.isLoaded())
+		{
+			skyBox.draw(skyBoxShader);
+		}
         glDepthFunc(oldDepthFuncMode);
+
+		// Bring the streamed textures towards the detail this frame asked for
+		TextureCache::instance().updateStreaming(streamingBudgetMs);
         
         // Swap buffers
         glfwSwapBuffers(window);
+
+		if (!firstFrameDrawn)
+		{
+			firstFrameDrawn = true;
+			std::cout << "First frame after " << startupTimer.elapsedMs() << " ms\n";
+		}
+		if (!allAssetsLoaded && assetLoader.isFinished())
+		{
+			allAssetsLoaded = true;
+			std::cout << "All assets loaded after " << startupTimer.elapsedMs() << " ms (" << assetLoader.getLoadedCount() << " loaded, "
+				<< assetLoader.getFailedCount() << " failed)\n";
+			TextureCache::instance().printStats();
+		}
     }
     
+    // Let decodes that are still running finish before the assets go out of scope
+    assetLoader.waitForDecodes();
+    endLoadTest();
+    UploadRing::instance().shutdown();
+	delete terrainSource;
+
     // Close OpenGL window and terminate GLFW
     glfwTerminate();
     return 0;
@@ -337,6 +496,52 @@ void keyboardInput(GLFWwindow *window)
 	}
 }
 
+void startLoadTest(AssetLoader& loader)
+{
+	// Free the last run's copies first so the textures miss the cache and are uploaded again
+	endLoadTest();
+
+	g_loadTestModel = new Model("../assets/models/cyborg/cyborg.obj", loader);
+	g_loadTestTerrain = new Terrain(30.0f, 2.0f, loader);
+
+	// Whole mip chains, so the texture uploads are as large as they get
+	const char* texturePaths[] = { "../assets/models/cyborg/cyborg_diffuse.png", "../assets/models/cyborg/cyborg_specular.png",
+		"../assets/textures/grass.jpg", "../assets/textures/rock.jpg", "../assets/textures/snow.jpg",
+		"../assets/textures/sphere_diffuse.png", "../assets/textures/sphere_specular.png", "../assets/textures/sphere_normal.png" };
+	TextureOptions options;
+	options.streamed = false;
+	for (size_t i = 0; i < sizeof(texturePaths) / sizeof(texturePaths[0]); i++)
+	{
+		TextureCache::instance().acquire(texturePaths[i], options, loader, [](unsigned int textureID) {
+			g_loadTestTextures.push_back(textureID);
+		});
+	}
+
+	g_loadTestFrames.reset();
+	g_loadTestRunning = true;
+}
+
+void endLoadTest()
+{
+	if (g_loadTestModel)
+	{
+		g_loadTestModel->deleteBuffers();
+		delete g_loadTestModel;
+		g_loadTestModel = NULL;
+	}
+	if (g_loadTestTerrain)
+	{
+		g_loadTestTerrain->deleteBuffers();
+		delete g_loadTestTerrain;
+		g_loadTestTerrain = NULL;
+	}
+	for (size_t i = 0; i < g_loadTestTextures.size(); i++)
+	{
+		TextureCache::instance().release(g_loadTestTextures[i]);
+	}
+	g_loadTestTextures.clear();
+}
+
 void mouseMove(GLFWwindow* window, double x, double y)
 {
     g_Camera.onMouseMove(x, y);
@@ -352,6 +557,22 @@ void mouseClick(GLFWwindow* window, int button, int action, int mods)
 		if (action == GLFW_PRESS)
         {
 			g_Camera.onMouseDown();
+
+			if (g_Camera.terrain)
+			{
+				glm::vec3 origin, direction;
+				g_Camera.getRay(x, y, origin, direction);
+				float distance;
+				if (g_Camera.terrain->raycast(origin, direction, g_Camera.far, distance))
+				{
+					glm::vec3 hit = origin + direction * distance;
+					std::cout << "Terrain hit at (" << hit.x << ", " << hit.y << ", " << hit.z << "), " << distance << " away\n";
+				}
+				else
+				{
+					std::cout << "No terrain under the cursor\n";
+				}
+			}
 		}
 		else if (action == GLFW_RELEASE)
         {
@@ -382,6 +603,106 @@ void keyClick(GLFWwindow* window, int key, int scancode, int action, int mods)
 	{
 		pointLightColor0 = glm::vec3(dis(gen), dis(gen), dis(gen));
 	}
+	if (key == GLFW_KEY_L && action == GLFW_PRESS)
+	{
+		Model::forcedLod = (Model::forcedLod + 1 < (int)MAX_MESH_LODS) ? Model::forcedLod + 1 : -1;
+		if (Model::forcedLod < 0)
+			std::cout << "Model level of detail: automatic\n";
+		else
+			std::cout << "Model level of detail: forced to " << Model::forcedLod << "\n";
+	}
+	if (key == GLFW_KEY_I && action == GLFW_PRESS)
+	{
+		std::cout << "Meshlets: " << g_clusterStats.clusters << " tested, " << g_clusterStats.frustumCulled << " outside the view, "
+			<< g_clusterStats.backfaceCulled << " facing away. Triangles: " << g_clusterStats.trianglesDrawn << " drawn, "
+			<< g_clusterStats.trianglesRejected << " rejected\n";
+	}
+	if (key == GLFW_KEY_F && action == GLFW_PRESS)
+	{
+		meshlets::checkCones();
+	}
+	if (key == GLFW_KEY_K && action == GLFW_PRESS)
+	{
+		std::cout << "Terrain: " << g_terrainStats.chunksDrawn << " chunks drawn, " << g_terrainStats.chunksCulled << " outside the view, "
+			<< g_terrainStats.nodesTested << " nodes tested. Triangles: " << g_terrainStats.trianglesDrawn << " drawn\n";
+		std::cout << "Terrain patch: " << g_terrainStats.meshBytes << " bytes of indices, " << g_terrainStats.instanceBytes
+			<< " bytes of chunk instances last frame\n";
+		std::cout << "Chunks per level, finest first:";
+		for (unsigned int i = 0; i < g_terrainStats.levelCount; i++)
+			std::cout << " " << g_terrainStats.chunksPerLevel[i];
+		std::cout << "\n";
+		std::cout << "Height tiles: " << g_terrainPaging.residentTiles << " of " << g_terrainPaging.slots << " slots resident, "
+			<< g_terrainPaging.bytesResident / (1024 * 1024) << " of " << g_terrainPaging.budgetBytes / (1024 * 1024) << " MB, "
+			<< g_terrainPaging.wantedTiles << " wanted, " << g_terrainPaging.pendingTiles << " pending. "
+			<< g_terrainPaging.tilesLoaded << " loaded, " << g_terrainPaging.tilesEvicted << " evicted. "
+			<< g_terrainPaging.editedTiles << " edited, " << g_terrainPaging.bytesEdited / 1024 << " KB\n";
+	}
+	if (key == GLFW_KEY_B && action == GLFW_PRESS)
+	{
+		TextureCache::instance().benchmarkDecode();
+	}
+	if (key == GLFW_KEY_G && action == GLFW_PRESS)
+	{
+		TextureCache::instance().benchmarkMipmaps();
+	}
+	if (key == GLFW_KEY_N && action == GLFW_PRESS)
+	{
+		heightmapFile::benchmarkConvert("../assets/terrain/terrain0-16bbp-257x257.raw", 257, 257);
+	}
+	if (key == GLFW_KEY_J && action == GLFW_PRESS && g_Camera.terrain)
+	{
+		g_Camera.terrain->benchmarkQueries();
+	}
+	if (key == GLFW_KEY_Y && action == GLFW_PRESS && g_Camera.terrain)
+	{
+		g_Camera.terrain->benchmarkRays();
+	}
+	if (key >= GLFW_KEY_1 && key <= GLFW_KEY_4 && action != GLFW_RELEASE && g_Camera.terrain)
+	{
+		// Held keys repeat, a dab each time
+		double x, y;
+		glfwGetCursorPos(window, &x, &y);
+		glm::vec3 origin, direction;
+		g_Camera.getRay(x, y, origin, direction);
+		float distance;
+		if (g_Camera.terrain->raycast(origin, direction, g_Camera.far, distance))
+		{
+			TerrainBrush brush;
+			brush.mode = (TerrainBrushMode)(BRUSH_RAISE + (key - GLFW_KEY_1));
+			brush.center = origin + direction * distance;
+			brush.radius = 8.0f;
+			brush.strength = (brush.mode == BRUSH_RAISE || brush.mode == BRUSH_LOWER) ? 0.25f : 0.5f;
+			g_Camera.terrain->applyBrush(brush);
+		}
+	}
+	if (key == GLFW_KEY_X && action == GLFW_PRESS && g_Camera.terrain)
+	{
+		g_Camera.terrain->benchmarkEdits();
+	}
+	if (key == GLFW_KEY_V && action == GLFW_PRESS)
+	{
+		heightmapGenerator::benchmark();
+	}
+	if (key == GLFW_KEY_T && action == GLFW_PRESS)
+	{
+		TextureCache::instance().printStreamingStats();
+	}
+	if ((key == GLFW_KEY_LEFT_BRACKET || key == GLFW_KEY_RIGHT_BRACKET) && action == GLFW_PRESS)
+	{
+		unsigned long long budget = TextureCache::instance().getStats().residencyBudget;
+		budget = (key == GLFW_KEY_LEFT_BRACKET) ? std::max(budget / 2, minTextureBudget) : budget * 2;
+		TextureCache::instance().setResidencyBudget(budget);
+		std::cout << "Texture budget: " << budget / (1024 * 1024) << " MB\n";
+	}
+	if (key == GLFW_KEY_U && action == GLFW_PRESS)
+	{
+		g_loadTestRequested = true;
+	}
+	if (key == GLFW_KEY_O && action == GLFW_PRESS)
+	{
+		UploadRing::instance().setEnabled(!UploadRing::instance().isEnabled());
+		std::cout << "Upload ring " << (UploadRing::instance().isEnabled() ? "on" : "off") << "\n";
+	}
 }
 
 void mouseScroll(GLFWwindow* window, double xOffset, double yOffset)
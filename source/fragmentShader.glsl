@@ -6,8 +6,10 @@ in vec3 fragPos;
 in vec3 fragNormal;
 in vec2 texCoord;
 
-uniform sampler2D diffuseMap;
-uniform sampler2D specularMap;
+uniform sampler2DArray diffuseMap;
+uniform sampler2DArray specularMap;
+uniform int diffuseLayer;
+uniform int specularLayer;
 uniform vec3 viewPos;
 
 struct PointLight
@@ -32,9 +34,9 @@ uniform DirLight dirLight;
 
 vec3 calcLightCommon(vec3 color, float ambientIntensity, float diffuseIntensity, vec3 lightDirection, vec3 normal, vec3 viewDir){
 	//diffuseͼɫ
-	vec3 diffuseTex = texture(diffuseMap, vec2(texCoord.x, 1.0 - texCoord.y)).rgb;
+	vec3 diffuseTex = texture(diffuseMap, vec3(texCoord.x, 1.0 - texCoord.y, diffuseLayer)).rgb;
 	//specularͼɫ
-	vec3 specularTex = texture(specularMap, vec2(texCoord.x, 1.0 - texCoord.y)).rgb;
+	vec3 specularTex = texture(specularMap, vec3(texCoord.x, 1.0 - texCoord.y, specularLayer)).rgb;
 	//Դ
 	vec3 lightDir = lightDirection;
 	//
@@ -4,9 +4,11 @@ layout (location=0) in vec3 aPos;
 uniform mat4 model;
 uniform mat4 view;
 uniform mat4 projection;
+uniform vec3 positionOffset;
+uniform vec3 positionScale;
 
 void main()						
 {							
-	vec4 pos = vec4(aPos, 1.0);
+	vec4 pos = vec4(positionOffset + aPos * positionScale, 1.0);
 	gl_Position = projection * view * model * pos;
 };
\ No newline at end of file
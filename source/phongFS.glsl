@@ -71,8 +71,9 @@ vec3 calcDirLight(DirLight light, vec3 normal, vec3 viewDir){
 void main (void) 
 {
 	//TBN㷨
-	vec3 normal = texture(normalMap, vec2(texCoord.x, 1.0 - texCoord.y)).rgb;
-	normal = normalize(normal * 2.0 - 1.0);//to [-1,1]
+	// Only x and y are stored, z is always towards the surface
+	vec2 normalXY = texture(normalMap, vec2(texCoord.x, 1.0 - texCoord.y)).rg * 2.0 - 1.0;//to [-1,1]
+	vec3 normal = vec3(normalXY, sqrt(max(1.0 - dot(normalXY, normalXY), 0.0)));
 	normal = normalize(TBN * normal);
 
 	vec3 viewDir = normalize(viewPos - fragPos);
@@ -1,10 +1,11 @@
 #version 330 core
 
+// Packed vertex: snorm16 position relative to the bounds, octahedral snorm8 normal in .zw,
+// half float uv, octahedral snorm8 tangent in .xy with the bitangent sign in .z
 layout (location=0) in vec3 aPos;
-layout (location=1) in vec3 aNormal;
+layout (location=1) in vec4 aNormal;
 layout (location=2) in vec2 aTexCoord;
-layout (location=3) in vec3 aTangent;
-layout (location=4) in vec3 aBiTangent;
+layout (location=3) in vec4 aTangent;
 
 out vec3 fragPos;
 out vec2 texCoord;
@@ -13,16 +14,27 @@ out mat3 TBN;
 uniform mat4 model;
 uniform mat4 view;
 uniform mat4 projection;
+uniform vec3 positionOffset;
+uniform vec3 positionScale;
+
+vec3 octDecode(vec2 e) {
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    float t = max(-n.z, 0.0);
+    n.x += n.x >= 0.0 ? -t : t;
+    n.y += n.y >= 0.0 ? -t : t;
+    return normalize(n);
+}
 
 void main() {
-    gl_Position = projection * view * model * vec4(aPos, 1.0f);
-    fragPos = vec3(model * vec4(aPos, 1.0));
+    vec3 position = positionOffset + aPos * positionScale;
+    gl_Position = projection * view * model * vec4(position, 1.0f);
+    fragPos = vec3(model * vec4(position, 1.0));
 	texCoord = aTexCoord;
 
     //TBN
-	vec3 T = normalize(vec3(model * vec4(aTangent, 0.0)));
-	vec3 N = normalize(vec3(model * vec4(aNormal, 0.0)));
+	vec3 T = normalize(vec3(model * vec4(octDecode(aTangent.xy), 0.0)));
+	vec3 N = normalize(vec3(model * vec4(octDecode(aNormal.zw), 0.0)));
 	T = normalize(T - dot(T, N) * N);
-	vec3 B = cross(T, N);
+	vec3 B = cross(N, T) * aTangent.z;
 	TBN = mat3(T, B, N);
 }
\ No newline at end of file
@@ -4,14 +4,17 @@ layout (location=0) in vec3 aPos;
 uniform mat4 model;
 uniform mat4 view;
 uniform mat4 projection;
+uniform vec3 positionOffset;
+uniform vec3 positionScale;
 
 out vec3 texCoord;
 
 void main()						
 {
-	vec4 pos = projection * view * model * vec4(aPos, 1.0);
+	vec3 position = positionOffset + aPos * positionScale;
+	vec4 pos = projection * view * model * vec4(position, 1.0);
 	gl_Position = pos.xyww;
 
-	vec3 newPos = aPos;
+	vec3 newPos = position;
 	texCoord = newPos;
 };
\ No newline at end of file
@@ -6,9 +6,10 @@ in vec2 texCoord;
 in vec3 fragPos;
 in vec3 localNormal;
 
-uniform sampler2D texture_grass;
-uniform sampler2D texture_rock;
-uniform sampler2D texture_snow;
+uniform sampler2DArray terrainMaps;
+uniform int grassLayer;
+uniform int rockLayer;
+uniform int snowLayer;
 uniform float heightThreshold;//ֵ֮snow ֮¸ݶͳ̶Ȼgrassrock
 
 uniform vec3 viewPos;
@@ -65,9 +66,9 @@ vec3 calcDirLight(DirLight light, vec3 normal, vec3 viewDir, vec3 terrainColor){
 
 void main()
 {
-	vec3 grassColor = texture(texture_grass, texCoord * 16.0).rgb;
-	vec3 rockColor = texture(texture_rock, texCoord * 32.0).rgb;
-	vec3 snowColor = texture(texture_snow, texCoord * 32.0).rgb;
+	vec3 grassColor = texture(terrainMaps, vec3(texCoord * 16.0, grassLayer)).rgb;
+	vec3 rockColor = texture(terrainMaps, vec3(texCoord * 32.0, rockLayer)).rgb;
+	vec3 snowColor = texture(terrainMaps, vec3(texCoord * 32.0, snowLayer)).rgb;
 
 	vec3 normal = normalize(localNormal);
 	float factor = dot(normal, vec3(0.0, 1.0, 0.0));
@@ -1,21 +1,61 @@
 #version 330 core					
-layout (location=0) in vec3 aPos;
-layout (location=1) in vec3 aNormal;
-layout (location=2) in vec2 aTexCoord;
+// Per chunk: first sample it covers and the samples between its grid lines
+layout (location=1) in vec3 aNode;
+// Distance the morph starts at and one over the distance it takes
+layout (location=2) in vec2 aMorph;
+// First sample of the tile the chunk reads, the samples between its texels and its layer
+layout (location=3) in vec4 aTile;
 
 uniform mat4 model;
 uniform mat4 view;
 uniform mat4 projection;
 
+// Resident height tiles, normalised to 0-1, with a texel past each edge of the tile
+uniform sampler2DArray heightTiles;
+uniform float tileWidth;
+// Vertices along a side of the patch, which are numbered row by row
+uniform int patchWidth;
+uniform vec2 heightmapSize;
+uniform float heightScale;
+uniform float blockScale;
+uniform vec3 localViewPos;
+
 out vec2 texCoord;
 out vec3 fragPos;
 out vec3 localNormal;
 
+float sampleHeight(vec2 samplePos)
+{
+	vec2 texel = (samplePos - aTile.xy) / aTile.z + 1.0;
+	return textureLod(heightTiles, vec3((texel + 0.5) / tileWidth, aTile.w), 0.0).r * heightScale;
+}
+
+vec3 terrainPosition(vec2 samplePos)
+{
+	vec2 xz = (samplePos - (heightmapSize - 1.0) * 0.5) * blockScale;
+	return vec3(xz.x, sampleHeight(samplePos), xz.y);
+}
+
 void main()						
 {							
-	vec4 pos = vec4(aPos, 1.0);
+	vec2 grid = vec2(gl_VertexID % patchWidth, gl_VertexID / patchWidth);
+	vec2 samplePos = aNode.xy + grid * aNode.z;
+	float distanceToView = distance(terrainPosition(samplePos), localViewPos);
+	float morphAmount = clamp((distanceToView - aMorph.x) * aMorph.y, 0.0, 1.0);
+
+	// Odd vertices slide onto their even neighbour, leaving the grid of the next level up
+	vec2 odd = fract(grid * 0.5) * 2.0;
+	samplePos = clamp(samplePos - odd * aNode.z * morphAmount, vec2(0.0), heightmapSize - 1.0);
+
+	vec4 pos = vec4(terrainPosition(samplePos), 1.0);
 	gl_Position = projection * view * model * pos;
-	texCoord = aTexCoord;
+	texCoord = samplePos / (heightmapSize - 1.0);
 	fragPos = (model * pos).xyz;
-	localNormal = aNormal;
+
+	// Central differences across the tile's texels, its edges reach one texel past the chunk
+	float left = sampleHeight(samplePos - vec2(aTile.z, 0.0));
+	float right = sampleHeight(samplePos + vec2(aTile.z, 0.0));
+	float down = sampleHeight(samplePos - vec2(0.0, aTile.z));
+	float up = sampleHeight(samplePos + vec2(0.0, aTile.z));
+	localNormal = normalize(vec3(left - right, 2.0 * aTile.z * blockScale, down - up));
 };
\ No newline at end of file
@@ -1,8 +1,9 @@
 #version 330 core
 
-layout (location = 0) in vec3 position;
+// Packed vertex: snorm16 position relative to the bounds, half float uv, octahedral snorm8 normal in .zw
+layout (location = 0) in vec3 packedPosition;
 layout (location = 1) in vec2 texCoords;
-layout (location = 2) in vec3 normal;
+layout (location = 2) in vec4 packedNormal;
 
 out vec3 fragPos;
 out vec3 fragNormal;
@@ -11,8 +12,20 @@ out vec2 texCoord;
 uniform mat4 model;
 uniform mat4 view;
 uniform mat4 projection;
+uniform vec3 positionOffset;
+uniform vec3 positionScale;
+
+vec3 octDecode(vec2 e) {
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    float t = max(-n.z, 0.0);
+    n.x += n.x >= 0.0 ? -t : t;
+    n.y += n.y >= 0.0 ? -t : t;
+    return normalize(n);
+}
 
 void main() {
+    vec3 position = positionOffset + packedPosition * positionScale;
+    vec3 normal = octDecode(packedNormal.zw);
     gl_Position = projection * view * model * vec4(position, 1.0f);
     fragNormal = mat3(transpose(inverse(model))) * normal; 
     fragPos = vec3(model * vec4(position, 1.0));